@@ -0,0 +1,205 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "bench-corpus.h"
+
+#include <glib/gstdio.h>
+
+
+
+void
+bench_corpus_put_ushort (GByteArray *array,
+                         guint value)
+{
+  guint8 data[2] = { value & 0xff, (value >> 8) & 0xff };
+
+  g_byte_array_append (array, data, 2);
+}
+
+
+
+void
+bench_corpus_put_ulong (GByteArray *array,
+                        guint32 value)
+{
+  guint8 data[4] = { value & 0xff, (value >> 8) & 0xff, (value >> 16) & 0xff, (value >> 24) & 0xff };
+
+  g_byte_array_append (array, data, 4);
+}
+
+
+
+GdkPixbuf *
+bench_corpus_pixbuf_new (gint width,
+                         gint height,
+                         guint n)
+{
+  GdkPixbuf *pixbuf;
+  guchar *pixels;
+  guchar *p;
+  gint rowstride;
+  gint x, y;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+
+  /* a gradient with some detail, different for every file */
+  for (y = 0; y < height; y++)
+    for (x = 0, p = pixels + y * rowstride; x < width; x++, p += 3)
+      {
+        p[0] = (x * 255 / width + n * 37) & 0xff;
+        p[1] = (y * 255 / height + n * 91) & 0xff;
+        p[2] = ((x ^ y) + n) & 0xff;
+      }
+
+  return pixbuf;
+}
+
+
+
+/* takes the reference on @pixbuf */
+GBytes *
+bench_corpus_encode (GdkPixbuf *pixbuf,
+                     const gchar *type)
+{
+  GError *error = NULL;
+  gchar *buffer;
+  gsize length;
+  gboolean saved;
+
+  if (g_strcmp0 (type, "jpeg") == 0)
+    saved = gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &length, type, &error,
+                                       "quality", "90", NULL);
+  else
+    saved = gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &length, type, &error, NULL);
+
+  g_object_unref (pixbuf);
+
+  if (!saved)
+    {
+      g_printerr ("Failed to encode %s image: %s\n", type, error->message);
+      g_error_free (error);
+      return NULL;
+    }
+
+  return g_bytes_new_take (buffer, length);
+}
+
+
+
+GBytes *
+bench_corpus_jpeg_with_exif (gint width,
+                             gint height,
+                             guint n)
+{
+  GByteArray *array;
+  GBytes *image;
+  GBytes *thumb;
+  const guint8 *data;
+  gsize image_length;
+  gsize thumb_length;
+  guint offset;
+
+  image = bench_corpus_encode (bench_corpus_pixbuf_new (width, height, n), "jpeg");
+  thumb = bench_corpus_encode (bench_corpus_pixbuf_new (160, 160 * height / width, n), "jpeg");
+  if (image == NULL || thumb == NULL)
+    {
+      if (image != NULL)
+        g_bytes_unref (image);
+      if (thumb != NULL)
+        g_bytes_unref (thumb);
+
+      return NULL;
+    }
+
+  data = g_bytes_get_data (image, &image_length);
+  g_bytes_get_data (thumb, &thumb_length);
+
+  /* SOI followed by an APP1 Exif segment */
+  array = g_byte_array_new ();
+  g_byte_array_append (array, (const guint8 *) "\xff\xd8\xff\xe1", 4);
+  g_byte_array_append (array, (const guint8 *) "\0\0", 2);
+  g_byte_array_append (array, (const guint8 *) "Exif\0\0", 6);
+
+  /* little endian TIFF header, first IFD right after it */
+  g_byte_array_append (array, (const guint8 *) "II", 2);
+  bench_corpus_put_ushort (array, 0x2a);
+  bench_corpus_put_ulong (array, 8);
+
+  /* a single IFD with a JPEG thumbnail */
+  offset = 8 + 2 + 3 * 12 + 4;
+  bench_corpus_put_ushort (array, 3);
+  bench_corpus_put_ushort (array, 0x0103);
+  bench_corpus_put_ushort (array, 3);
+  bench_corpus_put_ulong (array, 1);
+  bench_corpus_put_ulong (array, 6);
+  bench_corpus_put_ushort (array, 0x0201);
+  bench_corpus_put_ushort (array, 4);
+  bench_corpus_put_ulong (array, 1);
+  bench_corpus_put_ulong (array, offset);
+  bench_corpus_put_ushort (array, 0x0202);
+  bench_corpus_put_ushort (array, 4);
+  bench_corpus_put_ulong (array, 1);
+  bench_corpus_put_ulong (array, thumb_length);
+  bench_corpus_put_ulong (array, 0);
+  g_byte_array_append (array, g_bytes_get_data (thumb, NULL), thumb_length);
+
+  /* segment length, big endian and including the length itself */
+  array->data[4] = ((array->len - 4) >> 8) & 0xff;
+  array->data[5] = (array->len - 4) & 0xff;
+
+  /* the remainder of the image, without its SOI */
+  g_byte_array_append (array, data + 2, image_length - 2);
+
+  g_bytes_unref (image);
+  g_bytes_unref (thumb);
+
+  return g_byte_array_free_to_bytes (array);
+}
+
+
+
+void
+bench_corpus_remove_recursive (const gchar *path)
+{
+  const gchar *name;
+  gchar *child;
+  GDir *dir;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir != NULL)
+    {
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          child = g_build_filename (path, name, NULL);
+          if (g_file_test (child, G_FILE_TEST_IS_DIR)
+              && !g_file_test (child, G_FILE_TEST_IS_SYMLINK))
+            bench_corpus_remove_recursive (child);
+          else
+            g_unlink (child);
+          g_free (child);
+        }
+
+      g_dir_close (dir);
+    }
+
+  g_rmdir (path);
+}
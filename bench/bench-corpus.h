@@ -0,0 +1,50 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __BENCH_CORPUS_H__
+#define __BENCH_CORPUS_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+void
+bench_corpus_put_ushort (GByteArray *array,
+                         guint value);
+void
+bench_corpus_put_ulong (GByteArray *array,
+                        guint32 value);
+GdkPixbuf *
+bench_corpus_pixbuf_new (gint width,
+                         gint height,
+                         guint n) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+GBytes *
+bench_corpus_encode (GdkPixbuf *pixbuf,
+                     const gchar *type) G_GNUC_WARN_UNUSED_RESULT;
+GBytes *
+bench_corpus_jpeg_with_exif (gint width,
+                             gint height,
+                             guint n) G_GNUC_WARN_UNUSED_RESULT;
+void
+bench_corpus_remove_recursive (const gchar *path);
+
+G_END_DECLS
+
+#endif /* !__BENCH_CORPUS_H__ */
@@ -0,0 +1,218 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "bench-harness.h"
+
+#include <glib/gstdio.h>
+#include <stdlib.h>
+
+/* every benchmark runs a fixed number of rounds of a fixed number of
+ * iterations, the median round is what gets reported and compared */
+#define N_ROUNDS 7
+
+
+
+static gchar *suite_name = NULL;
+static gchar *opt_baseline = NULL;
+static gchar *opt_save = NULL;
+static gdouble opt_threshold = 10.0;
+static GKeyFile *baseline = NULL;
+static GKeyFile *results = NULL;
+static guint n_regressions = 0;
+
+static GOptionEntry option_entries[] = {
+  { "baseline", 0, 0, G_OPTION_ARG_FILENAME, &opt_baseline,
+    "Compare against the results saved in FILE", "FILE" },
+  { "save", 0, 0, G_OPTION_ARG_FILENAME, &opt_save,
+    "Save the results to FILE", "FILE" },
+  { "threshold", 0, 0, G_OPTION_ARG_DOUBLE, &opt_threshold,
+    "Slowdown in percent that counts as a regression (default: 10)", "PERCENT" },
+  { NULL },
+};
+
+
+
+static gint
+bench_harness_compare_doubles (gconstpointer a,
+                               gconstpointer b)
+{
+  gdouble da = *(const gdouble *) a;
+  gdouble db = *(const gdouble *) b;
+
+  return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+
+
+static gchar *
+bench_harness_default_file (const gchar *variable)
+{
+  const gchar *dir;
+  gchar *filename;
+  gchar *path;
+
+  /* lets meson test pass the files through the environment */
+  dir = g_getenv (variable);
+  if (dir == NULL || *dir == '\0')
+    return NULL;
+
+  filename = g_strdup_printf ("%s.ini", suite_name);
+  path = g_build_filename (dir, filename, NULL);
+  g_free (filename);
+
+  return path;
+}
+
+
+
+void
+bench_harness_init (gint *argc,
+                    gchar ***argv,
+                    const gchar *suite)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+
+  g_return_if_fail (suite != NULL);
+
+  suite_name = g_strdup (suite);
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, option_entries, NULL);
+  if (!g_option_context_parse (context, argc, argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      exit (EXIT_FAILURE);
+    }
+  g_option_context_free (context);
+
+  if (opt_baseline == NULL)
+    opt_baseline = bench_harness_default_file ("TUMBLER_BENCH_BASELINE_DIR");
+  if (opt_save == NULL)
+    opt_save = bench_harness_default_file ("TUMBLER_BENCH_SAVE_DIR");
+
+  if (opt_baseline != NULL)
+    {
+      baseline = g_key_file_new ();
+      if (!g_key_file_load_from_file (baseline, opt_baseline, G_KEY_FILE_NONE, &error))
+        {
+          g_printerr ("No baseline loaded from %s: %s\n", opt_baseline, error->message);
+          g_clear_error (&error);
+          g_key_file_free (baseline);
+          baseline = NULL;
+        }
+    }
+
+  results = g_key_file_new ();
+}
+
+
+
+void
+bench_harness_run (const gchar *name,
+                   guint iterations,
+                   BenchHarnessFunc func,
+                   gpointer user_data)
+{
+  gdouble rounds[N_ROUNDS];
+  gdouble median;
+  gdouble reference;
+  gint64 start;
+  guint round;
+  guint n;
+
+  g_return_if_fail (name != NULL);
+  g_return_if_fail (iterations > 0);
+  g_return_if_fail (func != NULL);
+
+  /* warm up caches and lazily initialized state */
+  for (n = 0; n < MAX (iterations / 10, 1); n++)
+    func (user_data);
+
+  for (round = 0; round < N_ROUNDS; round++)
+    {
+      start = g_get_monotonic_time ();
+      for (n = 0; n < iterations; n++)
+        func (user_data);
+      rounds[round] = (g_get_monotonic_time () - start) * 1000.0 / iterations;
+    }
+
+  qsort (rounds, N_ROUNDS, sizeof (gdouble), bench_harness_compare_doubles);
+  median = rounds[N_ROUNDS / 2];
+
+  g_print ("%-40s %12.1f ns/iter (min %.1f, max %.1f, %u iterations)",
+           name, median, rounds[0], rounds[N_ROUNDS - 1], iterations);
+
+  g_key_file_set_double (results, suite_name, name, median);
+
+  if (baseline != NULL && g_key_file_has_key (baseline, suite_name, name, NULL))
+    {
+      reference = g_key_file_get_double (baseline, suite_name, name, NULL);
+      if (reference > 0)
+        {
+          g_print ("  %+.1f%%", (median - reference) * 100.0 / reference);
+          if (median > reference * (1.0 + opt_threshold / 100.0))
+            {
+              g_print ("  REGRESSION");
+              n_regressions++;
+            }
+        }
+    }
+
+  g_print ("\n");
+}
+
+
+
+gint
+bench_harness_finish (void)
+{
+  GError *error = NULL;
+  gchar *dirname;
+  gint retval = EXIT_SUCCESS;
+
+  if (opt_save != NULL)
+    {
+      dirname = g_path_get_dirname (opt_save);
+      g_mkdir_with_parents (dirname, 0755);
+      g_free (dirname);
+    }
+
+  if (opt_save != NULL && !g_key_file_save_to_file (results, opt_save, &error))
+    {
+      g_printerr ("Failed to save the results to %s: %s\n", opt_save, error->message);
+      g_error_free (error);
+      retval = EXIT_FAILURE;
+    }
+
+  if (n_regressions > 0)
+    {
+      g_printerr ("%u benchmark(s) regressed by more than %.1f%%\n",
+                  n_regressions, opt_threshold);
+      retval = EXIT_FAILURE;
+    }
+
+  if (baseline != NULL)
+    g_key_file_free (baseline);
+  g_key_file_free (results);
+  g_free (suite_name);
+
+  return retval;
+}
@@ -0,0 +1,44 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __BENCH_HARNESS_H__
+#define __BENCH_HARNESS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef void (*BenchHarnessFunc) (gpointer user_data);
+
+void
+bench_harness_init (gint *argc,
+                    gchar ***argv,
+                    const gchar *suite);
+void
+bench_harness_run (const gchar *name,
+                   guint iterations,
+                   BenchHarnessFunc func,
+                   gpointer user_data);
+gint
+bench_harness_finish (void);
+
+G_END_DECLS
+
+#endif /* !__BENCH_HARNESS_H__ */
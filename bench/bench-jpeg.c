@@ -0,0 +1,121 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* the kernels are static, so benchmark them in place */
+#include "plugins/jpeg-thumbnailer/jpeg-thumbnailer.c"
+
+#include "bench-corpus.h"
+#include "bench-harness.h"
+
+#define IMAGE_WIDTH 2400
+#define IMAGE_HEIGHT 1600
+
+
+
+typedef struct
+{
+  const guchar *data;
+  gsize length;
+  gint size;
+} JpegData;
+
+
+
+static void
+bench_exif_extract_thumbnail (gpointer user_data)
+{
+  JpegData *data = user_data;
+  GdkPixbuf *pixbuf;
+  guint orientation;
+
+  pixbuf = tvtj_exif_extract_thumbnail (data->data, data->length, data->size, &orientation);
+  g_object_unref (pixbuf);
+}
+
+
+
+static void
+bench_jpeg_load (gpointer user_data)
+{
+  JpegData *data = user_data;
+
+  g_object_unref (tvtj_jpeg_load (data->data, data->length, data->size));
+}
+
+
+
+int
+main (int argc,
+      char **argv)
+{
+  JpegData data;
+  GdkPixbuf *pixbuf;
+  GBytes *image;
+  gchar *name;
+  guint orientation;
+  guint n;
+  const struct
+  {
+    gint denom;
+    gint size;
+    guint iterations;
+  } scales[] = {
+    { 8, 128, 50 },
+    { 4, 256, 30 },
+    { 2, 512, 20 },
+    { 1, 1024, 10 },
+  };
+
+  bench_harness_init (&argc, &argv, "jpeg");
+
+  image = bench_corpus_jpeg_with_exif (IMAGE_WIDTH, IMAGE_HEIGHT, 0);
+  if (image == NULL)
+    return EXIT_FAILURE;
+
+  /* the Exif payload starts after SOI, the APP1 marker and its length */
+  data.data = g_bytes_get_data (image, &data.length);
+  data.length = ((data.data[4] << 8) | data.data[5]) - 2;
+  data.data += 6;
+  data.size = 128;
+  pixbuf = tvtj_exif_extract_thumbnail (data.data, data.length, data.size, &orientation);
+  if (pixbuf == NULL)
+    {
+      g_printerr ("The Exif thumbnail of the test image could not be extracted\n");
+      g_bytes_unref (image);
+      return EXIT_FAILURE;
+    }
+  g_object_unref (pixbuf);
+  bench_harness_run ("exif_extract_thumbnail", 2000, bench_exif_extract_thumbnail, &data);
+
+  data.data = g_bytes_get_data (image, &data.length);
+  for (n = 0; n < G_N_ELEMENTS (scales); n++)
+    {
+      g_assert (tvtj_denom (IMAGE_WIDTH, IMAGE_HEIGHT, scales[n].size) == scales[n].denom);
+
+      data.size = scales[n].size;
+      name = g_strdup_printf ("jpeg_load/scale_denom-%d", scales[n].denom);
+      bench_harness_run (name, scales[n].iterations, bench_jpeg_load, &data);
+      g_free (name);
+    }
+
+  g_bytes_unref (image);
+
+  return bench_harness_finish ();
+}
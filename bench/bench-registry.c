@@ -0,0 +1,146 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "bench-harness.h"
+
+#include "tumblerd/tumbler-registry.h"
+
+#include <stdlib.h>
+
+#define N_INFOS 10000
+
+
+
+typedef TumblerAbstractThumbnailer BenchThumbnailer;
+typedef TumblerAbstractThumbnailerClass BenchThumbnailerClass;
+
+GType
+bench_thumbnailer_get_type (void);
+
+G_DEFINE_TYPE (BenchThumbnailer, bench_thumbnailer, TUMBLER_TYPE_ABSTRACT_THUMBNAILER)
+
+typedef struct
+{
+  TumblerRegistry *registry;
+  TumblerFileInfo *infos[N_INFOS];
+} RegistryData;
+
+static const gchar *mime_types[][4] = {
+  { "image/jpeg", NULL },
+  { "image/png", "image/gif", "image/bmp", NULL },
+  { "application/pdf", "application/postscript", NULL },
+  { "video/mp4", "video/webm", "video/x-matroska", NULL },
+  { "application/x-font-ttf", "application/x-font-otf", NULL },
+  { "application/vnd.oasis.opendocument.text", NULL },
+  { "image/x-canon-cr2", "image/x-nikon-nef", NULL },
+  { "audio/mpeg", "audio/flac", NULL },
+};
+
+
+
+static void
+bench_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
+                          GCancellable *cancellable,
+                          TumblerFileInfo *info)
+{
+}
+
+
+
+static void
+bench_thumbnailer_class_init (BenchThumbnailerClass *klass)
+{
+  klass->create = bench_thumbnailer_create;
+}
+
+
+
+static void
+bench_thumbnailer_init (BenchThumbnailer *thumbnailer)
+{
+}
+
+
+
+static void
+bench_get_thumbnailer_array (gpointer user_data)
+{
+  RegistryData *data = user_data;
+  GList **thumbnailers;
+  guint n;
+
+  thumbnailers = tumbler_registry_get_thumbnailer_array (data->registry, data->infos, N_INFOS);
+
+  for (n = 0; n < N_INFOS; n++)
+    g_list_free_full (thumbnailers[n], g_object_unref);
+  g_free (thumbnailers);
+}
+
+
+
+int
+main (int argc,
+      char **argv)
+{
+  const gchar *uri_schemes[] = { "file", "sftp", "smb", NULL };
+  TumblerThumbnailFlavor *flavor;
+  TumblerThumbnailer *thumbnailer;
+  RegistryData data;
+  const gchar **group;
+  gchar *uri;
+  guint n, k;
+
+  bench_harness_init (&argc, &argv, "registry");
+
+  data.registry = tumbler_registry_new ();
+
+  /* two competing thumbnailers for every group of MIME types */
+  for (n = 0; n < G_N_ELEMENTS (mime_types); n++)
+    for (k = 0; k < 2; k++)
+      {
+        thumbnailer = g_object_new (bench_thumbnailer_get_type (),
+                                    "uri-schemes", uri_schemes,
+                                    "mime-types", mime_types[n],
+                                    "priority", (gint) k,
+                                    NULL);
+        tumbler_registry_add (data.registry, thumbnailer);
+        g_object_unref (thumbnailer);
+      }
+  tumbler_registry_update_supported (data.registry);
+
+  flavor = tumbler_thumbnail_flavor_new_normal ();
+  for (n = 0; n < N_INFOS; n++)
+    {
+      group = mime_types[n % G_N_ELEMENTS (mime_types)];
+      k = (n / G_N_ELEMENTS (mime_types)) % g_strv_length ((gchar **) group);
+      uri = g_strdup_printf ("file:///home/user/Files/%04u/file-%05u", n / 100, n);
+      data.infos[n] = tumbler_file_info_new (uri, group[k], flavor);
+      g_free (uri);
+    }
+  g_object_unref (flavor);
+
+  bench_harness_run ("registry_get_thumbnailer_array/10k", 10, bench_get_thumbnailer_array, &data);
+
+  for (n = 0; n < N_INFOS; n++)
+    g_object_unref (data.infos[n]);
+  g_object_unref (data.registry);
+
+  return bench_harness_finish ();
+}
@@ -0,0 +1,66 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "bench-corpus.h"
+#include "bench-harness.h"
+
+#include "tumbler/tumbler.h"
+
+
+
+typedef struct
+{
+  GdkPixbuf *source;
+  gint size;
+} ScaleData;
+
+
+
+static void
+bench_scale_pixbuf (gpointer user_data)
+{
+  ScaleData *data = user_data;
+
+  g_object_unref (tumbler_util_scale_pixbuf (data->source, data->size, data->size));
+}
+
+
+
+int
+main (int argc,
+      char **argv)
+{
+  ScaleData data;
+
+  bench_harness_init (&argc, &argv, "util");
+
+  data.source = bench_corpus_pixbuf_new (1920, 1280, 0);
+
+  data.size = 128;
+  bench_harness_run ("scale_pixbuf/1920x1280-to-normal", 50, bench_scale_pixbuf, &data);
+  data.size = 256;
+  bench_harness_run ("scale_pixbuf/1920x1280-to-large", 50, bench_scale_pixbuf, &data);
+  data.size = 1024;
+  bench_harness_run ("scale_pixbuf/1920x1280-to-xx-large", 20, bench_scale_pixbuf, &data);
+
+  g_object_unref (data.source);
+
+  return bench_harness_finish ();
+}
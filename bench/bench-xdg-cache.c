@@ -0,0 +1,196 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "bench-corpus.h"
+#include "bench-harness.h"
+
+#include "plugins/xdg-cache/xdg-cache-cache.h"
+#include "plugins/xdg-cache/xdg-cache-thumbnail.h"
+
+#include <stdlib.h>
+
+#define N_URIS 10000
+
+
+
+/* stands in for the cache plugin module the types are usually registered with */
+typedef GTypeModule BenchModule;
+typedef GTypeModuleClass BenchModuleClass;
+
+GType
+bench_module_get_type (void);
+
+G_DEFINE_TYPE (BenchModule, bench_module, G_TYPE_TYPE_MODULE)
+
+typedef struct
+{
+  TumblerThumbnailFlavor *flavor;
+  TumblerThumbnail *thumbnail;
+  TumblerImageData image_data;
+  gchar *uris[N_URIS];
+  gchar *path;
+  guint next;
+} CacheData;
+
+
+
+static gboolean
+bench_module_load (GTypeModule *module)
+{
+  return TRUE;
+}
+
+
+
+static void
+bench_module_unload (GTypeModule *module)
+{
+}
+
+
+
+static void
+bench_module_class_init (BenchModuleClass *klass)
+{
+  klass->load = bench_module_load;
+  klass->unload = bench_module_unload;
+}
+
+
+
+static void
+bench_module_init (BenchModule *module)
+{
+}
+
+
+
+static void
+bench_get_file (gpointer user_data)
+{
+  CacheData *data = user_data;
+
+  g_object_unref (xdg_cache_cache_get_file (data->uris[data->next++ % N_URIS], data->flavor));
+}
+
+
+
+static void
+bench_save_image_data (gpointer user_data)
+{
+  CacheData *data = user_data;
+  GError *error = NULL;
+
+  if (!tumbler_thumbnail_save_image_data (data->thumbnail, &data->image_data, 1.0, NULL, &error))
+    {
+      g_printerr ("Failed to save the thumbnail: %s\n", error->message);
+      exit (EXIT_FAILURE);
+    }
+}
+
+
+
+static void
+bench_read_thumbnail_info (gpointer user_data)
+{
+  CacheData *data = user_data;
+  gdouble mtime;
+  gchar *uri;
+
+  if (!xdg_cache_cache_read_thumbnail_info (data->path, &uri, &mtime, NULL, NULL) || uri == NULL)
+    {
+      g_printerr ("Failed to read the thumbnail info\n");
+      exit (EXIT_FAILURE);
+    }
+
+  g_free (uri);
+}
+
+
+
+int
+main (int argc,
+      char **argv)
+{
+  GTypeModule *module;
+  TumblerCache *cache;
+  GdkPixbuf *pixbuf;
+  CacheData data;
+  GError *error = NULL;
+  GFile *file;
+  gchar *tmp_dir;
+  guint n;
+
+  bench_harness_init (&argc, &argv, "xdg-cache");
+
+  /* keep the thumbnails away from the user's cache */
+  tmp_dir = g_dir_make_tmp ("tumbler-bench-XXXXXX", &error);
+  if (tmp_dir == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return EXIT_FAILURE;
+    }
+  g_setenv ("XDG_CACHE_HOME", tmp_dir, TRUE);
+
+  module = g_object_new (bench_module_get_type (), NULL);
+  g_type_module_use (module);
+  xdg_cache_cache_register ((TumblerCachePlugin *) module);
+  xdg_cache_thumbnail_register ((TumblerCachePlugin *) module);
+
+  data.flavor = tumbler_thumbnail_flavor_new_normal ();
+  data.next = 0;
+
+  for (n = 0; n < N_URIS; n++)
+    data.uris[n] = g_strdup_printf ("file:///home/user/Pictures/%04u/IMG_%05u.jpg", n / 100, n);
+  bench_harness_run ("cache_get_file", N_URIS, bench_get_file, &data);
+
+  cache = g_object_new (XDG_CACHE_TYPE_CACHE, NULL);
+  data.thumbnail = g_object_new (XDG_CACHE_TYPE_THUMBNAIL, "cache", cache,
+                                 "uri", data.uris[0], "flavor", data.flavor, NULL);
+
+  pixbuf = bench_corpus_pixbuf_new (128, 85, 0);
+  data.image_data.data = gdk_pixbuf_get_pixels (pixbuf);
+  data.image_data.has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+  data.image_data.bits_per_sample = gdk_pixbuf_get_bits_per_sample (pixbuf);
+  data.image_data.width = gdk_pixbuf_get_width (pixbuf);
+  data.image_data.height = gdk_pixbuf_get_height (pixbuf);
+  data.image_data.rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  data.image_data.colorspace = (TumblerColorspace) gdk_pixbuf_get_colorspace (pixbuf);
+  bench_harness_run ("thumbnail_save_image_data", 200, bench_save_image_data, &data);
+
+  file = xdg_cache_cache_get_file (data.uris[0], data.flavor);
+  data.path = g_file_get_path (file);
+  g_object_unref (file);
+  bench_harness_run ("cache_read_thumbnail_info", 2000, bench_read_thumbnail_info, &data);
+
+  g_object_unref (pixbuf);
+  g_object_unref (data.thumbnail);
+  g_object_unref (cache);
+  g_object_unref (data.flavor);
+  for (n = 0; n < N_URIS; n++)
+    g_free (data.uris[n]);
+  g_free (data.path);
+
+  bench_corpus_remove_recursive (tmp_dir);
+  g_free (tmp_dir);
+
+  return bench_harness_finish ();
+}
@@ -0,0 +1,1590 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "bench-corpus.h"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THUMBNAILER_NAME TUMBLER_SERVICE_NAME_PREFIX ".Thumbnailer1"
+#define THUMBNAILER_PATH TUMBLER_SERVICE_PATH_PREFIX "/Thumbnailer1"
+#define THUMBNAILER_IFACE TUMBLER_SERVICE_NAME_PREFIX ".Thumbnailer1"
+
+#define STARTUP_TIMEOUT 10
+
+
+
+typedef enum
+{
+  BENCH_PATTERN_BURST,
+  BENCH_PATTERN_BATCHES,
+  BENCH_PATTERN_SCROLL,
+} BenchPattern;
+
+typedef struct _BenchKind BenchKind;
+typedef struct _BenchFile BenchFile;
+typedef struct _BenchRun BenchRun;
+typedef struct _BenchBatch BenchBatch;
+typedef struct _BenchEvent BenchEvent;
+typedef struct _BenchRequest BenchRequest;
+
+struct _BenchKind
+{
+  const gchar *name;
+  const gchar *mime_type;
+  const gchar *extension;
+  GBytes *(*generate) (guint n);
+};
+
+struct _BenchFile
+{
+  const BenchKind *kind;
+  gchar *uri;
+  gint64 queued;
+  gint64 ready;
+  gboolean failed;
+};
+
+struct _BenchRun
+{
+  const gchar *scheduler;
+  GDBusConnection *connection;
+  GCancellable *cancellable;
+  GMainLoop *loop;
+  GPtrArray *files;
+  GHashTable *uris;
+  guint next;
+  guint n_sent;
+  guint n_finished;
+  guint queue_id;
+  guint32 last_handle;
+  gboolean timed_out;
+  gint64 started;
+  gint64 finished;
+
+  /* replay of a recorded trace */
+  GPtrArray *events;
+  GPtrArray *requests;
+  GHashTable *handles;
+  GHashTable *live;
+  GArray *ready_latencies;
+  guint n_skipped;
+};
+
+struct _BenchBatch
+{
+  BenchRun *run;
+  guint first;
+  guint n;
+};
+
+/* an event of a trace recorded with TUMBLER_RECORD_FILE, see tumblerd's
+ * tumbler-recorder.c for the format */
+struct _BenchEvent
+{
+  gchar type;
+  gint64 time;
+  guint32 handle;
+  guint32 handle_to_dequeue;
+  gchar *flavor;
+  gchar *scheduler;
+  gchar **uris;
+  gchar **mime_types;
+};
+
+struct _BenchRequest
+{
+  BenchRun *run;
+  BenchEvent *event;
+  guint32 handle;
+  guint n_ready;
+  guint n_failed;
+  gint64 sent;
+  gint64 finished;
+};
+
+
+
+static GBytes *bench_generate_jpeg (guint n);
+static GBytes *bench_generate_jpeg_exif (guint n);
+static GBytes *bench_generate_png (guint n);
+static GBytes *bench_generate_pdf (guint n);
+static GBytes *bench_generate_font (guint n);
+static GBytes *bench_generate_odf (guint n);
+
+
+
+static const BenchKind bench_kinds[] = {
+  { "jpeg", "image/jpeg", "jpg", bench_generate_jpeg },
+  { "jpeg-exif", "image/jpeg", "jpg", bench_generate_jpeg_exif },
+  { "png", "image/png", "png", bench_generate_png },
+  { "pdf", "application/pdf", "pdf", bench_generate_pdf },
+  { "font", "application/x-font-ttf", "ttf", bench_generate_font },
+  { "odf", "application/vnd.oasis.opendocument.text", "odt", bench_generate_odf },
+};
+
+static gchar *opt_tumblerd = NULL;
+static gchar *opt_pattern = NULL;
+static gchar *opt_schedulers = NULL;
+static gchar *opt_flavor = NULL;
+static gchar *opt_font = NULL;
+static gint opt_files = 50;
+static gint opt_batch_size = 32;
+static gint opt_interval = 20;
+static gint opt_timeout = 300;
+static gboolean opt_keep = FALSE;
+static gchar *opt_replay = NULL;
+static gdouble opt_speed = 1.0;
+
+static BenchPattern bench_pattern = BENCH_PATTERN_BURST;
+static GBytes *bench_font_data = NULL;
+static GPtrArray *bench_events = NULL;
+
+static GOptionEntry option_entries[] = {
+  { "tumblerd", 0, 0, G_OPTION_ARG_FILENAME, &opt_tumblerd,
+    "Path of the tumblerd executable", "PATH" },
+  { "pattern", 'p', 0, G_OPTION_ARG_STRING, &opt_pattern,
+    "Request pattern: burst, batches or scroll (default: burst)", "PATTERN" },
+  { "schedulers", 's', 0, G_OPTION_ARG_STRING, &opt_schedulers,
+    "Comma-separated schedulers to run (default: foreground,background)", "LIST" },
+  { "flavor", 0, 0, G_OPTION_ARG_STRING, &opt_flavor,
+    "Thumbnail flavor (default: normal)", "FLAVOR" },
+  { "files", 'n', 0, G_OPTION_ARG_INT, &opt_files,
+    "Number of files per type (default: 50)", "N" },
+  { "batch-size", 'b', 0, G_OPTION_ARG_INT, &opt_batch_size,
+    "Files per request for the batches and scroll patterns (default: 32)", "N" },
+  { "interval", 'i', 0, G_OPTION_ARG_INT, &opt_interval,
+    "Milliseconds between two requests (default: 20)", "MS" },
+  { "timeout", 't', 0, G_OPTION_ARG_INT, &opt_timeout,
+    "Seconds after which a run is aborted (default: 300)", "SECONDS" },
+  { "font", 0, 0, G_OPTION_ARG_FILENAME, &opt_font,
+    "Font file used for the font corpus", "PATH" },
+  { "keep", 'k', 0, G_OPTION_ARG_NONE, &opt_keep,
+    "Keep the temporary corpus and cache directories", NULL },
+  { "replay", 'r', 0, G_OPTION_ARG_FILENAME, &opt_replay,
+    "Replay a trace recorded with TUMBLER_RECORD_FILE instead of a synthetic corpus", "FILE" },
+  { "speed", 0, 0, G_OPTION_ARG_DOUBLE, &opt_speed,
+    "Replay speed factor (default: 1.0)", "FACTOR" },
+  { NULL },
+};
+
+
+
+static guint32
+bench_crc32 (const guint8 *data,
+             gsize length)
+{
+  guint32 crc = 0xffffffff;
+  gsize n;
+  guint k;
+
+  for (n = 0; n < length; n++)
+    {
+      crc ^= data[n];
+      for (k = 0; k < 8; k++)
+        crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+    }
+
+  return ~crc;
+}
+
+
+
+static GBytes *
+bench_generate_jpeg (guint n)
+{
+  return bench_corpus_encode (bench_corpus_pixbuf_new (1920, 1280, n), "jpeg");
+}
+
+
+
+static GBytes *
+bench_generate_jpeg_exif (guint n)
+{
+  return bench_corpus_jpeg_with_exif (1920, 1280, n);
+}
+
+
+
+static GBytes *
+bench_generate_png (guint n)
+{
+  return bench_corpus_encode (bench_corpus_pixbuf_new (1024, 768, n), "png");
+}
+
+
+
+static GBytes *
+bench_generate_pdf (guint n)
+{
+  GString *pdf;
+  gchar *content;
+  gsize offsets[6];
+  gsize xref;
+  guint i;
+
+  content = g_strdup_printf ("BT /F1 48 Tf 72 700 Td (Tumbler %u) Tj ET", n);
+
+  pdf = g_string_new ("%PDF-1.4\n");
+  offsets[1] = pdf->len;
+  g_string_append (pdf, "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+  offsets[2] = pdf->len;
+  g_string_append (pdf, "2 0 obj\n<< /Type /Pages /Kids [3 0 R] /Count 1 >>\nendobj\n");
+  offsets[3] = pdf->len;
+  g_string_append (pdf, "3 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 612 792] "
+                        "/Contents 4 0 R /Resources << /Font << /F1 5 0 R >> >> >>\nendobj\n");
+  offsets[4] = pdf->len;
+  g_string_append_printf (pdf, "4 0 obj\n<< /Length %" G_GSIZE_FORMAT " >>\nstream\n%s\n"
+                               "endstream\nendobj\n",
+                          strlen (content), content);
+  offsets[5] = pdf->len;
+  g_string_append (pdf, "5 0 obj\n<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>\n"
+                        "endobj\n");
+
+  xref = pdf->len;
+  g_string_append (pdf, "xref\n0 6\n0000000000 65535 f \n");
+  for (i = 1; i < G_N_ELEMENTS (offsets); i++)
+    g_string_append_printf (pdf, "%010" G_GSIZE_FORMAT " 00000 n \n", offsets[i]);
+  g_string_append_printf (pdf, "trailer\n<< /Size 6 /Root 1 0 R >>\nstartxref\n"
+                               "%" G_GSIZE_FORMAT "\n%%%%EOF\n",
+                          xref);
+
+  g_free (content);
+
+  return g_string_free_to_bytes (pdf);
+}
+
+
+
+static gchar *
+bench_find_font (const gchar *path,
+                 guint depth)
+{
+  const gchar *name;
+  gchar *child;
+  gchar *found = NULL;
+  GDir *dir;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    return NULL;
+
+  while (found == NULL && (name = g_dir_read_name (dir)) != NULL)
+    {
+      child = g_build_filename (path, name, NULL);
+
+      if (g_str_has_suffix (name, ".ttf")
+          && g_file_test (child, G_FILE_TEST_IS_REGULAR))
+        found = g_steal_pointer (&child);
+      else if (depth > 0 && g_file_test (child, G_FILE_TEST_IS_DIR))
+        found = bench_find_font (child, depth - 1);
+
+      g_free (child);
+    }
+
+  g_dir_close (dir);
+
+  return found;
+}
+
+
+
+static GBytes *
+bench_generate_font (guint n)
+{
+  const gchar *const *dirs;
+  gchar *fonts_dir;
+  gchar *path = NULL;
+  gchar *contents;
+  gsize length;
+  guint i;
+
+  /* all font files are copies of the same font */
+  if (bench_font_data != NULL)
+    return g_bytes_ref (bench_font_data);
+
+  if (opt_font != NULL)
+    path = g_strdup (opt_font);
+  else
+    {
+      dirs = g_get_system_data_dirs ();
+      for (i = 0; path == NULL && dirs[i] != NULL; i++)
+        {
+          fonts_dir = g_build_filename (dirs[i], "fonts", NULL);
+          path = bench_find_font (fonts_dir, 4);
+          g_free (fonts_dir);
+        }
+    }
+
+  if (path == NULL || !g_file_get_contents (path, &contents, &length, NULL))
+    {
+      g_printerr ("No TrueType font found, skipping fonts (use --font)\n");
+      g_free (path);
+      return NULL;
+    }
+
+  g_free (path);
+  bench_font_data = g_bytes_new_take (contents, length);
+
+  return g_bytes_ref (bench_font_data);
+}
+
+
+
+static void
+bench_zip_add (GByteArray *array,
+               GByteArray *directory,
+               guint *n_entries,
+               const gchar *name,
+               const guint8 *data,
+               guint32 length)
+{
+  guint32 offset = array->len;
+  guint32 crc = bench_crc32 (data, length);
+  guint i;
+
+  /* stored entries only, a local header and a central directory record for each */
+  for (i = 0; i < 2; i++)
+    {
+      GByteArray *target = i == 0 ? array : directory;
+
+      bench_corpus_put_ulong (target, i == 0 ? 0x04034b50 : 0x02014b50);
+      if (i == 1)
+        bench_corpus_put_ushort (target, 20);
+      bench_corpus_put_ushort (target, 20);
+      bench_corpus_put_ushort (target, 0);
+      bench_corpus_put_ushort (target, 0);
+      bench_corpus_put_ushort (target, 0);
+      bench_corpus_put_ushort (target, 0x21);
+      bench_corpus_put_ulong (target, crc);
+      bench_corpus_put_ulong (target, length);
+      bench_corpus_put_ulong (target, length);
+      bench_corpus_put_ushort (target, strlen (name));
+      bench_corpus_put_ushort (target, 0);
+      if (i == 1)
+        {
+          bench_corpus_put_ushort (target, 0);
+          bench_corpus_put_ushort (target, 0);
+          bench_corpus_put_ushort (target, 0);
+          bench_corpus_put_ulong (target, 0);
+          bench_corpus_put_ulong (target, offset);
+        }
+      g_byte_array_append (target, (const guint8 *) name, strlen (name));
+    }
+
+  g_byte_array_append (array, data, length);
+  *n_entries += 1;
+}
+
+
+
+static GBytes *
+bench_generate_odf (guint n)
+{
+  const gchar *mime_type = "application/vnd.oasis.opendocument.text";
+  GByteArray *array;
+  GByteArray *directory;
+  GBytes *thumb;
+  gsize length;
+  guint32 offset;
+  guint n_entries = 0;
+
+  thumb = bench_corpus_encode (bench_corpus_pixbuf_new (256, 181, n), "png");
+  if (thumb == NULL)
+    return NULL;
+
+  array = g_byte_array_new ();
+  directory = g_byte_array_new ();
+
+  bench_zip_add (array, directory, &n_entries, "mimetype",
+                 (const guint8 *) mime_type, strlen (mime_type));
+  bench_zip_add (array, directory, &n_entries, "Thumbnails/thumbnail.png",
+                 g_bytes_get_data (thumb, &length), length);
+
+  /* central directory and its end record */
+  offset = array->len;
+  g_byte_array_append (array, directory->data, directory->len);
+  bench_corpus_put_ulong (array, 0x06054b50);
+  bench_corpus_put_ushort (array, 0);
+  bench_corpus_put_ushort (array, 0);
+  bench_corpus_put_ushort (array, n_entries);
+  bench_corpus_put_ushort (array, n_entries);
+  bench_corpus_put_ulong (array, directory->len);
+  bench_corpus_put_ulong (array, offset);
+  bench_corpus_put_ushort (array, 0);
+
+  g_byte_array_unref (directory);
+  g_bytes_unref (thumb);
+
+  return g_byte_array_free_to_bytes (array);
+}
+
+
+
+static GPtrArray *
+bench_generate_corpus (const gchar *directory,
+                       GError **error)
+{
+  const BenchKind *kind;
+  GPtrArray *files;
+  BenchFile *file;
+  GBytes *data;
+  gchar *filename;
+  gchar *path;
+  gboolean skip[G_N_ELEMENTS (bench_kinds)] = { FALSE, };
+  guint i, k;
+
+  files = g_ptr_array_new ();
+
+  /* interleave the types, like files sorted by name in a folder */
+  for (i = 0; i < (guint) opt_files; i++)
+    for (k = 0; k < G_N_ELEMENTS (bench_kinds); k++)
+      {
+        kind = &bench_kinds[k];
+        if (skip[k])
+          continue;
+
+        data = kind->generate (i);
+        if (data == NULL)
+          {
+            skip[k] = TRUE;
+            continue;
+          }
+
+        filename = g_strdup_printf ("%s-%04u.%s", kind->name, i, kind->extension);
+        path = g_build_filename (directory, filename, NULL);
+        g_free (filename);
+
+        if (!g_file_set_contents (path, g_bytes_get_data (data, NULL),
+                                  g_bytes_get_size (data), error))
+          {
+            g_bytes_unref (data);
+            g_free (path);
+            g_ptr_array_free (files, TRUE);
+            return NULL;
+          }
+
+        file = g_new0 (BenchFile, 1);
+        file->kind = kind;
+        file->uri = g_filename_to_uri (path, NULL, NULL);
+        g_ptr_array_add (files, file);
+
+        g_bytes_unref (data);
+        g_free (path);
+      }
+
+  return files;
+}
+
+
+
+static void
+bench_check_done (BenchRun *run)
+{
+  guint n_total = run->events != NULL ? run->events->len : run->files->len;
+
+  if (run->next < n_total || run->n_finished < run->n_sent)
+    return;
+
+  run->finished = g_get_monotonic_time ();
+  g_main_loop_quit (run->loop);
+}
+
+
+
+static void
+bench_signal (GDBusConnection *connection,
+              const gchar *sender_name,
+              const gchar *object_path,
+              const gchar *interface_name,
+              const gchar *signal_name,
+              GVariant *parameters,
+              gpointer user_data)
+{
+  BenchRun *run = user_data;
+  BenchFile *file;
+  const gchar **uris;
+  gint64 now = g_get_monotonic_time ();
+  guint i;
+
+  if (g_strcmp0 (signal_name, "Ready") == 0)
+    {
+      g_variant_get (parameters, "(u^a&s)", NULL, &uris);
+      for (i = 0; uris[i] != NULL; i++)
+        {
+          file = g_hash_table_lookup (run->uris, uris[i]);
+          if (file != NULL && file->ready == 0)
+            file->ready = now;
+        }
+      g_free (uris);
+    }
+  else if (g_strcmp0 (signal_name, "Error") == 0)
+    {
+      g_variant_get (parameters, "(u^a&sis)", NULL, &uris, NULL, NULL);
+      for (i = 0; uris[i] != NULL; i++)
+        {
+          file = g_hash_table_lookup (run->uris, uris[i]);
+          if (file != NULL)
+            file->failed = TRUE;
+        }
+      g_free (uris);
+    }
+  else if (g_strcmp0 (signal_name, "Finished") == 0)
+    {
+      run->n_finished++;
+      bench_check_done (run);
+    }
+}
+
+
+
+static void
+bench_queue_finish (GObject *object,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+  BenchBatch *batch = user_data;
+  BenchRun *run = batch->run;
+  BenchFile *file;
+  GVariant *reply;
+  GError *error = NULL;
+  guint i;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+  if (reply != NULL)
+    {
+      g_variant_get (reply, "(u)", &run->last_handle);
+      g_variant_unref (reply);
+    }
+  else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      /* the run is over */
+      g_error_free (error);
+    }
+  else
+    {
+      g_printerr ("Queue failed: %s\n", error->message);
+      g_error_free (error);
+
+      /* no Finished signal will come for this request */
+      for (i = 0; i < batch->n; i++)
+        {
+          file = g_ptr_array_index (run->files, batch->first + i);
+          file->failed = TRUE;
+        }
+      run->n_finished++;
+      bench_check_done (run);
+    }
+
+  g_free (batch);
+}
+
+
+
+static gboolean
+bench_queue (gpointer user_data)
+{
+  BenchRun *run = user_data;
+  BenchBatch *batch;
+  BenchFile *file;
+  const gchar **uris;
+  const gchar **mime_types;
+  gint64 now = g_get_monotonic_time ();
+  guint32 unqueue = 0;
+  guint i;
+
+  batch = g_new0 (BenchBatch, 1);
+  batch->run = run;
+  batch->first = run->next;
+  if (bench_pattern == BENCH_PATTERN_BURST)
+    batch->n = run->files->len;
+  else
+    batch->n = MIN ((guint) opt_batch_size, run->files->len - run->next);
+
+  uris = g_new0 (const gchar *, batch->n + 1);
+  mime_types = g_new0 (const gchar *, batch->n + 1);
+  for (i = 0; i < batch->n; i++)
+    {
+      file = g_ptr_array_index (run->files, batch->first + i);
+      file->queued = now;
+      uris[i] = file->uri;
+      mime_types[i] = file->kind->mime_type;
+    }
+
+  if (run->started == 0)
+    run->started = now;
+
+  /* scrolling past a folder drops the request for the previous view */
+  if (bench_pattern == BENCH_PATTERN_SCROLL)
+    unqueue = run->last_handle;
+
+  g_dbus_connection_call (run->connection, THUMBNAILER_NAME, THUMBNAILER_PATH,
+                          THUMBNAILER_IFACE, "Queue",
+                          g_variant_new ("(^as^asssu)", uris, mime_types,
+                                         opt_flavor, run->scheduler, unqueue),
+                          G_VARIANT_TYPE ("(u)"), G_DBUS_CALL_FLAGS_NONE, -1,
+                          run->cancellable, bench_queue_finish, batch);
+
+  g_free (uris);
+  g_free (mime_types);
+
+  run->next += batch->n;
+  run->n_sent++;
+
+  if (run->next < run->files->len)
+    return G_SOURCE_CONTINUE;
+
+  run->queue_id = 0;
+
+  return G_SOURCE_REMOVE;
+}
+
+
+
+static gboolean
+bench_timeout (gpointer user_data)
+{
+  BenchRun *run = user_data;
+
+  run->timed_out = TRUE;
+  run->finished = g_get_monotonic_time ();
+  g_main_loop_quit (run->loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+
+
+static void
+bench_name_appeared (GDBusConnection *connection,
+                     const gchar *name,
+                     const gchar *name_owner,
+                     gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+}
+
+
+
+static gint
+bench_compare_doubles (gconstpointer a,
+                       gconstpointer b)
+{
+  gdouble da = *(const gdouble *) a;
+  gdouble db = *(const gdouble *) b;
+
+  return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+
+
+static gdouble
+bench_percentile (GArray *samples,
+                  guint percentile)
+{
+  guint index;
+
+  if (samples->len == 0)
+    return 0;
+
+  /* nearest rank on the sorted samples */
+  index = (percentile * samples->len + 99) / 100;
+  index = CLAMP (index, 1, samples->len) - 1;
+
+  return g_array_index (samples, gdouble, index);
+}
+
+
+
+static void
+bench_json_double (GString *json,
+                   const gchar *name,
+                   gdouble value)
+{
+  gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append_printf (json, "\"%s\": %s", name,
+                          g_ascii_formatd (buffer, sizeof (buffer), "%.3f", value));
+}
+
+
+
+static void
+bench_report_run (GString *json,
+                  BenchRun *run,
+                  gdouble startup_ms)
+{
+  const BenchKind *kind;
+  BenchFile *file;
+  GArray *samples;
+  gdouble wall_ms;
+  guint n_queued, n_ready, n_failed;
+  guint n_total_ready = 0;
+  guint i, k;
+
+  wall_ms = (run->finished - run->started) / 1000.0;
+
+  g_string_append_printf (json, "    {\n      \"scheduler\": \"%s\",\n", run->scheduler);
+  g_string_append (json, "      ");
+  bench_json_double (json, "startup_ms", startup_ms);
+  g_string_append (json, ",\n      ");
+  bench_json_double (json, "wall_ms", wall_ms);
+  g_string_append_printf (json, ",\n      \"requests\": %u,\n      \"timed_out\": %s,\n"
+                                "      \"types\": [\n",
+                          run->n_sent, run->timed_out ? "true" : "false");
+
+  samples = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+  for (k = 0; k < G_N_ELEMENTS (bench_kinds); k++)
+    {
+      kind = &bench_kinds[k];
+      n_queued = n_ready = n_failed = 0;
+      g_array_set_size (samples, 0);
+
+      for (i = 0; i < run->files->len; i++)
+        {
+          file = g_ptr_array_index (run->files, i);
+          if (file->kind != kind)
+            continue;
+
+          n_queued++;
+          if (file->ready != 0)
+            {
+              gdouble latency = (file->ready - file->queued) / 1000.0;
+
+              g_array_append_val (samples, latency);
+              n_ready++;
+            }
+          else if (file->failed)
+            n_failed++;
+        }
+
+      if (n_queued == 0)
+        continue;
+
+      n_total_ready += n_ready;
+      g_array_sort (samples, bench_compare_doubles);
+
+      if (json->str[json->len - 2] == '}')
+        g_string_insert_c (json, json->len - 1, ',');
+
+      g_string_append_printf (json, "        { \"kind\": \"%s\", \"mime_type\": \"%s\", "
+                                    "\"queued\": %u, \"ready\": %u, \"failed\": %u, "
+                                    "\"unfinished\": %u, ",
+                              kind->name, kind->mime_type, n_queued, n_ready, n_failed,
+                              n_queued - n_ready - n_failed);
+      bench_json_double (json, "p50_ms", bench_percentile (samples, 50));
+      g_string_append (json, ", ");
+      bench_json_double (json, "p95_ms", bench_percentile (samples, 95));
+      g_string_append (json, ", ");
+      bench_json_double (json, "p99_ms", bench_percentile (samples, 99));
+      g_string_append (json, " }\n");
+    }
+
+  g_array_free (samples, TRUE);
+
+  g_string_append (json, "      ],\n      ");
+  bench_json_double (json, "throughput", wall_ms > 0 ? n_total_ready * 1000.0 / wall_ms : 0);
+  g_string_append (json, "\n    }");
+}
+
+
+
+static void
+bench_event_free (gpointer data)
+{
+  BenchEvent *event = data;
+
+  g_free (event->flavor);
+  g_free (event->scheduler);
+  g_strfreev (event->uris);
+  g_strfreev (event->mime_types);
+  g_free (event);
+}
+
+
+
+static GPtrArray *
+bench_replay_load (const gchar *path,
+                   GError **error)
+{
+  BenchEvent *event;
+  GPtrArray *events;
+  gchar **lines;
+  gchar **fields;
+  gchar *contents;
+  gchar *field;
+  gboolean valid;
+  gint64 base = 0;
+  gint64 last = 0;
+  guint n_fields, n_uris;
+  guint i, n;
+
+  if (!g_file_get_contents (path, &contents, NULL, error))
+    return NULL;
+
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  events = g_ptr_array_new_with_free_func (bench_event_free);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      if (*lines[i] == '\0' || *lines[i] == '#')
+        continue;
+
+      fields = g_strsplit (lines[i], "\t", -1);
+      n_fields = g_strv_length (fields);
+      for (n = 0; n < n_fields; n++)
+        {
+          field = g_strcompress (fields[n]);
+          g_free (fields[n]);
+          fields[n] = field;
+        }
+
+      event = g_new0 (BenchEvent, 1);
+      valid = n_fields >= 3 && strlen (fields[0]) == 1;
+      if (valid)
+        {
+          event->type = fields[0][0];
+
+          /* the times of a session start over, its events follow the last one
+           * of the previous session without the idle time in between */
+          if (event->type == 'S')
+            base = last;
+
+          event->time = base + g_ascii_strtoll (fields[1], NULL, 10);
+          last = MAX (last, event->time);
+        }
+
+      if (valid && event->type == 'Q' && n_fields >= 6 && n_fields % 2 == 0)
+        {
+          event->handle = g_ascii_strtoull (fields[2], NULL, 10);
+          event->handle_to_dequeue = g_ascii_strtoull (fields[3], NULL, 10);
+          event->flavor = g_strdup (fields[4]);
+          event->scheduler = g_strdup (fields[5]);
+
+          n_uris = (n_fields - 6) / 2;
+          event->uris = g_new0 (gchar *, n_uris + 1);
+          event->mime_types = g_new0 (gchar *, n_uris + 1);
+          for (n = 0; n < n_uris; n++)
+            {
+              event->uris[n] = g_strdup (fields[6 + 2 * n]);
+              event->mime_types[n] = g_strdup (fields[7 + 2 * n]);
+            }
+        }
+      else if (valid && event->type == 'D')
+        event->handle = g_ascii_strtoull (fields[2], NULL, 10);
+      else if (!valid || (event->type != 'U' && event->type != 'S'))
+        valid = FALSE;
+
+      g_strfreev (fields);
+
+      if (!valid)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "%s:%u: Malformed event", path, i + 1);
+          bench_event_free (event);
+          g_ptr_array_free (events, TRUE);
+          g_strfreev (lines);
+          return NULL;
+        }
+
+      g_ptr_array_add (events, event);
+    }
+
+  g_strfreev (lines);
+
+  return events;
+}
+
+
+
+static void
+bench_replay_signal (GDBusConnection *connection,
+                     const gchar *sender_name,
+                     const gchar *object_path,
+                     const gchar *interface_name,
+                     const gchar *signal_name,
+                     GVariant *parameters,
+                     gpointer user_data)
+{
+  BenchRun *run = user_data;
+  BenchRequest *request;
+  const gchar **uris;
+  gdouble latency;
+  gint64 now = g_get_monotonic_time ();
+  guint32 handle;
+  guint i;
+
+  if (g_strcmp0 (signal_name, "Ready") == 0)
+    {
+      g_variant_get (parameters, "(u^a&s)", &handle, &uris);
+      request = g_hash_table_lookup (run->live, GUINT_TO_POINTER (handle));
+      for (i = 0; request != NULL && uris[i] != NULL; i++)
+        {
+          latency = (now - request->sent) / 1000.0;
+          g_array_append_val (run->ready_latencies, latency);
+          request->n_ready++;
+        }
+      g_free (uris);
+    }
+  else if (g_strcmp0 (signal_name, "Error") == 0)
+    {
+      g_variant_get (parameters, "(u^a&sis)", &handle, &uris, NULL, NULL);
+      request = g_hash_table_lookup (run->live, GUINT_TO_POINTER (handle));
+      if (request != NULL)
+        request->n_failed += g_strv_length ((gchar **) uris);
+      g_free (uris);
+    }
+  else if (g_strcmp0 (signal_name, "Finished") == 0)
+    {
+      g_variant_get (parameters, "(u)", &handle);
+      request = g_hash_table_lookup (run->live, GUINT_TO_POINTER (handle));
+      if (request != NULL && request->finished == 0)
+        {
+          request->finished = now;
+          run->n_finished++;
+          bench_check_done (run);
+        }
+    }
+}
+
+
+
+static void
+bench_replay_queue_finish (GObject *object,
+                           GAsyncResult *result,
+                           gpointer user_data)
+{
+  BenchRequest *request = user_data;
+  GVariant *reply;
+  GError *error = NULL;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+  if (reply != NULL)
+    {
+      g_variant_get (reply, "(u)", &request->handle);
+      g_hash_table_insert (request->run->live, GUINT_TO_POINTER (request->handle), request);
+      g_variant_unref (reply);
+    }
+  else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      /* the run is over */
+      g_error_free (error);
+    }
+  else
+    {
+      g_printerr ("Queue failed: %s\n", error->message);
+      g_error_free (error);
+
+      /* no Finished signal will come for this request */
+      request->n_failed = g_strv_length (request->event->uris);
+      request->finished = g_get_monotonic_time ();
+      request->run->n_finished++;
+      bench_check_done (request->run);
+    }
+}
+
+
+
+static void
+bench_replay_event (BenchRun *run,
+                    BenchEvent *event)
+{
+  BenchRequest *request;
+  BenchRequest *previous;
+  guint32 unqueue = 0;
+
+  if (event->type == 'Q')
+    {
+      request = g_new0 (BenchRequest, 1);
+      request->run = run;
+      request->event = event;
+      request->sent = g_get_monotonic_time ();
+      g_ptr_array_add (run->requests, request);
+      g_hash_table_insert (run->handles, GUINT_TO_POINTER (event->handle), request);
+
+      /* recorded handles have to be mapped to the ones of this run */
+      previous = g_hash_table_lookup (run->handles,
+                                      GUINT_TO_POINTER (event->handle_to_dequeue));
+      if (event->handle_to_dequeue != 0 && previous != NULL)
+        unqueue = previous->handle;
+
+      g_dbus_connection_call (run->connection, THUMBNAILER_NAME, THUMBNAILER_PATH,
+                              THUMBNAILER_IFACE, "Queue",
+                              g_variant_new ("(^as^asssu)", event->uris, event->mime_types,
+                                             event->flavor,
+                                             run->scheduler != NULL ? run->scheduler
+                                                                    : event->scheduler,
+                                             unqueue),
+                              G_VARIANT_TYPE ("(u)"), G_DBUS_CALL_FLAGS_NONE, -1,
+                              run->cancellable, bench_replay_queue_finish, request);
+      run->n_sent++;
+    }
+  else if (event->type == 'D')
+    {
+      previous = g_hash_table_lookup (run->handles, GUINT_TO_POINTER (event->handle));
+      if (previous != NULL && previous->handle != 0)
+        g_dbus_connection_call (run->connection, THUMBNAILER_NAME, THUMBNAILER_PATH,
+                                THUMBNAILER_IFACE, "Dequeue",
+                                g_variant_new ("(u)", previous->handle),
+                                NULL, G_DBUS_CALL_FLAGS_NONE, -1,
+                                run->cancellable, NULL, NULL);
+      else
+        run->n_skipped++;
+    }
+  else if (event->type == 'S')
+    {
+      /* a new tumblerd instance, which hands out its handles anew */
+      g_hash_table_remove_all (run->handles);
+    }
+  else
+    {
+      /* mount removals can't be replayed */
+      run->n_skipped++;
+    }
+}
+
+
+
+static gboolean
+bench_replay (gpointer user_data)
+{
+  BenchRun *run = user_data;
+  BenchEvent *event;
+  gint64 now = g_get_monotonic_time ();
+  gint64 offset;
+  gint64 due;
+
+  if (run->started == 0)
+    run->started = now;
+
+  offset = ((BenchEvent *) g_ptr_array_index (run->events, 0))->time;
+
+  /* send everything that is due, then sleep until the next event */
+  while (run->next < run->events->len)
+    {
+      event = g_ptr_array_index (run->events, run->next);
+      due = run->started + (gint64) ((event->time - offset) / opt_speed);
+      if (due > now)
+        {
+          run->queue_id = g_timeout_add ((due - now + 999) / 1000, bench_replay, run);
+          return G_SOURCE_REMOVE;
+        }
+
+      bench_replay_event (run, event);
+      run->next++;
+    }
+
+  run->queue_id = 0;
+  bench_check_done (run);
+
+  return G_SOURCE_REMOVE;
+}
+
+
+
+static void
+bench_report_replay (GString *json,
+                     BenchRun *run,
+                     gdouble startup_ms)
+{
+  BenchRequest *request;
+  GArray *samples;
+  gdouble wall_ms;
+  gdouble latency;
+  guint n_uris = 0, n_ready = 0, n_failed = 0;
+  guint i;
+
+  wall_ms = (run->finished - run->started) / 1000.0;
+
+  samples = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  for (i = 0; i < run->requests->len; i++)
+    {
+      request = g_ptr_array_index (run->requests, i);
+      n_uris += g_strv_length (request->event->uris);
+      n_ready += request->n_ready;
+      n_failed += request->n_failed;
+      if (request->finished != 0)
+        {
+          latency = (request->finished - request->sent) / 1000.0;
+          g_array_append_val (samples, latency);
+        }
+    }
+  g_array_sort (samples, bench_compare_doubles);
+  g_array_sort (run->ready_latencies, bench_compare_doubles);
+
+  g_string_append_printf (json, "    {\n      \"scheduler\": \"%s\",\n",
+                          run->scheduler != NULL ? run->scheduler : "recorded");
+  g_string_append (json, "      ");
+  bench_json_double (json, "startup_ms", startup_ms);
+  g_string_append (json, ",\n      ");
+  bench_json_double (json, "wall_ms", wall_ms);
+  g_string_append_printf (json, ",\n      \"requests\": %u,\n      \"finished\": %u,\n"
+                                "      \"skipped_events\": %u,\n      \"timed_out\": %s,\n"
+                                "      \"uris\": %u,\n      \"ready\": %u,\n      \"failed\": %u,\n"
+                                "      \"request_ms\": { ",
+                          run->n_sent, samples->len, run->n_skipped,
+                          run->timed_out ? "true" : "false", n_uris, n_ready, n_failed);
+  bench_json_double (json, "p50", bench_percentile (samples, 50));
+  g_string_append (json, ", ");
+  bench_json_double (json, "p95", bench_percentile (samples, 95));
+  g_string_append (json, ", ");
+  bench_json_double (json, "p99", bench_percentile (samples, 99));
+  g_string_append (json, " },\n      \"ready_ms\": { ");
+  bench_json_double (json, "p50", bench_percentile (run->ready_latencies, 50));
+  g_string_append (json, ", ");
+  bench_json_double (json, "p95", bench_percentile (run->ready_latencies, 95));
+  g_string_append (json, ", ");
+  bench_json_double (json, "p99", bench_percentile (run->ready_latencies, 99));
+  g_string_append (json, " }\n    }");
+
+  g_array_free (samples, TRUE);
+}
+
+
+
+static void
+bench_replay_run (BenchRun *run,
+                  const gchar *scheduler,
+                  GString *json,
+                  gdouble startup_ms)
+{
+  guint source_id;
+  guint signal_id;
+
+  /* "recorded" keeps the scheduler of every recorded request */
+  run->scheduler = g_strcmp0 (scheduler, "recorded") != 0 ? scheduler : NULL;
+  run->cancellable = g_cancellable_new ();
+  run->events = bench_events;
+  run->requests = g_ptr_array_new_with_free_func (g_free);
+  run->handles = g_hash_table_new (NULL, NULL);
+  run->live = g_hash_table_new (NULL, NULL);
+  run->ready_latencies = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+  signal_id = g_dbus_connection_signal_subscribe (run->connection, NULL, THUMBNAILER_IFACE,
+                                                  NULL, THUMBNAILER_PATH, NULL,
+                                                  G_DBUS_SIGNAL_FLAGS_NONE,
+                                                  bench_replay_signal, run, NULL);
+
+  run->queue_id = g_idle_add (bench_replay, run);
+  source_id = g_timeout_add_seconds (opt_timeout, bench_timeout, run);
+
+  g_main_loop_run (run->loop);
+
+  if (!run->timed_out)
+    g_source_remove (source_id);
+  if (run->queue_id != 0)
+    g_source_remove (run->queue_id);
+  g_dbus_connection_signal_unsubscribe (run->connection, signal_id);
+  g_cancellable_cancel (run->cancellable);
+
+  if (json->str[json->len - 2] == '}')
+    g_string_insert_c (json, json->len - 1, ',');
+  bench_report_replay (json, run, startup_ms);
+  g_string_append_c (json, '\n');
+}
+
+
+
+static GSubprocess *
+bench_start_tumblerd (GTestDBus *bus,
+                      const gchar *tmp_dir,
+                      const gchar *scheduler,
+                      BenchRun *run,
+                      gdouble *startup_ms,
+                      GError **error)
+{
+  GSubprocessLauncher *launcher;
+  GSubprocess *process;
+  gchar *cache_dir;
+  gint64 spawned;
+  guint watch_id;
+  guint source_id;
+
+  /* every run starts with an empty cache and a fresh daemon */
+  cache_dir = g_strdup_printf ("%s/cache-%s", tmp_dir, scheduler);
+  if (g_mkdir_with_parents (cache_dir, 0700) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Failed to create %s", cache_dir);
+      g_free (cache_dir);
+      return NULL;
+    }
+
+  run->connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (bus),
+                                                            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+                                                              | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                            NULL, NULL, error);
+  if (run->connection == NULL)
+    {
+      g_free (cache_dir);
+      return NULL;
+    }
+
+  launcher = g_subprocess_launcher_new (G_SUBPROCESS_FLAGS_NONE);
+  g_subprocess_launcher_setenv (launcher, "DBUS_SESSION_BUS_ADDRESS",
+                                g_test_dbus_get_bus_address (bus), TRUE);
+  g_subprocess_launcher_setenv (launcher, "XDG_CACHE_HOME", cache_dir, TRUE);
+
+  /* don't overwrite a trace while replaying it */
+  g_subprocess_launcher_unsetenv (launcher, "TUMBLER_RECORD_FILE");
+
+  spawned = g_get_monotonic_time ();
+  process = g_subprocess_launcher_spawn (launcher, error, opt_tumblerd, NULL);
+  g_object_unref (launcher);
+  g_free (cache_dir);
+
+  if (process == NULL)
+    {
+      g_clear_object (&run->connection);
+      return NULL;
+    }
+
+  /* wait for the thumbnailer service to show up on the bus */
+  run->loop = g_main_loop_new (NULL, FALSE);
+  watch_id = g_bus_watch_name_on_connection (run->connection, THUMBNAILER_NAME,
+                                             G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                             bench_name_appeared, NULL, run->loop, NULL);
+  source_id = g_timeout_add_seconds (STARTUP_TIMEOUT, bench_timeout, run);
+  g_main_loop_run (run->loop);
+  if (!run->timed_out)
+    g_source_remove (source_id);
+  g_bus_unwatch_name (watch_id);
+  *startup_ms = (g_get_monotonic_time () - spawned) / 1000.0;
+
+  if (run->timed_out)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                   "%s did not appear on the bus", THUMBNAILER_NAME);
+      g_subprocess_force_exit (process);
+      g_subprocess_wait (process, NULL, NULL);
+      g_object_unref (process);
+      g_main_loop_unref (run->loop);
+      g_clear_object (&run->connection);
+      return NULL;
+    }
+
+  return process;
+}
+
+
+
+static gboolean
+bench_run (GTestDBus *bus,
+           const gchar *tmp_dir,
+           const gchar *scheduler,
+           GPtrArray *corpus,
+           GString *json,
+           GError **error)
+{
+  GSubprocess *process;
+  BenchRun run = { 0, };
+  BenchFile *file;
+  GVariant *reply;
+  gchar **schedulers;
+  gboolean supported = TRUE;
+  gdouble startup_ms;
+  guint source_id;
+  guint signal_id;
+  guint i;
+
+  process = bench_start_tumblerd (bus, tmp_dir, scheduler, &run, &startup_ms, error);
+  if (process == NULL)
+    return FALSE;
+
+  /* skip schedulers the daemon doesn't know about */
+  if (bench_events == NULL || g_strcmp0 (scheduler, "recorded") != 0)
+    {
+      reply = g_dbus_connection_call_sync (run.connection, THUMBNAILER_NAME, THUMBNAILER_PATH,
+                                           THUMBNAILER_IFACE, "GetSchedulers", NULL,
+                                           G_VARIANT_TYPE ("(as)"), G_DBUS_CALL_FLAGS_NONE,
+                                           -1, NULL, error);
+      if (reply == NULL)
+        {
+          g_subprocess_force_exit (process);
+          g_subprocess_wait (process, NULL, NULL);
+          g_object_unref (process);
+          g_main_loop_unref (run.loop);
+          g_object_unref (run.connection);
+          return FALSE;
+        }
+
+      g_variant_get (reply, "(^as)", &schedulers);
+      supported = g_strv_contains ((const gchar *const *) schedulers, scheduler);
+      g_strfreev (schedulers);
+      g_variant_unref (reply);
+    }
+
+  if (!supported)
+    {
+      g_printerr ("Scheduler \"%s\" is not supported, skipping\n", scheduler);
+    }
+  else if (bench_events != NULL)
+    {
+      bench_replay_run (&run, scheduler, json, startup_ms);
+    }
+  else
+    {
+      run.scheduler = scheduler;
+      run.cancellable = g_cancellable_new ();
+      run.files = corpus;
+      run.uris = g_hash_table_new (g_str_hash, g_str_equal);
+      for (i = 0; i < corpus->len; i++)
+        {
+          file = g_ptr_array_index (corpus, i);
+          file->queued = file->ready = 0;
+          file->failed = FALSE;
+          g_hash_table_insert (run.uris, file->uri, file);
+        }
+
+      signal_id = g_dbus_connection_signal_subscribe (run.connection, NULL, THUMBNAILER_IFACE,
+                                                      NULL, THUMBNAILER_PATH, NULL,
+                                                      G_DBUS_SIGNAL_FLAGS_NONE,
+                                                      bench_signal, &run, NULL);
+
+      if (bench_pattern == BENCH_PATTERN_BURST)
+        bench_queue (&run);
+      else
+        run.queue_id = g_timeout_add (opt_interval, bench_queue, &run);
+      source_id = g_timeout_add_seconds (opt_timeout, bench_timeout, &run);
+
+      g_main_loop_run (run.loop);
+
+      if (!run.timed_out)
+        g_source_remove (source_id);
+      if (run.queue_id != 0)
+        g_source_remove (run.queue_id);
+      g_dbus_connection_signal_unsubscribe (run.connection, signal_id);
+      g_cancellable_cancel (run.cancellable);
+
+      if (json->str[json->len - 2] == '}')
+        g_string_insert_c (json, json->len - 1, ',');
+      bench_report_run (json, &run, startup_ms);
+      g_string_append_c (json, '\n');
+
+      g_hash_table_destroy (run.uris);
+    }
+
+  g_subprocess_force_exit (process);
+  g_subprocess_wait (process, NULL, NULL);
+  g_object_unref (process);
+
+  /* flush pending callbacks before the run goes out of scope */
+  while (g_main_context_pending (NULL))
+    g_main_context_iteration (NULL, FALSE);
+
+  if (run.requests != NULL)
+    {
+      g_ptr_array_free (run.requests, TRUE);
+      g_hash_table_destroy (run.handles);
+      g_hash_table_destroy (run.live);
+      g_array_free (run.ready_latencies, TRUE);
+    }
+  if (run.cancellable != NULL)
+    g_object_unref (run.cancellable);
+  g_main_loop_unref (run.loop);
+  g_object_unref (run.connection);
+
+  return TRUE;
+}
+
+
+
+static void
+bench_file_free (gpointer data)
+{
+  BenchFile *file = data;
+
+  g_free (file->uri);
+  g_free (file);
+}
+
+
+
+int
+main (int argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GPtrArray *corpus;
+  GTestDBus *bus;
+  GString *json;
+  GError *error = NULL;
+  gchar **schedulers;
+  gchar *corpus_dir;
+  gchar *tmp_dir;
+  gint retval = EXIT_SUCCESS;
+  guint i;
+
+  context = g_option_context_new (NULL);
+  g_option_context_set_summary (context,
+                                "Run tumblerd on a private D-Bus session bus, queue a "
+                                "synthetic corpus or replay a recorded trace and report "
+                                "throughput and time-to-ready as JSON.\n\nThumbnailer "
+                                "plugins are loaded from "
+                                TUMBLER_PLUGIN_DIRECTORY ".");
+  g_option_context_add_main_entries (context, option_entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      g_option_context_free (context);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  if (opt_tumblerd == NULL)
+    opt_tumblerd = g_strdup (TUMBLERD_PATH);
+  if (opt_flavor == NULL)
+    opt_flavor = g_strdup ("normal");
+  if (opt_schedulers == NULL)
+    opt_schedulers = g_strdup (opt_replay != NULL ? "recorded" : "foreground,background");
+
+  if (opt_pattern == NULL || g_strcmp0 (opt_pattern, "burst") == 0)
+    bench_pattern = BENCH_PATTERN_BURST;
+  else if (g_strcmp0 (opt_pattern, "batches") == 0)
+    bench_pattern = BENCH_PATTERN_BATCHES;
+  else if (g_strcmp0 (opt_pattern, "scroll") == 0)
+    bench_pattern = BENCH_PATTERN_SCROLL;
+  else
+    {
+      g_printerr ("Unknown pattern \"%s\"\n", opt_pattern);
+      return EXIT_FAILURE;
+    }
+
+  if (opt_files <= 0 || opt_batch_size <= 0 || opt_interval < 0 || opt_timeout <= 0
+      || opt_speed <= 0)
+    {
+      g_printerr ("Counts, sizes, timeouts and speeds must be positive\n");
+      return EXIT_FAILURE;
+    }
+
+  if (opt_replay != NULL)
+    {
+      bench_events = bench_replay_load (opt_replay, &error);
+      if (bench_events == NULL)
+        {
+          g_printerr ("Failed to load the trace: %s\n", error->message);
+          g_error_free (error);
+          return EXIT_FAILURE;
+        }
+      else if (bench_events->len == 0)
+        {
+          g_printerr ("The trace %s is empty\n", opt_replay);
+          g_ptr_array_free (bench_events, TRUE);
+          return EXIT_FAILURE;
+        }
+    }
+
+  tmp_dir = g_dir_make_tmp ("tumbler-bench-XXXXXX", &error);
+  if (tmp_dir == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return EXIT_FAILURE;
+    }
+
+  /* a replayed trace refers to existing files */
+  if (bench_events != NULL)
+    {
+      corpus = g_ptr_array_new ();
+    }
+  else
+    {
+      corpus_dir = g_build_filename (tmp_dir, "corpus", NULL);
+      g_mkdir (corpus_dir, 0700);
+      corpus = bench_generate_corpus (corpus_dir, &error);
+      g_free (corpus_dir);
+    }
+
+  if (corpus == NULL)
+    {
+      g_printerr ("Failed to generate the corpus: %s\n", error->message);
+      g_error_free (error);
+      bench_corpus_remove_recursive (tmp_dir);
+      g_free (tmp_dir);
+      return EXIT_FAILURE;
+    }
+  g_ptr_array_set_free_func (corpus, bench_file_free);
+
+  bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+  g_test_dbus_up (bus);
+
+  json = g_string_new (NULL);
+  if (bench_events != NULL)
+    {
+      g_string_append_printf (json, "{\n  \"version\": \"%s\",\n  \"pattern\": \"replay\",\n"
+                                    "  \"events\": %u,\n  ",
+                              PACKAGE_VERSION, bench_events->len);
+      bench_json_double (json, "speed", opt_speed);
+      g_string_append (json, ",\n");
+    }
+  else
+    g_string_append_printf (json, "{\n  \"version\": \"%s\",\n  \"pattern\": \"%s\",\n"
+                                  "  \"flavor\": \"%s\",\n  \"files\": %u,\n",
+                            PACKAGE_VERSION, opt_pattern != NULL ? opt_pattern : "burst",
+                            opt_flavor, corpus->len);
+  if (bench_events == NULL && bench_pattern != BENCH_PATTERN_BURST)
+    g_string_append_printf (json, "  \"batch_size\": %d,\n  \"interval_ms\": %d,\n",
+                            opt_batch_size, opt_interval);
+  g_string_append (json, "  \"runs\": [\n");
+
+  schedulers = g_strsplit (opt_schedulers, ",", -1);
+  for (i = 0; schedulers[i] != NULL; i++)
+    {
+      g_strstrip (schedulers[i]);
+      if (*schedulers[i] == '\0')
+        continue;
+
+      if (!bench_run (bus, tmp_dir, schedulers[i], corpus, json, &error))
+        {
+          g_printerr ("Run with scheduler \"%s\" failed: %s\n", schedulers[i], error->message);
+          g_clear_error (&error);
+          retval = EXIT_FAILURE;
+        }
+    }
+  g_strfreev (schedulers);
+
+  g_string_append (json, "  ]\n}\n");
+  g_print ("%s", json->str);
+  g_string_free (json, TRUE);
+
+  g_test_dbus_down (bus);
+  g_object_unref (bus);
+
+  g_ptr_array_free (corpus, TRUE);
+  if (bench_events != NULL)
+    g_ptr_array_free (bench_events, TRUE);
+  if (bench_font_data != NULL)
+    g_bytes_unref (bench_font_data);
+
+  if (opt_keep)
+    g_printerr ("Keeping %s\n", tmp_dir);
+  else
+    bench_corpus_remove_recursive (tmp_dir);
+  g_free (tmp_dir);
+
+  return retval;
+}
@@ -42,6 +42,7 @@ typedef struct
   GSList *locations;
   GSList *excludes;
   gint64 max_file_size;
+  gint max_concurrency;
 } TumblerThumbnailerSettings;
 
 
@@ -103,7 +104,9 @@ desktop_thumbnailer_get_from_desktop_file (GFile *file,
   gchar **mime_types, **paths;
   const gchar *filename;
   gchar *exec = NULL;
+  gchar *batch_exec;
   gint64 max_file_size;
+  gint max_concurrency;
   gint priority;
 
   g_return_val_if_fail (G_IS_FILE (file), NULL);
@@ -148,6 +151,13 @@ desktop_thumbnailer_get_from_desktop_file (GFile *file,
       g_clear_error (&error);
     }
 
+  max_concurrency = g_key_file_get_integer (rc, "X-Tumbler Settings", "MaxConcurrency", &error);
+  if (error != NULL)
+    {
+      max_concurrency = settings->max_concurrency;
+      g_clear_error (&error);
+    }
+
   paths = g_key_file_get_string_list (rc, "X-Tumbler Settings", "Locations", NULL, &error);
   if (error != NULL)
     {
@@ -172,10 +182,17 @@ desktop_thumbnailer_get_from_desktop_file (GFile *file,
       g_strfreev (paths);
     }
 
+  /* optional persistent worker, used instead of Exec when available */
+  batch_exec = g_key_file_get_string (rc, "X-Tumbler Settings", "BatchExec", NULL);
+  if (batch_exec != NULL && *batch_exec == '\0')
+    g_clear_pointer (&batch_exec, g_free);
+
   thumbnailer = g_object_new (DESKTOP_TYPE_THUMBNAILER, "uri-schemes", uri_schemes,
                               "mime-types", mime_types, "priority", priority,
-                              "max-file-size", max_file_size, "locations", locations,
-                              "excludes", excludes, "exec", exec, NULL);
+                              "max-file-size", max_file_size,
+                              "max-concurrency", MAX (max_concurrency, 0), "locations", locations,
+                              "excludes", excludes, "exec", exec,
+                              "batch-exec", batch_exec, NULL);
 
   g_debug ("Registered thumbnailer '%s'", filename);
   tumbler_util_dump_strv (G_LOG_DOMAIN, "Supported mime types",
@@ -184,6 +201,7 @@ desktop_thumbnailer_get_from_desktop_file (GFile *file,
   g_key_file_free (rc);
   g_strfreev (mime_types);
   g_free (exec);
+  g_free (batch_exec);
   g_slist_free_full (locations, g_object_unref);
   g_slist_free_full (excludes, g_object_unref);
 
@@ -264,6 +282,7 @@ desktop_thumbnailer_provider_get_thumbnailers (TumblerThumbnailerProvider *provi
 
   settings->priority = g_key_file_get_integer (rc, type, "Priority", NULL);
   settings->max_file_size = g_key_file_get_int64 (rc, type, "MaxFileSize", NULL);
+  settings->max_concurrency = g_key_file_get_integer (rc, type, "MaxConcurrency", NULL);
 
   paths = g_key_file_get_string_list (rc, type, "Locations", NULL, NULL);
   settings->locations = tumbler_util_locations_from_strv (paths);
@@ -25,6 +25,16 @@
 #include <glib-object.h>
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
+#include <string.h>
+
+
+
+/* upper bound for the size of an encoded image sent back by a batch worker */
+#define WORKER_MAX_IMAGE_SIZE (64 * 1024 * 1024)
+
+
+
+typedef struct _DesktopThumbnailerWorker DesktopThumbnailerWorker;
 
 
 
@@ -47,6 +57,8 @@ desktop_thumbnailer_set_property (GObject *object,
 
 static void
 desktop_thumbnailer_finalize (GObject *object);
+static void
+desktop_thumbnailer_worker_free (DesktopThumbnailerWorker *worker);
 
 
 
@@ -55,6 +67,20 @@ struct _DesktopThumbnailer
   TumblerAbstractThumbnailer __parent__;
 
   gchar *exec;
+  gchar *batch_exec;
+
+  /* persistent helper processes started from batch_exec, see
+   * desktop_thumbnailer_worker_run() for the protocol */
+  GMutex workers_lock;
+  GQueue idle_workers;
+  gboolean batch_disabled;
+};
+
+struct _DesktopThumbnailerWorker
+{
+  GSubprocess *process;
+  GOutputStream *input;
+  GDataInputStream *output;
 };
 
 
@@ -67,7 +93,8 @@ G_DEFINE_DYNAMIC_TYPE (DesktopThumbnailer,
 enum
 {
   PROP_0,
-  PROP_EXEC
+  PROP_EXEC,
+  PROP_BATCH_EXEC,
 };
 
 
@@ -94,6 +121,10 @@ desktop_thumbnailer_get_property (GObject *object,
       g_value_set_string (value, thumbnailer->exec);
       break;
 
+    case PROP_BATCH_EXEC:
+      g_value_set_string (value, thumbnailer->batch_exec);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -116,6 +147,10 @@ desktop_thumbnailer_set_property (GObject *object,
       thumbnailer->exec = g_strdup (g_value_get_string (value));
       break;
 
+    case PROP_BATCH_EXEC:
+      thumbnailer->batch_exec = g_strdup (g_value_get_string (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -143,6 +178,14 @@ desktop_thumbnailer_class_init (DesktopThumbnailerClass *klass)
                                                         NULL,
                                                         G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class,
+                                   PROP_BATCH_EXEC,
+                                   g_param_spec_string ("batch-exec",
+                                                        NULL,
+                                                        NULL,
+                                                        NULL,
+                                                        G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE));
+
   gobject_class->finalize = desktop_thumbnailer_finalize;
   abstractthumbnailer_class = TUMBLER_ABSTRACT_THUMBNAILER_CLASS (klass);
   abstractthumbnailer_class->create = desktop_thumbnailer_create;
@@ -160,8 +203,16 @@ static void
 desktop_thumbnailer_finalize (GObject *object)
 {
   DesktopThumbnailer *thumbnailer = DESKTOP_THUMBNAILER (object);
+  DesktopThumbnailerWorker *worker;
+
+  /* terminate all idle helper processes */
+  while ((worker = g_queue_pop_head (&thumbnailer->idle_workers)) != NULL)
+    desktop_thumbnailer_worker_free (worker);
+
+  g_mutex_clear (&thumbnailer->workers_lock);
 
   g_free (thumbnailer->exec);
+  g_free (thumbnailer->batch_exec);
 
   G_OBJECT_CLASS (desktop_thumbnailer_parent_class)->finalize (object);
 }
@@ -169,6 +220,9 @@ desktop_thumbnailer_finalize (GObject *object)
 static void
 desktop_thumbnailer_init (DesktopThumbnailer *thumbnailer)
 {
+  g_mutex_init (&thumbnailer->workers_lock);
+  g_queue_init (&thumbnailer->idle_workers);
+  thumbnailer->batch_disabled = FALSE;
 }
 
 
@@ -243,6 +297,273 @@ desktop_thumbnailer_exec_parse (const gchar *exec,
 
 
 
+static DesktopThumbnailerWorker *
+desktop_thumbnailer_worker_new (DesktopThumbnailer *thumbnailer,
+                                GError **error)
+{
+  DesktopThumbnailerWorker *worker;
+  GSubprocessFlags flags;
+  GSubprocess *process;
+  gchar **argv;
+
+  if (!g_shell_parse_argv (thumbnailer->batch_exec, NULL, &argv, error))
+    return NULL;
+
+  flags = G_SUBPROCESS_FLAGS_STDIN_PIPE | G_SUBPROCESS_FLAGS_STDOUT_PIPE;
+  if (!tumbler_util_is_debug_logging_enabled (G_LOG_DOMAIN))
+    flags |= G_SUBPROCESS_FLAGS_STDERR_SILENCE;
+
+  process = g_subprocess_newv ((const gchar *const *) argv, flags, error);
+  g_strfreev (argv);
+
+  if (process == NULL)
+    return NULL;
+
+  g_debug ("'BatchExec=%s': Started worker process %s",
+           thumbnailer->batch_exec, g_subprocess_get_identifier (process));
+
+  worker = g_slice_new0 (DesktopThumbnailerWorker);
+  worker->process = process;
+  worker->input = g_object_ref (g_subprocess_get_stdin_pipe (process));
+  worker->output = g_data_input_stream_new (g_subprocess_get_stdout_pipe (process));
+  g_data_input_stream_set_newline_type (worker->output, G_DATA_STREAM_NEWLINE_TYPE_LF);
+
+  return worker;
+}
+
+
+
+static void
+desktop_thumbnailer_worker_free (DesktopThumbnailerWorker *worker)
+{
+  if (worker == NULL)
+    return;
+
+  /* closing stdin asks a well-behaved worker to exit, make sure it does */
+  g_output_stream_close (worker->input, NULL, NULL);
+  g_subprocess_force_exit (worker->process);
+
+  g_object_unref (worker->input);
+  g_object_unref (worker->output);
+  g_object_unref (worker->process);
+
+  g_slice_free (DesktopThumbnailerWorker, worker);
+}
+
+
+
+static DesktopThumbnailerWorker *
+desktop_thumbnailer_worker_acquire (DesktopThumbnailer *thumbnailer)
+{
+  DesktopThumbnailerWorker *worker;
+  GError *error = NULL;
+
+  g_mutex_lock (&thumbnailer->workers_lock);
+
+  if (thumbnailer->batch_disabled)
+    {
+      g_mutex_unlock (&thumbnailer->workers_lock);
+      return NULL;
+    }
+
+  /* reuse an idle worker if possible */
+  worker = g_queue_pop_head (&thumbnailer->idle_workers);
+
+  g_mutex_unlock (&thumbnailer->workers_lock);
+
+  if (worker != NULL)
+    return worker;
+
+  /* otherwise start a new one, there are at most as many workers as there are
+   * scheduler threads running this thumbnailer concurrently */
+  worker = desktop_thumbnailer_worker_new (thumbnailer, &error);
+  if (worker == NULL)
+    {
+      g_warning ("Failed to start worker \"%s\", falling back to \"%s\": %s",
+                 thumbnailer->batch_exec, thumbnailer->exec, error->message);
+      g_error_free (error);
+
+      /* don't try again for every file */
+      g_mutex_lock (&thumbnailer->workers_lock);
+      thumbnailer->batch_disabled = TRUE;
+      g_mutex_unlock (&thumbnailer->workers_lock);
+    }
+
+  return worker;
+}
+
+
+
+static void
+desktop_thumbnailer_worker_release (DesktopThumbnailer *thumbnailer,
+                                    DesktopThumbnailerWorker *worker)
+{
+  g_mutex_lock (&thumbnailer->workers_lock);
+  g_queue_push_head (&thumbnailer->idle_workers, worker);
+  g_mutex_unlock (&thumbnailer->workers_lock);
+}
+
+
+
+/*
+ * Batch protocol: for each file, tumbler writes one line to the worker's stdin
+ *   <size>\t<uri>\t<path>\n
+ * where <path> is empty for non-local files. The worker answers on stdout with either
+ *   OK <length>\n<length bytes of image data in any format GdkPixbuf can load>
+ * or
+ *   ERROR <message>\n
+ * and then waits for the next line. It should exit when its stdin is closed.
+ *
+ * Returns %FALSE if the worker is no longer usable, in which case @error is not set and
+ * the file should be handled through the per-file Exec command instead.
+ */
+static gboolean
+desktop_thumbnailer_worker_run (DesktopThumbnailerWorker *worker,
+                                const gchar *uri,
+                                const gchar *path,
+                                gint size,
+                                GCancellable *cancellable,
+                                GdkPixbuf **pixbuf,
+                                GError **error)
+{
+  GdkPixbufLoader *loader;
+  GError *err = NULL;
+  gchar *request, *reply, *end;
+  guchar *data;
+  guint64 length;
+  gsize n_read;
+  gboolean ok = FALSE;
+
+  request = g_strdup_printf ("%d\t%s\t%s\n", size, uri, path != NULL ? path : "");
+  if (!g_output_stream_write_all (worker->input, request, strlen (request), NULL,
+                                  cancellable, &err)
+      || !g_output_stream_flush (worker->input, cancellable, &err))
+    {
+      g_free (request);
+      g_debug ("Failed to write to worker: %s", err->message);
+      g_error_free (err);
+      return FALSE;
+    }
+
+  g_free (request);
+
+  reply = g_data_input_stream_read_line_utf8 (worker->output, NULL, cancellable, &err);
+  if (reply == NULL)
+    {
+      g_debug ("Failed to read from worker: %s", err != NULL ? err->message : "EOF");
+      g_clear_error (&err);
+      return FALSE;
+    }
+
+  if (g_str_has_prefix (reply, "ERROR "))
+    {
+      g_set_error (error, TUMBLER_ERROR, TUMBLER_ERROR_NO_CONTENT, "%s", reply + 6);
+      g_free (reply);
+      return TRUE;
+    }
+
+  if (!g_str_has_prefix (reply, "OK "))
+    {
+      g_debug ("Malformed worker reply \"%s\"", reply);
+      g_free (reply);
+      return FALSE;
+    }
+
+  length = g_ascii_strtoull (reply + 3, &end, 10);
+  if (*end != '\0' || length == 0 || length > WORKER_MAX_IMAGE_SIZE)
+    {
+      g_debug ("Malformed worker reply \"%s\"", reply);
+      g_free (reply);
+      return FALSE;
+    }
+
+  g_free (reply);
+
+  data = g_malloc (length);
+  if (g_input_stream_read_all (G_INPUT_STREAM (worker->output), data, length, &n_read,
+                               cancellable, &err)
+      && n_read == length)
+    {
+      /* the worker is still in a consistent state, whatever the image data is */
+      ok = TRUE;
+
+      loader = gdk_pixbuf_loader_new ();
+      if (gdk_pixbuf_loader_write (loader, data, length, error)
+          && gdk_pixbuf_loader_close (loader, error))
+        {
+          *pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+          if (*pixbuf != NULL)
+            g_object_ref (*pixbuf);
+          else
+            g_set_error (error, TUMBLER_ERROR, TUMBLER_ERROR_INVALID_FORMAT,
+                         TUMBLER_ERROR_MESSAGE_CREATION_FAILED);
+        }
+      else
+        gdk_pixbuf_loader_close (loader, NULL);
+
+      g_object_unref (loader);
+    }
+  else
+    {
+      g_debug ("Failed to read image data from worker: %s",
+               err != NULL ? err->message : "Unexpected EOF");
+      g_clear_error (&err);
+    }
+
+  g_free (data);
+
+  return ok;
+}
+
+
+
+static GdkPixbuf *
+desktop_thumbnailer_load_thumbnail_batch (DesktopThumbnailer *thumbnailer,
+                                          const gchar *uri,
+                                          const gchar *path,
+                                          gint width,
+                                          gint height,
+                                          GCancellable *cancellable,
+                                          gboolean *handled,
+                                          GError **error)
+{
+  DesktopThumbnailerWorker *worker;
+  GdkPixbuf *source = NULL, *pixbuf = NULL;
+
+  *handled = FALSE;
+
+  /* the protocol is line based */
+  if (path != NULL && strpbrk (path, "\t\n") != NULL)
+    return NULL;
+
+  worker = desktop_thumbnailer_worker_acquire (thumbnailer);
+  if (worker == NULL)
+    return NULL;
+
+  if (desktop_thumbnailer_worker_run (worker, uri, path, MIN (width, height),
+                                      cancellable, &source, error))
+    {
+      *handled = TRUE;
+      desktop_thumbnailer_worker_release (thumbnailer, worker);
+
+      if (source != NULL)
+        {
+          pixbuf = tumbler_util_scale_pixbuf (source, width, height);
+          g_object_unref (source);
+        }
+    }
+  else
+    {
+      /* the worker is in an unknown state (crashed, cancelled mid-request,
+       * protocol error), get rid of it and let the caller fall back */
+      desktop_thumbnailer_worker_free (worker);
+    }
+
+  return pixbuf;
+}
+
+
+
 static GdkPixbuf *
 desktop_thumbnailer_load_thumbnail (DesktopThumbnailer *thumbnailer,
                                     const gchar *uri,
@@ -357,6 +678,7 @@ desktop_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
   gint width;
   GError *error = NULL;
   GdkPixbuf *pixbuf = NULL;
+  gboolean handled = FALSE;
 
   g_return_if_fail (DESKTOP_IS_THUMBNAILER (thumbnailer));
   g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
@@ -379,9 +701,17 @@ desktop_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
 
   tumbler_thumbnail_flavor_get_size (flavor, &width, &height);
 
-  pixbuf = desktop_thumbnailer_load_thumbnail (DESKTOP_THUMBNAILER (thumbnailer),
-                                               uri, g_file_peek_path (file),
-                                               width, height, cancellable, &error);
+  /* prefer a persistent worker if the thumbnailer provides one */
+  if (DESKTOP_THUMBNAILER (thumbnailer)->batch_exec != NULL)
+    pixbuf = desktop_thumbnailer_load_thumbnail_batch (DESKTOP_THUMBNAILER (thumbnailer),
+                                                       uri, g_file_peek_path (file),
+                                                       width, height, cancellable,
+                                                       &handled, &error);
+
+  if (!handled && !g_cancellable_set_error_if_cancelled (cancellable, &error))
+    pixbuf = desktop_thumbnailer_load_thumbnail (DESKTOP_THUMBNAILER (thumbnailer),
+                                                 uri, g_file_peek_path (file),
+                                                 width, height, cancellable, &error);
 
   if (pixbuf != NULL)
     {
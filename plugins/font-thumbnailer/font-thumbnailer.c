@@ -29,12 +29,27 @@
 
 
 
+/* glyphs are rendered at least at the size of the large flavor, so that
+ * one rendering serves both the normal and the large flavor */
+#define SAMPLE_MIN_SIZE 256
+
+/* number of rendered samples kept around */
+#define SAMPLE_CACHE_SIZE 16
+
+
+
+typedef struct _FontSample FontSample;
+
+
+
 static void
 font_thumbnailer_finalize (GObject *object);
 static void
 font_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
                          GCancellable *cancellable,
                          TumblerFileInfo *info);
+static void
+font_thumbnailer_reclaim (TumblerAbstractThumbnailer *thumbnailer);
 
 
 
@@ -42,8 +57,21 @@ struct _FontThumbnailer
 {
   TumblerAbstractThumbnailer __parent__;
 
-  FT_Library library;
-  FT_Error library_error;
+  /* a FreeType library must not be used by several threads at once, so
+   * every create() call takes its own one from this pool */
+  GMutex lock;
+  GSList *libraries;
+
+  /* recently rendered samples, most recently used first */
+  GQueue samples;
+};
+
+struct _FontSample
+{
+  gchar *uri;
+  gdouble mtime;
+  gint size;
+  GdkPixbuf *pixbuf;
 };
 
 
@@ -73,6 +101,7 @@ font_thumbnailer_class_init (FontThumbnailerClass *klass)
 
   abstractthumbnailer_class = TUMBLER_ABSTRACT_THUMBNAILER_CLASS (klass);
   abstractthumbnailer_class->create = font_thumbnailer_create;
+  abstractthumbnailer_class->reclaim = font_thumbnailer_reclaim;
 }
 
 
@@ -87,24 +116,64 @@ font_thumbnailer_class_finalize (FontThumbnailerClass *klass)
 static void
 font_thumbnailer_init (FontThumbnailer *thumbnailer)
 {
-  /* initialize freetype and remember possible errors */
-  thumbnailer->library_error = FT_Init_FreeType (&thumbnailer->library);
+  g_mutex_init (&thumbnailer->lock);
+  g_queue_init (&thumbnailer->samples);
 }
 
 
+
+static void
+font_sample_free (gpointer data)
+{
+  FontSample *sample = data;
+
+  g_free (sample->uri);
+  g_object_unref (sample->pixbuf);
+  g_slice_free (FontSample, sample);
+}
+
+
+
 static void
 font_thumbnailer_finalize (GObject *object)
 {
   FontThumbnailer *thumbnailer = FONT_THUMBNAILER (object);
+  GSList *lp;
 
-  /* release the freetype library object */
-  FT_Done_FreeType (thumbnailer->library);
+  /* release the freetype library objects */
+  for (lp = thumbnailer->libraries; lp != NULL; lp = lp->next)
+    FT_Done_FreeType (lp->data);
+  g_slist_free (thumbnailer->libraries);
+
+  g_queue_clear_full (&thumbnailer->samples, font_sample_free);
+  g_mutex_clear (&thumbnailer->lock);
 
   (*G_OBJECT_CLASS (font_thumbnailer_parent_class)->finalize) (object);
 }
 
 
 
+static void
+font_thumbnailer_reclaim (TumblerAbstractThumbnailer *thumbnailer)
+{
+  FontThumbnailer *font_thumbnailer = FONT_THUMBNAILER (thumbnailer);
+  GSList *libraries;
+  GSList *lp;
+
+  g_mutex_lock (&font_thumbnailer->lock);
+  libraries = font_thumbnailer->libraries;
+  font_thumbnailer->libraries = NULL;
+  g_queue_clear_full (&font_thumbnailer->samples, font_sample_free);
+  g_mutex_unlock (&font_thumbnailer->lock);
+
+  /* the pool only holds idle libraries, along with their glyph caches */
+  for (lp = libraries; lp != NULL; lp = lp->next)
+    FT_Done_FreeType (lp->data);
+  g_slist_free (libraries);
+}
+
+
+
 static const gchar *
 ft_strerror (FT_Error error)
 {
@@ -202,12 +271,10 @@ render_glyph (GdkPixbuf *pixbuf,
 
 
 static GdkPixbuf *
-trim_and_scale_pixbuf (GdkPixbuf *pixbuf,
-                       gint dest_width,
-                       gint dest_height)
+trim_pixbuf (GdkPixbuf *pixbuf)
 {
   GdkPixbuf *subpixbuf;
-  GdkPixbuf *scaled;
+  GdkPixbuf *trimmed;
   gboolean seen_pixel;
   guchar *pixels;
   gint rowstride;
@@ -302,39 +369,29 @@ trim_and_scale_pixbuf (GdkPixbuf *pixbuf,
                                         trim_right - trim_left,
                                         trim_bottom - trim_top);
 
-  /* check if we still need to scale down */
-  if (gdk_pixbuf_get_width (subpixbuf) > dest_width
-      || gdk_pixbuf_get_height (subpixbuf) > dest_height)
-    {
-      scaled = tumbler_util_scale_pixbuf (subpixbuf, dest_width, dest_height);
-      g_object_unref (G_OBJECT (subpixbuf));
-      subpixbuf = scaled;
-    }
+  /* copy it, so the untrimmed pixels can be released */
+  trimmed = gdk_pixbuf_copy (subpixbuf);
+  g_object_unref (subpixbuf);
 
-  return subpixbuf;
+  return trimmed;
 }
 
 
 
 static GdkPixbuf *
-generate_pixbuf (FT_Face face,
-                 TumblerThumbnailFlavor *flavor,
-                 FT_Error *error)
+render_sample (FT_Face face,
+               gint size,
+               FT_Error *error)
 {
   GdkPixbuf *pixbuf = NULL;
   GdkPixbuf *result = NULL;
   FT_UInt glyph1;
   FT_UInt glyph2;
-  gint width;
-  gint height;
   gint pen_x;
   gint pen_y;
 
-  /* determine the desired size for this flavor */
-  tumbler_thumbnail_flavor_get_size (flavor, &width, &height);
-
   /* try to set the pixel size */
-  *error = FT_Set_Pixel_Sizes (face, 0, MIN (width, height));
+  *error = FT_Set_Pixel_Sizes (face, 0, size);
   if (G_UNLIKELY (*error != 0))
     return NULL;
 
@@ -347,25 +404,31 @@ generate_pixbuf (FT_Face face,
     glyph2 = MIN (97, face->num_glyphs - 1);
 
   /* allocate the pixbuf to render the glyphs to */
-  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width * 3, (height * 3) / 2);
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, size * 3, (size * 3) / 2);
   gdk_pixbuf_fill (pixbuf, 0xffffffff);
 
   /* initial pen position */
-  pen_x = width / 2;
-  pen_y = height;
+  pen_x = size / 2;
+  pen_y = size;
 
   /* render the first letter to the pixbuf */
   *error = render_glyph (pixbuf, face, glyph1, &pen_x, &pen_y);
   if (G_UNLIKELY (*error != 0))
-    return NULL;
+    {
+      g_object_unref (pixbuf);
+      return NULL;
+    }
 
   /* render the second letter to the pixbuf */
   *error = render_glyph (pixbuf, face, glyph2, &pen_x, &pen_y);
   if (G_UNLIKELY (*error != 0))
-    return NULL;
+    {
+      g_object_unref (pixbuf);
+      return NULL;
+    }
 
-  /* trim the pixbuf and rescale if necessary */
-  result = trim_and_scale_pixbuf (pixbuf, width, height);
+  /* trim the pixbuf, it is scaled to the flavor size later */
+  result = trim_pixbuf (pixbuf);
   g_object_unref (pixbuf);
 
   return result;
@@ -373,84 +436,166 @@ generate_pixbuf (FT_Face face,
 
 
 
+static FT_Error
+font_thumbnailer_take_library (FontThumbnailer *thumbnailer,
+                               FT_Library *library)
+{
+  g_mutex_lock (&thumbnailer->lock);
+
+  if (thumbnailer->libraries != NULL)
+    {
+      *library = thumbnailer->libraries->data;
+      thumbnailer->libraries = g_slist_delete_link (thumbnailer->libraries,
+                                                    thumbnailer->libraries);
+      g_mutex_unlock (&thumbnailer->lock);
+      return 0;
+    }
+
+  g_mutex_unlock (&thumbnailer->lock);
+
+  /* all libraries are in use, initialize a new one */
+  return FT_Init_FreeType (library);
+}
+
+
+
 static void
-font_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
-                         GCancellable *cancellable,
-                         TumblerFileInfo *info)
+font_thumbnailer_return_library (FontThumbnailer *thumbnailer,
+                                 FT_Library library)
 {
-  TumblerThumbnailFlavor *flavor;
-  TumblerImageData data;
-  TumblerThumbnail *thumbnail;
-  FontThumbnailer *font_thumbnailer = FONT_THUMBNAILER (thumbnailer);
-  const gchar *uri;
-  GdkPixbuf *pixbuf;
+  g_mutex_lock (&thumbnailer->lock);
+  thumbnailer->libraries = g_slist_prepend (thumbnailer->libraries, library);
+  g_mutex_unlock (&thumbnailer->lock);
+}
+
+
+
+static GdkPixbuf *
+font_thumbnailer_lookup_sample (FontThumbnailer *thumbnailer,
+                                const gchar *uri,
+                                gdouble mtime,
+                                gint size)
+{
+  FontSample *sample;
+  GdkPixbuf *pixbuf = NULL;
+  GList *lp;
+
+  g_mutex_lock (&thumbnailer->lock);
+
+  for (lp = thumbnailer->samples.head; lp != NULL; lp = lp->next)
+    {
+      sample = lp->data;
+      if (sample->mtime == mtime && sample->size >= size && g_str_equal (sample->uri, uri))
+        {
+          /* move the sample to the front */
+          g_queue_unlink (&thumbnailer->samples, lp);
+          g_queue_push_head_link (&thumbnailer->samples, lp);
+
+          pixbuf = g_object_ref (sample->pixbuf);
+          break;
+        }
+    }
+
+  g_mutex_unlock (&thumbnailer->lock);
+
+  return pixbuf;
+}
+
+
+
+static void
+font_thumbnailer_insert_sample (FontThumbnailer *thumbnailer,
+                                const gchar *uri,
+                                gdouble mtime,
+                                gint size,
+                                GdkPixbuf *pixbuf)
+{
+  FontSample *sample;
+  GList *lp;
+
+  g_mutex_lock (&thumbnailer->lock);
+
+  /* drop older samples of the same file */
+  for (lp = thumbnailer->samples.head; lp != NULL; lp = lp->next)
+    {
+      sample = lp->data;
+      if (g_str_equal (sample->uri, uri))
+        {
+          g_queue_delete_link (&thumbnailer->samples, lp);
+          font_sample_free (sample);
+          break;
+        }
+    }
+
+  sample = g_slice_new (FontSample);
+  sample->uri = g_strdup (uri);
+  sample->mtime = mtime;
+  sample->size = size;
+  sample->pixbuf = g_object_ref (pixbuf);
+  g_queue_push_head (&thumbnailer->samples, sample);
+
+  if (thumbnailer->samples.length > SAMPLE_CACHE_SIZE)
+    font_sample_free (g_queue_pop_tail (&thumbnailer->samples));
+
+  g_mutex_unlock (&thumbnailer->lock);
+}
+
+
+
+static GdkPixbuf *
+font_thumbnailer_load_sample (FontThumbnailer *thumbnailer,
+                              TumblerFileInfo *info,
+                              gint size,
+                              GCancellable *cancellable,
+                              GError **error)
+{
+  FT_Library library;
+  GdkPixbuf *pixbuf = NULL;
   FT_Error ft_error;
   FT_Face face;
-  GError *error = NULL;
+  GError *load_error = NULL;
   GFile *file;
-  gchar *error_msg;
   gchar *font_data;
   gsize length;
   gint n;
 
-  g_return_if_fail (FONT_IS_THUMBNAILER (thumbnailer));
-  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
-  g_return_if_fail (TUMBLER_IS_FILE_INFO (info));
-
-  /* do nothing if cancelled */
-  if (g_cancellable_is_cancelled (cancellable))
-    return;
-
-  uri = tumbler_file_info_get_uri (info);
-  g_debug ("Handling URI '%s'", uri);
-
-  /* check if we have a valid freetype library object */
-  if (font_thumbnailer->library_error != 0)
+  /* get a freetype library object for this thread */
+  ft_error = font_thumbnailer_take_library (thumbnailer, &library);
+  if (ft_error != 0)
     {
-      /* there was an error in the freetype initialization, abort */
-      error_msg = g_strdup_printf (_("Could not initialize freetype: %s"),
-                                   ft_strerror (font_thumbnailer->library_error));
-      g_signal_emit_by_name (thumbnailer, "error", info,
-                             TUMBLER_ERROR, TUMBLER_ERROR_UNSUPPORTED, error_msg);
-      g_free (error_msg);
-      return;
+      g_set_error (error, TUMBLER_ERROR, TUMBLER_ERROR_UNSUPPORTED,
+                   _("Could not initialize freetype: %s"), ft_strerror (ft_error));
+      return NULL;
     }
 
   /* try to read the file into memory */
   file = g_file_new_for_uri (tumbler_file_info_get_uri (info));
-  if (!g_file_load_contents (file, cancellable, &font_data, &length, NULL, &error))
+  if (!g_file_load_contents (file, cancellable, &font_data, &length, NULL, &load_error))
     {
-      /* there was an error, emit error signal */
-      error_msg = g_strdup_printf (_("Could not load file contents: %s"),
-                                   error->message);
-      g_signal_emit_by_name (thumbnailer, "error", info,
-                             error->domain, error->code, error_msg);
-      g_free (error_msg);
+      g_set_error (error, load_error->domain, load_error->code,
+                   _("Could not load file contents: %s"), load_error->message);
 
       /* clean up */
-      g_error_free (error);
+      g_error_free (load_error);
       g_object_unref (file);
+      font_thumbnailer_return_library (thumbnailer, library);
 
-      return;
+      return NULL;
     }
   g_object_unref (file);
 
   /* try to open the font file */
-  ft_error = FT_New_Memory_Face (font_thumbnailer->library, (const FT_Byte *) font_data,
-                                 length, 0, &face);
+  ft_error = FT_New_Memory_Face (library, (const FT_Byte *) font_data, length, 0, &face);
   if (G_UNLIKELY (ft_error != 0))
     {
-      /* the font file could not be loaded, emit an error signal */
-      error_msg = g_strdup_printf (_("Could not open font file: %s"),
-                                   ft_strerror (ft_error));
-      g_signal_emit_by_name (thumbnailer, "error", info,
-                             TUMBLER_ERROR, TUMBLER_ERROR_NO_CONTENT, error_msg);
-      g_free (error_msg);
+      g_set_error (error, TUMBLER_ERROR, TUMBLER_ERROR_NO_CONTENT,
+                   _("Could not open font file: %s"), ft_strerror (ft_error));
 
       /* clean up */
       g_free (font_data);
+      font_thumbnailer_return_library (thumbnailer, library);
 
-      return;
+      return NULL;
     }
 
   /* try to set the character map */
@@ -465,50 +610,101 @@ font_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
           ft_error = FT_Set_Charmap (face, face->charmaps[n]);
           if (G_UNLIKELY (ft_error != 0))
             {
-              /* emit an error signal */
-              error_msg = g_strdup_printf (_("Could not set the character map: %s"),
-                                           ft_strerror (ft_error));
-              g_signal_emit_by_name (thumbnailer, "error", info,
-                                     TUMBLER_ERROR, TUMBLER_ERROR_INVALID_FORMAT, error_msg);
-              g_free (error_msg);
-
-              /* clean up */
-              g_free (font_data);
-              FT_Done_Face (face);
-
-              return;
+              g_set_error (error, TUMBLER_ERROR, TUMBLER_ERROR_INVALID_FORMAT,
+                           _("Could not set the character map: %s"), ft_strerror (ft_error));
+              break;
             }
         }
     }
 
+  /* render the glyphs */
+  if (ft_error == 0)
+    {
+      pixbuf = render_sample (face, size, &ft_error);
+      if (G_UNLIKELY (ft_error != 0))
+        g_set_error (error, TUMBLER_ERROR, TUMBLER_ERROR_INVALID_FORMAT,
+                     _("Could not render glyphs: %s"), ft_strerror (ft_error));
+    }
+
+  /* release the font face */
+  FT_Done_Face (face);
+  g_free (font_data);
+  font_thumbnailer_return_library (thumbnailer, library);
+
+  return pixbuf;
+}
+
+
+
+static void
+font_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
+                         GCancellable *cancellable,
+                         TumblerFileInfo *info)
+{
+  TumblerThumbnailFlavor *flavor;
+  TumblerImageData data;
+  TumblerThumbnail *thumbnail;
+  FontThumbnailer *font_thumbnailer = FONT_THUMBNAILER (thumbnailer);
+  const gchar *uri;
+  GdkPixbuf *sample;
+  GdkPixbuf *pixbuf;
+  GError *error = NULL;
+  gdouble mtime;
+  gint width;
+  gint height;
+  gint size;
+
+  g_return_if_fail (FONT_IS_THUMBNAILER (thumbnailer));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+  g_return_if_fail (TUMBLER_IS_FILE_INFO (info));
+
+  /* do nothing if cancelled */
+  if (g_cancellable_is_cancelled (cancellable))
+    return;
+
+  uri = tumbler_file_info_get_uri (info);
+  g_debug ("Handling URI '%s'", uri);
+
   thumbnail = tumbler_file_info_get_thumbnail (info);
 
   g_assert (thumbnail != NULL);
 
-  /* generate a thumbnail for the flavor */
+  /* determine the desired size for this flavor */
   flavor = tumbler_thumbnail_get_flavor (thumbnail);
-  pixbuf = generate_pixbuf (face, flavor, &ft_error);
+  tumbler_thumbnail_flavor_get_size (flavor, &width, &height);
   g_object_unref (flavor);
+  size = MIN (width, height);
 
-  /* abort if there was an error */
-  if (G_UNLIKELY (ft_error != 0))
+  /* reuse a sample rendered for another flavor if possible */
+  mtime = tumbler_file_info_get_mtime (info);
+  sample = font_thumbnailer_lookup_sample (font_thumbnailer, uri, mtime, size);
+  if (sample == NULL)
     {
-      /* emit an error signal */
-      error_msg = g_strdup_printf (_("Could not render glyphs: %s"),
-                                   ft_strerror (ft_error));
-      g_signal_emit_by_name (thumbnailer, "error", info,
-                             TUMBLER_ERROR, TUMBLER_ERROR_INVALID_FORMAT, error_msg);
-      g_free (error_msg);
+      sample = font_thumbnailer_load_sample (font_thumbnailer, info, MAX (size, SAMPLE_MIN_SIZE),
+                                             cancellable, &error);
+      if (sample == NULL)
+        {
+          /* emit an error signal */
+          g_signal_emit_by_name (thumbnailer, "error", info,
+                                 error->domain, error->code, error->message);
 
-      /* clean up */
-      g_free (font_data);
-      FT_Done_Face (face);
+          /* clean up */
+          g_error_free (error);
+          g_object_unref (thumbnail);
+
+          return;
+        }
 
-      return;
+      font_thumbnailer_insert_sample (font_thumbnailer, uri, mtime,
+                                      MAX (size, SAMPLE_MIN_SIZE), sample);
     }
 
-  /* release the font face */
-  FT_Done_Face (face);
+  /* scale the sample down to the flavor size if necessary */
+  if (gdk_pixbuf_get_width (sample) > width || gdk_pixbuf_get_height (sample) > height)
+    pixbuf = tumbler_util_scale_pixbuf (sample, width, height);
+  else
+    pixbuf = g_object_ref (sample);
+  g_object_unref (sample);
 
   /* compose the image data */
   data.data = gdk_pixbuf_get_pixels (pixbuf);
@@ -541,5 +737,4 @@ font_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
   /* clean up */
   g_object_unref (pixbuf);
   g_object_unref (thumbnail);
-  g_free (font_data);
 }
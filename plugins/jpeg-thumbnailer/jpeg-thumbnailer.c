@@ -60,6 +60,9 @@
 #include <unistd.h>
 #endif
 
+/* an APP1 segment with the EXIF data and its thumbnail is at most 64 KiB */
+#define EXIF_HEADER_SIZE (64 * 1024)
+
 
 
 static void
@@ -148,7 +151,7 @@ static void
 tvtj_free (guchar *pixels,
            gpointer data)
 {
-  g_free (pixels);
+  tumbler_util_pixels_free (pixels);
 }
 
 
@@ -308,14 +311,14 @@ tvtj_jpeg_load (const JOCTET *content,
   /* allocate the pixel buffer and extra space for grayscale data */
   if (G_LIKELY (cinfo.num_components != 1))
     {
-      pixels = g_malloc (cinfo.output_width * cinfo.output_height * cinfo.num_components);
+      pixels = tumbler_util_pixels_alloc (cinfo.output_width * cinfo.output_height * cinfo.num_components);
       buffer = NULL;
       out_num_components = cinfo.num_components;
       lines[0] = pixels;
     }
   else
     {
-      pixels = g_malloc (cinfo.output_width * cinfo.output_height * 3);
+      pixels = tumbler_util_pixels_alloc (cinfo.output_width * cinfo.output_height * 3);
       buffer = g_malloc (cinfo.output_width);
       out_num_components = 3;
       lines[0] = buffer;
@@ -362,7 +365,7 @@ tvtj_jpeg_load (const JOCTET *content,
 error:
   jpeg_destroy_decompress (&cinfo);
   g_free (buffer);
-  g_free (pixels);
+  tumbler_util_pixels_free (pixels);
   return NULL;
 }
 
@@ -813,6 +816,9 @@ jpeg_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
           /* determine the status of the file */
           if (G_LIKELY (fstat (fd, &statb) == 0 && statb.st_size > 0))
             {
+              /* the embedded thumbnail, if any, is within the first APP1 segment */
+              tumbler_util_advise_read (fd, 0, MIN (statb.st_size, EXIF_HEADER_SIZE));
+
               /* try to mmap the file */
               content = (JOCTET *) mmap (NULL, statb.st_size, PROT_READ,
                                          MAP_SHARED, fd, 0);
@@ -828,6 +834,7 @@ jpeg_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
                   if (pixbuf == NULL)
                     {
                       /* fall back to loading and scaling the image itself */
+                      tumbler_util_advise_read (fd, 0, statb.st_size);
                       pixbuf = tvtj_jpeg_load (content, statb.st_size, size);
 
                       if (G_UNLIKELY (pixbuf == NULL))
@@ -853,6 +860,9 @@ jpeg_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
 
               /* unmap the file content */
               munmap ((void *) content, statb.st_size);
+
+              /* the file is not needed anymore in background jobs */
+              tumbler_util_advise_done (fd, 0, statb.st_size);
             }
 
           /* close the file */
@@ -0,0 +1,590 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "pack-cache-cache.h"
+#include "pack-cache-thumbnail.h"
+
+#include <glib/gstdio.h>
+#include <math.h>
+#include <string.h>
+
+
+
+/* defaults for the [PackCache] section of tumbler.rc */
+#define EXPORT_DEFAULT TRUE
+
+
+
+static void
+pack_cache_cache_iface_init (TumblerCacheIface *iface);
+static void
+pack_cache_cache_finalize (GObject *object);
+static TumblerThumbnail *
+pack_cache_cache_get_thumbnail (TumblerCache *cache,
+                                const gchar *uri,
+                                TumblerThumbnailFlavor *flavor);
+static void
+pack_cache_cache_cleanup (TumblerCache *cache,
+                          const gchar *const *base_uris,
+                          gdouble since);
+static void
+pack_cache_cache_delete (TumblerCache *cache,
+                         const gchar *const *uris);
+static void
+pack_cache_cache_copy (TumblerCache *cache,
+                       const gchar *const *from_uris,
+                       const gchar *const *to_uris);
+static void
+pack_cache_cache_move (TumblerCache *cache,
+                       const gchar *const *from_uris,
+                       const gchar *const *to_uris);
+static gboolean
+pack_cache_cache_is_thumbnail (TumblerCache *cache,
+                               const gchar *uri);
+static GList *
+pack_cache_cache_get_flavors (TumblerCache *cache);
+
+
+
+typedef struct
+{
+  const gchar *const *base_uris;
+  gdouble since;
+} CleanupMatch;
+
+struct _PackCacheCache
+{
+  GObject __parent__;
+
+  GList *flavors;
+  GList *dirs;
+  GList *shared_suffixes;
+
+  /* one store per flavor, by flavor name */
+  GHashTable *stores;
+
+  gboolean export;
+};
+
+
+
+G_DEFINE_DYNAMIC_TYPE_EXTENDED (PackCacheCache,
+                                pack_cache_cache,
+                                G_TYPE_OBJECT,
+                                0,
+                                G_IMPLEMENT_INTERFACE_DYNAMIC (TUMBLER_TYPE_CACHE,
+                                                               pack_cache_cache_iface_init));
+
+
+
+void
+pack_cache_cache_register (TumblerCachePlugin *plugin)
+{
+  pack_cache_cache_register_type (G_TYPE_MODULE (plugin));
+}
+
+
+
+static void
+pack_cache_cache_class_init (PackCacheCacheClass *klass)
+{
+  GObjectClass *gobject_class;
+
+  gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = pack_cache_cache_finalize;
+}
+
+
+
+static void
+pack_cache_cache_class_finalize (PackCacheCacheClass *klass)
+{
+}
+
+
+
+static void
+pack_cache_cache_iface_init (TumblerCacheIface *iface)
+{
+  iface->get_thumbnail = pack_cache_cache_get_thumbnail;
+  iface->cleanup = pack_cache_cache_cleanup;
+  iface->do_delete = pack_cache_cache_delete;
+  iface->copy = pack_cache_cache_copy;
+  iface->move = pack_cache_cache_move;
+  iface->is_thumbnail = pack_cache_cache_is_thumbnail;
+  iface->get_flavors = pack_cache_cache_get_flavors;
+}
+
+
+
+static void
+pack_cache_cache_init (PackCacheCache *cache)
+{
+  const gchar *cachedir = g_get_user_cache_dir ();
+  const gchar *name;
+  GKeyFile *rc;
+  GError *error = NULL;
+  gchar *path;
+
+  cache->flavors = g_list_prepend (cache->flavors, tumbler_thumbnail_flavor_new_normal ());
+  cache->flavors = g_list_prepend (cache->flavors, tumbler_thumbnail_flavor_new_large ());
+  cache->flavors = g_list_prepend (cache->flavors, tumbler_thumbnail_flavor_new_x_large ());
+  cache->flavors = g_list_prepend (cache->flavors, tumbler_thumbnail_flavor_new_xx_large ());
+
+  cache->stores = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify) pack_cache_store_free);
+
+  /* the packs themselves must not be thumbnailed either */
+  path = g_build_filename (cachedir, "tumbler", "packs", NULL);
+  cache->dirs = g_list_prepend (cache->dirs, g_file_new_for_path (path));
+  g_free (path);
+
+  for (GList *lp = cache->flavors; lp != NULL; lp = lp->next)
+    {
+      name = tumbler_thumbnail_flavor_get_name (lp->data);
+
+      path = g_build_filename (cachedir, "tumbler", "packs", name, NULL);
+      g_hash_table_insert (cache->stores, g_strdup (name), pack_cache_store_new (path));
+      g_free (path);
+
+      path = g_build_filename (cachedir, "thumbnails", name, NULL);
+      cache->dirs = g_list_prepend (cache->dirs, g_file_new_for_path (path));
+      g_free (path);
+
+      cache->shared_suffixes = g_list_prepend (cache->shared_suffixes,
+                                               g_strconcat (G_DIR_SEPARATOR_S, ".sh_thumbnails",
+                                                            G_DIR_SEPARATOR_S, name, NULL));
+    }
+
+  rc = tumbler_util_get_settings ();
+  cache->export = g_key_file_get_boolean (rc, "PackCache", "ExportPNG", &error);
+  if (error != NULL)
+    {
+      cache->export = EXPORT_DEFAULT;
+      g_error_free (error);
+    }
+  g_key_file_free (rc);
+}
+
+
+
+static void
+pack_cache_cache_finalize (GObject *object)
+{
+  PackCacheCache *cache = PACK_CACHE_CACHE (object);
+
+  g_hash_table_destroy (cache->stores);
+
+  g_list_free_full (cache->flavors, g_object_unref);
+  g_list_free_full (cache->dirs, g_object_unref);
+  g_list_free_full (cache->shared_suffixes, g_free);
+
+  G_OBJECT_CLASS (pack_cache_cache_parent_class)->finalize (object);
+}
+
+
+
+static TumblerThumbnail *
+pack_cache_cache_get_thumbnail (TumblerCache *cache,
+                                const gchar *uri,
+                                TumblerThumbnailFlavor *flavor)
+{
+  g_return_val_if_fail (PACK_CACHE_IS_CACHE (cache), NULL);
+  g_return_val_if_fail (uri != NULL && *uri != '\0', NULL);
+  g_return_val_if_fail (TUMBLER_IS_THUMBNAIL_FLAVOR (flavor), NULL);
+
+  if (pack_cache_cache_get_store (PACK_CACHE_CACHE (cache), flavor) == NULL)
+    return NULL;
+
+  return g_object_new (PACK_CACHE_TYPE_THUMBNAIL, "cache", cache,
+                       "uri", uri, "flavor", flavor, NULL);
+}
+
+
+
+static gboolean
+pack_cache_cache_uri_is_in (const gchar *uri,
+                            const gchar *base_uri)
+{
+  gsize length = strlen (base_uri);
+
+  if (strncmp (uri, base_uri, length) != 0)
+    return FALSE;
+
+  return uri[length] == '\0' || uri[length] == '/'
+         || (length > 0 && base_uri[length - 1] == '/');
+}
+
+
+
+static gboolean
+pack_cache_cache_cleanup_match (const gchar *uri,
+                                gdouble mtime,
+                                gpointer user_data)
+{
+  CleanupMatch *match = user_data;
+  guint n;
+
+  /* as in the XDG cache, a threshold of 0 only removes the base URIs themselves */
+  if (match->since == 0)
+    {
+      for (n = 0; match->base_uris != NULL && match->base_uris[n] != NULL; n++)
+        if (strcmp (uri, match->base_uris[n]) == 0)
+          return TRUE;
+
+      return FALSE;
+    }
+
+  if (mtime <= match->since)
+    return TRUE;
+
+  for (n = 0; match->base_uris != NULL && match->base_uris[n] != NULL; n++)
+    if (pack_cache_cache_uri_is_in (uri, match->base_uris[n]))
+      return TRUE;
+
+  return FALSE;
+}
+
+
+
+static gboolean
+pack_cache_cache_prefix_match (const gchar *uri,
+                               gdouble mtime,
+                               gpointer user_data)
+{
+  return pack_cache_cache_uri_is_in (uri, user_data);
+}
+
+
+
+static void
+pack_cache_cache_remove (PackCacheCache *cache,
+                         PackCacheStore *store,
+                         TumblerThumbnailFlavor *flavor,
+                         const gchar *uri)
+{
+  gchar *filename;
+
+  pack_cache_store_remove (store, uri);
+
+  if (cache->export)
+    {
+      filename = pack_cache_cache_get_export_filename (uri, flavor);
+      g_unlink (filename);
+      g_free (filename);
+    }
+}
+
+
+
+static void
+pack_cache_cache_cleanup (TumblerCache *cache,
+                          const gchar *const *base_uris,
+                          gdouble since)
+{
+  PackCacheCache *pack_cache = PACK_CACHE_CACHE (cache);
+  PackCacheStore *store;
+  CleanupMatch match = { base_uris, since };
+  GList *uris;
+
+  g_return_if_fail (PACK_CACHE_IS_CACHE (cache));
+
+  for (GList *lp = pack_cache->flavors; lp != NULL; lp = lp->next)
+    {
+      store = pack_cache_cache_get_store (pack_cache, lp->data);
+      uris = pack_cache_store_find (store, pack_cache_cache_cleanup_match, &match);
+
+      for (GList *iter = uris; iter != NULL; iter = iter->next)
+        pack_cache_cache_remove (pack_cache, store, lp->data, iter->data);
+
+      g_list_free_full (uris, g_free);
+    }
+}
+
+
+
+static void
+pack_cache_cache_delete (TumblerCache *cache,
+                         const gchar *const *uris)
+{
+  PackCacheCache *pack_cache = PACK_CACHE_CACHE (cache);
+  PackCacheStore *store;
+  guint n;
+
+  g_return_if_fail (PACK_CACHE_IS_CACHE (cache));
+  g_return_if_fail (uris != NULL);
+
+  for (GList *lp = pack_cache->flavors; lp != NULL; lp = lp->next)
+    {
+      store = pack_cache_cache_get_store (pack_cache, lp->data);
+      for (n = 0; uris[n] != NULL; n++)
+        if (pack_cache_store_lookup (store, uris[n], NULL))
+          pack_cache_cache_remove (pack_cache, store, lp->data, uris[n]);
+    }
+}
+
+
+
+/* the PNG of a thumbnail names its source, so it is re-encoded for the new URI */
+static void
+pack_cache_cache_copy_or_move_thumbnail (PackCacheCache *cache,
+                                         PackCacheStore *store,
+                                         TumblerThumbnailFlavor *flavor,
+                                         gboolean do_copy,
+                                         const gchar *from_uri,
+                                         const gchar *to_uri)
+{
+  GdkPixbufLoader *loader;
+  GdkPixbuf *pixbuf = NULL;
+  GError *error = NULL;
+  GBytes *bytes;
+  gdouble mtime;
+  gchar *buffer;
+  gchar *filename;
+  gsize length;
+
+  bytes = pack_cache_store_get (store, from_uri, &mtime, NULL);
+  if (bytes == NULL)
+    return;
+
+  loader = gdk_pixbuf_loader_new_with_type ("png", NULL);
+  if (loader != NULL)
+    {
+      if (gdk_pixbuf_loader_write_bytes (loader, bytes, NULL)
+          && gdk_pixbuf_loader_close (loader, NULL))
+        pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+      else
+        gdk_pixbuf_loader_close (loader, NULL);
+    }
+
+  if (pixbuf != NULL
+      && pack_cache_cache_encode (pixbuf, to_uri, mtime, &buffer, &length, &error))
+    {
+      if (pack_cache_store_put (store, to_uri, mtime, (const guchar *) buffer, length, &error)
+          && cache->export)
+        {
+          filename = pack_cache_cache_get_export_filename (to_uri, flavor);
+          pack_cache_store_export (store, to_uri, filename, NULL);
+          g_free (filename);
+        }
+
+      g_free (buffer);
+    }
+
+  if (error != NULL)
+    {
+      g_warning ("Failed to copy the thumbnail of \"%s\": %s", from_uri, error->message);
+      g_error_free (error);
+    }
+
+  /* as in the XDG cache, the old thumbnail is dropped even if the move failed */
+  if (!do_copy)
+    pack_cache_cache_remove (cache, store, flavor, from_uri);
+
+  if (loader != NULL)
+    g_object_unref (loader);
+  g_bytes_unref (bytes);
+}
+
+
+
+static void
+pack_cache_cache_copy_or_move (TumblerCache *cache,
+                               gboolean do_copy,
+                               const gchar *const *from_uris,
+                               const gchar *const *to_uris)
+{
+  PackCacheCache *pack_cache = PACK_CACHE_CACHE (cache);
+  PackCacheStore *store;
+  GList *uris;
+  gchar *to_uri;
+  guint n;
+
+  g_return_if_fail (PACK_CACHE_IS_CACHE (cache));
+  g_return_if_fail (from_uris != NULL);
+  g_return_if_fail (to_uris != NULL);
+
+  for (GList *lp = pack_cache->flavors; lp != NULL; lp = lp->next)
+    {
+      store = pack_cache_cache_get_store (pack_cache, lp->data);
+
+      for (n = 0; from_uris[n] != NULL && to_uris[n] != NULL; n++)
+        {
+          /* the URI itself, or everything below it for a directory */
+          uris = pack_cache_store_find (store, pack_cache_cache_prefix_match,
+                                        (gpointer) from_uris[n]);
+
+          for (GList *iter = uris; iter != NULL; iter = iter->next)
+            {
+              to_uri = g_strconcat (to_uris[n], (gchar *) iter->data + strlen (from_uris[n]), NULL);
+              pack_cache_cache_copy_or_move_thumbnail (pack_cache, store, lp->data, do_copy,
+                                                       iter->data, to_uri);
+              g_free (to_uri);
+            }
+
+          g_list_free_full (uris, g_free);
+        }
+    }
+}
+
+
+
+static void
+pack_cache_cache_copy (TumblerCache *cache,
+                       const gchar *const *from_uris,
+                       const gchar *const *to_uris)
+{
+  pack_cache_cache_copy_or_move (cache, TRUE, from_uris, to_uris);
+}
+
+
+
+static void
+pack_cache_cache_move (TumblerCache *cache,
+                       const gchar *const *from_uris,
+                       const gchar *const *to_uris)
+{
+  pack_cache_cache_copy_or_move (cache, FALSE, from_uris, to_uris);
+}
+
+
+
+static gboolean
+pack_cache_cache_is_thumbnail (TumblerCache *cache,
+                               const gchar *uri)
+{
+  PackCacheCache *pack_cache = PACK_CACHE_CACHE (cache);
+  gboolean is_thumbnail = FALSE;
+  GFile *file;
+  gchar *uri_dir;
+
+  g_return_val_if_fail (PACK_CACHE_IS_CACHE (cache), FALSE);
+  g_return_val_if_fail (uri != NULL, FALSE);
+
+  file = g_file_new_for_uri (uri);
+  for (GList *lp = pack_cache->dirs; lp != NULL && !is_thumbnail; lp = lp->next)
+    is_thumbnail = g_file_has_prefix (file, lp->data);
+  g_object_unref (file);
+
+  if (is_thumbnail)
+    return TRUE;
+
+  /* check if it is a thumbnail in a shared repository */
+  uri_dir = g_path_get_dirname (uri);
+  for (GList *lp = pack_cache->shared_suffixes; lp != NULL && !is_thumbnail; lp = lp->next)
+    is_thumbnail = g_str_has_suffix (uri_dir, lp->data);
+  g_free (uri_dir);
+
+  return is_thumbnail;
+}
+
+
+
+static GList *
+pack_cache_cache_get_flavors (TumblerCache *cache)
+{
+  PackCacheCache *pack_cache = PACK_CACHE_CACHE (cache);
+  GList *flavors = NULL;
+
+  g_return_val_if_fail (PACK_CACHE_IS_CACHE (cache), NULL);
+
+  for (GList *iter = g_list_last (pack_cache->flavors); iter != NULL; iter = iter->prev)
+    flavors = g_list_prepend (flavors, g_object_ref (iter->data));
+
+  return flavors;
+}
+
+
+
+PackCacheStore *
+pack_cache_cache_get_store (PackCacheCache *cache,
+                            TumblerThumbnailFlavor *flavor)
+{
+  g_return_val_if_fail (PACK_CACHE_IS_CACHE (cache), NULL);
+  g_return_val_if_fail (TUMBLER_IS_THUMBNAIL_FLAVOR (flavor), NULL);
+
+  return g_hash_table_lookup (cache->stores, tumbler_thumbnail_flavor_get_name (flavor));
+}
+
+
+
+gboolean
+pack_cache_cache_get_export (PackCacheCache *cache)
+{
+  g_return_val_if_fail (PACK_CACHE_IS_CACHE (cache), FALSE);
+
+  return cache->export;
+}
+
+
+
+gchar *
+pack_cache_cache_get_export_filename (const gchar *uri,
+                                      TumblerThumbnailFlavor *flavor)
+{
+  gchar *filename;
+  gchar *md5_hash;
+  gchar *path;
+
+  g_return_val_if_fail (uri != NULL && *uri != '\0', NULL);
+  g_return_val_if_fail (TUMBLER_IS_THUMBNAIL_FLAVOR (flavor), NULL);
+
+  md5_hash = g_compute_checksum_for_string (G_CHECKSUM_MD5, uri, -1);
+  filename = g_strdup_printf ("%s.png", md5_hash);
+  path = g_build_filename (g_get_user_cache_dir (), "thumbnails",
+                           tumbler_thumbnail_flavor_get_name (flavor), filename, NULL);
+
+  g_free (filename);
+  g_free (md5_hash);
+
+  return path;
+}
+
+
+
+gboolean
+pack_cache_cache_encode (GdkPixbuf *pixbuf,
+                         const gchar *uri,
+                         gdouble mtime,
+                         gchar **buffer,
+                         gsize *length,
+                         GError **error)
+{
+  gchar *mtime_str;
+  guint64 mtime_int = (guint64) mtime;
+  gboolean success;
+
+  g_return_val_if_fail (GDK_IS_PIXBUF (pixbuf), FALSE);
+  g_return_val_if_fail (uri != NULL, FALSE);
+  g_return_val_if_fail (buffer != NULL && length != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  mtime_str = g_strdup_printf ("%" G_GUINT64_FORMAT ".%.6" G_GUINT32_FORMAT,
+                               mtime_int, (guint32) round (1.e6 * (mtime - mtime_int)));
+
+  success = gdk_pixbuf_save_to_buffer (pixbuf, buffer, length, "png", error,
+                                       "tEXt::Thumb::URI", uri,
+                                       "tEXt::Thumb::MTime", mtime_str,
+                                       NULL);
+
+  g_free (mtime_str);
+
+  return success;
+}
@@ -0,0 +1,57 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __PACK_CACHE_CACHE_H__
+#define __PACK_CACHE_CACHE_H__
+
+#include "pack-cache-store.h"
+
+#include "tumbler/tumbler.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS;
+
+#define PACK_CACHE_TYPE_CACHE (pack_cache_cache_get_type ())
+G_DECLARE_FINAL_TYPE (PackCacheCache, pack_cache_cache, PACK_CACHE, CACHE, GObject)
+
+void
+pack_cache_cache_register (TumblerCachePlugin *plugin);
+
+PackCacheStore *
+pack_cache_cache_get_store (PackCacheCache *cache,
+                            TumblerThumbnailFlavor *flavor);
+gboolean
+pack_cache_cache_get_export (PackCacheCache *cache);
+gchar *
+pack_cache_cache_get_export_filename (const gchar *uri,
+                                      TumblerThumbnailFlavor *flavor) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+gboolean
+pack_cache_cache_encode (GdkPixbuf *pixbuf,
+                         const gchar *uri,
+                         gdouble mtime,
+                         gchar **buffer,
+                         gsize *length,
+                         GError **error);
+
+G_END_DECLS;
+
+#endif /* !__PACK_CACHE_CACHE_H__ */
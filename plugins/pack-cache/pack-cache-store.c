@@ -0,0 +1,894 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "pack-cache-store.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+/* thumbnails are appended to pack files of up to this size, the last one
+ * being the active pack new records are written to */
+#define PACK_MAX_SIZE (64 * 1024 * 1024)
+#define PACK_SUFFIX ".pack"
+
+#define PACK_FILE_MAGIC "TUMBPACK"
+#define PACK_FILE_VERSION 1
+#define PACK_FILE_HEADER_SIZE (sizeof (PackFileHeader))
+
+#define PACK_RECORD_MAGIC 0x544d4252 /* "TMBR" */
+#define PACK_RECORD_HEADER_SIZE (sizeof (PackRecordHeader))
+
+/* a sealed pack is rewritten once more than half of it is dead records */
+#define PACK_NEEDS_COMPACTION(store, pack) \
+  ((pack) != (store)->active && (pack)->dead * 2 > (pack)->size)
+
+
+
+typedef struct _Pack Pack;
+typedef struct _PackEntry PackEntry;
+typedef struct _PackFileHeader PackFileHeader;
+typedef struct _PackRecordHeader PackRecordHeader;
+
+struct _PackFileHeader
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 reserved;
+};
+
+/* followed by the URI and the PNG data, a record without data removes
+ * earlier records of the URI */
+struct _PackRecordHeader
+{
+  guint32 magic;
+  guint32 uri_length;
+  guint32 data_length;
+  guint32 reserved;
+  gdouble mtime;
+};
+
+struct _Pack
+{
+  guint number;
+  gchar *filename;
+  GMappedFile *mapping;
+  goffset size;
+  goffset dead;
+};
+
+struct _PackEntry
+{
+  Pack *pack;
+  goffset offset;
+  guint32 uri_length;
+  guint32 data_length;
+  gdouble mtime;
+};
+
+struct _PackCacheStore
+{
+  GMutex lock;
+  gchar *dirname;
+
+  /* all packs ordered by number, and where each URI lives */
+  GPtrArray *packs;
+  GHashTable *entries;
+
+  Pack *active;
+  gint fd;
+
+  GThread *compactor;
+  gboolean compacting;
+  gboolean shutting_down;
+};
+
+
+
+static gpointer
+pack_cache_store_compact_thread (gpointer data);
+
+
+
+static gsize
+pack_entry_get_record_size (PackEntry *entry)
+{
+  return PACK_RECORD_HEADER_SIZE + entry->uri_length + entry->data_length;
+}
+
+
+
+static void
+pack_free (gpointer data)
+{
+  Pack *pack = data;
+
+  if (pack->mapping != NULL)
+    g_mapped_file_unref (pack->mapping);
+
+  g_free (pack->filename);
+  g_slice_free (Pack, pack);
+}
+
+
+
+static void
+pack_entry_free (gpointer data)
+{
+  g_slice_free (PackEntry, data);
+}
+
+
+
+static Pack *
+pack_new (PackCacheStore *store,
+          guint number)
+{
+  Pack *pack;
+  gchar *basename;
+
+  pack = g_slice_new0 (Pack);
+  pack->number = number;
+
+  basename = g_strdup_printf ("%08u" PACK_SUFFIX, number);
+  pack->filename = g_build_filename (store->dirname, basename, NULL);
+  g_free (basename);
+
+  return pack;
+}
+
+
+
+/* makes sure the mapping of the pack covers all records written so far */
+static gboolean
+pack_map (Pack *pack,
+          GError **error)
+{
+  if (pack->mapping != NULL && (goffset) g_mapped_file_get_length (pack->mapping) >= pack->size)
+    return TRUE;
+
+  /* readers still holding bytes of the old mapping keep it alive */
+  if (pack->mapping != NULL)
+    g_mapped_file_unref (pack->mapping);
+
+  pack->mapping = g_mapped_file_new (pack->filename, FALSE, error);
+
+  return pack->mapping != NULL;
+}
+
+
+
+static gint
+pack_compare_numbers (gconstpointer a,
+                      gconstpointer b)
+{
+  const Pack *pack_a = *(const Pack **) a;
+  const Pack *pack_b = *(const Pack **) b;
+
+  return (pack_a->number > pack_b->number) - (pack_a->number < pack_b->number);
+}
+
+
+
+static void
+pack_cache_store_apply (PackCacheStore *store,
+                        Pack *pack,
+                        goffset offset,
+                        const PackRecordHeader *header,
+                        const gchar *uri)
+{
+  PackEntry *entry;
+
+  entry = g_hash_table_lookup (store->entries, uri);
+  if (entry != NULL)
+    entry->pack->dead += pack_entry_get_record_size (entry);
+
+  if (header->data_length == 0)
+    {
+      /* the removal record itself is only needed until older packs are gone */
+      pack->dead += PACK_RECORD_HEADER_SIZE + header->uri_length;
+      if (entry != NULL)
+        g_hash_table_remove (store->entries, uri);
+
+      return;
+    }
+
+  if (entry == NULL)
+    {
+      entry = g_slice_new (PackEntry);
+      g_hash_table_insert (store->entries, g_strdup (uri), entry);
+    }
+
+  entry->pack = pack;
+  entry->offset = offset;
+  entry->uri_length = header->uri_length;
+  entry->data_length = header->data_length;
+  entry->mtime = header->mtime;
+}
+
+
+
+/* rebuilds the index from the records of a pack, a record torn by a crash
+ * and everything after it is cut off */
+static void
+pack_cache_store_scan (PackCacheStore *store,
+                       Pack *pack)
+{
+  PackRecordHeader header;
+  const gchar *contents;
+  GError *error = NULL;
+  goffset length;
+  goffset offset;
+  gchar *uri;
+
+  if (!pack_map (pack, &error))
+    {
+      g_warning ("Failed to read thumbnail pack \"%s\": %s", pack->filename, error->message);
+      g_error_free (error);
+      return;
+    }
+
+  contents = g_mapped_file_get_contents (pack->mapping);
+  length = g_mapped_file_get_length (pack->mapping);
+
+  if (length < (goffset) PACK_FILE_HEADER_SIZE
+      || memcmp (contents, PACK_FILE_MAGIC, 8) != 0
+      || ((const PackFileHeader *) contents)->version != PACK_FILE_VERSION)
+    {
+      g_warning ("Ignoring invalid thumbnail pack \"%s\"", pack->filename);
+      pack->size = 0;
+      return;
+    }
+
+  for (offset = PACK_FILE_HEADER_SIZE; offset + (goffset) PACK_RECORD_HEADER_SIZE <= length;)
+    {
+      memcpy (&header, contents + offset, PACK_RECORD_HEADER_SIZE);
+      if (header.magic != PACK_RECORD_MAGIC
+          || header.uri_length == 0
+          || offset + (goffset) PACK_RECORD_HEADER_SIZE + header.uri_length + header.data_length > length)
+        break;
+
+      uri = g_strndup (contents + offset + PACK_RECORD_HEADER_SIZE, header.uri_length);
+      pack_cache_store_apply (store, pack, offset, &header, uri);
+      g_free (uri);
+
+      offset += PACK_RECORD_HEADER_SIZE + header.uri_length + header.data_length;
+    }
+
+  if (offset < length)
+    {
+      g_warning ("Truncating thumbnail pack \"%s\" at offset %" G_GOFFSET_FORMAT,
+                 pack->filename, offset);
+      if (truncate (pack->filename, offset) != 0)
+        g_warning ("Failed to truncate \"%s\": %s", pack->filename, g_strerror (errno));
+    }
+
+  pack->size = offset;
+}
+
+
+
+PackCacheStore *
+pack_cache_store_new (const gchar *dirname)
+{
+  PackCacheStore *store;
+  const gchar *name;
+  Pack *pack;
+  guint64 number;
+  gchar *end;
+  GDir *dir;
+  guint n;
+
+  g_return_val_if_fail (dirname != NULL, NULL);
+
+  store = g_slice_new0 (PackCacheStore);
+  g_mutex_init (&store->lock);
+  store->dirname = g_strdup (dirname);
+  store->packs = g_ptr_array_new_with_free_func (pack_free);
+  store->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, pack_entry_free);
+  store->fd = -1;
+
+  g_mkdir_with_parents (dirname, S_IRWXU);
+
+  dir = g_dir_open (dirname, 0, NULL);
+  if (dir != NULL)
+    {
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          if (!g_str_has_suffix (name, PACK_SUFFIX))
+            continue;
+
+          number = g_ascii_strtoull (name, &end, 10);
+          if (end == name || strcmp (end, PACK_SUFFIX) != 0 || number > G_MAXUINT)
+            continue;
+
+          g_ptr_array_add (store->packs, pack_new (store, number));
+        }
+
+      g_dir_close (dir);
+    }
+
+  /* later records win, so the packs are read oldest first */
+  g_ptr_array_sort (store->packs, pack_compare_numbers);
+  for (n = 0; n < store->packs->len; n++)
+    pack_cache_store_scan (store, g_ptr_array_index (store->packs, n));
+
+  /* keep appending to the last pack if there is room left */
+  if (store->packs->len > 0)
+    {
+      pack = g_ptr_array_index (store->packs, store->packs->len - 1);
+      if (pack->size >= (goffset) PACK_FILE_HEADER_SIZE && pack->size < PACK_MAX_SIZE)
+        store->active = pack;
+    }
+
+  g_debug ("Loaded %u thumbnails from %u packs in \"%s\"",
+           g_hash_table_size (store->entries), store->packs->len, dirname);
+
+  return store;
+}
+
+
+
+void
+pack_cache_store_free (PackCacheStore *store)
+{
+  if (store == NULL)
+    return;
+
+  g_mutex_lock (&store->lock);
+  store->shutting_down = TRUE;
+  g_mutex_unlock (&store->lock);
+
+  if (store->compactor != NULL)
+    g_thread_join (store->compactor);
+
+  if (store->fd >= 0)
+    close (store->fd);
+
+  g_hash_table_destroy (store->entries);
+  g_ptr_array_free (store->packs, TRUE);
+  g_free (store->dirname);
+  g_mutex_clear (&store->lock);
+
+  g_slice_free (PackCacheStore, store);
+}
+
+
+
+static gboolean
+pack_cache_store_write_all (gint fd,
+                            const guchar *data,
+                            gsize length,
+                            GError **error)
+{
+  gssize n_written;
+
+  while (length > 0)
+    {
+      n_written = write (fd, data, length);
+      if (n_written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                               g_strerror (errno));
+          return FALSE;
+        }
+
+      data += n_written;
+      length -= n_written;
+    }
+
+  return TRUE;
+}
+
+
+
+/* opens the active pack for appending, starting a new one if the current
+ * one is full; called with the store lock held */
+static gboolean
+pack_cache_store_open_active (PackCacheStore *store,
+                              GError **error)
+{
+  PackFileHeader header;
+  Pack *pack;
+  guint number;
+
+  if (store->active != NULL && store->active->size >= PACK_MAX_SIZE)
+    {
+      if (store->fd >= 0)
+        {
+          close (store->fd);
+          store->fd = -1;
+        }
+
+      store->active = NULL;
+    }
+
+  if (store->active != NULL && store->fd >= 0)
+    return TRUE;
+
+  if (store->active == NULL)
+    {
+      number = 0;
+      if (store->packs->len > 0)
+        number = ((Pack *) g_ptr_array_index (store->packs, store->packs->len - 1))->number + 1;
+
+      pack = pack_new (store, number);
+      store->fd = g_open (pack->filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                          S_IRUSR | S_IWUSR);
+      if (store->fd < 0)
+        {
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Failed to create \"%s\": %s", pack->filename, g_strerror (errno));
+          pack_free (pack);
+          return FALSE;
+        }
+
+      memset (&header, 0, sizeof (header));
+      memcpy (header.magic, PACK_FILE_MAGIC, 8);
+      header.version = PACK_FILE_VERSION;
+
+      if (!pack_cache_store_write_all (store->fd, (const guchar *) &header, sizeof (header), error))
+        {
+          close (store->fd);
+          store->fd = -1;
+          g_unlink (pack->filename);
+          pack_free (pack);
+          return FALSE;
+        }
+
+      pack->size = sizeof (header);
+      g_ptr_array_add (store->packs, pack);
+      store->active = pack;
+    }
+  else
+    {
+      store->fd = g_open (store->active->filename, O_WRONLY | O_APPEND | O_CLOEXEC, 0);
+      if (store->fd < 0)
+        {
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Failed to open \"%s\": %s", store->active->filename, g_strerror (errno));
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+
+
+/* appends a record to the active pack and returns its offset, or -1;
+ * called with the store lock held */
+static goffset
+pack_cache_store_append (PackCacheStore *store,
+                         const gchar *uri,
+                         gdouble mtime,
+                         const guchar *data,
+                         guint32 data_length,
+                         GError **error)
+{
+  PackRecordHeader header;
+  guchar *record;
+  gsize length;
+  goffset offset;
+
+  if (!pack_cache_store_open_active (store, error))
+    return -1;
+
+  memset (&header, 0, sizeof (header));
+  header.magic = PACK_RECORD_MAGIC;
+  header.uri_length = strlen (uri);
+  header.data_length = data_length;
+  header.mtime = mtime;
+
+  /* a single write, so that a crash leaves at most one torn record */
+  length = PACK_RECORD_HEADER_SIZE + header.uri_length + data_length;
+  record = g_malloc (length);
+  memcpy (record, &header, PACK_RECORD_HEADER_SIZE);
+  memcpy (record + PACK_RECORD_HEADER_SIZE, uri, header.uri_length);
+  if (data_length > 0)
+    memcpy (record + PACK_RECORD_HEADER_SIZE + header.uri_length, data, data_length);
+
+  offset = store->active->size;
+  if (!pack_cache_store_write_all (store->fd, record, length, error))
+    {
+      /* drop whatever made it into the file */
+      if (ftruncate (store->fd, offset) != 0)
+        {
+          close (store->fd);
+          store->fd = -1;
+          store->active = NULL;
+        }
+
+      g_free (record);
+      return -1;
+    }
+
+  g_free (record);
+  store->active->size += length;
+
+  return offset;
+}
+
+
+
+/* called with the store lock held */
+static void
+pack_cache_store_maybe_compact (PackCacheStore *store,
+                                Pack *pack)
+{
+  if (!PACK_NEEDS_COMPACTION (store, pack) || store->compacting || store->shutting_down)
+    return;
+
+  /* the previous compactor is done, it only clears the flag on its way out */
+  if (store->compactor != NULL)
+    g_thread_join (store->compactor);
+
+  store->compacting = TRUE;
+  store->compactor = g_thread_new ("pack-compactor", pack_cache_store_compact_thread, store);
+}
+
+
+
+gboolean
+pack_cache_store_lookup (PackCacheStore *store,
+                         const gchar *uri,
+                         gdouble *mtime)
+{
+  PackEntry *entry;
+
+  g_return_val_if_fail (store != NULL, FALSE);
+  g_return_val_if_fail (uri != NULL, FALSE);
+
+  g_mutex_lock (&store->lock);
+
+  entry = g_hash_table_lookup (store->entries, uri);
+  if (entry != NULL && mtime != NULL)
+    *mtime = entry->mtime;
+
+  g_mutex_unlock (&store->lock);
+
+  return entry != NULL;
+}
+
+
+
+/* the returned bytes point into the mapped pack, no copy is made */
+GBytes *
+pack_cache_store_get (PackCacheStore *store,
+                      const gchar *uri,
+                      gdouble *mtime,
+                      GError **error)
+{
+  PackEntry *entry;
+  GBytes *mapped;
+  GBytes *bytes = NULL;
+
+  g_return_val_if_fail (store != NULL, NULL);
+  g_return_val_if_fail (uri != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  g_mutex_lock (&store->lock);
+
+  entry = g_hash_table_lookup (store->entries, uri);
+  if (entry == NULL)
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                 "No thumbnail for \"%s\" in the pack cache", uri);
+  else if (pack_map (entry->pack, error))
+    {
+      mapped = g_mapped_file_get_bytes (entry->pack->mapping);
+      bytes = g_bytes_new_from_bytes (mapped,
+                                      entry->offset + PACK_RECORD_HEADER_SIZE + entry->uri_length,
+                                      entry->data_length);
+      g_bytes_unref (mapped);
+
+      if (mtime != NULL)
+        *mtime = entry->mtime;
+    }
+
+  g_mutex_unlock (&store->lock);
+
+  return bytes;
+}
+
+
+
+gboolean
+pack_cache_store_put (PackCacheStore *store,
+                      const gchar *uri,
+                      gdouble mtime,
+                      const guchar *data,
+                      gsize length,
+                      GError **error)
+{
+  PackRecordHeader header;
+  Pack *old_pack = NULL;
+  PackEntry *entry;
+  goffset offset;
+
+  g_return_val_if_fail (store != NULL, FALSE);
+  g_return_val_if_fail (uri != NULL && *uri != '\0', FALSE);
+  g_return_val_if_fail (data != NULL && length > 0 && length <= G_MAXUINT32, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  g_mutex_lock (&store->lock);
+
+  offset = pack_cache_store_append (store, uri, mtime, data, length, error);
+  if (offset >= 0)
+    {
+      entry = g_hash_table_lookup (store->entries, uri);
+      if (entry != NULL)
+        old_pack = entry->pack;
+
+      header.uri_length = strlen (uri);
+      header.data_length = length;
+      header.mtime = mtime;
+      pack_cache_store_apply (store, store->active, offset, &header, uri);
+
+      if (old_pack != NULL)
+        pack_cache_store_maybe_compact (store, old_pack);
+    }
+
+  g_mutex_unlock (&store->lock);
+
+  return offset >= 0;
+}
+
+
+
+void
+pack_cache_store_remove (PackCacheStore *store,
+                         const gchar *uri)
+{
+  PackRecordHeader header;
+  PackEntry *entry;
+  GError *error = NULL;
+  Pack *pack;
+  goffset offset;
+
+  g_return_if_fail (store != NULL);
+  g_return_if_fail (uri != NULL && *uri != '\0');
+
+  g_mutex_lock (&store->lock);
+
+  entry = g_hash_table_lookup (store->entries, uri);
+  if (entry != NULL)
+    {
+      pack = entry->pack;
+      offset = pack_cache_store_append (store, uri, 0, NULL, 0, &error);
+      if (offset >= 0)
+        {
+          header.uri_length = strlen (uri);
+          header.data_length = 0;
+          header.mtime = 0;
+          pack_cache_store_apply (store, store->active, offset, &header, uri);
+          pack_cache_store_maybe_compact (store, pack);
+        }
+      else
+        {
+          g_warning ("Failed to remove \"%s\" from the pack cache: %s", uri, error->message);
+          g_error_free (error);
+        }
+    }
+
+  g_mutex_unlock (&store->lock);
+}
+
+
+
+GList *
+pack_cache_store_find (PackCacheStore *store,
+                       PackCacheStoreFunc func,
+                       gpointer user_data)
+{
+  GHashTableIter iter;
+  PackEntry *entry;
+  GList *uris = NULL;
+  gchar *uri;
+
+  g_return_val_if_fail (store != NULL, NULL);
+  g_return_val_if_fail (func != NULL, NULL);
+
+  g_mutex_lock (&store->lock);
+
+  g_hash_table_iter_init (&iter, store->entries);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &uri, (gpointer *) &entry))
+    if (func (uri, entry->mtime, user_data))
+      uris = g_list_prepend (uris, g_strdup (uri));
+
+  g_mutex_unlock (&store->lock);
+
+  return uris;
+}
+
+
+
+/* writes the thumbnail as a spec compliant PNG file, for clients that look
+ * for thumbnails in the XDG cache directory */
+gboolean
+pack_cache_store_export (PackCacheStore *store,
+                         const gchar *uri,
+                         const gchar *filename,
+                         GError **error)
+{
+  GBytes *bytes;
+  gboolean success;
+  gchar *dirname;
+
+  g_return_val_if_fail (store != NULL, FALSE);
+  g_return_val_if_fail (uri != NULL, FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  bytes = pack_cache_store_get (store, uri, NULL, error);
+  if (bytes == NULL)
+    return FALSE;
+
+  dirname = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dirname, S_IRWXU);
+  g_free (dirname);
+
+  /* the PNG already carries the Thumb::URI and Thumb::MTime keys */
+  success = g_file_set_contents_full (filename, g_bytes_get_data (bytes, NULL),
+                                      g_bytes_get_size (bytes),
+                                      G_FILE_SET_CONTENTS_CONSISTENT, S_IRUSR | S_IWUSR,
+                                      error);
+  g_bytes_unref (bytes);
+
+  return success;
+}
+
+
+
+/* moves the live records of a sealed pack to the active one and deletes it;
+ * the store lock is only held for one record at a time */
+static void
+pack_cache_store_compact_pack (PackCacheStore *store,
+                               Pack *pack)
+{
+  PackRecordHeader header;
+  const gchar *contents;
+  PackEntry *entry;
+  GError *error = NULL;
+  goffset offset;
+  goffset new_offset;
+  gchar *uri;
+
+  g_mutex_lock (&store->lock);
+  if (!pack_map (pack, &error))
+    {
+      g_warning ("Failed to compact \"%s\": %s", pack->filename, error->message);
+      g_error_free (error);
+
+      /* do not try again in this session */
+      pack->dead = 0;
+      g_mutex_unlock (&store->lock);
+      return;
+    }
+  contents = g_mapped_file_get_contents (pack->mapping);
+  g_mutex_unlock (&store->lock);
+
+  for (offset = PACK_FILE_HEADER_SIZE; offset < pack->size;)
+    {
+      memcpy (&header, contents + offset, PACK_RECORD_HEADER_SIZE);
+      uri = g_strndup (contents + offset + PACK_RECORD_HEADER_SIZE, header.uri_length);
+
+      g_mutex_lock (&store->lock);
+
+      if (store->shutting_down)
+        {
+          /* the records copied so far are duplicates, the pack stays valid */
+          g_mutex_unlock (&store->lock);
+          g_free (uri);
+          return;
+        }
+
+      entry = g_hash_table_lookup (store->entries, uri);
+      if (header.data_length > 0 && entry != NULL && entry->pack == pack && entry->offset == offset)
+        {
+          new_offset = pack_cache_store_append (store, uri, header.mtime,
+                                                (const guchar *) contents + offset
+                                                  + PACK_RECORD_HEADER_SIZE + header.uri_length,
+                                                header.data_length, &error);
+          if (new_offset >= 0)
+            {
+              entry->pack = store->active;
+              entry->offset = new_offset;
+            }
+        }
+      else if (header.data_length == 0 && entry == NULL
+               && pack != g_ptr_array_index (store->packs, 0))
+        {
+          /* older packs may still hold records this one removes */
+          new_offset = pack_cache_store_append (store, uri, 0, NULL, 0, &error);
+          if (new_offset >= 0)
+            store->active->dead += PACK_RECORD_HEADER_SIZE + header.uri_length;
+        }
+
+      g_mutex_unlock (&store->lock);
+      g_free (uri);
+
+      if (error != NULL)
+        {
+          g_warning ("Failed to compact \"%s\": %s", pack->filename, error->message);
+          g_error_free (error);
+
+          /* do not try again in this session */
+          g_mutex_lock (&store->lock);
+          pack->dead = 0;
+          g_mutex_unlock (&store->lock);
+          return;
+        }
+
+      offset += PACK_RECORD_HEADER_SIZE + header.uri_length + header.data_length;
+    }
+
+  g_mutex_lock (&store->lock);
+
+  /* the copies have to be on disk before the originals go away */
+  if (store->fd >= 0)
+    fdatasync (store->fd);
+
+  g_debug ("Compacted thumbnail pack \"%s\"", pack->filename);
+
+  g_unlink (pack->filename);
+  g_ptr_array_remove (store->packs, pack);
+
+  g_mutex_unlock (&store->lock);
+}
+
+
+
+static gpointer
+pack_cache_store_compact_thread (gpointer data)
+{
+  PackCacheStore *store = data;
+  Pack *pack;
+  guint n;
+
+  for (;;)
+    {
+      g_mutex_lock (&store->lock);
+
+      for (n = 0, pack = NULL; pack == NULL && n < store->packs->len; n++)
+        if (PACK_NEEDS_COMPACTION (store, (Pack *) g_ptr_array_index (store->packs, n)))
+          pack = g_ptr_array_index (store->packs, n);
+
+      if (pack == NULL || store->shutting_down)
+        {
+          store->compacting = FALSE;
+          g_mutex_unlock (&store->lock);
+          return NULL;
+        }
+
+      g_mutex_unlock (&store->lock);
+
+      pack_cache_store_compact_pack (store, pack);
+    }
+}
@@ -0,0 +1,69 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __PACK_CACHE_STORE_H__
+#define __PACK_CACHE_STORE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS;
+
+typedef struct _PackCacheStore PackCacheStore;
+
+typedef gboolean (*PackCacheStoreFunc) (const gchar *uri,
+                                        gdouble mtime,
+                                        gpointer user_data);
+
+PackCacheStore *
+pack_cache_store_new (const gchar *dirname);
+void
+pack_cache_store_free (PackCacheStore *store);
+gboolean
+pack_cache_store_lookup (PackCacheStore *store,
+                         const gchar *uri,
+                         gdouble *mtime);
+GBytes *
+pack_cache_store_get (PackCacheStore *store,
+                      const gchar *uri,
+                      gdouble *mtime,
+                      GError **error) G_GNUC_WARN_UNUSED_RESULT;
+gboolean
+pack_cache_store_put (PackCacheStore *store,
+                      const gchar *uri,
+                      gdouble mtime,
+                      const guchar *data,
+                      gsize length,
+                      GError **error);
+void
+pack_cache_store_remove (PackCacheStore *store,
+                         const gchar *uri);
+GList *
+pack_cache_store_find (PackCacheStore *store,
+                       PackCacheStoreFunc func,
+                       gpointer user_data) G_GNUC_WARN_UNUSED_RESULT;
+gboolean
+pack_cache_store_export (PackCacheStore *store,
+                         const gchar *uri,
+                         const gchar *filename,
+                         GError **error);
+
+G_END_DECLS;
+
+#endif /* !__PACK_CACHE_STORE_H__ */
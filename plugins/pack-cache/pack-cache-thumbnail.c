@@ -0,0 +1,485 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "pack-cache-cache.h"
+#include "pack-cache-thumbnail.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <libxfce4util/libxfce4util.h>
+
+
+
+/* Property identifiers */
+enum
+{
+  PROP_0,
+  PROP_CACHE,
+  PROP_URI,
+  PROP_FLAVOR,
+};
+
+
+
+static void
+pack_cache_thumbnail_thumbnail_init (TumblerThumbnailIface *iface);
+static void
+pack_cache_thumbnail_finalize (GObject *object);
+static void
+pack_cache_thumbnail_get_property (GObject *object,
+                                   guint prop_id,
+                                   GValue *value,
+                                   GParamSpec *pspec);
+static void
+pack_cache_thumbnail_set_property (GObject *object,
+                                   guint prop_id,
+                                   const GValue *value,
+                                   GParamSpec *pspec);
+static gboolean
+pack_cache_thumbnail_load (TumblerThumbnail *thumbnail,
+                           GCancellable *cancellable,
+                           GError **error);
+static gboolean
+pack_cache_thumbnail_import (PackCacheThumbnail *thumbnail,
+                             gdouble mtime);
+static gboolean
+pack_cache_thumbnail_needs_update (TumblerThumbnail *thumbnail,
+                                   const gchar *uri,
+                                   gdouble mtime);
+static gboolean
+pack_cache_thumbnail_save_image_data (TumblerThumbnail *thumbnail,
+                                      TumblerImageData *data,
+                                      gdouble mtime,
+                                      GCancellable *cancellable,
+                                      GError **error);
+static GBytes *
+pack_cache_thumbnail_load_bytes (TumblerThumbnail *thumbnail,
+                                 GCancellable *cancellable,
+                                 GError **error);
+
+
+
+struct _PackCacheThumbnail
+{
+  GObject __parent__;
+
+  TumblerThumbnailFlavor *flavor;
+  PackCacheCache *cache;
+  PackCacheStore *store;
+  gchar *uri;
+  gboolean cached;
+  gdouble cached_mtime;
+};
+
+
+
+G_DEFINE_DYNAMIC_TYPE_EXTENDED (PackCacheThumbnail,
+                                pack_cache_thumbnail,
+                                G_TYPE_OBJECT,
+                                0,
+                                G_IMPLEMENT_INTERFACE_DYNAMIC (TUMBLER_TYPE_THUMBNAIL,
+                                                               pack_cache_thumbnail_thumbnail_init));
+
+
+
+void
+pack_cache_thumbnail_register (TumblerCachePlugin *plugin)
+{
+  pack_cache_thumbnail_register_type (G_TYPE_MODULE (plugin));
+}
+
+
+
+static void
+pack_cache_thumbnail_class_init (PackCacheThumbnailClass *klass)
+{
+  GObjectClass *gobject_class;
+
+  gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = pack_cache_thumbnail_finalize;
+  gobject_class->get_property = pack_cache_thumbnail_get_property;
+  gobject_class->set_property = pack_cache_thumbnail_set_property;
+
+  g_object_class_override_property (gobject_class, PROP_CACHE, "cache");
+  g_object_class_override_property (gobject_class, PROP_URI, "uri");
+  g_object_class_override_property (gobject_class, PROP_FLAVOR, "flavor");
+}
+
+
+
+static void
+pack_cache_thumbnail_class_finalize (PackCacheThumbnailClass *klass)
+{
+}
+
+
+
+static void
+pack_cache_thumbnail_thumbnail_init (TumblerThumbnailIface *iface)
+{
+  iface->load = pack_cache_thumbnail_load;
+  iface->needs_update = pack_cache_thumbnail_needs_update;
+  iface->save_image_data = pack_cache_thumbnail_save_image_data;
+  iface->load_bytes = pack_cache_thumbnail_load_bytes;
+}
+
+
+
+static void
+pack_cache_thumbnail_init (PackCacheThumbnail *thumbnail)
+{
+}
+
+
+
+static void
+pack_cache_thumbnail_finalize (GObject *object)
+{
+  PackCacheThumbnail *thumbnail = PACK_CACHE_THUMBNAIL (object);
+
+  g_free (thumbnail->uri);
+
+  g_object_unref (thumbnail->cache);
+  g_object_unref (thumbnail->flavor);
+
+  (*G_OBJECT_CLASS (pack_cache_thumbnail_parent_class)->finalize) (object);
+}
+
+
+
+static void
+pack_cache_thumbnail_get_property (GObject *object,
+                                   guint prop_id,
+                                   GValue *value,
+                                   GParamSpec *pspec)
+{
+  PackCacheThumbnail *thumbnail = PACK_CACHE_THUMBNAIL (object);
+
+  switch (prop_id)
+    {
+    case PROP_CACHE:
+      g_value_set_object (value, TUMBLER_CACHE (thumbnail->cache));
+      break;
+    case PROP_URI:
+      g_value_set_string (value, thumbnail->uri);
+      break;
+    case PROP_FLAVOR:
+      g_value_set_object (value, thumbnail->flavor);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+
+
+static void
+pack_cache_thumbnail_set_property (GObject *object,
+                                   guint prop_id,
+                                   const GValue *value,
+                                   GParamSpec *pspec)
+{
+  PackCacheThumbnail *thumbnail = PACK_CACHE_THUMBNAIL (object);
+
+  switch (prop_id)
+    {
+    case PROP_CACHE:
+      thumbnail->cache = PACK_CACHE_CACHE (g_value_dup_object (value));
+      break;
+    case PROP_URI:
+      thumbnail->uri = g_value_dup_string (value);
+      break;
+    case PROP_FLAVOR:
+      thumbnail->flavor = g_value_dup_object (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+
+  /* the store lives as long as the cache, which we hold a reference on */
+  if (thumbnail->cache != NULL && thumbnail->flavor != NULL && thumbnail->store == NULL)
+    thumbnail->store = pack_cache_cache_get_store (thumbnail->cache, thumbnail->flavor);
+}
+
+
+
+static gboolean
+pack_cache_thumbnail_load (TumblerThumbnail *thumbnail,
+                           GCancellable *cancellable,
+                           GError **error)
+{
+  PackCacheThumbnail *cache_thumbnail = PACK_CACHE_THUMBNAIL (thumbnail);
+
+  g_return_val_if_fail (PACK_CACHE_IS_THUMBNAIL (thumbnail), FALSE);
+  g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+  g_return_val_if_fail (cache_thumbnail->store != NULL, FALSE);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return FALSE;
+
+  /* a hash probe, the PNG is only touched when someone asks for it */
+  cache_thumbnail->cached_mtime = 0;
+  cache_thumbnail->cached = pack_cache_store_lookup (cache_thumbnail->store,
+                                                     cache_thumbnail->uri,
+                                                     &cache_thumbnail->cached_mtime);
+
+  return TRUE;
+}
+
+
+
+static gboolean
+pack_cache_thumbnail_export (PackCacheThumbnail *thumbnail,
+                             gboolean replace)
+{
+  GError *error = NULL;
+  gboolean success = TRUE;
+  gchar *filename;
+
+  if (!pack_cache_cache_get_export (thumbnail->cache))
+    return TRUE;
+
+  filename = pack_cache_cache_get_export_filename (thumbnail->uri, thumbnail->flavor);
+  if ((replace || !g_file_test (filename, G_FILE_TEST_EXISTS))
+      && !pack_cache_store_export (thumbnail->store, thumbnail->uri, filename, &error))
+    {
+      g_warning ("Failed to export the thumbnail of \"%s\": %s", thumbnail->uri, error->message);
+      g_error_free (error);
+      success = FALSE;
+    }
+
+  g_free (filename);
+
+  return success;
+}
+
+
+
+static gboolean
+pack_cache_thumbnail_import (PackCacheThumbnail *thumbnail,
+                             gdouble mtime)
+{
+  GdkPixbufLoader *loader;
+  GdkPixbuf *pixbuf = NULL;
+  const gchar *value;
+  gboolean found = FALSE;
+  GError *error = NULL;
+  gchar *filename;
+  gchar *contents;
+  gsize length;
+
+  /* specialized thumbnailers write to the XDG thumbnail directory themselves */
+  filename = pack_cache_cache_get_export_filename (thumbnail->uri, thumbnail->flavor);
+  if (!g_file_get_contents (filename, &contents, &length, NULL))
+    {
+      g_free (filename);
+      return FALSE;
+    }
+
+  g_free (filename);
+
+  loader = gdk_pixbuf_loader_new_with_type ("png", NULL);
+  if (loader != NULL)
+    {
+      if (gdk_pixbuf_loader_write (loader, (const guchar *) contents, length, NULL)
+          && gdk_pixbuf_loader_close (loader, NULL))
+        pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+      else
+        gdk_pixbuf_loader_close (loader, NULL);
+    }
+
+  if (pixbuf != NULL)
+    {
+      value = gdk_pixbuf_get_option (pixbuf, "tEXt::Thumb::URI");
+      found = g_strcmp0 (value, thumbnail->uri) == 0;
+
+      value = gdk_pixbuf_get_option (pixbuf, "tEXt::Thumb::MTime");
+      found = found && value != NULL && g_ascii_strtod (value, NULL) == mtime;
+    }
+
+  /* the file already follows the thumbnail spec, store it unchanged */
+  if (found)
+    {
+      found = pack_cache_store_put (thumbnail->store, thumbnail->uri, mtime,
+                                    (const guchar *) contents, length, &error);
+      if (found)
+        {
+          thumbnail->cached = TRUE;
+          thumbnail->cached_mtime = mtime;
+        }
+      else
+        {
+          g_warning ("Failed to import the thumbnail of \"%s\": %s", thumbnail->uri, error->message);
+          g_error_free (error);
+        }
+    }
+
+  if (loader != NULL)
+    g_object_unref (loader);
+  g_free (contents);
+
+  return found;
+}
+
+
+
+static gboolean
+pack_cache_thumbnail_needs_update (TumblerThumbnail *thumbnail,
+                                   const gchar *uri,
+                                   gdouble mtime)
+{
+  PackCacheThumbnail *cache_thumbnail = PACK_CACHE_THUMBNAIL (thumbnail);
+  gchar *thumbnail_path;
+  gdouble thumb_mtime = 0;
+  gboolean found = FALSE;
+  GdkPixbuf *pixbuf;
+  const gchar *value;
+
+  g_return_val_if_fail (PACK_CACHE_IS_THUMBNAIL (thumbnail), FALSE);
+  g_return_val_if_fail (uri != NULL && *uri != '\0', FALSE);
+
+  if (cache_thumbnail->cached
+      && cache_thumbnail->cached_mtime != 0
+      && cache_thumbnail->cached_mtime == mtime
+      && g_strcmp0 (cache_thumbnail->uri, uri) == 0)
+    {
+      /* clients reading the XDG directory get the PNG even if it was removed */
+      pack_cache_thumbnail_export (cache_thumbnail, FALSE);
+      return FALSE;
+    }
+
+  /* pick up thumbnails written to the XDG directory by other thumbnailers */
+  if (g_strcmp0 (cache_thumbnail->uri, uri) == 0
+      && pack_cache_thumbnail_import (cache_thumbnail, mtime))
+    return FALSE;
+
+  /* look for a shared thumbnail repository next to the file */
+  thumbnail_path = xfce_create_shared_thumbnail_path (uri, tumbler_thumbnail_flavor_get_name (cache_thumbnail->flavor));
+  if (thumbnail_path != NULL && g_file_test (thumbnail_path, G_FILE_TEST_EXISTS))
+    {
+      pixbuf = gdk_pixbuf_new_from_file (thumbnail_path, NULL);
+      if (pixbuf != NULL)
+        {
+          value = gdk_pixbuf_get_option (pixbuf, "tEXt::Thumb::MTime");
+          if (value != NULL)
+            thumb_mtime = g_ascii_strtod (value, NULL);
+          found = mtime == thumb_mtime;
+
+          g_object_unref (pixbuf);
+        }
+    }
+
+  g_free (thumbnail_path);
+
+  return !found;
+}
+
+
+
+static gboolean
+pack_cache_thumbnail_save_image_data (TumblerThumbnail *thumbnail,
+                                      TumblerImageData *data,
+                                      gdouble mtime,
+                                      GCancellable *cancellable,
+                                      GError **error)
+{
+  PackCacheThumbnail *cache_thumbnail = PACK_CACHE_THUMBNAIL (thumbnail);
+  GdkPixbuf *dest_pixbuf;
+  GdkPixbuf *src_pixbuf;
+  GError *err = NULL;
+  gchar *buffer;
+  gsize length;
+
+  g_return_val_if_fail (PACK_CACHE_IS_THUMBNAIL (thumbnail), FALSE);
+  g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  /* abort if cancelled */
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return FALSE;
+
+  src_pixbuf = gdk_pixbuf_new_from_data (data->data,
+                                         (GdkColorspace) data->colorspace,
+                                         data->has_alpha,
+                                         data->bits_per_sample,
+                                         data->width,
+                                         data->height,
+                                         data->rowstride,
+                                         NULL, NULL);
+
+  /* generate a new pixbuf that is guranteed to follow the thumbnail spec */
+  dest_pixbuf = tumbler_util_pixbuf_new (TRUE, data->width, data->height);
+  gdk_pixbuf_copy_area (src_pixbuf, 0, 0, data->width, data->height, dest_pixbuf, 0, 0);
+
+  /* the stored PNG is exactly what the XDG cache would write */
+  if (pack_cache_cache_encode (dest_pixbuf, cache_thumbnail->uri, mtime, &buffer, &length, &err))
+    {
+      if (pack_cache_store_put (cache_thumbnail->store, cache_thumbnail->uri, mtime,
+                                (const guchar *) buffer, length, &err))
+        {
+          cache_thumbnail->cached = TRUE;
+          cache_thumbnail->cached_mtime = mtime;
+        }
+
+      g_free (buffer);
+    }
+
+  g_object_unref (dest_pixbuf);
+  g_object_unref (src_pixbuf);
+
+  if (err != NULL)
+    {
+      g_set_error (error, TUMBLER_ERROR, TUMBLER_ERROR_SAVE_FAILED,
+                   TUMBLER_ERROR_MESSAGE_SAVE_FAILED, cache_thumbnail->uri);
+      g_error_free (err);
+      return FALSE;
+    }
+
+  /* clients reading the XDG directory may look for the PNG as soon as
+   * they got the ready signal */
+  if (!pack_cache_thumbnail_export (cache_thumbnail, TRUE))
+    {
+      g_set_error (error, TUMBLER_ERROR, TUMBLER_ERROR_SAVE_FAILED,
+                   TUMBLER_ERROR_MESSAGE_SAVE_FAILED, cache_thumbnail->uri);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+
+static GBytes *
+pack_cache_thumbnail_load_bytes (TumblerThumbnail *thumbnail,
+                                 GCancellable *cancellable,
+                                 GError **error)
+{
+  PackCacheThumbnail *cache_thumbnail = PACK_CACHE_THUMBNAIL (thumbnail);
+
+  g_return_val_if_fail (PACK_CACHE_IS_THUMBNAIL (thumbnail), NULL);
+  g_return_val_if_fail (cache_thumbnail->store != NULL, NULL);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return NULL;
+
+  return pack_cache_store_get (cache_thumbnail->store, cache_thumbnail->uri, NULL, error);
+}
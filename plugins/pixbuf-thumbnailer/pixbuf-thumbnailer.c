@@ -121,7 +121,7 @@ pixbuf_thumbnailer_new_from_stream (GInputStream *stream,
   g_signal_connect (loader, "size-prepared",
                     G_CALLBACK (tumbler_util_size_prepared), thumbnail);
 
-  buffer = g_new (guchar, LOADER_BUFFER_SIZE);
+  buffer = tumbler_util_pixels_alloc (LOADER_BUFFER_SIZE);
   for (;;)
     {
       n_read = g_input_stream_read (stream, buffer, LOADER_BUFFER_SIZE,
@@ -165,7 +165,7 @@ pixbuf_thumbnailer_new_from_stream (GInputStream *stream,
     }
 
   g_object_unref (loader);
-  g_free (buffer);
+  tumbler_util_pixels_free (buffer);
   if (err != NULL)
     g_propagate_error (error, err);
 
@@ -201,13 +201,13 @@ pixbuf_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
   /* try to open the source file for reading */
   file = g_file_new_for_uri (uri);
   stream = g_file_read (file, cancellable, &error);
-  g_object_unref (file);
 
   if (stream == NULL)
     {
       g_signal_emit_by_name (thumbnailer, "error", info,
                              error->domain, error->code, error->message);
       g_error_free (error);
+      g_object_unref (file);
 
       return;
     }
@@ -224,6 +224,10 @@ pixbuf_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
 
   g_object_unref (stream);
 
+  /* the file is not needed anymore in background jobs */
+  tumbler_util_advise_file_done (file);
+  g_object_unref (file);
+
   if (pixbuf == NULL)
     {
       g_signal_emit_by_name (thumbnailer, "error", info,
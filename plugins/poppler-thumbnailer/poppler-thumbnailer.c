@@ -25,6 +25,10 @@
 #include <glib/gi18n.h>
 #include <poppler.h>
 
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
 
 
 static void
@@ -108,7 +112,7 @@ poppler_thumbnailer_pixbuf_from_surface (cairo_surface_t *surface)
   surface_format = cairo_image_surface_get_format (surface);
   has_alpha = (surface_format == CAIRO_FORMAT_ARGB32);
 
-  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width, height);
+  pixbuf = tumbler_util_pixbuf_new (TRUE, width, height);
   pixbuf_n_channels = gdk_pixbuf_get_n_channels (pixbuf);
   pixbuf_rowstride = gdk_pixbuf_get_rowstride (pixbuf);
   pixbuf_pixels = gdk_pixbuf_get_pixels (pixbuf);
@@ -159,15 +163,32 @@ poppler_thumbnailer_pixbuf_from_surface (cairo_surface_t *surface)
 static GdkPixbuf *
 poppler_thumbnailer_pixbuf_from_page (PopplerPage *page)
 {
+  static cairo_user_data_key_t pixels_key;
   cairo_surface_t *surface;
   cairo_t *cr;
   GdkPixbuf *pixbuf;
   gdouble width, height;
+  guchar *pixels;
+  gint stride;
 
   /* get the page size */
   poppler_page_get_size (page, &width, &height);
 
-  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  /* render into a pixel buffer from the arena, cleared like the ones of
+   * cairo_image_surface_create() */
+  stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, width);
+  if (stride > 0 && height >= 1)
+    {
+      pixels = tumbler_util_pixels_alloc ((gsize) stride * (gint) height);
+      memset (pixels, 0, (gsize) stride * (gint) height);
+
+      surface = cairo_image_surface_create_for_data (pixels, CAIRO_FORMAT_ARGB32,
+                                                     width, height, stride);
+      cairo_surface_set_user_data (surface, &pixels_key, pixels, tumbler_util_pixels_free);
+    }
+  else
+    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+
   cr = cairo_create (surface);
 
   cairo_save (cr);
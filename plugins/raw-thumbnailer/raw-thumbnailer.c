@@ -26,6 +26,7 @@
 #include <glib-object.h>
 #include <glib/gi18n.h>
 #include <libopenraw-gnome/gdkpixbuf.h>
+#include <libopenraw/libopenraw.h>
 #include <memory.h>
 #include <setjmp.h>
 #include <stdio.h>
@@ -87,6 +88,171 @@ raw_thumbnailer_init (RawThumbnailer *thumbnailer)
 
 
 
+static GdkPixbuf *
+raw_thumbnailer_rotate_pixbuf (GdkPixbuf *src,
+                               gint orientation)
+{
+  GdkPixbuf *dest = NULL;
+  GdkPixbuf *temp;
+
+  g_return_val_if_fail (GDK_IS_PIXBUF (src), NULL);
+
+  switch (orientation)
+    {
+    case 2:
+      dest = gdk_pixbuf_flip (src, TRUE);
+      break;
+
+    case 3:
+      dest = gdk_pixbuf_rotate_simple (src, GDK_PIXBUF_ROTATE_UPSIDEDOWN);
+      break;
+
+    case 4:
+      dest = gdk_pixbuf_flip (src, FALSE);
+      break;
+
+    case 5:
+      temp = gdk_pixbuf_rotate_simple (src, GDK_PIXBUF_ROTATE_CLOCKWISE);
+      dest = gdk_pixbuf_flip (temp, TRUE);
+      g_object_unref (temp);
+      break;
+
+    case 6:
+      dest = gdk_pixbuf_rotate_simple (src, GDK_PIXBUF_ROTATE_CLOCKWISE);
+      break;
+
+    case 7:
+      temp = gdk_pixbuf_rotate_simple (src, GDK_PIXBUF_ROTATE_CLOCKWISE);
+      dest = gdk_pixbuf_flip (temp, FALSE);
+      g_object_unref (temp);
+      break;
+
+    case 8:
+      dest = gdk_pixbuf_rotate_simple (src, GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE);
+      break;
+
+    default:
+      /* no or unknown orientation */
+      dest = g_object_ref (src);
+      break;
+    }
+
+  return dest;
+}
+
+
+
+static GdkPixbuf *
+raw_thumbnailer_load_preview (const gchar *path,
+                              TumblerThumbnail *thumbnail,
+                              gint width,
+                              gint height)
+{
+  ORRawFileRef raw_file;
+  ORThumbnailRef preview;
+  GdkPixbufLoader *loader;
+  GdkPixbuf *pixbuf = NULL;
+  GdkPixbuf *temp;
+  const uint32_t *sizes;
+  uint32_t size = MIN (width, height);
+  uint32_t best = 0;
+  uint32_t x, y;
+  size_t n_sizes, n;
+  gint orientation;
+
+  raw_file = or_rawfile_new (path, OR_RAWFILE_TYPE_UNKNOWN);
+  if (raw_file == NULL)
+    return NULL;
+
+  /* pick the smallest embedded preview that is at least as large as the
+   * flavor, or the largest one if they are all smaller */
+  sizes = or_rawfile_get_thumbnail_sizes (raw_file, &n_sizes);
+  for (n = 0; sizes != NULL && n < n_sizes; n++)
+    {
+      if (best == 0)
+        best = sizes[n];
+      else if (sizes[n] >= size)
+        {
+          if (best < size || sizes[n] < best)
+            best = sizes[n];
+        }
+      else if (best < size && sizes[n] > best)
+        best = sizes[n];
+    }
+
+  if (best == 0)
+    {
+      or_rawfile_release (raw_file);
+      return NULL;
+    }
+
+  preview = or_thumbnail_new ();
+  if (or_rawfile_get_thumbnail (raw_file, best, preview) == OR_ERROR_NONE)
+    {
+      switch (or_thumbnail_format (preview))
+        {
+        case OR_DATA_TYPE_JPEG:
+          /* the JPEG loader decodes at a reduced DCT scale when asked for a smaller size */
+          loader = gdk_pixbuf_loader_new ();
+          g_signal_connect (loader, "size-prepared",
+                            G_CALLBACK (tumbler_util_size_prepared), thumbnail);
+          if (gdk_pixbuf_loader_write (loader, or_thumbnail_data (preview),
+                                       or_thumbnail_data_size (preview), NULL)
+              && gdk_pixbuf_loader_close (loader, NULL))
+            {
+              pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+              if (pixbuf != NULL)
+                g_object_ref (pixbuf);
+            }
+          else
+            {
+              gdk_pixbuf_loader_close (loader, NULL);
+            }
+          g_object_unref (loader);
+          break;
+
+        case OR_DATA_TYPE_PIXMAP_8RGB:
+          or_thumbnail_dimensions (preview, &x, &y);
+          if (x > 0 && y > 0 && (gsize) x * y * 3 <= or_thumbnail_data_size (preview))
+            {
+              /* the pixels belong to the preview, so don't keep a reference to them */
+              temp = gdk_pixbuf_new_from_data (or_thumbnail_data (preview), GDK_COLORSPACE_RGB,
+                                               FALSE, 8, x, y, x * 3, NULL, NULL);
+              pixbuf = tumbler_util_scale_pixbuf (temp, width, height);
+              if (pixbuf == temp)
+                {
+                  g_object_unref (pixbuf);
+                  pixbuf = gdk_pixbuf_copy (temp);
+                }
+              g_object_unref (temp);
+            }
+          break;
+
+        default:
+          break;
+        }
+    }
+  or_thumbnail_release (preview);
+
+  /* apply the orientation to the reduced image only */
+  if (pixbuf != NULL)
+    {
+      orientation = or_rawfile_get_orientation (raw_file);
+      if (orientation > 1)
+        {
+          temp = raw_thumbnailer_rotate_pixbuf (pixbuf, orientation);
+          g_object_unref (pixbuf);
+          pixbuf = temp;
+        }
+    }
+
+  or_rawfile_release (raw_file);
+
+  return pixbuf;
+}
+
+
+
 static void
 raw_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
                         GCancellable *cancellable,
@@ -129,7 +295,11 @@ raw_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
   path = g_file_peek_path (file);
   if (path != NULL && g_path_is_absolute (path))
     {
-      pixbuf = or_gdkpixbuf_extract_rotated_thumbnail (path, MIN (width, height));
+      /* choose and decode the preview ourselves, let libopenraw handle
+       * the formats we don't know about */
+      pixbuf = raw_thumbnailer_load_preview (path, thumbnail, width, height);
+      if (pixbuf == NULL)
+        pixbuf = or_gdkpixbuf_extract_rotated_thumbnail (path, MIN (width, height));
 
       if (pixbuf == NULL)
         {
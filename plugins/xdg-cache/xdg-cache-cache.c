@@ -25,10 +25,13 @@
 #include <glib/gi18n.h>
 #include <glib/gprintf.h>
 #include <glib/gstdio.h>
+#include <errno.h>
 #include <math.h>
+#include <utime.h>
 #include <png.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 
 
@@ -60,9 +63,45 @@ xdg_cache_cache_is_thumbnail (TumblerCache *cache,
                               const gchar *uri);
 static GList *
 xdg_cache_cache_get_flavors (TumblerCache *cache);
+static guint
+xdg_cache_cache_evict (TumblerCache *cache,
+                       TumblerThumbnailFlavor *flavor,
+                       guint64 max_size,
+                       guint max_entries,
+                       GCancellable *cancellable);
 
 
 
+typedef struct
+{
+  gchar *filename;
+  gint64 time;
+  guint64 size;
+} EvictionCandidate;
+
+
+
+/* thumbnail names are MD5 hashes, so their first digit splits a flavor into
+ * shards of about the same size; each eviction run only looks at one of them
+ * rather than at every thumbnail of the flavor */
+#define EVICTION_SHARDS 16
+#define EVICTION_STATE_FILE "xdg-eviction.state"
+
+
+
+/* how long the answer for a source directory is trusted, long enough to cover
+ * the URIs of one request, which usually share a few directories */
+#define SHARED_REPOSITORY_TTL (5 * G_USEC_PER_SEC)
+#define SHARED_REPOSITORY_MAX_DIRS 4096
+
+
+
+typedef struct
+{
+  gint64 checked;
+  gboolean exists;
+} SharedRepository;
+
 struct _XDGCacheCache
 {
   GObject __parent__;
@@ -70,6 +109,15 @@ struct _XDGCacheCache
   GList *flavors;
   GList *dirs;
   GList *shared_suffixes;
+
+  /* last use of the thumbnails read or written since the last eviction,
+   * by path, in seconds */
+  GMutex accessed_lock;
+  GHashTable *accessed;
+
+  /* whether a source directory has a .sh_thumbnails repository, by directory */
+  GMutex shared_lock;
+  GHashTable *shared_repositories;
 };
 
 
@@ -119,6 +167,7 @@ xdg_cache_cache_iface_init (TumblerCacheIface *iface)
   iface->move = xdg_cache_cache_move;
   iface->is_thumbnail = xdg_cache_cache_is_thumbnail;
   iface->get_flavors = xdg_cache_cache_get_flavors;
+  iface->evict = xdg_cache_cache_evict;
 }
 
 
@@ -129,6 +178,12 @@ xdg_cache_cache_init (XDGCacheCache *cache)
   TumblerThumbnailFlavor *flavor;
   const gchar *cachedir = g_get_user_cache_dir ();
 
+  g_mutex_init (&cache->accessed_lock);
+  cache->accessed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  g_mutex_init (&cache->shared_lock);
+  cache->shared_repositories = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
   flavor = tumbler_thumbnail_flavor_new_normal ();
   cache->flavors = g_list_prepend (cache->flavors, flavor);
 
@@ -148,6 +203,10 @@ xdg_cache_cache_init (XDGCacheCache *cache)
       gchar *suffix = g_strconcat (G_DIR_SEPARATOR_S, ".sh_thumbnails", G_DIR_SEPARATOR_S, dirname, NULL);
       cache->dirs = g_list_prepend (cache->dirs, g_file_new_for_path (path));
       cache->shared_suffixes = g_list_prepend (cache->shared_suffixes, suffix);
+
+      /* create the flavor directory with user-only read/write/execute permissions
+       * once, rather than on every save */
+      g_mkdir_with_parents (path, S_IRWXU);
       g_free (path);
     }
 }
@@ -163,6 +222,12 @@ xdg_cache_cache_finalize (GObject *object)
   g_list_free_full (cache->dirs, g_object_unref);
   g_list_free_full (cache->shared_suffixes, g_free);
 
+  g_hash_table_destroy (cache->accessed);
+  g_mutex_clear (&cache->accessed_lock);
+
+  g_hash_table_destroy (cache->shared_repositories);
+  g_mutex_clear (&cache->shared_lock);
+
   G_OBJECT_CLASS (xdg_cache_cache_parent_class)->finalize (object);
 }
 
@@ -194,10 +259,9 @@ xdg_cache_cache_cleanup (TumblerCache *cache,
   const gchar *file_basename;
   gdouble mtime;
   GFile *base_file;
-  GFile *dummy_file;
   GFile *original_file;
-  GFile *parent;
   GList *iter;
+  gchar **base_filenames = NULL;
   gchar *dirname;
   gchar *filename;
   gchar *uri;
@@ -212,11 +276,7 @@ xdg_cache_cache_cleanup (TumblerCache *cache,
       if (since != 0)
         {
           /* compute the flavor directory filename */
-          dummy_file = xdg_cache_cache_get_file ("foo", iter->data);
-          parent = g_file_get_parent (dummy_file);
-          dirname = g_file_get_path (parent);
-          g_object_unref (parent);
-          g_object_unref (dummy_file);
+          dirname = xdg_cache_cache_get_flavor_dir (iter->data);
 
           /* attempt to open the directory for reading */
           dir = g_dir_open (dirname, 0, NULL);
@@ -283,23 +343,31 @@ xdg_cache_cache_cleanup (TumblerCache *cache,
         }
       /* According to the spec, mtime since can be 0 to ignore the threshold and
        * only cleanup based on the URI prefix array. */
-      else
+      else if (base_uris != NULL)
         {
-          for (n = 0; base_uris != NULL && base_uris[n] != NULL; ++n)
-            {
-              base_file = xdg_cache_cache_get_file (base_uris[n], iter->data);
+          /* the file names are the same in every flavor, hash the URIs only once */
+          if (base_filenames == NULL)
+            base_filenames = xdg_cache_cache_get_filenames (base_uris,
+                                                            g_strv_length ((gchar **) base_uris));
+
+          dirname = xdg_cache_cache_get_flavor_dir (iter->data);
 
-              filename = (gchar *) g_file_peek_path (base_file);
+          for (n = 0; base_filenames[n] != NULL; ++n)
+            {
+              filename = g_build_filename (dirname, base_filenames[n], NULL);
               if (g_file_test (filename, G_FILE_TEST_IS_REGULAR))
                 {
                   g_unlink (filename);
                 }
 
-              /* releas the base file */
-              g_object_unref (base_file);
+              g_free (filename);
             }
+
+          g_free (dirname);
         }
     }
+
+  g_strfreev (base_filenames);
 }
 
 
@@ -310,21 +378,32 @@ xdg_cache_cache_delete (TumblerCache *cache,
 {
   XDGCacheCache *xdg_cache = XDG_CACHE_CACHE (cache);
   GList *iter;
-  GFile *file;
-  gint n;
+  gchar **filenames;
+  gchar *dirname;
+  gchar *path;
+  guint n;
 
   g_return_if_fail (XDG_CACHE_IS_CACHE (cache));
   g_return_if_fail (uris != NULL);
 
+  /* the file names are the same in every flavor, hash the URIs only once */
+  filenames = xdg_cache_cache_get_filenames (uris, g_strv_length ((gchar **) uris));
+
   for (iter = xdg_cache->flavors; iter != NULL; iter = iter->next)
     {
-      for (n = 0; uris[n] != NULL; ++n)
+      dirname = xdg_cache_cache_get_flavor_dir (iter->data);
+
+      for (n = 0; filenames[n] != NULL; ++n)
         {
-          file = xdg_cache_cache_get_file (uris[n], iter->data);
-          g_file_delete (file, NULL, NULL);
-          g_object_unref (file);
+          path = g_build_filename (dirname, filenames[n], NULL);
+          g_unlink (path);
+          g_free (path);
         }
+
+      g_free (dirname);
     }
+
+  g_strfreev (filenames);
 }
 
 
@@ -402,8 +481,6 @@ xdg_cache_cache_copy_or_move (TumblerCache *cache,
   GFile *dest_source_file;
   GList *iter;
   guint n;
-  GFile *dummy_file;
-  GFile *parent;
   gchar *dirname;
   GDir *dir;
   const gchar *file_basename;
@@ -437,11 +514,7 @@ xdg_cache_cache_copy_or_move (TumblerCache *cache,
           if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
             {
               /* compute the flavor directory filename */
-              dummy_file = xdg_cache_cache_get_file ("foo", iter->data);
-              parent = g_file_get_parent (dummy_file);
-              dirname = g_file_get_path (parent);
-              g_object_unref (parent);
-              g_object_unref (dummy_file);
+              dirname = xdg_cache_cache_get_flavor_dir (iter->data);
 
               /* the base path */
               base_file = g_file_new_for_uri (from_uris[n]);
@@ -595,6 +668,328 @@ xdg_cache_cache_get_flavors (TumblerCache *cache)
 
 
 
+static void
+xdg_cache_cache_clear_candidate (gpointer data)
+{
+  EvictionCandidate *candidate = data;
+
+  g_free (candidate->filename);
+}
+
+
+
+static gint
+xdg_cache_cache_compare_candidates (gconstpointer a,
+                                    gconstpointer b)
+{
+  const EvictionCandidate *candidate_a = a;
+  const EvictionCandidate *candidate_b = b;
+
+  return (candidate_a->time > candidate_b->time) - (candidate_a->time < candidate_b->time);
+}
+
+
+
+static gboolean
+xdg_cache_cache_is_thumbnail_name (const gchar *name)
+{
+  guint n;
+
+  /* only finished thumbnails, temporary files are still being written */
+  if (strlen (name) != 36 || strcmp (name + 32, ".png") != 0)
+    return FALSE;
+
+  for (n = 0; n < 32; n++)
+    if (!g_ascii_isxdigit (name[n]))
+      return FALSE;
+
+  return TRUE;
+}
+
+
+
+static gchar *
+xdg_cache_cache_get_eviction_state_filename (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "tumbler", EVICTION_STATE_FILE, NULL);
+}
+
+
+
+/* the shard to look at next, kept on disk because tumblerd exits when idle */
+static guint
+xdg_cache_cache_load_eviction_shard (TumblerThumbnailFlavor *flavor)
+{
+  GKeyFile *state;
+  gchar *filename;
+  gint shard = 0;
+
+  state = g_key_file_new ();
+  filename = xdg_cache_cache_get_eviction_state_filename ();
+
+  if (g_key_file_load_from_file (state, filename, G_KEY_FILE_NONE, NULL))
+    shard = g_key_file_get_integer (state, "Eviction",
+                                    tumbler_thumbnail_flavor_get_name (flavor), NULL);
+
+  g_free (filename);
+  g_key_file_free (state);
+
+  return CLAMP (shard, 0, EVICTION_SHARDS - 1);
+}
+
+
+
+static void
+xdg_cache_cache_save_eviction_shard (TumblerThumbnailFlavor *flavor,
+                                     guint shard)
+{
+  GKeyFile *state;
+  GError *error = NULL;
+  gchar *filename;
+  gchar *dirname;
+
+  state = g_key_file_new ();
+  filename = xdg_cache_cache_get_eviction_state_filename ();
+  dirname = g_path_get_dirname (filename);
+
+  /* keep the shards of the other flavors, evictions run one after the other */
+  g_key_file_load_from_file (state, filename, G_KEY_FILE_NONE, NULL);
+  g_key_file_set_integer (state, "Eviction", tumbler_thumbnail_flavor_get_name (flavor), shard);
+
+  if (g_mkdir_with_parents (dirname, 0700) != 0
+      || !g_key_file_save_to_file (state, filename, &error))
+    {
+      g_debug ("Failed to save the eviction state to \"%s\": %s", filename,
+               error != NULL ? error->message : g_strerror (errno));
+      g_clear_error (&error);
+    }
+
+  g_free (dirname);
+  g_free (filename);
+  g_key_file_free (state);
+}
+
+
+
+static guint
+xdg_cache_cache_evict (TumblerCache *cache,
+                       TumblerThumbnailFlavor *flavor,
+                       guint64 max_size,
+                       guint max_entries,
+                       GCancellable *cancellable)
+{
+  XDGCacheCache *xdg_cache = XDG_CACHE_CACHE (cache);
+  EvictionCandidate *candidate;
+  EvictionCandidate new_candidate;
+  struct utimbuf times;
+  GHashTableIter iter;
+  const gchar *name;
+  GStatBuf statbuf;
+  GArray *candidates;
+  GArray *touched;
+  guint64 total_size = 0;
+  gpointer key, value;
+  gchar *dirname;
+  gchar *prefix;
+  guint evicted = 0;
+  guint shard;
+  guint n;
+  GDir *dir;
+
+  g_return_val_if_fail (XDG_CACHE_IS_CACHE (cache), 0);
+  g_return_val_if_fail (TUMBLER_IS_THUMBNAIL_FLAVOR (flavor), 0);
+
+  if (max_size == 0 && max_entries == 0)
+    return 0;
+
+  /* the limits of the flavor, shared evenly by the shards */
+  shard = xdg_cache_cache_load_eviction_shard (flavor);
+  if (max_size > 0)
+    max_size = MAX (max_size / EVICTION_SHARDS, 1);
+  if (max_entries > 0)
+    max_entries = MAX (max_entries / EVICTION_SHARDS, 1);
+
+  dirname = xdg_cache_cache_get_flavor_dir (flavor);
+  prefix = g_strconcat (dirname, G_DIR_SEPARATOR_S, NULL);
+
+  /* keep the last use of a thumbnail in its file time, so that recency
+   * survives restarts without a database of its own */
+  touched = g_array_new (FALSE, FALSE, sizeof (EvictionCandidate));
+  g_mutex_lock (&xdg_cache->accessed_lock);
+  g_hash_table_iter_init (&iter, xdg_cache->accessed);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    if (g_str_has_prefix (key, prefix))
+      {
+        new_candidate.filename = key;
+        new_candidate.time = GPOINTER_TO_UINT (value);
+        g_array_append_val (touched, new_candidate);
+        g_hash_table_iter_steal (&iter);
+      }
+  g_mutex_unlock (&xdg_cache->accessed_lock);
+
+  for (n = 0; n < touched->len; n++)
+    {
+      candidate = &g_array_index (touched, EvictionCandidate, n);
+      times.actime = candidate->time;
+      times.modtime = candidate->time;
+      g_utime (candidate->filename, &times);
+      g_free (candidate->filename);
+    }
+  g_array_free (touched, TRUE);
+
+  candidates = g_array_new (FALSE, FALSE, sizeof (EvictionCandidate));
+  g_array_set_clear_func (candidates, (GDestroyNotify) xdg_cache_cache_clear_candidate);
+
+  dir = g_dir_open (dirname, 0, NULL);
+  if (dir != NULL)
+    {
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          if ((candidates->len & 1023) == 0 && g_cancellable_is_cancelled (cancellable))
+            break;
+
+          if (!xdg_cache_cache_is_thumbnail_name (name)
+              || (guint) g_ascii_xdigit_value (name[0]) != shard)
+            continue;
+
+          new_candidate.filename = g_build_filename (dirname, name, NULL);
+          if (g_stat (new_candidate.filename, &statbuf) != 0)
+            {
+              g_free (new_candidate.filename);
+              continue;
+            }
+
+          /* what the file takes up on disk, small files waste most of a block */
+          new_candidate.time = statbuf.st_mtime;
+          new_candidate.size = (guint64) statbuf.st_blocks * 512;
+          total_size += new_candidate.size;
+          g_array_append_val (candidates, new_candidate);
+        }
+
+      g_dir_close (dir);
+    }
+
+  if (!g_cancellable_is_cancelled (cancellable)
+      && ((max_size > 0 && total_size > max_size)
+          || (max_entries > 0 && candidates->len > max_entries)))
+    {
+      /* least recently used first */
+      g_array_sort (candidates, xdg_cache_cache_compare_candidates);
+
+      for (n = 0; n < candidates->len; n++)
+        {
+          if (!((max_size > 0 && total_size > max_size)
+                || (max_entries > 0 && candidates->len - evicted > max_entries)))
+            break;
+
+          if ((n & 63) == 0 && g_cancellable_is_cancelled (cancellable))
+            break;
+
+          candidate = &g_array_index (candidates, EvictionCandidate, n);
+          if (g_unlink (candidate->filename) == 0)
+            {
+              total_size -= candidate->size;
+              evicted++;
+            }
+        }
+
+      g_debug ("Evicted %u thumbnails from shard %x of \"%s\", %" G_GUINT64_FORMAT " bytes left",
+               evicted, shard, dirname, total_size);
+    }
+
+  /* a cancelled run looks at the same shard again next time */
+  if (!g_cancellable_is_cancelled (cancellable))
+    xdg_cache_cache_save_eviction_shard (flavor, (shard + 1) % EVICTION_SHARDS);
+
+  g_array_free (candidates, TRUE);
+  g_free (prefix);
+  g_free (dirname);
+
+  return evicted;
+}
+
+
+
+/* remembers the use of a thumbnail for the next eviction */
+void
+xdg_cache_cache_touch (XDGCacheCache *cache,
+                       const gchar *path)
+{
+  g_return_if_fail (XDG_CACHE_IS_CACHE (cache));
+  g_return_if_fail (path != NULL);
+
+  g_mutex_lock (&cache->accessed_lock);
+  g_hash_table_insert (cache->accessed, g_strdup (path),
+                       GUINT_TO_POINTER ((guint) (g_get_real_time () / G_USEC_PER_SEC)));
+  g_mutex_unlock (&cache->accessed_lock);
+}
+
+
+
+/* Most directories have no shared thumbnail repository, so this is checked once
+ * per source directory rather than once per URI */
+gboolean
+xdg_cache_cache_has_shared_repository (XDGCacheCache *cache,
+                                       const gchar *uri)
+{
+  SharedRepository *repository;
+  gboolean exists = FALSE;
+  gboolean known = FALSE;
+  gchar *filename;
+  gchar *dirname;
+  gchar *path;
+  gint64 now;
+
+  g_return_val_if_fail (XDG_CACHE_IS_CACHE (cache), FALSE);
+  g_return_val_if_fail (uri != NULL, FALSE);
+
+  /* shared repositories only exist for local files */
+  filename = g_filename_from_uri (uri, NULL, NULL);
+  if (filename == NULL)
+    return FALSE;
+
+  dirname = g_path_get_dirname (filename);
+  g_free (filename);
+
+  now = g_get_monotonic_time ();
+
+  g_mutex_lock (&cache->shared_lock);
+  repository = g_hash_table_lookup (cache->shared_repositories, dirname);
+  if (repository != NULL && now - repository->checked < SHARED_REPOSITORY_TTL)
+    {
+      exists = repository->exists;
+      known = TRUE;
+    }
+  g_mutex_unlock (&cache->shared_lock);
+
+  if (known)
+    {
+      g_free (dirname);
+      return exists;
+    }
+
+  path = g_build_filename (dirname, ".sh_thumbnails", NULL);
+  exists = g_file_test (path, G_FILE_TEST_IS_DIR);
+  g_free (path);
+
+  repository = g_new (SharedRepository, 1);
+  repository->checked = now;
+  repository->exists = exists;
+
+  g_mutex_lock (&cache->shared_lock);
+
+  /* forget everything rather than track the age of each directory */
+  if (g_hash_table_size (cache->shared_repositories) >= SHARED_REPOSITORY_MAX_DIRS)
+    g_hash_table_remove_all (cache->shared_repositories);
+
+  g_hash_table_replace (cache->shared_repositories, dirname, repository);
+  g_mutex_unlock (&cache->shared_lock);
+
+  return exists;
+}
+
+
+
 GFile *
 xdg_cache_cache_get_file (const gchar *uri,
                           TumblerThumbnailFlavor *flavor)
@@ -631,38 +1026,85 @@ GFile *
 xdg_cache_cache_get_temp_file (const gchar *uri,
                                TumblerThumbnailFlavor *flavor)
 {
-  const gchar *cachedir;
-  const gchar *dirname;
-  gint64 current_time;
+  GFile *dest_file;
   GFile *file;
-  gchar *filename;
-  gchar *md5_hash;
   gchar *path;
 
   g_return_val_if_fail (uri != NULL && *uri != '\0', NULL);
   g_return_val_if_fail (TUMBLER_IS_THUMBNAIL_FLAVOR (flavor), NULL);
 
-  cachedir = g_get_user_cache_dir ();
-  dirname = tumbler_thumbnail_flavor_get_name (flavor);
-
-  current_time = g_get_real_time ();
-
-  md5_hash = g_compute_checksum_for_string (G_CHECKSUM_MD5, uri, -1);
-  filename = g_strdup_printf ("%s-%ld.png", md5_hash,
-                              current_time / G_USEC_PER_SEC);
-  path = g_build_filename (cachedir, "thumbnails", dirname, filename, NULL);
-
+  dest_file = xdg_cache_cache_get_file (uri, flavor);
+  path = xdg_cache_cache_get_temp_path (g_file_peek_path (dest_file));
   file = g_file_new_for_path (path);
 
+  g_object_unref (dest_file);
   g_free (path);
-  g_free (filename);
-  g_free (md5_hash);
 
   return file;
 }
 
 
 
+/* Hashes all @uris with a single checksum object and returns their thumbnail file
+ * names, which are the same in every flavor directory */
+gchar **
+xdg_cache_cache_get_filenames (const gchar *const *uris,
+                               guint n_uris)
+{
+  GChecksum *checksum;
+  gchar **filenames;
+  guint n;
+
+  g_return_val_if_fail (uris != NULL || n_uris == 0, NULL);
+
+  checksum = g_checksum_new (G_CHECKSUM_MD5);
+  filenames = g_new (gchar *, n_uris + 1);
+
+  for (n = 0; n < n_uris; ++n)
+    {
+      g_checksum_update (checksum, (const guchar *) uris[n], -1);
+      filenames[n] = g_strconcat (g_checksum_get_string (checksum), ".png", NULL);
+      g_checksum_reset (checksum);
+    }
+
+  filenames[n_uris] = NULL;
+  g_checksum_free (checksum);
+
+  return filenames;
+}
+
+
+
+gchar *
+xdg_cache_cache_get_flavor_dir (TumblerThumbnailFlavor *flavor)
+{
+  g_return_val_if_fail (TUMBLER_IS_THUMBNAIL_FLAVOR (flavor), NULL);
+
+  return g_build_filename (g_get_user_cache_dir (), "thumbnails",
+                           tumbler_thumbnail_flavor_get_name (flavor), NULL);
+}
+
+
+
+/* Like xdg_cache_cache_get_temp_file(), but derived from the thumbnail @path
+ * instead of hashing the URI again */
+gchar *
+xdg_cache_cache_get_temp_path (const gchar *path)
+{
+  static gint counter = 0;
+  gsize len;
+
+  g_return_val_if_fail (g_str_has_suffix (path, ".png"), NULL);
+
+  len = strlen (path) - strlen (".png");
+
+  /* unique per writer, so concurrent saves of the same URI do not collide */
+  return g_strdup_printf ("%.*s-%d-%u.png", (gint) len, path, (gint) getpid (),
+                          (guint) g_atomic_int_add (&counter, 1));
+}
+
+
+
 /* Will return %TRUE if the thumbnail was loaded successfully, or did not exist.
  * Check whether @uri is non-%NULL and @mtime is a valid time to determine
  * between the two. Will return %FALSE and set @error if the PNG was corrupt. */
@@ -40,12 +40,25 @@ xdg_cache_cache_get_file (const gchar *uri,
 GFile *
 xdg_cache_cache_get_temp_file (const gchar *uri,
                                TumblerThumbnailFlavor *flavor) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+gchar **
+xdg_cache_cache_get_filenames (const gchar *const *uris,
+                               guint n_uris) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+gchar *
+xdg_cache_cache_get_flavor_dir (TumblerThumbnailFlavor *flavor) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+gchar *
+xdg_cache_cache_get_temp_path (const gchar *path) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
 gboolean
 xdg_cache_cache_read_thumbnail_info (const gchar *filename,
                                      gchar **uri,
                                      gdouble *mtime,
                                      GCancellable *cancellable,
                                      GError **error);
+void
+xdg_cache_cache_touch (XDGCacheCache *cache,
+                       const gchar *path);
+gboolean
+xdg_cache_cache_has_shared_repository (XDGCacheCache *cache,
+                                       const gchar *uri);
 gboolean
 xdg_cache_cache_write_thumbnail_info (const gchar *filename,
                                       const gchar *uri,
@@ -24,8 +24,11 @@
 #include <gdk-pixbuf/gdk-pixbuf.h>
 #include <glib/gstdio.h>
 #include <libxfce4util/libxfce4util.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 
 
@@ -68,6 +71,10 @@ xdg_cache_thumbnail_save_image_data (TumblerThumbnail *thumbnail,
                                      gdouble mtime,
                                      GCancellable *cancellable,
                                      GError **error);
+static GBytes *
+xdg_cache_thumbnail_load_bytes (TumblerThumbnail *thumbnail,
+                                GCancellable *cancellable,
+                                GError **error);
 
 
 
@@ -80,6 +87,9 @@ struct _XDGCacheThumbnail
   gchar *uri;
   gchar *cached_uri;
   gdouble cached_mtime;
+
+  /* the URI is hashed once, on first use */
+  gchar *path;
 };
 
 
@@ -131,6 +141,7 @@ xdg_cache_thumbnail_thumbnail_init (TumblerThumbnailIface *iface)
   iface->load = xdg_cache_thumbnail_load;
   iface->needs_update = xdg_cache_thumbnail_needs_update;
   iface->save_image_data = xdg_cache_thumbnail_save_image_data;
+  iface->load_bytes = xdg_cache_thumbnail_load_bytes;
 }
 
 
@@ -149,6 +160,7 @@ xdg_cache_thumbnail_finalize (GObject *object)
 
   g_free (thumbnail->uri);
   g_free (thumbnail->cached_uri);
+  g_free (thumbnail->path);
 
   g_object_unref (thumbnail->cache);
   g_object_unref (thumbnail->flavor);
@@ -212,6 +224,26 @@ xdg_cache_thumbnail_set_property (GObject *object,
 
 
 
+static const gchar *
+xdg_cache_thumbnail_get_path (XDGCacheThumbnail *cache_thumbnail)
+{
+  gchar **filenames;
+  gchar *dirname;
+
+  if (cache_thumbnail->path == NULL)
+    {
+      filenames = xdg_cache_cache_get_filenames ((const gchar *const *) &cache_thumbnail->uri, 1);
+      dirname = xdg_cache_cache_get_flavor_dir (cache_thumbnail->flavor);
+      cache_thumbnail->path = g_build_filename (dirname, filenames[0], NULL);
+      g_free (dirname);
+      g_strfreev (filenames);
+    }
+
+  return cache_thumbnail->path;
+}
+
+
+
 static gboolean
 xdg_cache_thumbnail_load (TumblerThumbnail *thumbnail,
                           GCancellable *cancellable,
@@ -219,7 +251,7 @@ xdg_cache_thumbnail_load (TumblerThumbnail *thumbnail,
 {
   XDGCacheThumbnail *cache_thumbnail = XDG_CACHE_THUMBNAIL (thumbnail);
   GError *err = NULL;
-  GFile *file;
+  const gchar *path;
 
   g_return_val_if_fail (XDG_CACHE_IS_THUMBNAIL (thumbnail), FALSE);
   g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), FALSE);
@@ -227,17 +259,19 @@ xdg_cache_thumbnail_load (TumblerThumbnail *thumbnail,
   g_return_val_if_fail (cache_thumbnail->uri != NULL, FALSE);
   g_return_val_if_fail (XDG_CACHE_IS_CACHE (cache_thumbnail->cache), FALSE);
 
-  file = xdg_cache_cache_get_file (cache_thumbnail->uri,
-                                   cache_thumbnail->flavor);
+  path = xdg_cache_thumbnail_get_path (cache_thumbnail);
 
   g_clear_pointer (&cache_thumbnail->cached_uri, g_free);
   cache_thumbnail->cached_mtime = 0;
 
-  xdg_cache_cache_read_thumbnail_info (g_file_peek_path (file),
+  xdg_cache_cache_read_thumbnail_info (path,
                                        &cache_thumbnail->cached_uri,
                                        &cache_thumbnail->cached_mtime,
                                        cancellable, &err);
-  g_object_unref (file);
+
+  /* every lookup of an existing thumbnail counts as a use for eviction */
+  if (cache_thumbnail->cached_uri != NULL)
+    xdg_cache_cache_touch (cache_thumbnail->cache, path);
 
   if (err != NULL)
     {
@@ -253,13 +287,18 @@ xdg_cache_thumbnail_load (TumblerThumbnail *thumbnail,
 
 
 static gboolean
-has_valid_shared_thumbnail (const gchar *uri,
+has_valid_shared_thumbnail (XDGCacheCache *cache,
+                            const gchar *uri,
                             const gchar *size,
                             gdouble mtime)
 {
   gchar *thumbnail_path;
   gboolean found;
 
+  /* avoid building and testing a path per URI in the common case */
+  if (!xdg_cache_cache_has_shared_repository (cache, uri))
+    return FALSE;
+
   thumbnail_path = xfce_create_shared_thumbnail_path (uri, size);
 
   if (thumbnail_path != NULL && g_file_test (thumbnail_path, G_FILE_TEST_EXISTS))
@@ -271,6 +310,8 @@ has_valid_shared_thumbnail (const gchar *uri,
         found = mtime == thumb_mtime;
       else
         found = FALSE;
+
+      g_free (thumb_uri);
     }
   else
     found = FALSE;
@@ -304,7 +345,7 @@ xdg_cache_thumbnail_needs_update (TumblerThumbnail *thumbnail,
 
   if (!is_valid) /* if the personal repository is invalid, look for a shared thumbnail repository */
     {
-      if (has_valid_shared_thumbnail (uri, tumbler_thumbnail_flavor_get_name (cache_thumbnail->flavor), mtime))
+      if (has_valid_shared_thumbnail (cache_thumbnail->cache, uri, tumbler_thumbnail_flavor_get_name (cache_thumbnail->flavor), mtime))
         return FALSE;
     }
 
@@ -313,6 +354,216 @@ xdg_cache_thumbnail_needs_update (TumblerThumbnail *thumbnail,
 
 
 
+static gboolean
+xdg_cache_thumbnail_save_named (XDGCacheThumbnail *cache_thumbnail,
+                                GdkPixbuf *pixbuf,
+                                const gchar *mtime_str,
+                                GCancellable *cancellable,
+                                GError **error)
+{
+  GFileOutputStream *stream;
+  GError *err = NULL;
+  GFile *temp_file;
+  const gchar *dest_path;
+  gchar *temp_path;
+  gboolean saved = FALSE;
+
+  /* determine the temporary file to write to */
+  dest_path = xdg_cache_thumbnail_get_path (cache_thumbnail);
+  temp_path = xdg_cache_cache_get_temp_path (dest_path);
+  temp_file = g_file_new_for_path (temp_path);
+
+  /* open a stream to write to (and possibly replace) the temp file */
+  stream = g_file_replace (temp_file, NULL, FALSE, G_FILE_CREATE_PRIVATE, cancellable, &err);
+
+  /* the flavor directory is created at startup, but may have been removed since */
+  if (stream == NULL && g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+    {
+      gchar *dirname = g_path_get_dirname (temp_path);
+
+      g_clear_error (&err);
+      g_mkdir_with_parents (dirname, S_IRWXU);
+      stream = g_file_replace (temp_file, NULL, FALSE, G_FILE_CREATE_PRIVATE, cancellable, &err);
+      g_free (dirname);
+    }
+
+  if (stream != NULL)
+    {
+      /* try to save the pixbuf */
+      saved = gdk_pixbuf_save_to_stream (pixbuf, G_OUTPUT_STREAM (stream), "png",
+                                         cancellable, &err,
+                                         "tEXt::Thumb::URI", cache_thumbnail->uri,
+                                         "tEXt::Thumb::MTime", mtime_str,
+                                         NULL);
+
+      /* close and destroy the output stream */
+      g_object_unref (stream);
+
+      /* saving succeeded, try to rename the thumbnail */
+      if (saved && g_rename (temp_path, dest_path) == -1)
+        {
+          g_set_error (&err, TUMBLER_ERROR, TUMBLER_ERROR_SAVE_FAILED,
+                       TUMBLER_ERROR_MESSAGE_SAVE_FAILED, dest_path);
+          saved = FALSE;
+        }
+
+      /* delete temp file if there was an error */
+      if (!saved)
+        g_unlink (temp_path);
+    }
+
+  g_object_unref (temp_file);
+  g_free (temp_path);
+
+  if (err != NULL)
+    g_propagate_error (error, err);
+
+  return saved;
+}
+
+
+
+#if defined(HAVE_LINKAT) && defined(O_TMPFILE)
+static gboolean
+xdg_cache_thumbnail_write_fd (const gchar *buf,
+                              gsize count,
+                              GError **error,
+                              gpointer data)
+{
+  gint fd = GPOINTER_TO_INT (data);
+  gssize written;
+
+  while (count > 0)
+    {
+      written = write (fd, buf, count);
+      if (written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                               g_strerror (errno));
+          return FALSE;
+        }
+
+      buf += written;
+      count -= written;
+    }
+
+  return TRUE;
+}
+#endif
+
+
+
+/* Returns %FALSE without setting @error if anonymous files are not supported,
+ * in which case the caller should fall back to xdg_cache_thumbnail_save_named() */
+static gboolean
+xdg_cache_thumbnail_save_anonymous (XDGCacheThumbnail *cache_thumbnail,
+                                    GdkPixbuf *pixbuf,
+                                    const gchar *mtime_str,
+                                    GCancellable *cancellable,
+                                    GError **error)
+{
+#if defined(HAVE_LINKAT) && defined(O_TMPFILE)
+  static gint unsupported = FALSE;
+  GError *err = NULL;
+  const gchar *dest_path;
+  gchar *temp_path;
+  gchar *dirname;
+  gchar *fd_path;
+  gboolean saved;
+  gint fd;
+
+  if (g_atomic_int_get (&unsupported))
+    return FALSE;
+
+  dest_path = xdg_cache_thumbnail_get_path (cache_thumbnail);
+  dirname = g_path_get_dirname (dest_path);
+
+  /* the file has no name until it is complete, so there is nothing to clean up
+   * on failure and concurrent writers of the same URI cannot collide */
+  fd = g_open (dirname, O_TMPFILE | O_WRONLY | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (fd < 0 && errno == ENOENT)
+    {
+      g_mkdir_with_parents (dirname, S_IRWXU);
+      fd = g_open (dirname, O_TMPFILE | O_WRONLY | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    }
+
+  g_free (dirname);
+
+  if (fd < 0)
+    {
+      /* older kernels or file systems without O_TMPFILE support */
+      if (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL)
+        g_atomic_int_set (&unsupported, TRUE);
+      else
+        g_set_error (error, TUMBLER_ERROR, TUMBLER_ERROR_SAVE_FAILED,
+                     TUMBLER_ERROR_MESSAGE_SAVE_FAILED, dest_path);
+
+      return FALSE;
+    }
+
+  saved = gdk_pixbuf_save_to_callback (pixbuf, xdg_cache_thumbnail_write_fd,
+                                       GINT_TO_POINTER (fd), "png", &err,
+                                       "tEXt::Thumb::URI", cache_thumbnail->uri,
+                                       "tEXt::Thumb::MTime", mtime_str,
+                                       NULL);
+
+  if (saved && !g_cancellable_set_error_if_cancelled (cancellable, &err))
+    {
+      fd_path = g_strdup_printf ("/proc/self/fd/%d", fd);
+
+      /* a new thumbnail is given its name in a single step, an existing one is
+       * replaced atomically by linking to a unique name and renaming that */
+      if (linkat (AT_FDCWD, fd_path, AT_FDCWD, dest_path, AT_SYMLINK_FOLLOW) != 0)
+        {
+          if (errno == EEXIST)
+            {
+              temp_path = xdg_cache_cache_get_temp_path (dest_path);
+
+              if (linkat (AT_FDCWD, fd_path, AT_FDCWD, temp_path, AT_SYMLINK_FOLLOW) != 0)
+                saved = FALSE;
+              else if (g_rename (temp_path, dest_path) != 0)
+                {
+                  g_unlink (temp_path);
+                  saved = FALSE;
+                }
+
+              g_free (temp_path);
+            }
+          else if (errno == ENOENT && !g_file_test ("/proc/self/fd", G_FILE_TEST_IS_DIR))
+            {
+              /* linking needs /proc, fall back to named temp files */
+              g_atomic_int_set (&unsupported, TRUE);
+              saved = FALSE;
+            }
+          else
+            saved = FALSE;
+
+          if (!saved && !g_atomic_int_get (&unsupported))
+            g_set_error (&err, TUMBLER_ERROR, TUMBLER_ERROR_SAVE_FAILED,
+                         TUMBLER_ERROR_MESSAGE_SAVE_FAILED, dest_path);
+        }
+
+      g_free (fd_path);
+    }
+  else
+    saved = FALSE;
+
+  close (fd);
+
+  if (err != NULL)
+    g_propagate_error (error, err);
+
+  return saved;
+#else
+  return FALSE;
+#endif
+}
+
+
+
 static gboolean
 xdg_cache_thumbnail_save_image_data (TumblerThumbnail *thumbnail,
                                      TumblerImageData *data,
@@ -321,15 +572,9 @@ xdg_cache_thumbnail_save_image_data (TumblerThumbnail *thumbnail,
                                      GError **error)
 {
   XDGCacheThumbnail *cache_thumbnail = XDG_CACHE_THUMBNAIL (thumbnail);
-  GFileOutputStream *stream;
   GdkPixbuf *dest_pixbuf;
   GdkPixbuf *src_pixbuf;
   GError *err = NULL;
-  GFile *dest_file;
-  GFile *flavor_dir;
-  GFile *temp_file;
-  const gchar *dest_path;
-  const gchar *temp_path;
   gchar *mtime_str;
   guint64 mtime_int = (guint64) mtime;
   gint width;
@@ -357,75 +602,28 @@ xdg_cache_thumbnail_save_image_data (TumblerThumbnail *thumbnail,
                                          NULL, NULL);
 
   /* generate a new pixbuf that is guranteed to follow the thumbnail spec */
-  dest_pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width, height);
+  dest_pixbuf = tumbler_util_pixbuf_new (TRUE, width, height);
 
   /* copy the thumbnail pixbuf into the destination pixbuf */
   gdk_pixbuf_copy_area (src_pixbuf, 0, 0, width, height, dest_pixbuf, 0, 0);
 
-  /* determine the URI of the temporary file to write to */
-  temp_file = xdg_cache_cache_get_temp_file (cache_thumbnail->uri,
-                                             cache_thumbnail->flavor);
+  /* convert the modified time of the source URI to a string */
+  mtime_str = g_strdup_printf ("%" G_GUINT64_FORMAT ".%.6" G_GUINT32_FORMAT,
+                               mtime_int, (guint32) round (1.e6 * (mtime - mtime_int)));
 
-  /* determine the flavor directory */
-  flavor_dir = g_file_get_parent (temp_file);
-
-  /* create the flavor directory with user-only read/write/execute permissions */
-  g_mkdir_with_parents (g_file_peek_path (flavor_dir), S_IRWXU);
-
-  /* free the flavor dir GFile */
-  g_object_unref (flavor_dir);
-
-  /* open a stream to write to (and possibly replace) the temp file */
-  stream = g_file_replace (temp_file, NULL, FALSE, G_FILE_CREATE_PRIVATE, cancellable, &err);
-
-  if (stream != NULL)
+  /* write to an anonymous file if possible, to a named temp file otherwise */
+  if (!xdg_cache_thumbnail_save_anonymous (cache_thumbnail, dest_pixbuf, mtime_str,
+                                           cancellable, &err)
+      && err == NULL)
     {
-      gboolean saved;
-
-      /* convert the modified time of the source URI to a string */
-      mtime_str = g_strdup_printf ("%" G_GUINT64_FORMAT ".%.6" G_GUINT32_FORMAT,
-                                   mtime_int, (guint32) round (1.e6 * (mtime - mtime_int)));
-
-      /* try to save the pixbuf */
-      saved = gdk_pixbuf_save_to_stream (dest_pixbuf, G_OUTPUT_STREAM (stream), "png",
-                                         cancellable, &err,
-                                         "tEXt::Thumb::URI", cache_thumbnail->uri,
-                                         "tEXt::Thumb::MTime", mtime_str,
-                                         NULL);
-
-      /* close and destroy the output stream */
-      g_object_unref (stream);
-
-      if (saved)
-        {
-          /* saving succeeded, termine the final destination of the thumbnail */
-          dest_file = xdg_cache_cache_get_file (cache_thumbnail->uri,
-                                                cache_thumbnail->flavor);
-
-          /* determine temp and destination paths */
-          temp_path = g_file_peek_path (temp_file);
-          dest_path = g_file_peek_path (dest_file);
-
-          /* try to rename the thumbnail */
-          if (g_rename (temp_path, dest_path) == -1)
-            g_set_error (&err, TUMBLER_ERROR, TUMBLER_ERROR_SAVE_FAILED,
-                         TUMBLER_ERROR_MESSAGE_SAVE_FAILED, dest_path);
-
-          /* destroy the destination GFile */
-          g_object_unref (dest_file);
-        }
-
-      /* delete temp file if there was an error */
-      g_file_delete (temp_file, NULL, NULL);
-
-      /* free the modified time string */
-      g_free (mtime_str);
+      xdg_cache_thumbnail_save_named (cache_thumbnail, dest_pixbuf, mtime_str,
+                                      cancellable, &err);
     }
 
-  /* destroy the source pixbuf, destination pixbuf and temporary GFile */
+  /* destroy the source and destination pixbufs */
   g_object_unref (dest_pixbuf);
   g_object_unref (src_pixbuf);
-  g_object_unref (temp_file);
+  g_free (mtime_str);
 
   if (err != NULL)
     {
@@ -440,3 +638,45 @@ xdg_cache_thumbnail_save_image_data (TumblerThumbnail *thumbnail,
       return TRUE;
     }
 }
+
+
+
+static GBytes *
+xdg_cache_thumbnail_load_bytes (TumblerThumbnail *thumbnail,
+                                GCancellable *cancellable,
+                                GError **error)
+{
+  XDGCacheThumbnail *cache_thumbnail = XDG_CACHE_THUMBNAIL (thumbnail);
+  GBytes *bytes;
+  GError *err = NULL;
+  GFile *file;
+  gchar *path;
+
+  g_return_val_if_fail (XDG_CACHE_IS_THUMBNAIL (thumbnail), NULL);
+  g_return_val_if_fail (cache_thumbnail->uri != NULL, NULL);
+
+  file = g_file_new_for_path (xdg_cache_thumbnail_get_path (cache_thumbnail));
+  bytes = g_file_load_bytes (file, cancellable, NULL, &err);
+  g_object_unref (file);
+
+  /* the thumbnail may come from a shared repository next to the file */
+  if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+    {
+      path = xfce_create_shared_thumbnail_path (cache_thumbnail->uri,
+                                                tumbler_thumbnail_flavor_get_name (cache_thumbnail->flavor));
+      if (path != NULL)
+        {
+          g_clear_error (&err);
+
+          file = g_file_new_for_path (path);
+          bytes = g_file_load_bytes (file, cancellable, NULL, &err);
+          g_object_unref (file);
+          g_free (path);
+        }
+    }
+
+  if (err != NULL)
+    g_propagate_error (error, err);
+
+  return bytes;
+}
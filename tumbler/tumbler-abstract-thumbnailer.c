@@ -24,6 +24,11 @@
 
 
 
+/* how often a job waiting for admission checks whether it was cancelled */
+#define ADMISSION_POLL_INTERVAL (G_TIME_SPAN_SECOND / 4)
+
+
+
 /* Property identifiers */
 enum
 {
@@ -33,6 +38,7 @@ enum
   PROP_HASH_KEYS,
   PROP_PRIORITY,
   PROP_MAX_FILE_SIZE,
+  PROP_MAX_CONCURRENCY,
   PROP_LOCATIONS,
   PROP_EXCLUDES
 };
@@ -59,6 +65,10 @@ static void
 tumbler_abstract_thumbnailer_create (TumblerThumbnailer *thumbnailer,
                                      GCancellable *cancellable,
                                      TumblerFileInfo *info);
+static gboolean
+tumbler_abstract_thumbnailer_is_saturated (TumblerThumbnailer *thumbnailer);
+static void
+tumbler_abstract_thumbnailer_reclaim (TumblerThumbnailer *thumbnailer);
 
 
 
@@ -71,6 +81,12 @@ struct _TumblerAbstractThumbnailerPrivate
   gint64 max_file_size;
   GSList *locations;
   GSList *excludes;
+
+  /* admission control: at most max_concurrency (if > 0) jobs run create() at once */
+  GMutex admission_lock;
+  GCond admission_cond;
+  gint max_concurrency;
+  gint n_active;
 };
 
 
@@ -101,6 +117,7 @@ tumbler_abstract_thumbnailer_class_init (TumblerAbstractThumbnailerClass *klass)
   g_object_class_override_property (gobject_class, PROP_HASH_KEYS, "hash-keys");
   g_object_class_override_property (gobject_class, PROP_PRIORITY, "priority");
   g_object_class_override_property (gobject_class, PROP_MAX_FILE_SIZE, "max-file-size");
+  g_object_class_override_property (gobject_class, PROP_MAX_CONCURRENCY, "max-concurrency");
   g_object_class_override_property (gobject_class, PROP_LOCATIONS, "locations");
   g_object_class_override_property (gobject_class, PROP_EXCLUDES, "excludes");
 }
@@ -111,6 +128,8 @@ static void
 tumbler_abstract_thumbnailer_thumbnailer_init (TumblerThumbnailerIface *iface)
 {
   iface->create = tumbler_abstract_thumbnailer_create;
+  iface->is_saturated = tumbler_abstract_thumbnailer_is_saturated;
+  iface->reclaim = tumbler_abstract_thumbnailer_reclaim;
 }
 
 
@@ -119,6 +138,9 @@ static void
 tumbler_abstract_thumbnailer_init (TumblerAbstractThumbnailer *thumbnailer)
 {
   thumbnailer->priv = tumbler_abstract_thumbnailer_get_instance_private (thumbnailer);
+
+  g_mutex_init (&thumbnailer->priv->admission_lock);
+  g_cond_init (&thumbnailer->priv->admission_cond);
 }
 
 
@@ -182,6 +204,9 @@ tumbler_abstract_thumbnailer_finalize (GObject *object)
   g_slist_free_full (thumbnailer->priv->locations, g_object_unref);
   g_slist_free_full (thumbnailer->priv->excludes, g_object_unref);
 
+  g_cond_clear (&thumbnailer->priv->admission_cond);
+  g_mutex_clear (&thumbnailer->priv->admission_lock);
+
   (*G_OBJECT_CLASS (tumbler_abstract_thumbnailer_parent_class)->finalize) (object);
 }
 
@@ -227,6 +252,10 @@ tumbler_abstract_thumbnailer_get_property (GObject *object,
       g_value_set_int64 (value, thumbnailer->priv->max_file_size);
       break;
 
+    case PROP_MAX_CONCURRENCY:
+      g_value_set_int (value, thumbnailer->priv->max_concurrency);
+      break;
+
     case PROP_LOCATIONS:
       dup = g_slist_copy_deep (thumbnailer->priv->locations, tumbler_object_ref, NULL);
       g_value_set_pointer (value, dup);
@@ -276,6 +305,13 @@ tumbler_abstract_thumbnailer_set_property (GObject *object,
       thumbnailer->priv->max_file_size = g_value_get_int64 (value);
       break;
 
+    case PROP_MAX_CONCURRENCY:
+      g_mutex_lock (&thumbnailer->priv->admission_lock);
+      thumbnailer->priv->max_concurrency = g_value_get_int (value);
+      g_cond_broadcast (&thumbnailer->priv->admission_cond);
+      g_mutex_unlock (&thumbnailer->priv->admission_lock);
+      break;
+
     case PROP_LOCATIONS:
       dup = g_slist_copy_deep (g_value_get_pointer (value), tumbler_object_ref, NULL);
       thumbnailer->priv->locations = dup;
@@ -294,16 +330,107 @@ tumbler_abstract_thumbnailer_set_property (GObject *object,
 
 
 
+static gboolean
+tumbler_abstract_thumbnailer_admit (TumblerAbstractThumbnailer *thumbnailer,
+                                    GCancellable *cancellable)
+{
+  TumblerAbstractThumbnailerPrivate *priv = thumbnailer->priv;
+  gint64 end_time;
+
+  g_mutex_lock (&priv->admission_lock);
+
+  while (priv->max_concurrency > 0 && priv->n_active >= priv->max_concurrency)
+    {
+      /* give up if the job was cancelled while waiting */
+      if (g_cancellable_is_cancelled (cancellable))
+        {
+          g_mutex_unlock (&priv->admission_lock);
+          return FALSE;
+        }
+
+      end_time = g_get_monotonic_time () + ADMISSION_POLL_INTERVAL;
+      g_cond_wait_until (&priv->admission_cond, &priv->admission_lock, end_time);
+    }
+
+  priv->n_active++;
+
+  g_mutex_unlock (&priv->admission_lock);
+
+  return TRUE;
+}
+
+
+
+static void
+tumbler_abstract_thumbnailer_release (TumblerAbstractThumbnailer *thumbnailer)
+{
+  TumblerAbstractThumbnailerPrivate *priv = thumbnailer->priv;
+
+  g_mutex_lock (&priv->admission_lock);
+
+  priv->n_active--;
+  g_cond_signal (&priv->admission_cond);
+
+  g_mutex_unlock (&priv->admission_lock);
+}
+
+
+
 static void
 tumbler_abstract_thumbnailer_create (TumblerThumbnailer *thumbnailer,
                                      GCancellable *cancellable,
                                      TumblerFileInfo *info)
 {
+  TumblerAbstractThumbnailer *abstract_thumbnailer = TUMBLER_ABSTRACT_THUMBNAILER (thumbnailer);
+
   g_return_if_fail (TUMBLER_IS_ABSTRACT_THUMBNAILER (thumbnailer));
   g_return_if_fail (TUMBLER_IS_FILE_INFO (info));
   g_return_if_fail (TUMBLER_ABSTRACT_THUMBNAILER_GET_CLASS (thumbnailer)->create != NULL);
 
-  TUMBLER_ABSTRACT_THUMBNAILER_GET_CLASS (thumbnailer)->create (TUMBLER_ABSTRACT_THUMBNAILER (thumbnailer), cancellable, info);
+  /* wait until the thumbnailer accepts another job, a job cancelled in the
+   * meantime is dropped silently, just like plugins do it */
+  if (!tumbler_abstract_thumbnailer_admit (abstract_thumbnailer, cancellable))
+    return;
+
+  TUMBLER_ABSTRACT_THUMBNAILER_GET_CLASS (thumbnailer)->create (abstract_thumbnailer, cancellable, info);
+
+  tumbler_abstract_thumbnailer_release (abstract_thumbnailer);
+}
+
+
+
+static gboolean
+tumbler_abstract_thumbnailer_is_saturated (TumblerThumbnailer *thumbnailer)
+{
+  TumblerAbstractThumbnailerPrivate *priv = TUMBLER_ABSTRACT_THUMBNAILER (thumbnailer)->priv;
+  gboolean saturated;
+
+  g_mutex_lock (&priv->admission_lock);
+  saturated = priv->max_concurrency > 0 && priv->n_active >= priv->max_concurrency;
+  g_mutex_unlock (&priv->admission_lock);
+
+  return saturated;
+}
+
+
+
+static void
+tumbler_abstract_thumbnailer_reclaim (TumblerThumbnailer *thumbnailer)
+{
+  TumblerAbstractThumbnailer *abstract_thumbnailer = TUMBLER_ABSTRACT_THUMBNAILER (thumbnailer);
+  TumblerAbstractThumbnailerPrivate *priv = abstract_thumbnailer->priv;
+
+  if (TUMBLER_ABSTRACT_THUMBNAILER_GET_CLASS (thumbnailer)->reclaim == NULL)
+    return;
+
+  /* keep new jobs out while the subclass releases its resources, and leave
+   * a thumbnailer alone that is still busy */
+  g_mutex_lock (&priv->admission_lock);
+
+  if (priv->n_active == 0)
+    TUMBLER_ABSTRACT_THUMBNAILER_GET_CLASS (thumbnailer)->reclaim (abstract_thumbnailer);
+
+  g_mutex_unlock (&priv->admission_lock);
 }
 
 #define __TUMBLER_ABSTRACT_THUMBNAILER_C__
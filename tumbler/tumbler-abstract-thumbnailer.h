@@ -51,6 +51,7 @@ struct _TumblerAbstractThumbnailerClass
   void (*create) (TumblerAbstractThumbnailer *thumbnailer,
                   GCancellable *cancellable,
                   TumblerFileInfo *info);
+  void (*reclaim) (TumblerAbstractThumbnailer *thumbnailer);
 };
 
 struct _TumblerAbstractThumbnailer
@@ -20,6 +20,7 @@
 
 #include "tumbler-cache-plugin.h"
 #include "tumbler-error.h"
+#include "tumbler-util.h"
 #include "tumbler-visibility.h"
 
 #include <glib/gi18n.h>
@@ -173,16 +174,51 @@ tumbler_cache_plugin_unload (GTypeModule *type_module)
 
 
 
+/* the cache backend can be chosen in the [Cache] section of tumbler.rc */
+static gchar *
+tumbler_cache_plugin_get_module_name (void)
+{
+  GKeyFile *rc;
+  gchar *backend;
+  gchar *name;
+  guint n;
+
+  rc = tumbler_util_get_settings ();
+  backend = g_key_file_get_string (rc, "Cache", "Backend", NULL);
+  g_key_file_free (rc);
+
+  /* the name ends up in a module path */
+  for (n = 0; backend != NULL && backend[n] != '\0'; n++)
+    if (!g_ascii_isalnum (backend[n]))
+      {
+        g_warning ("Invalid cache backend \"%s\", using the default one", backend);
+        g_clear_pointer (&backend, g_free);
+      }
+
+  if (backend == NULL || *backend == '\0' || g_strcmp0 (backend, "xdg") == 0)
+    name = g_strdup ("tumbler-cache-plugin." G_MODULE_SUFFIX);
+  else
+    name = g_strdup_printf ("tumbler-%s-cache." G_MODULE_SUFFIX, backend);
+
+  g_free (backend);
+
+  return name;
+}
+
+
+
 GTypeModule *
 tumbler_cache_plugin_get_default (void)
 {
   static TumblerCachePlugin *plugin = NULL;
+  gchar *name;
 
   if (plugin == NULL)
     {
       plugin = g_object_new (TUMBLER_TYPE_CACHE_PLUGIN, NULL);
-      g_type_module_set_name (G_TYPE_MODULE (plugin),
-                              "tumbler-cache-plugin." G_MODULE_SUFFIX);
+      name = tumbler_cache_plugin_get_module_name ();
+      g_type_module_set_name (G_TYPE_MODULE (plugin), name);
+      g_free (name);
       g_object_add_weak_pointer (G_OBJECT (plugin), (gpointer) &plugin);
 
       if (!g_type_module_use (G_TYPE_MODULE (plugin)))
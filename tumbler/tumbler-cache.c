@@ -182,5 +182,42 @@ tumbler_cache_get_flavor (TumblerCache *cache,
   return flavor;
 }
 
+
+
+/**
+ * tumbler_cache_evict:
+ * @cache       : a #TumblerCache.
+ * @flavor      : the #TumblerThumbnailFlavor to evict thumbnails of.
+ * @max_size    : the disk space in bytes the thumbnails of @flavor may use,
+ *                or 0 for no limit.
+ * @max_entries : the number of thumbnails of @flavor to keep, or 0 for no limit.
+ * @cancellable : (nullable): a #GCancellable, or %NULL.
+ *
+ * Removes the least recently used thumbnails of @flavor until it fits into
+ * @max_size and @max_entries. Caches may do this in several steps, each call
+ * only looking at part of their thumbnails. Caches that don't implement
+ * eviction are left alone.
+ *
+ * Return value: the number of thumbnails removed.
+ */
+guint
+tumbler_cache_evict (TumblerCache *cache,
+                     TumblerThumbnailFlavor *flavor,
+                     guint64 max_size,
+                     guint max_entries,
+                     GCancellable *cancellable)
+{
+  g_return_val_if_fail (TUMBLER_IS_CACHE (cache), 0);
+  g_return_val_if_fail (TUMBLER_IS_THUMBNAIL_FLAVOR (flavor), 0);
+  g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), 0);
+
+  /* not every cache can be bounded */
+  if (TUMBLER_CACHE_GET_IFACE (cache)->evict == NULL)
+    return 0;
+
+  return (TUMBLER_CACHE_GET_IFACE (cache)->evict) (cache, flavor, max_size,
+                                                   max_entries, cancellable);
+}
+
 #define __TUMBLER_CACHE_C__
 #include "tumbler-visibility.c"
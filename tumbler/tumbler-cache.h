@@ -60,6 +60,11 @@ struct _TumblerCacheInterface
   gboolean (*is_thumbnail) (TumblerCache *cache,
                             const gchar *uri);
   GList *(*get_flavors) (TumblerCache *cache);
+  guint (*evict) (TumblerCache *cache,
+                  TumblerThumbnailFlavor *flavor,
+                  guint64 max_size,
+                  guint max_entries,
+                  GCancellable *cancellable);
 };
 
 TumblerCache *
@@ -92,6 +97,12 @@ tumbler_cache_get_flavors (TumblerCache *cache) G_GNUC_MALLOC G_GNUC_WARN_UNUSED
 TumblerThumbnailFlavor *
 tumbler_cache_get_flavor (TumblerCache *cache,
                           const gchar *name) G_GNUC_WARN_UNUSED_RESULT;
+guint
+tumbler_cache_evict (TumblerCache *cache,
+                     TumblerThumbnailFlavor *flavor,
+                     guint64 max_size,
+                     guint max_entries,
+                     GCancellable *cancellable);
 
 G_END_DECLS
 
@@ -127,33 +127,97 @@ tumbler_provider_factory_add_types (TumblerProviderFactory *factory,
   /* collect all the types provided by the plugin */
   tumbler_provider_plugin_get_types (plugin, &types, &n_types);
 
-  /* resize the provider info array */
-  g_ptr_array_set_size (factory->provider_infos,
-                        factory->provider_infos->len + n_types);
-
   for (n = 0; n < n_types; ++n)
     {
+      /* skip types already added by a previous load of the plugin */
+      for (idx = 0; idx < factory->provider_infos->len; ++idx)
+        {
+          provider_info = factory->provider_infos->pdata[idx];
+          if (provider_info->type == types[n])
+            break;
+        }
+
+      if (idx < factory->provider_infos->len)
+        continue;
+
       /* allocate a new provider info structure */
       provider_info = g_slice_new0 (TumblerProviderInfo);
       provider_info->type = types[n];
       provider_info->provider = NULL;
 
-      /* compute the idx for this info */
-      idx = factory->provider_infos->len - n_types + n;
-
       /* insert the provider info into the array */
-      factory->provider_infos->pdata[idx] = provider_info;
+      g_ptr_array_add (factory->provider_infos, provider_info);
     }
 }
 
 
 
+static TumblerProviderPlugin *
+tumbler_provider_factory_get_plugin (const gchar *basename)
+{
+  TumblerProviderPlugin *plugin;
+  GList *lp;
+
+  /* check if we already have that module */
+  for (lp = tumbler_provider_plugins; lp != NULL; lp = lp->next)
+    if (g_str_equal (G_TYPE_MODULE (lp->data)->name, basename))
+      return TUMBLER_PROVIDER_PLUGIN (lp->data);
+
+  /* allocate a new plugin and add it to our list */
+  plugin = tumbler_provider_plugin_new (basename);
+  tumbler_provider_plugins = g_list_prepend (tumbler_provider_plugins, plugin);
+
+  return plugin;
+}
+
+
+
+static GList *
+tumbler_provider_factory_prepend_provider (GList *providers,
+                                           TumblerProviderInfo *info,
+                                           GType type,
+                                           GKeyFile *rc)
+{
+  const gchar *type_name;
+  gchar *name;
+  gboolean disabled;
+
+  /* check if this plugin is disabled with the assumption
+   * the provider only provides 1 type; without settings, every
+   * provider is included */
+  type_name = g_type_name (info->type);
+  g_assert (g_str_has_suffix (type_name, "Provider"));
+  name = g_strndup (type_name, strlen (type_name) - 8);
+  disabled = rc != NULL && g_key_file_get_boolean (rc, name, "Disabled", NULL);
+  if (disabled)
+    {
+      g_debug ("Thumbnailer \"%s\" disabled in config file", name);
+      g_free (name);
+      return providers;
+    }
+  g_free (name);
+
+  /* check if the provider type implements the given type */
+  if (G_LIKELY (g_type_is_a (info->type, type)))
+    {
+      /* create the provider on demand */
+      if (info->provider == NULL)
+        info->provider = g_object_new (info->type, NULL);
+
+      /* add the provider to the list */
+      providers = g_list_prepend (providers, g_object_ref (info->provider));
+    }
+
+  return providers;
+}
+
+
+
 static GList *
 tumbler_provider_factory_load_plugins (TumblerProviderFactory *factory)
 {
   TumblerProviderPlugin *plugin;
   const gchar *basename;
-  GList *lp;
   GList *plugins = NULL;
   GDir *dir;
 
@@ -171,23 +235,8 @@ tumbler_provider_factory_load_plugins (TumblerProviderFactory *factory)
           /* check if this is a valid plugin file */
           if (g_str_has_suffix (basename, "." G_MODULE_SUFFIX))
             {
-              /* check if we already have that module */
-              for (lp = tumbler_provider_plugins; lp != NULL; lp = lp->next)
-                if (g_str_equal (G_TYPE_MODULE (lp->data)->name, basename))
-                  break;
-
-              /* use or allocate a new plugin for the file */
-              if (lp != NULL)
-                {
-                  /* reuse the existing plugin */
-                  plugin = TUMBLER_PROVIDER_PLUGIN (lp->data);
-                }
-              else
-                {
-                  /* allocate a new plugin and add it to our list */
-                  plugin = tumbler_provider_plugin_new (basename);
-                  tumbler_provider_plugins = g_list_prepend (tumbler_provider_plugins, plugin);
-                }
+              /* use or allocate a plugin for the file */
+              plugin = tumbler_provider_factory_get_plugin (basename);
 
               /* try to load the plugin */
               if (g_type_module_use (G_TYPE_MODULE (plugin)))
@@ -210,6 +259,15 @@ tumbler_provider_factory_load_plugins (TumblerProviderFactory *factory)
 
 
 
+static gint
+tumbler_provider_factory_compare_modules (gconstpointer a,
+                                          gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar *const *) a, *(const gchar *const *) b);
+}
+
+
+
 TumblerProviderFactory *
 tumbler_provider_factory_get_default (void)
 {
@@ -238,14 +296,10 @@ GList *
 tumbler_provider_factory_get_providers (TumblerProviderFactory *factory,
                                         GType type)
 {
-  TumblerProviderInfo *info;
   GList *lp;
   GList *plugins;
   GList *providers = NULL;
   guint n;
-  const gchar *type_name;
-  gchar *name;
-  gboolean disabled;
   GKeyFile *rc;
 
   G_LOCK (factory_lock);
@@ -258,34 +312,9 @@ tumbler_provider_factory_get_providers (TumblerProviderFactory *factory,
 
   /* iterate over all provider infos */
   for (n = 0; n < factory->provider_infos->len; ++n)
-    {
-      info = factory->provider_infos->pdata[n];
-
-      /* check if this plugin is disabled with the assumption
-       * the provider only provides 1 type */
-      type_name = g_type_name (info->type);
-      g_assert (g_str_has_suffix (type_name, "Provider"));
-      name = g_strndup (type_name, strlen (type_name) - 8);
-      disabled = g_key_file_get_boolean (rc, name, "Disabled", NULL);
-      if (disabled)
-        {
-          g_debug ("Thumbnailer \"%s\" disabled in config file", name);
-          g_free (name);
-          continue;
-        }
-      g_free (name);
-
-      /* check if the provider type implements the given type */
-      if (G_LIKELY (g_type_is_a (info->type, type)))
-        {
-          /* create the provider on demand */
-          if (info->provider == NULL)
-            info->provider = g_object_new (info->type, NULL);
-
-          /* add the provider to the list */
-          providers = g_list_prepend (providers, g_object_ref (info->provider));
-        }
-    }
+    providers = tumbler_provider_factory_prepend_provider (providers,
+                                                           factory->provider_infos->pdata[n],
+                                                           type, rc);
 
   /* release all plugins */
   for (lp = plugins; lp != NULL; lp = lp->next)
@@ -299,5 +328,89 @@ tumbler_provider_factory_get_providers (TumblerProviderFactory *factory,
   return providers;
 }
 
+
+
+gchar **
+tumbler_provider_factory_list_modules (TumblerProviderFactory *factory)
+{
+  GPtrArray *modules;
+  const gchar *basename;
+  GDir *dir;
+
+  g_return_val_if_fail (TUMBLER_IS_PROVIDER_FACTORY (factory), NULL);
+
+  modules = g_ptr_array_new ();
+
+  dir = g_dir_open (TUMBLER_PLUGIN_DIRECTORY, 0, NULL);
+  if (dir != NULL)
+    {
+      for (basename = g_dir_read_name (dir);
+           basename != NULL;
+           basename = g_dir_read_name (dir))
+        {
+          if (g_str_has_suffix (basename, "." G_MODULE_SUFFIX))
+            g_ptr_array_add (modules, g_strdup (basename));
+        }
+
+      g_dir_close (dir);
+    }
+
+  g_ptr_array_sort (modules, tumbler_provider_factory_compare_modules);
+  g_ptr_array_add (modules, NULL);
+
+  return (gchar **) g_ptr_array_free (modules, FALSE);
+}
+
+
+
+GList *
+tumbler_provider_factory_get_module_providers (TumblerProviderFactory *factory,
+                                               const gchar *module,
+                                               GType type,
+                                               gboolean include_disabled)
+{
+  TumblerProviderPlugin *plugin;
+  TumblerProviderInfo *info;
+  const GType *types;
+  GList *providers = NULL;
+  GKeyFile *rc = NULL;
+  gint n_types;
+  gint n;
+  guint i;
+
+  g_return_val_if_fail (TUMBLER_IS_PROVIDER_FACTORY (factory), NULL);
+  g_return_val_if_fail (module != NULL, NULL);
+
+  G_LOCK (factory_lock);
+
+  plugin = tumbler_provider_factory_get_plugin (module);
+  if (g_type_module_use (G_TYPE_MODULE (plugin)))
+    {
+      tumbler_provider_factory_add_types (factory, plugin);
+
+      if (!include_disabled)
+        rc = tumbler_util_get_settings ();
+
+      /* only instantiate the providers of this plugin */
+      tumbler_provider_plugin_get_types (plugin, &types, &n_types);
+      for (n = 0; n < n_types; ++n)
+        for (i = 0; i < factory->provider_infos->len; ++i)
+          {
+            info = factory->provider_infos->pdata[i];
+            if (info->type == types[n])
+              providers = tumbler_provider_factory_prepend_provider (providers, info, type, rc);
+          }
+
+      if (rc != NULL)
+        g_key_file_free (rc);
+
+      g_type_module_unuse (G_TYPE_MODULE (plugin));
+    }
+
+  G_UNLOCK (factory_lock);
+
+  return providers;
+}
+
 #define __TUMBLER_PROVIDER_FACTORY_C__
 #include "tumbler-visibility.c"
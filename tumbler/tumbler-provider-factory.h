@@ -37,6 +37,13 @@ tumbler_provider_factory_get_default (void);
 GList *
 tumbler_provider_factory_get_providers (TumblerProviderFactory *factory,
                                         GType type) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+gchar **
+tumbler_provider_factory_list_modules (TumblerProviderFactory *factory) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+GList *
+tumbler_provider_factory_get_module_providers (TumblerProviderFactory *factory,
+                                               const gchar *module,
+                                               GType type,
+                                               gboolean include_disabled) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
 
 G_END_DECLS;
 
@@ -20,6 +20,7 @@
 
 #include "tumbler-cache.h"
 #include "tumbler-thumbnail.h"
+#include "tumbler-util.h"
 #include "tumbler-visibility.h"
 
 
@@ -55,6 +56,23 @@ tumbler_thumbnail_default_init (TumblerThumbnailIface *klass)
 
 
 
+static void
+tumbler_thumbnail_trace_save (TumblerThumbnail *thumbnail,
+                              gint64 begin_time)
+{
+  gchar *uri;
+
+  /* don't even look up the URI when not tracing */
+  if (begin_time == 0)
+    return;
+
+  g_object_get (thumbnail, "uri", &uri, NULL);
+  tumbler_util_trace_end (begin_time, "save", "uri=%s", uri);
+  g_free (uri);
+}
+
+
+
 gboolean
 tumbler_thumbnail_load (TumblerThumbnail *thumbnail,
                         GCancellable *cancellable,
@@ -91,14 +109,21 @@ tumbler_thumbnail_save_image_data (TumblerThumbnail *thumbnail,
                                    GCancellable *cancellable,
                                    GError **error)
 {
+  gboolean success;
+  gint64 begin_time;
+
   g_return_val_if_fail (TUMBLER_IS_THUMBNAIL (thumbnail), FALSE);
   g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
   g_return_val_if_fail (TUMBLER_THUMBNAIL_GET_IFACE (thumbnail)->save_image_data != NULL, FALSE);
 
-  return (TUMBLER_THUMBNAIL_GET_IFACE (thumbnail)->save_image_data) (thumbnail, data,
-                                                                     mtime, cancellable,
-                                                                     error);
+  begin_time = tumbler_util_trace_begin ();
+  success = (TUMBLER_THUMBNAIL_GET_IFACE (thumbnail)->save_image_data) (thumbnail, data,
+                                                                        mtime, cancellable,
+                                                                        error);
+  tumbler_thumbnail_trace_save (thumbnail, begin_time);
+
+  return success;
 }
 
 
@@ -110,14 +135,43 @@ tumbler_thumbnail_save_file (TumblerThumbnail *thumbnail,
                              GCancellable *cancellable,
                              GError **error)
 {
+  gboolean success;
+  gint64 begin_time;
+
   g_return_val_if_fail (TUMBLER_IS_THUMBNAIL (thumbnail), FALSE);
   g_return_val_if_fail (G_IS_FILE (file), FALSE);
   g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
   g_return_val_if_fail (TUMBLER_THUMBNAIL_GET_IFACE (thumbnail)->save_file != NULL, FALSE);
 
-  return (TUMBLER_THUMBNAIL_GET_IFACE (thumbnail)->save_file) (thumbnail, file, mtime,
-                                                               cancellable, error);
+  begin_time = tumbler_util_trace_begin ();
+  success = (TUMBLER_THUMBNAIL_GET_IFACE (thumbnail)->save_file) (thumbnail, file, mtime,
+                                                                  cancellable, error);
+  tumbler_thumbnail_trace_save (thumbnail, begin_time);
+
+  return success;
+}
+
+
+
+/* the encoded thumbnail as stored in the cache, for caches that can hand it out */
+GBytes *
+tumbler_thumbnail_load_bytes (TumblerThumbnail *thumbnail,
+                              GCancellable *cancellable,
+                              GError **error)
+{
+  g_return_val_if_fail (TUMBLER_IS_THUMBNAIL (thumbnail), NULL);
+  g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  if (TUMBLER_THUMBNAIL_GET_IFACE (thumbnail)->load_bytes == NULL)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "The thumbnail cache does not provide thumbnail data");
+      return NULL;
+    }
+
+  return (TUMBLER_THUMBNAIL_GET_IFACE (thumbnail)->load_bytes) (thumbnail, cancellable, error);
 }
 
 
@@ -72,6 +72,9 @@ struct _TumblerThumbnailInterface
                          gdouble mtime,
                          GCancellable *cancellable,
                          GError **error);
+  GBytes *(*load_bytes) (TumblerThumbnail *thumbnail,
+                         GCancellable *cancellable,
+                         GError **error);
 };
 
 gboolean
@@ -94,6 +97,10 @@ tumbler_thumbnail_save_file (TumblerThumbnail *thumbnail,
                              gdouble mtime,
                              GCancellable *cancellable,
                              GError **error);
+GBytes *
+tumbler_thumbnail_load_bytes (TumblerThumbnail *thumbnail,
+                              GCancellable *cancellable,
+                              GError **error) G_GNUC_WARN_UNUSED_RESULT;
 TumblerThumbnailFlavor *
 tumbler_thumbnail_get_flavor (TumblerThumbnail *thumbnail);
 
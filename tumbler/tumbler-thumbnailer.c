@@ -77,6 +77,13 @@ tumbler_thumbnailer_default_init (TumblerThumbnailerIface *klass)
                                                            0, G_MAXINT64, 0,
                                                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_interface_install_property (klass,
+                                       g_param_spec_int ("max-concurrency",
+                                                         "max-concurrency",
+                                                         "max-concurrency",
+                                                         0, G_MAXINT, 0,
+                                                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   g_object_interface_install_property (klass,
                                        g_param_spec_pointer ("locations",
                                                              "locations",
@@ -211,6 +218,47 @@ tumbler_thumbnailer_get_max_file_size (TumblerThumbnailer *thumbnailer)
 
 
 
+gint
+tumbler_thumbnailer_get_max_concurrency (TumblerThumbnailer *thumbnailer)
+{
+  gint max_concurrency;
+
+  g_return_val_if_fail (TUMBLER_IS_THUMBNAILER (thumbnailer), 0);
+
+  g_object_get (thumbnailer, "max-concurrency", &max_concurrency, NULL);
+  return max_concurrency;
+}
+
+
+
+gboolean
+tumbler_thumbnailer_is_saturated (TumblerThumbnailer *thumbnailer)
+{
+  g_return_val_if_fail (TUMBLER_IS_THUMBNAILER (thumbnailer), FALSE);
+
+  /* thumbnailers without admission control never make callers wait */
+  if (TUMBLER_THUMBNAILER_GET_IFACE (thumbnailer)->is_saturated == NULL)
+    return FALSE;
+
+  return (*TUMBLER_THUMBNAILER_GET_IFACE (thumbnailer)->is_saturated) (thumbnailer);
+}
+
+
+
+void
+tumbler_thumbnailer_reclaim (TumblerThumbnailer *thumbnailer)
+{
+  g_return_if_fail (TUMBLER_IS_THUMBNAILER (thumbnailer));
+
+  /* thumbnailers without cached resources have nothing to release */
+  if (TUMBLER_THUMBNAILER_GET_IFACE (thumbnailer)->reclaim == NULL)
+    return;
+
+  (*TUMBLER_THUMBNAILER_GET_IFACE (thumbnailer)->reclaim) (thumbnailer);
+}
+
+
+
 gboolean
 tumbler_thumbnailer_supports_location (TumblerThumbnailer *thumbnailer,
                                        GFile *file)
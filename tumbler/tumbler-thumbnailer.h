@@ -54,6 +54,8 @@ struct _TumblerThumbnailerInterface
   void (*create) (TumblerThumbnailer *thumbnailer,
                   GCancellable *cancellable,
                   TumblerFileInfo *info);
+  gboolean (*is_saturated) (TumblerThumbnailer *thumbnailer);
+  void (*reclaim) (TumblerThumbnailer *thumbnailer);
 };
 
 void
@@ -71,6 +73,12 @@ gint
 tumbler_thumbnailer_get_priority (TumblerThumbnailer *thumbnailer);
 gint64
 tumbler_thumbnailer_get_max_file_size (TumblerThumbnailer *thumbnailer);
+gint
+tumbler_thumbnailer_get_max_concurrency (TumblerThumbnailer *thumbnailer);
+gboolean
+tumbler_thumbnailer_is_saturated (TumblerThumbnailer *thumbnailer);
+void
+tumbler_thumbnailer_reclaim (TumblerThumbnailer *thumbnailer);
 
 gboolean
 tumbler_thumbnailer_supports_location (TumblerThumbnailer *thumbnailer,
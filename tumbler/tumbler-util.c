@@ -26,13 +26,59 @@
 #include <math.h>
 #include <sys/stat.h>
 
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
 
+#ifdef HAVE_SYSPROF
+#include <sysprof-capture.h>
+#endif
+
 /* Float block size used in the stat struct */
 #define TUMBLER_STAT_BLKSIZE 512.
 
+/* pixel buffers are rounded up to size classes a quarter of a power of two
+ * apart, starting at this size */
+#define PIXELS_MIN_SIZE (64 * 1024)
+#define PIXELS_N_STEPS 4
+
+/* free pixel buffers kept per thread, most recently released first, up to
+ * this many and this many bytes; larger buffers, e.g. for the full size image
+ * of a large photo, are rare enough to go back to malloc right away */
+#define PIXELS_MAX_FREE 8
+#define PIXELS_MAX_ARENA_SIZE (32 * 1024 * 1024)
+#define PIXELS_MAX_CACHED_SIZE (8 * 1024 * 1024)
+
+/* room for the size class in front of the pixels, keeping malloc alignment */
+#define PIXELS_HEADER_SIZE 16
+
+
+
+typedef struct
+{
+  GQueue blocks;
+  gsize size;
+} TumblerPixelsArena;
+
+
+
+static void
+tumbler_util_pixels_arena_free (gpointer data);
+
+
+
+static GPrivate pixels_arena = G_PRIVATE_INIT (tumbler_util_pixels_arena_free);
+static GPrivate background_io;
+G_LOCK_DEFINE_STATIC (pixels_stats);
+static guint64 pixels_hits = 0;
+static guint64 pixels_misses = 0;
+
 
 
 /* that's what `! g_log_writer_default_would_drop (G_LOG_LEVEL_DEBUG, log_domain)` leads to:
@@ -396,6 +442,7 @@ tumbler_util_scale_pixbuf (GdkPixbuf *source,
                            gint dest_width,
                            gint dest_height)
 {
+  GdkPixbuf *dest;
   gdouble hratio, wratio;
   gint source_width, source_height;
 
@@ -419,9 +466,20 @@ tumbler_util_scale_pixbuf (GdkPixbuf *source,
   else
     dest_height = rint (source_height / wratio);
 
-  /* scale the pixbuf down to the desired size */
-  return gdk_pixbuf_scale_simple (source, MAX (dest_width, 1), MAX (dest_height, 1),
-                                  GDK_INTERP_BILINEAR);
+  dest_width = MAX (dest_width, 1);
+  dest_height = MAX (dest_height, 1);
+
+  /* scale the pixbuf down to the desired size, into a pixel buffer from the arena */
+  dest = tumbler_util_pixbuf_new (gdk_pixbuf_get_has_alpha (source), dest_width, dest_height);
+  if (dest == NULL)
+    return NULL;
+
+  gdk_pixbuf_scale (source, dest, 0, 0, dest_width, dest_height, 0, 0,
+                    (gdouble) dest_width / source_width,
+                    (gdouble) dest_height / source_height,
+                    GDK_INTERP_BILINEAR);
+
+  return dest;
 }
 
 
@@ -433,5 +491,276 @@ tumbler_util_object_ref (gconstpointer src,
   return g_object_ref ((gpointer) src);
 }
 
+
+
+static gsize
+tumbler_util_pixels_class_size (gsize size)
+{
+  gsize step;
+
+  if (size <= PIXELS_MIN_SIZE)
+    return PIXELS_MIN_SIZE;
+
+  /* size lies in (2^(n-1), 2^n], split that range into PIXELS_N_STEPS */
+  step = ((gsize) 1 << (g_bit_storage (size - 1) - 1)) / PIXELS_N_STEPS;
+
+  return (size + step - 1) & ~(step - 1);
+}
+
+
+
+static void
+tumbler_util_pixels_arena_free (gpointer data)
+{
+  TumblerPixelsArena *arena = data;
+
+  g_queue_clear_full (&arena->blocks, g_free);
+  g_slice_free (TumblerPixelsArena, arena);
+}
+
+
+
+/* pixel buffers are borrowed from an arena of the calling thread, so that a
+ * worker thread reuses the same few large blocks for every thumbnail instead
+ * of mapping and unmapping them each time */
+gpointer
+tumbler_util_pixels_alloc (gsize size)
+{
+  TumblerPixelsArena *arena;
+  GList *lp;
+  gsize class_size;
+  guchar *block = NULL;
+
+  g_return_val_if_fail (size <= G_MAXSIZE - PIXELS_HEADER_SIZE, NULL);
+
+  class_size = tumbler_util_pixels_class_size (size);
+
+  arena = g_private_get (&pixels_arena);
+  if (arena != NULL)
+    {
+      for (lp = arena->blocks.head; lp != NULL; lp = lp->next)
+        if (*(gsize *) lp->data == class_size)
+          {
+            block = lp->data;
+            g_queue_delete_link (&arena->blocks, lp);
+            arena->size -= class_size;
+            break;
+          }
+    }
+
+  G_LOCK (pixels_stats);
+  if (block != NULL)
+    pixels_hits++;
+  else
+    pixels_misses++;
+  G_UNLOCK (pixels_stats);
+
+  if (block == NULL)
+    {
+      block = g_malloc (PIXELS_HEADER_SIZE + class_size);
+      *(gsize *) block = class_size;
+    }
+
+  return block + PIXELS_HEADER_SIZE;
+}
+
+
+
+void
+tumbler_util_pixels_free (gpointer pixels)
+{
+  TumblerPixelsArena *arena;
+  guchar *block;
+  gsize class_size;
+
+  if (pixels == NULL)
+    return;
+
+  block = (guchar *) pixels - PIXELS_HEADER_SIZE;
+  class_size = *(gsize *) block;
+  if (class_size > PIXELS_MAX_CACHED_SIZE)
+    {
+      g_free (block);
+      return;
+    }
+
+  arena = g_private_get (&pixels_arena);
+  if (arena == NULL)
+    {
+      arena = g_slice_new0 (TumblerPixelsArena);
+      g_private_set (&pixels_arena, arena);
+    }
+
+  /* the block goes to the arena of the thread releasing it */
+  g_queue_push_head (&arena->blocks, block);
+  arena->size += class_size;
+
+  while (arena->blocks.length > PIXELS_MAX_FREE || arena->size > PIXELS_MAX_ARENA_SIZE)
+    {
+      block = g_queue_pop_tail (&arena->blocks);
+      arena->size -= *(gsize *) block;
+      g_free (block);
+    }
+}
+
+
+
+static void
+tumbler_util_pixbuf_free_pixels (guchar *pixels,
+                                 gpointer data)
+{
+  tumbler_util_pixels_free (pixels);
+}
+
+
+
+GdkPixbuf *
+tumbler_util_pixbuf_new (gboolean has_alpha,
+                         gint width,
+                         gint height)
+{
+  gint channels = has_alpha ? 4 : 3;
+  gint rowstride;
+
+  g_return_val_if_fail (width > 0 && height > 0, NULL);
+
+  if (width > (G_MAXINT - 3) / channels)
+    return NULL;
+
+  /* same row alignment as gdk_pixbuf_new() */
+  rowstride = (width * channels + 3) & ~3;
+  if ((gsize) height > (G_MAXSIZE - PIXELS_HEADER_SIZE) / rowstride)
+    return NULL;
+
+  return gdk_pixbuf_new_from_data (tumbler_util_pixels_alloc ((gsize) rowstride * height),
+                                   GDK_COLORSPACE_RGB, has_alpha, 8, width, height,
+                                   rowstride, tumbler_util_pixbuf_free_pixels, NULL);
+}
+
+
+
+void
+tumbler_util_pixels_get_stats (guint64 *hits,
+                               guint64 *misses)
+{
+  G_LOCK (pixels_stats);
+  if (hits != NULL)
+    *hits = pixels_hits;
+  if (misses != NULL)
+    *misses = pixels_misses;
+  G_UNLOCK (pixels_stats);
+}
+
+
+
+/* Marks the calling thread as one that generates thumbnails nobody is waiting
+ * for, so that the source files it reads are dropped from the page cache again
+ * instead of evicting the user's working set */
+void
+tumbler_util_set_background_io (gboolean background)
+{
+  g_private_set (&background_io, GINT_TO_POINTER (background));
+}
+
+
+
+/* The range of @fd will be read sequentially and soon, a @length of 0 meaning
+ * the rest of the file */
+void
+tumbler_util_advise_read (gint fd,
+                          goffset offset,
+                          goffset length)
+{
+  g_return_if_fail (fd >= 0);
+
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise (fd, offset, length, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise (fd, offset, length, POSIX_FADV_WILLNEED);
+#endif
+}
+
+
+
+/* Drops the range of @fd from the page cache on background threads once the
+ * thumbnail has been generated. Pages still mapped are kept, so unmap first. */
+void
+tumbler_util_advise_done (gint fd,
+                          goffset offset,
+                          goffset length)
+{
+  g_return_if_fail (fd >= 0);
+
+#ifdef HAVE_POSIX_FADVISE
+  if (g_private_get (&background_io) != NULL)
+    posix_fadvise (fd, offset, length, POSIX_FADV_DONTNEED);
+#endif
+}
+
+
+
+/* Like tumbler_util_advise_done() for the whole of @file, for thumbnailers that
+ * read it through a stream */
+void
+tumbler_util_advise_file_done (GFile *file)
+{
+#ifdef HAVE_POSIX_FADVISE
+  const gchar *path;
+  gint fd;
+
+  g_return_if_fail (G_IS_FILE (file));
+
+  if (g_private_get (&background_io) == NULL)
+    return;
+
+  /* the page cache is shared by every descriptor of the file */
+  path = g_file_peek_path (file);
+  if (path == NULL)
+    return;
+
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd >= 0)
+    {
+      posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+      close (fd);
+    }
+#endif
+}
+
+
+
+/* tracing marks are only recorded while running under sysprof, the begin time
+ * is 0 otherwise, so that tumbler_util_trace_end() returns immediately */
+gint64
+tumbler_util_trace_begin (void)
+{
+#ifdef HAVE_SYSPROF
+  if (sysprof_collector_is_active ())
+    return SYSPROF_CAPTURE_CURRENT_TIME;
+#endif
+
+  return 0;
+}
+
+
+
+void
+tumbler_util_trace_end (gint64 begin_time,
+                        const gchar *name,
+                        const gchar *format,
+                        ...)
+{
+#ifdef HAVE_SYSPROF
+  va_list args;
+
+  if (begin_time == 0)
+    return;
+
+  va_start (args, format);
+  sysprof_collector_mark_vprintf (begin_time, SYSPROF_CAPTURE_CURRENT_TIME - begin_time,
+                                  "tumbler", name, format, args);
+  va_end (args);
+#endif
+}
+
 #define __TUMBLER_UTIL_C__
 #include "tumbler-visibility.c"
@@ -79,6 +79,46 @@ gpointer
 tumbler_util_object_ref (gconstpointer src,
                          gpointer data);
 
+gpointer
+tumbler_util_pixels_alloc (gsize size) G_GNUC_MALLOC;
+
+void
+tumbler_util_pixels_free (gpointer pixels);
+
+GdkPixbuf *
+tumbler_util_pixbuf_new (gboolean has_alpha,
+                         gint width,
+                         gint height) G_GNUC_WARN_UNUSED_RESULT;
+
+void
+tumbler_util_pixels_get_stats (guint64 *hits,
+                               guint64 *misses);
+
+void
+tumbler_util_set_background_io (gboolean background);
+
+void
+tumbler_util_advise_read (gint fd,
+                          goffset offset,
+                          goffset length);
+
+void
+tumbler_util_advise_done (gint fd,
+                          goffset offset,
+                          goffset length);
+
+void
+tumbler_util_advise_file_done (GFile *file);
+
+gint64
+tumbler_util_trace_begin (void);
+
+void
+tumbler_util_trace_end (gint64 begin_time,
+                        const gchar *name,
+                        const gchar *format,
+                        ...) G_GNUC_PRINTF (3, 4);
+
 G_END_DECLS
 
 #endif /* !__TUMBLER_UTIL_H__ */
@@ -20,10 +20,13 @@
  */
 
 #include "tumbler-cache-service.h"
+#include "tumbler-lazy-thumbnailer.h"
 #include "tumbler-lifecycle-manager.h"
 #include "tumbler-manager.h"
+#include "tumbler-plugin-cache.h"
 #include "tumbler-registry.h"
 #include "tumbler-service.h"
+#include "tumbler-stats-service.h"
 
 #include "tumbler/tumbler.h"
 
@@ -31,6 +34,11 @@
 #include <libxfce4util/libxfce4util.h>
 #include <stdlib.h>
 
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#include <signal.h>
+#endif
+
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
 #endif
@@ -56,6 +64,44 @@ shutdown_tumbler (TumblerLifecycleManager *lifecycle_manager,
 
 
 
+static void
+release_tumbler (TumblerLifecycleManager *lifecycle_manager,
+                 TumblerRegistry *registry)
+{
+  GList *thumbnailers;
+  GList *lp;
+
+  g_return_if_fail (TUMBLER_IS_LIFECYCLE_MANAGER (lifecycle_manager));
+  g_return_if_fail (TUMBLER_IS_REGISTRY (registry));
+
+  /* drop the plugin thumbnailers that were loaded on demand, along with
+   * their decoder state */
+  thumbnailers = tumbler_registry_get_thumbnailers (registry);
+  for (lp = thumbnailers; lp != NULL; lp = lp->next)
+    if (TUMBLER_IS_LAZY_THUMBNAILER (lp->data))
+      tumbler_lazy_thumbnailer_release (lp->data);
+  g_list_free_full (thumbnailers, g_object_unref);
+
+  g_thread_pool_stop_unused_threads ();
+}
+
+
+
+#ifdef G_OS_UNIX
+static gboolean
+on_terminate (gpointer user_data)
+{
+  GMainLoop *main_loop = user_data;
+
+  /* leave through the main loop, so that everything is shut down and saved */
+  g_main_loop_quit (main_loop);
+
+  return G_SOURCE_CONTINUE;
+}
+#endif
+
+
+
 static void
 on_dbus_name_lost (GDBusConnection *connection,
                    const gchar *name,
@@ -79,6 +125,7 @@ main (int argc,
   TumblerManager *manager;
   TumblerService *service;
   TumblerCacheService *cache_service;
+  TumblerStatsService *stats_service;
   GMainLoop *main_loop;
   GError *error = NULL;
   GList *providers;
@@ -87,7 +134,12 @@ main (int argc,
   GList *tp;
   gint retval = EXIT_SUCCESS;
   GKeyFile *rc;
+  GKeyFile *plugin_cache;
+  gchar **modules;
+  gboolean cached;
+  guint n;
   gint64 file_size;
+  gint max_concurrency;
   gint priority;
   const gchar *type_name;
   gchar **paths;
@@ -131,18 +183,37 @@ main (int argc,
   /* take a reference on the provider factory */
   provider_factory = tumbler_provider_factory_get_default ();
 
-  /* query all thumbnailer providers from the factory */
-  providers = tumbler_provider_factory_get_providers (provider_factory,
-                                                      TUMBLER_TYPE_THUMBNAILER_PROVIDER);
-
   /* settings */
   rc = tumbler_util_get_settings ();
 
-  /* iterate over all providers */
-  for (lp = providers; lp != NULL; lp = lp->next)
+  /* thumbnailers listed in the plugin cache are registered without loading
+   * their module, which only happens once they are first used */
+  plugin_cache = tumbler_plugin_cache_load ();
+
+  /* iterate over all plugin modules */
+  modules = tumbler_provider_factory_list_modules (provider_factory);
+  for (n = 0; modules[n] != NULL; n++)
     {
-      /* query the list of thumbnailers provided by this provider */
-      thumbnailers = tumbler_thumbnailer_provider_get_thumbnailers (lp->data);
+      cached = FALSE;
+      thumbnailers = NULL;
+      if (plugin_cache != NULL)
+        thumbnailers = tumbler_plugin_cache_get_thumbnailers (plugin_cache, modules[n], rc, &cached);
+
+      if (!cached)
+        {
+          /* query all thumbnailer providers of the module */
+          providers = tumbler_provider_factory_get_module_providers (provider_factory, modules[n],
+                                                                     TUMBLER_TYPE_THUMBNAILER_PROVIDER,
+                                                                     FALSE);
+
+          /* query the list of thumbnailers provided by these providers */
+          for (lp = providers; lp != NULL; lp = lp->next)
+            thumbnailers = g_list_concat (thumbnailers,
+                                          tumbler_thumbnailer_provider_get_thumbnailers (lp->data));
+
+          /* release all providers and free the provider list */
+          g_list_free_full (providers, g_object_unref);
+        }
 
       /* add all thumbnailers to the registry */
       for (tp = thumbnailers; tp != NULL; tp = tp->next)
@@ -151,9 +222,14 @@ main (int argc,
           if (g_object_class_find_property (G_OBJECT_GET_CLASS (tp->data), "exec") == NULL)
             {
               /* set settings from rc file */
-              type_name = G_OBJECT_TYPE_NAME (tp->data);
+              if (TUMBLER_IS_LAZY_THUMBNAILER (tp->data))
+                type_name = tumbler_lazy_thumbnailer_get_type_name (tp->data);
+              else
+                type_name = G_OBJECT_TYPE_NAME (tp->data);
+
               priority = g_key_file_get_integer (rc, type_name, "Priority", NULL);
               file_size = g_key_file_get_int64 (rc, type_name, "MaxFileSize", NULL);
+              max_concurrency = g_key_file_get_integer (rc, type_name, "MaxConcurrency", NULL);
 
               paths = g_key_file_get_string_list (rc, type_name, "Locations", NULL, NULL);
               locations = tumbler_util_locations_from_strv (paths);
@@ -164,6 +240,7 @@ main (int argc,
               g_strfreev (paths);
 
               g_object_set (tp->data, "priority", priority, "max-file-size", file_size,
+                            "max-concurrency", MAX (max_concurrency, 0),
                             "locations", locations, "excludes", excludes, NULL);
 
               /* cleanup */
@@ -179,20 +256,22 @@ main (int argc,
       g_list_free_full (thumbnailers, g_object_unref);
     }
 
-  g_key_file_free (rc);
+  g_strfreev (modules);
 
-  /* release all providers and free the provider list */
-  g_list_free_full (providers, g_object_unref);
+  if (plugin_cache != NULL)
+    g_key_file_free (plugin_cache);
 
-  /* drop the reference on the provider factory */
-  g_object_unref (provider_factory);
+  g_key_file_free (rc);
 
-  /* update the URI schemes / MIME types supported information */
-  tumbler_registry_update_supported (registry);
+  /* the URI schemes / MIME types supported information is updated by
+   * tumbler_manager_load(), once the specialized thumbnailers are known */
 
   /* create the thumbnail cache service */
   cache_service = tumbler_cache_service_new (connection, lifecycle_manager);
 
+  /* create the runtime metrics service */
+  stats_service = tumbler_stats_service_new (connection, lifecycle_manager);
+
   /* create the thumbnailer manager service */
   manager = tumbler_manager_new (connection, lifecycle_manager, registry);
 
@@ -214,6 +293,11 @@ main (int argc,
   /* create a new main loop */
   main_loop = g_main_loop_new (NULL, FALSE);
 
+#ifdef G_OS_UNIX
+  g_unix_signal_add (SIGTERM, on_terminate, main_loop);
+  g_unix_signal_add (SIGINT, on_terminate, main_loop);
+#endif
+
   /* Acquire the cache service dbus name */
   g_bus_own_name_on_connection (connection,
                                 TUMBLER_SERVICE_NAME_PREFIX ".Cache1",
@@ -232,6 +316,15 @@ main (int argc,
                                 main_loop,
                                 NULL);
 
+  /* Acquire the stats service dbus name */
+  g_bus_own_name_on_connection (connection,
+                                TUMBLER_SERVICE_NAME_PREFIX ".Stats1",
+                                G_BUS_NAME_OWNER_FLAGS_REPLACE,
+                                NULL, /* We dont need to do anything on name acquired*/
+                                on_dbus_name_lost,
+                                main_loop,
+                                NULL);
+
   /* Acquire the thumbnailer service dbus name */
   g_bus_own_name_on_connection (connection,
                                 TUMBLER_SERVICE_NAME_PREFIX ".Thumbnailer1",
@@ -244,7 +337,8 @@ main (int argc,
   /* check to see if all services are successfully exported on the bus */
   if (tumbler_manager_is_exported (manager)
       && tumbler_service_is_exported (service)
-      && tumbler_cache_service_is_exported (cache_service))
+      && tumbler_cache_service_is_exported (cache_service)
+      && tumbler_stats_service_is_exported (stats_service))
     {
       /* Let the manager initializes the thumbnailer
        * directory objects, directory monitors */
@@ -254,6 +348,10 @@ main (int argc,
       g_signal_connect (lifecycle_manager, "shutdown",
                         G_CALLBACK (shutdown_tumbler), main_loop);
 
+      /* release memory while idle, before shutting down */
+      g_signal_connect (lifecycle_manager, "release",
+                        G_CALLBACK (release_tumbler), registry);
+
       /* start the lifecycle manager */
       tumbler_lifecycle_manager_start (lifecycle_manager);
 
@@ -269,9 +367,13 @@ exit_tumbler:
   g_object_unref (service);
   g_object_unref (manager);
   g_object_unref (cache_service);
+  g_object_unref (stats_service);
   g_object_unref (registry);
   g_object_unref (lifecycle_manager);
 
+  /* drop the reference on the provider factory, kept for lazily loaded plugins */
+  g_object_unref (provider_factory);
+
   /* free the dbus session bus connection */
   g_object_unref (connection);
 
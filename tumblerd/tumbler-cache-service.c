@@ -20,6 +20,7 @@
 
 #include "tumbler-cache-service-gdbus.h"
 #include "tumbler-cache-service.h"
+#include "tumbler-scheduler.h"
 #include "tumbler-utils.h"
 
 #include "tumbler/tumbler.h"
@@ -31,6 +32,15 @@
 #define THUMBNAILER_CACHE_SERVICE TUMBLER_SERVICE_NAME_PREFIX ".Cache1"
 #define THUMBNAILER_CACHE_IFACE TUMBLER_SERVICE_NAME_PREFIX ".Cache1"
 
+/* defaults for the size budget in the [Cache] section of tumbler.rc,
+ * per flavor, in MiB and thumbnails; eviction is opt-in */
+#define EVICTION_MAX_SIZE 0
+#define EVICTION_MAX_ENTRIES 0
+
+/* the first eviction waits for startup to settle, later ones are rare */
+#define EVICTION_DELAY_SECONDS 60
+#define EVICTION_INTERVAL_SECONDS 3600
+
 typedef struct _MoveRequest MoveRequest;
 typedef struct _CopyRequest CopyRequest;
 typedef struct _DeleteRequest DeleteRequest;
@@ -73,6 +83,11 @@ tumbler_cache_service_delete_thread (gpointer data,
 static void
 tumbler_cache_service_cleanup_thread (gpointer data,
                                       gpointer user_data);
+static void
+tumbler_cache_service_evict_thread (gpointer data,
+                                    gpointer user_data);
+static gboolean
+tumbler_cache_service_evict_delay_timeout (gpointer user_data);
 
 
 
@@ -117,6 +132,13 @@ struct _TumblerCacheService
   GThreadPool *delete_pool;
   GThreadPool *cleanup_pool;
 
+  /* least recently used thumbnails are evicted in the background */
+  GThreadPool *evict_pool;
+  GCancellable *evict_cancellable;
+  guint evict_id;
+  guint64 max_size;
+  guint max_entries;
+
   TUMBLER_MUTEX (mutex);
 };
 
@@ -178,10 +200,38 @@ tumbler_cache_service_class_init (TumblerCacheServiceClass *klass)
 
 
 
+static guint
+tumbler_cache_service_get_setting (GKeyFile *rc,
+                                   const gchar *key,
+                                   guint default_value)
+{
+  GError *error = NULL;
+  gint value;
+
+  value = g_key_file_get_integer (rc, "Cache", key, &error);
+  if (error != NULL)
+    {
+      g_error_free (error);
+      return default_value;
+    }
+
+  return MAX (value, 0);
+}
+
+
+
 static void
 tumbler_cache_service_init (TumblerCacheService *service)
 {
+  GKeyFile *rc;
+
   tumbler_mutex_create (service->mutex);
+
+  rc = tumbler_util_get_settings ();
+  service->max_size = (guint64) tumbler_cache_service_get_setting (rc, "MaxSize", EVICTION_MAX_SIZE)
+                      * 1024 * 1024;
+  service->max_entries = tumbler_cache_service_get_setting (rc, "MaxEntries", EVICTION_MAX_ENTRIES);
+  g_key_file_free (rc);
 }
 
 
@@ -207,6 +257,17 @@ tumbler_cache_service_constructed (GObject *object)
   service->cleanup_pool = g_thread_pool_new (tumbler_cache_service_cleanup_thread,
                                              service, 1, FALSE, NULL);
 
+  /* an exclusive thread, its I/O priority is lowered for good */
+  if (service->cache != NULL && (service->max_size > 0 || service->max_entries > 0))
+    {
+      service->evict_pool = g_thread_pool_new (tumbler_cache_service_evict_thread,
+                                               service, 1, TRUE, NULL);
+      service->evict_cancellable = g_cancellable_new ();
+      service->evict_id = g_timeout_add_seconds (EVICTION_DELAY_SECONDS,
+                                                 tumbler_cache_service_evict_delay_timeout,
+                                                 service);
+    }
+
   service->skeleton = tumbler_exported_cache_service_skeleton_new ();
 
   /* everything's fine, install the cache type D-Bus info */
@@ -250,6 +311,17 @@ tumbler_cache_service_finalize (GObject *object)
   g_thread_pool_free (service->delete_pool, TRUE, TRUE);
   g_thread_pool_free (service->cleanup_pool, TRUE, TRUE);
 
+  if (service->evict_pool != NULL)
+    {
+      if (service->evict_id != 0)
+        g_source_remove (service->evict_id);
+
+      /* an eviction in progress stops at the next batch */
+      g_cancellable_cancel (service->evict_cancellable);
+      g_thread_pool_free (service->evict_pool, TRUE, TRUE);
+      g_object_unref (service->evict_cancellable);
+    }
+
   if (service->cache != NULL)
     g_object_unref (service->cache);
 
@@ -464,6 +536,74 @@ tumbler_cache_service_cleanup_thread (gpointer data,
 
 
 
+static void
+tumbler_cache_service_evict_thread (gpointer data,
+                                    gpointer user_data)
+{
+  TumblerCacheService *service = TUMBLER_CACHE_SERVICE (user_data);
+  static gboolean lowered_priority = FALSE;
+  GList *flavors;
+  GList *iter;
+  guint evicted = 0;
+
+  g_return_if_fail (TUMBLER_IS_CACHE_SERVICE (service));
+
+  /* eviction must never compete with thumbnail generation for the disk */
+  if (!lowered_priority)
+    {
+      tumbler_scheduler_thread_use_lower_priority ();
+      lowered_priority = TRUE;
+    }
+
+  /* one flavor at a time, each one stops early when cancelled */
+  flavors = tumbler_cache_get_flavors (service->cache);
+  for (iter = flavors; iter != NULL; iter = iter->next)
+    {
+      if (g_cancellable_is_cancelled (service->evict_cancellable))
+        break;
+
+      evicted += tumbler_cache_evict (service->cache, iter->data, service->max_size,
+                                      service->max_entries, service->evict_cancellable);
+    }
+  g_list_free_full (flavors, g_object_unref);
+
+  if (evicted > 0)
+    g_debug ("Evicted %u least recently used thumbnails", evicted);
+}
+
+
+
+static gboolean
+tumbler_cache_service_evict_timeout (gpointer user_data)
+{
+  TumblerCacheService *service = TUMBLER_CACHE_SERVICE (user_data);
+
+  /* skip this round if the previous one has not even started yet */
+  if (g_thread_pool_unprocessed (service->evict_pool) == 0)
+    g_thread_pool_push (service->evict_pool, GUINT_TO_POINTER (1), NULL);
+
+  return G_SOURCE_CONTINUE;
+}
+
+
+
+static gboolean
+tumbler_cache_service_evict_delay_timeout (gpointer user_data)
+{
+  TumblerCacheService *service = TUMBLER_CACHE_SERVICE (user_data);
+
+  tumbler_cache_service_evict_timeout (service);
+
+  /* after the first eviction, switch to the regular interval */
+  service->evict_id = g_timeout_add_seconds (EVICTION_INTERVAL_SECONDS,
+                                             tumbler_cache_service_evict_timeout,
+                                             service);
+
+  return G_SOURCE_REMOVE;
+}
+
+
+
 TumblerCacheService *
 tumbler_cache_service_new (GDBusConnection *connection,
                            TumblerLifecycleManager *lifecycle_manager)
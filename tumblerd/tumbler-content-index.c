@@ -0,0 +1,389 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "tumbler-content-index.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib/gstdio.h>
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Files are identified by their size, mime type and the blocks at their start,
+ * middle and end. That is enough to tell copies of the same photo or document
+ * apart from other files without reading them completely, and the thumbnailer
+ * reads these blocks anyway if the file turns out to be new. */
+
+#define CONTENT_BLOCK_SIZE (64 * 1024)
+#define CONTENT_INDEX_MAX_ENTRIES 65536
+#define CONTENT_KEY_DATA "tumbler-content-key"
+
+typedef struct _TumblerContentEntry TumblerContentEntry;
+
+
+
+struct _TumblerContentEntry
+{
+  gchar *uri;
+  gdouble mtime;
+};
+
+
+
+G_LOCK_DEFINE_STATIC (index);
+static GHashTable *content_index = NULL;
+
+
+
+static gboolean
+tumbler_content_index_is_enabled (void)
+{
+  static gsize enabled = 0;
+
+  if (g_once_init_enter (&enabled))
+    {
+      GKeyFile *rc = tumbler_util_get_settings ();
+      gboolean deduplicate = g_key_file_get_boolean (rc, "Cache", "Deduplicate", NULL);
+
+      g_key_file_free (rc);
+      g_once_init_leave (&enabled, deduplicate ? 2 : 1);
+    }
+
+  return enabled == 2;
+}
+
+
+
+static void
+tumbler_content_entry_free (gpointer data)
+{
+  TumblerContentEntry *entry = data;
+
+  g_free (entry->uri);
+  g_slice_free (TumblerContentEntry, entry);
+}
+
+
+
+static gboolean
+tumbler_content_index_read_block (gint fd,
+                                  guchar *buffer,
+                                  gsize count,
+                                  goffset offset,
+                                  GChecksum *checksum)
+{
+  gssize n_read;
+
+  while (count > 0)
+    {
+      n_read = pread (fd, buffer, count, offset);
+      if (n_read < 0 && errno == EINTR)
+        continue;
+      if (n_read <= 0)
+        return FALSE;
+
+      g_checksum_update (checksum, buffer, n_read);
+      count -= n_read;
+      offset += n_read;
+    }
+
+  return TRUE;
+}
+
+
+
+static gchar *
+tumbler_content_index_compute_key (TumblerFileInfo *info,
+                                   GCancellable *cancellable)
+{
+  TumblerThumbnailFlavor *flavor;
+  TumblerThumbnail *thumbnail;
+  GChecksum *checksum;
+  GStatBuf statbuf;
+  gboolean complete;
+  goffset offsets[3];
+  guchar *buffer;
+  gchar *filename;
+  gchar *header;
+  gchar *key = NULL;
+  guint n_blocks;
+  guint n;
+  gint fd;
+
+  /* only local files can be read cheaply */
+  filename = g_filename_from_uri (tumbler_file_info_get_uri (info), NULL, NULL);
+  if (filename == NULL)
+    return NULL;
+
+  fd = g_open (filename, O_RDONLY | O_CLOEXEC, 0);
+  g_free (filename);
+  if (fd < 0)
+    return NULL;
+
+  if (fstat (fd, &statbuf) != 0 || !S_ISREG (statbuf.st_mode) || statbuf.st_size == 0)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  thumbnail = tumbler_file_info_get_thumbnail (info);
+  flavor = tumbler_thumbnail_get_flavor (thumbnail);
+
+  header = g_strdup_printf ("%s\n%s\n%" G_GINT64_FORMAT "\n",
+                            tumbler_thumbnail_flavor_get_name (flavor),
+                            tumbler_file_info_get_mime_type (info),
+                            (gint64) statbuf.st_size);
+
+  g_object_unref (flavor);
+  g_object_unref (thumbnail);
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (checksum, (const guchar *) header, -1);
+  g_free (header);
+
+  /* small files are hashed completely */
+  if (statbuf.st_size <= 3 * CONTENT_BLOCK_SIZE)
+    {
+      offsets[0] = 0;
+      n_blocks = 1;
+    }
+  else
+    {
+      offsets[0] = 0;
+      offsets[1] = statbuf.st_size / 2 - CONTENT_BLOCK_SIZE / 2;
+      offsets[2] = statbuf.st_size - CONTENT_BLOCK_SIZE;
+      n_blocks = 3;
+    }
+
+  buffer = g_malloc (CONTENT_BLOCK_SIZE);
+  complete = TRUE;
+
+  for (n = 0; complete && n < n_blocks; ++n)
+    {
+      if (g_cancellable_is_cancelled (cancellable))
+        complete = FALSE;
+      else if (n_blocks == 1)
+        {
+          goffset offset;
+          gsize count;
+
+          for (offset = 0; complete && offset < statbuf.st_size; offset += count)
+            {
+              count = MIN (CONTENT_BLOCK_SIZE, statbuf.st_size - offset);
+              complete = tumbler_content_index_read_block (fd, buffer, count, offset, checksum);
+            }
+        }
+      else
+        complete = tumbler_content_index_read_block (fd, buffer, CONTENT_BLOCK_SIZE,
+                                                     offsets[n], checksum);
+    }
+
+  if (complete)
+    key = g_strdup (g_checksum_get_string (checksum));
+
+  g_free (buffer);
+  g_checksum_free (checksum);
+  close (fd);
+
+  return key;
+}
+
+
+
+static gboolean
+tumbler_content_index_copy (TumblerThumbnail *source,
+                            TumblerThumbnail *thumbnail,
+                            gdouble mtime,
+                            GCancellable *cancellable)
+{
+  TumblerImageData data;
+  GdkPixbufLoader *loader;
+  GdkPixbuf *pixbuf = NULL;
+  gboolean success = FALSE;
+  GBytes *bytes;
+
+  bytes = tumbler_thumbnail_load_bytes (source, cancellable, NULL);
+  if (bytes == NULL)
+    return FALSE;
+
+  /* decode the thumbnail, saving it again stores the URI and modification
+   * time of the copy */
+  loader = gdk_pixbuf_loader_new ();
+  if (gdk_pixbuf_loader_write_bytes (loader, bytes, NULL)
+      && gdk_pixbuf_loader_close (loader, NULL))
+    pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+  else
+    gdk_pixbuf_loader_close (loader, NULL);
+
+  if (pixbuf != NULL)
+    {
+      data.data = gdk_pixbuf_get_pixels (pixbuf);
+      data.has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+      data.bits_per_sample = gdk_pixbuf_get_bits_per_sample (pixbuf);
+      data.width = gdk_pixbuf_get_width (pixbuf);
+      data.height = gdk_pixbuf_get_height (pixbuf);
+      data.rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+      data.colorspace = (TumblerColorspace) gdk_pixbuf_get_colorspace (pixbuf);
+
+      success = tumbler_thumbnail_save_image_data (thumbnail, &data, mtime,
+                                                   cancellable, NULL);
+    }
+
+  g_object_unref (loader);
+  g_bytes_unref (bytes);
+
+  return success;
+}
+
+
+
+/* Returns %TRUE if the thumbnail of @info was copied from the thumbnail of a
+ * file with the same content, so it does not need to be generated */
+gboolean
+tumbler_content_index_reuse (TumblerFileInfo *info,
+                             GCancellable *cancellable)
+{
+  TumblerThumbnailFlavor *flavor;
+  TumblerContentEntry *entry;
+  TumblerThumbnail *source;
+  TumblerThumbnail *thumbnail;
+  TumblerCache *cache;
+  const gchar *uri;
+  gboolean reused = FALSE;
+  gboolean valid;
+  gdouble mtime = 0;
+  gchar *source_uri = NULL;
+  gchar *key;
+
+  g_return_val_if_fail (TUMBLER_IS_FILE_INFO (info), FALSE);
+
+  if (!tumbler_content_index_is_enabled ())
+    return FALSE;
+
+  key = tumbler_content_index_compute_key (info, cancellable);
+  if (key == NULL)
+    return FALSE;
+
+  /* remember the key for tumbler_content_index_add() */
+  g_object_set_data_full (G_OBJECT (info), CONTENT_KEY_DATA, key, g_free);
+
+  uri = tumbler_file_info_get_uri (info);
+
+  G_LOCK (index);
+  entry = content_index != NULL ? g_hash_table_lookup (content_index, key) : NULL;
+  if (entry != NULL && strcmp (entry->uri, uri) != 0)
+    {
+      source_uri = g_strdup (entry->uri);
+      mtime = entry->mtime;
+    }
+  G_UNLOCK (index);
+
+  if (source_uri == NULL)
+    return FALSE;
+
+  thumbnail = tumbler_file_info_get_thumbnail (info);
+  flavor = tumbler_thumbnail_get_flavor (thumbnail);
+  g_object_get (thumbnail, "cache", &cache, NULL);
+
+  /* the other file or its thumbnail may have changed since */
+  source = tumbler_cache_get_thumbnail (cache, source_uri, flavor);
+  valid = source != NULL
+          && tumbler_thumbnail_load (source, cancellable, NULL)
+          && !tumbler_thumbnail_needs_update (source, source_uri, mtime);
+
+  if (valid)
+    {
+      /* copy this flavor only, the other flavors of the file may be missing
+       * or outdated and must not be validated with the new modification time */
+      if (tumbler_content_index_copy (source, thumbnail,
+                                      tumbler_file_info_get_mtime (info), cancellable))
+        reused = tumbler_thumbnail_load (thumbnail, cancellable, NULL)
+                 && !tumbler_thumbnail_needs_update (thumbnail, uri,
+                                                     tumbler_file_info_get_mtime (info));
+    }
+  else
+    {
+      G_LOCK (index);
+      entry = g_hash_table_lookup (content_index, key);
+      if (entry != NULL && g_strcmp0 (entry->uri, source_uri) == 0)
+        g_hash_table_remove (content_index, key);
+      G_UNLOCK (index);
+    }
+
+  if (source != NULL)
+    g_object_unref (source);
+  g_object_unref (cache);
+  g_object_unref (flavor);
+  g_object_unref (thumbnail);
+  g_free (source_uri);
+
+  return reused;
+}
+
+
+
+/* Records the freshly generated thumbnail of @info for later copies */
+void
+tumbler_content_index_add (TumblerFileInfo *info)
+{
+  TumblerContentEntry *entry;
+  const gchar *key;
+
+  g_return_if_fail (TUMBLER_IS_FILE_INFO (info));
+
+  if (!tumbler_content_index_is_enabled ())
+    return;
+
+  /* set by tumbler_content_index_reuse() before the thumbnail was generated */
+  key = g_object_get_data (G_OBJECT (info), CONTENT_KEY_DATA);
+  if (key == NULL)
+    return;
+
+  G_LOCK (index);
+
+  if (content_index == NULL)
+    content_index = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free, tumbler_content_entry_free);
+
+  /* keep the first file, copies are more likely to go away */
+  if (!g_hash_table_contains (content_index, key))
+    {
+      /* forget everything rather than track the age of each entry */
+      if (g_hash_table_size (content_index) >= CONTENT_INDEX_MAX_ENTRIES)
+        g_hash_table_remove_all (content_index);
+
+      entry = g_slice_new (TumblerContentEntry);
+      entry->uri = g_strdup (tumbler_file_info_get_uri (info));
+      entry->mtime = tumbler_file_info_get_mtime (info);
+      g_hash_table_insert (content_index, g_strdup (key), entry);
+    }
+
+  G_UNLOCK (index);
+}
@@ -0,0 +1,36 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __TUMBLER_CONTENT_INDEX_H__
+#define __TUMBLER_CONTENT_INDEX_H__
+
+#include "tumbler/tumbler.h"
+
+G_BEGIN_DECLS
+
+gboolean
+tumbler_content_index_reuse (TumblerFileInfo *info,
+                             GCancellable *cancellable);
+void
+tumbler_content_index_add (TumblerFileInfo *info);
+
+G_END_DECLS
+
+#endif /* !__TUMBLER_CONTENT_INDEX_H__ */
@@ -20,7 +20,9 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include "tumbler-content-index.h"
 #include "tumbler-group-scheduler.h"
+#include "tumbler-stats.h"
 #include "tumbler-utils.h"
 
 #include "tumbler/tumbler.h"
@@ -67,6 +69,11 @@ static void
 tumbler_group_scheduler_cancel_by_mount (TumblerScheduler *scheduler,
                                          GMount *mount);
 static void
+tumbler_group_scheduler_resume (TumblerScheduler *scheduler,
+                                TumblerSchedulerRequest *request);
+static void
+tumbler_group_scheduler_reclaim (TumblerScheduler *scheduler);
+static void
 tumbler_group_scheduler_finish_request (TumblerGroupScheduler *scheduler,
                                         TumblerSchedulerRequest *request);
 static void
@@ -76,6 +83,16 @@ static void
 tumbler_group_scheduler_thread (gpointer data,
                                 gpointer user_data);
 static void
+tumbler_group_scheduler_run_thumbnailers (TumblerSchedulerRequest *request,
+                                          guint n,
+                                          GList *thumbnailers);
+static void
+tumbler_group_scheduler_process_async_results (TumblerGroupScheduler *scheduler,
+                                               TumblerSchedulerRequest *request);
+static void
+tumbler_group_scheduler_complete_request (TumblerGroupScheduler *scheduler,
+                                          TumblerSchedulerRequest *request);
+static void
 tumbler_group_scheduler_thumbnailer_error (TumblerThumbnailer *thumbnailer,
                                            TumblerFileInfo *failed_info,
                                            GQuark error_domain,
@@ -96,7 +113,6 @@ struct _TumblerGroupScheduler
   GThreadPool *pool;
   TUMBLER_MUTEX (mutex);
   GList *requests;
-  gboolean prioritized;
 
   gchar *name;
 };
@@ -113,6 +129,9 @@ struct _UriError
 
 G_LOCK_DEFINE (group_access_lock);
 
+/* set once a pool thread has lowered its priority, each of them has to */
+static GPrivate prioritized;
+
 
 
 G_DEFINE_FINAL_TYPE_WITH_CODE (TumblerGroupScheduler,
@@ -143,6 +162,8 @@ tumbler_group_scheduler_iface_init (TumblerSchedulerIface *iface)
   iface->push = tumbler_group_scheduler_push;
   iface->dequeue = tumbler_group_scheduler_dequeue;
   iface->cancel_by_mount = tumbler_group_scheduler_cancel_by_mount;
+  iface->resume = tumbler_group_scheduler_resume;
+  iface->reclaim = tumbler_group_scheduler_reclaim;
 }
 
 
@@ -153,16 +174,8 @@ tumbler_group_scheduler_init (TumblerGroupScheduler *scheduler)
   tumbler_mutex_create (scheduler->mutex);
   scheduler->requests = NULL;
 
-  /* Note that unless we convert this boolean to a TLS (thread-local), that
-   * we can only do this 'prioritized' flag with a thread-pool that is set to
-   * exclusive: because then the one thread keeps running until the pool is
-   * freed. */
-
-  scheduler->prioritized = FALSE;
-
-  /* allocate a pool with a number of threads depending on the system */
-  scheduler->pool = g_thread_pool_new (tumbler_group_scheduler_thread,
-                                       scheduler, g_get_num_processors (), TRUE, NULL);
+  /* the thread pool is created on first use */
+  scheduler->pool = NULL;
 }
 
 
@@ -172,8 +185,9 @@ tumbler_group_scheduler_finalize (GObject *object)
 {
   TumblerGroupScheduler *scheduler = TUMBLER_GROUP_SCHEDULER (object);
 
-  /* destroy both thread pools */
-  g_thread_pool_free (scheduler->pool, TRUE, TRUE);
+  /* destroy the thread pool */
+  if (scheduler->pool != NULL)
+    g_thread_pool_free (scheduler->pool, TRUE, TRUE);
 
   /* release all pending requests and destroy the request list */
   g_list_free_full (scheduler->requests, tumbler_scheduler_request_free);
@@ -231,6 +245,25 @@ tumbler_group_scheduler_set_property (GObject *object,
 
 
 
+static void
+tumbler_group_scheduler_push_pool (TumblerGroupScheduler *scheduler,
+                                   TumblerSchedulerRequest *request)
+{
+  GThreadPool *pool = scheduler->pool;
+
+  /* allocate a pool with a number of threads depending on the system */
+  if (pool == NULL)
+    {
+      pool = g_thread_pool_new (tumbler_group_scheduler_thread,
+                                scheduler, g_get_num_processors (), TRUE, NULL);
+      scheduler->pool = pool;
+    }
+
+  g_thread_pool_push (pool, request, NULL);
+}
+
+
+
 static void
 tumbler_group_scheduler_push (TumblerScheduler *scheduler,
                               TumblerSchedulerRequest *request)
@@ -249,7 +282,7 @@ tumbler_group_scheduler_push (TumblerScheduler *scheduler,
   group_scheduler->requests = g_list_prepend (group_scheduler->requests, request);
 
   /* enqueue the request in the pool */
-  g_thread_pool_push (group_scheduler->pool, request, NULL);
+  tumbler_group_scheduler_push_pool (group_scheduler, request);
 
   tumbler_mutex_unlock (group_scheduler->mutex);
 }
@@ -324,6 +357,53 @@ tumbler_group_scheduler_cancel_by_mount (TumblerScheduler *scheduler,
 
 
 
+static void
+tumbler_group_scheduler_resume (TumblerScheduler *scheduler,
+                                TumblerSchedulerRequest *request)
+{
+  TumblerGroupScheduler *group_scheduler = TUMBLER_GROUP_SCHEDULER (scheduler);
+
+  g_return_if_fail (TUMBLER_IS_GROUP_SCHEDULER (scheduler));
+  g_return_if_fail (request != NULL);
+
+  tumbler_mutex_lock (group_scheduler->mutex);
+
+  /* the request is still in the request list, only enqueue it again */
+  tumbler_group_scheduler_push_pool (group_scheduler, request);
+
+  tumbler_mutex_unlock (group_scheduler->mutex);
+}
+
+
+
+static void
+tumbler_group_scheduler_reclaim (TumblerScheduler *scheduler)
+{
+  TumblerGroupScheduler *group_scheduler = TUMBLER_GROUP_SCHEDULER (scheduler);
+  GThreadPool *pool = NULL;
+
+  g_return_if_fail (TUMBLER_IS_GROUP_SCHEDULER (scheduler));
+
+  tumbler_mutex_lock (group_scheduler->mutex);
+
+  /* an exclusive pool keeps all its threads until it is freed, so drop
+   * it while there is nothing to do, the next push creates a new one */
+  if (group_scheduler->requests == NULL && group_scheduler->pool != NULL)
+    {
+      pool = group_scheduler->pool;
+      group_scheduler->pool = NULL;
+    }
+
+  tumbler_mutex_unlock (group_scheduler->mutex);
+
+  /* the threads may still be on their way out of the last request, which
+   * takes the scheduler mutex, so wait for them without holding it */
+  if (pool != NULL)
+    g_thread_pool_free (pool, FALSE, TRUE);
+}
+
+
+
 static void
 tumbler_group_scheduler_finish_request (TumblerGroupScheduler *scheduler,
                                         TumblerSchedulerRequest *request)
@@ -405,30 +485,47 @@ tumbler_group_scheduler_thread (gpointer data,
   TumblerSchedulerRequest *request = data;
   TumblerGroupScheduler *scheduler = user_data;
   const gchar **uris;
-  const gchar **failed_uris;
-  const gchar **success_uris;
-  UriError *uri_error;
   gboolean uri_needs_update;
-  GString *message;
   GError *error = NULL;
-  GList *iter;
   GList *cached_uris = NULL;
   GList *missing_uris = NULL;
-  GList *lp, *lq;
+  GQueue pending_uris = G_QUEUE_INIT;
+  GList *lp;
+  gint64 trace;
   guint n;
-  gint error_code = 0;
-  GQuark error_domain = 0;
 
   g_return_if_fail (TUMBLER_IS_GROUP_SCHEDULER (scheduler));
   g_return_if_fail (request != NULL);
 
-  /* Set I/O priority for the exclusive ThreadPool's thread */
-  if (!scheduler->prioritized)
+  tumbler_stats_add (TUMBLER_STATS_QUEUED_REQUESTS, scheduler->name, NULL, -1);
+  tumbler_util_trace_end (request->trace_queued, "queue", "handle=%u", request->handle);
+
+  /* Set I/O priority for this thread of the exclusive ThreadPool */
+  if (g_private_get (&prioritized) == NULL)
     {
       tumbler_scheduler_thread_use_lower_priority ();
-      scheduler->prioritized = TRUE;
+      g_private_set (&prioritized, GINT_TO_POINTER (TRUE));
+    }
+
+  /* specialized thumbnailers are done with a request we let go earlier */
+  if (request->resumed)
+    {
+      tumbler_mutex_lock (scheduler->mutex);
+      if (request->dequeued)
+        {
+          tumbler_group_scheduler_finish_request (scheduler, request);
+          tumbler_mutex_unlock (scheduler->mutex);
+          return;
+        }
+      tumbler_mutex_unlock (scheduler->mutex);
+
+      tumbler_group_scheduler_process_async_results (scheduler, request);
+      tumbler_group_scheduler_complete_request (scheduler, request);
+      return;
     }
 
+  request->trace_started = tumbler_util_trace_begin ();
+
   /* notify others that we're starting to process this request */
   g_signal_emit_by_name (request->scheduler, "started", request->handle, request->origin);
 
@@ -462,7 +559,12 @@ tumbler_group_scheduler_thread (gpointer data,
       /* create a file infor for the current URI */
       uri_needs_update = FALSE;
 
+      trace = tumbler_util_trace_begin ();
       G_LOCK (group_access_lock);
+      tumbler_util_trace_end (trace, "lock", "handle=%u uri=%s", request->handle,
+                              tumbler_file_info_get_uri (request->infos[n]));
+
+      trace = tumbler_util_trace_begin ();
 
       /* try to load thumbnail information about the URI */
       if (tumbler_file_info_load (request->infos[n], NULL, &error))
@@ -484,9 +586,15 @@ tumbler_group_scheduler_thread (gpointer data,
 
       G_UNLOCK (group_access_lock);
 
+      tumbler_util_trace_end (trace, "file-info", "handle=%u uri=%s", request->handle,
+                              tumbler_file_info_get_uri (request->infos[n]));
+
       /* check if the URI is supported */
       if (error == NULL)
         {
+          tumbler_stats_add (uri_needs_update ? TUMBLER_STATS_CACHE_MISSES : TUMBLER_STATS_CACHE_HITS,
+                             scheduler->name, tumbler_file_info_get_mime_type (request->infos[n]), 1);
+
           /* put it in the right list depending on its thumbnail status */
           if (uri_needs_update)
             missing_uris = g_list_prepend (missing_uris, GINT_TO_POINTER (n));
@@ -525,43 +633,104 @@ tumbler_group_scheduler_thread (gpointer data,
   request->uri_errors = NULL;
   request->ready_uris = NULL;
 
-  /* iterate over invalid/missing URI list */
+  /* queue the invalid/missing URIs in request order */
   for (lp = g_list_last (missing_uris); lp != NULL; lp = lp->prev)
+    g_queue_push_tail (&pending_uris, lp->data);
+  g_list_free (missing_uris);
+
+  /* on rotational disks, follow the order of the files on disk instead */
+  request->reordered = tumbler_scheduler_request_sort_pending (request, &pending_uris);
+
+  /* iterate over invalid/missing URIs */
+  while (!g_queue_is_empty (&pending_uris))
     {
-      n = GPOINTER_TO_INT (lp->data);
+      n = tumbler_scheduler_request_pop_pending (request, &pending_uris);
 
-      /* finish the request if it was dequeued */
+      /* finish the request if it was dequeued, or once specialized
+       * thumbnailers don't use it anymore */
       tumbler_mutex_lock (scheduler->mutex);
       if (request->dequeued)
         {
-          tumbler_group_scheduler_finish_request (scheduler, request);
+          if (!tumbler_scheduler_request_detach (request))
+            tumbler_group_scheduler_finish_request (scheduler, request);
           tumbler_mutex_unlock (scheduler->mutex);
+          g_queue_clear (&pending_uris);
           return;
         }
       tumbler_mutex_unlock (scheduler->mutex);
 
-      for (lq = request->thumbnailers[n]; lq != NULL; lq = lq->next)
+      /* a copy of the same file may have been thumbnailed already */
+      if (tumbler_content_index_reuse (request->infos[n], request->cancellables[n]))
         {
-          /* forward only the error signal of the last thumbnailer */
-          if (lq->next == NULL)
-            g_signal_connect (lq->data, "error",
-                              G_CALLBACK (tumbler_group_scheduler_thumbnailer_error), request);
-          else if (tumbler_util_is_debug_logging_enabled (G_LOG_DOMAIN))
-            g_signal_connect (lq->data, "error",
-                              G_CALLBACK (tumbler_scheduler_thumberr_debuglog), request);
-
-          /* connect to the ready signal of the thumbnailer */
-          g_signal_connect (lq->data, "ready",
-                            G_CALLBACK (tumbler_group_scheduler_thumbnailer_ready), request);
-
-          /* tell the thumbnailer to generate the thumbnail */
-          tumbler_thumbnailer_create (lq->data, request->cancellables[n], request->infos[n]);
-
-          /* disconnect from all signals when we're finished */
-          g_signal_handlers_disconnect_by_data (lq->data, request);
+          tumbler_group_scheduler_thumbnailer_ready (request->thumbnailers[n]->data,
+                                                     request->infos[n], request);
+          continue;
         }
+
+      /* specialized thumbnailers don't need this thread to wait for them */
+      if (!tumbler_scheduler_request_queue_async (request, n))
+        tumbler_group_scheduler_run_thumbnailers (request, n, request->thumbnailers[n]);
     }
 
+  /* let the request go while specialized thumbnailers are busy with it */
+  if (tumbler_scheduler_request_detach (request))
+    return;
+
+  tumbler_group_scheduler_process_async_results (scheduler, request);
+  tumbler_group_scheduler_complete_request (scheduler, request);
+}
+
+
+
+static gint
+tumbler_group_scheduler_compare_ready_uris (gconstpointer a,
+                                            gconstpointer b,
+                                            gpointer user_data)
+{
+  guint position_a = GPOINTER_TO_UINT (g_hash_table_lookup (user_data, a));
+  guint position_b = GPOINTER_TO_UINT (g_hash_table_lookup (user_data, b));
+
+  return position_a < position_b ? -1 : (position_a > position_b ? 1 : 0);
+}
+
+
+
+static GList *
+tumbler_group_scheduler_sort_ready_uris (TumblerSchedulerRequest *request)
+{
+  GHashTable *positions;
+  GList *sorted;
+  guint n;
+
+  /* map each URI to its first position in the request */
+  positions = g_hash_table_new (g_str_hash, g_str_equal);
+  for (n = request->length; n > 0; n--)
+    g_hash_table_insert (positions, (gpointer) tumbler_file_info_get_uri (request->infos[n - 1]),
+                         GUINT_TO_POINTER (n));
+
+  sorted = g_list_sort_with_data (request->ready_uris,
+                                  tumbler_group_scheduler_compare_ready_uris,
+                                  positions);
+  g_hash_table_destroy (positions);
+
+  return sorted;
+}
+
+
+
+static void
+tumbler_group_scheduler_complete_request (TumblerGroupScheduler *scheduler,
+                                          TumblerSchedulerRequest *request)
+{
+  const gchar **failed_uris;
+  const gchar **success_uris;
+  UriError *uri_error;
+  GString *message;
+  GList *iter;
+  guint n;
+  gint error_code = 0;
+  GQuark error_domain = 0;
+
   tumbler_mutex_lock (scheduler->mutex);
 
   /* We emit all the errors and ready signals together in order to
@@ -619,6 +788,10 @@ tumbler_group_scheduler_thread (gpointer data,
   /* free all URI errors and the error URI list */
   g_list_free_full (request->uri_errors, uri_error_free);
 
+  /* report the URIs in request order even if they were processed out of order */
+  if (request->reordered)
+    request->ready_uris = tumbler_group_scheduler_sort_ready_uris (request);
+
   /* check if we have any successfully processed URIs */
   if (request->ready_uris != NULL)
     {
@@ -651,6 +824,98 @@ tumbler_group_scheduler_thread (gpointer data,
 
 
 
+static void
+tumbler_group_scheduler_run_thumbnailers (TumblerSchedulerRequest *request,
+                                          guint n,
+                                          GList *thumbnailers)
+{
+  GList *lq;
+  gint64 start;
+  gint64 trace;
+
+  for (lq = thumbnailers; lq != NULL; lq = lq->next)
+    {
+      /* forward only the error signal of the last thumbnailer */
+      if (lq->next == NULL)
+        g_signal_connect (lq->data, "error",
+                          G_CALLBACK (tumbler_group_scheduler_thumbnailer_error), request);
+      else if (tumbler_util_is_debug_logging_enabled (G_LOG_DOMAIN))
+        g_signal_connect (lq->data, "error",
+                          G_CALLBACK (tumbler_scheduler_thumberr_debuglog), request);
+
+      /* connect to the ready signal of the thumbnailer */
+      g_signal_connect (lq->data, "ready",
+                        G_CALLBACK (tumbler_group_scheduler_thumbnailer_ready), request);
+
+      /* tell the thumbnailer to generate the thumbnail */
+      trace = tumbler_util_trace_begin ();
+      start = g_get_monotonic_time ();
+      tumbler_thumbnailer_create (lq->data, request->cancellables[n], request->infos[n]);
+      tumbler_util_trace_end (trace, "create", "handle=%u uri=%s thumbnailer=%s",
+                              request->handle, tumbler_file_info_get_uri (request->infos[n]),
+                              G_OBJECT_TYPE_NAME (lq->data));
+      tumbler_stats_observe (TUMBLER_STATS_CREATE_SECONDS, G_OBJECT_TYPE_NAME (lq->data),
+                             tumbler_file_info_get_mime_type (request->infos[n]),
+                             g_get_monotonic_time () - start);
+
+      /* disconnect from all signals when we're finished */
+      g_signal_handlers_disconnect_by_data (lq->data, request);
+    }
+}
+
+
+
+static void
+tumbler_group_scheduler_process_async_results (TumblerGroupScheduler *scheduler,
+                                               TumblerSchedulerRequest *request)
+{
+  TumblerSchedulerAsyncResult *result;
+  TumblerFileInfo *info;
+  GList *thumbnailers;
+  GList *lp;
+
+  /* results are prepended as they come in */
+  for (lp = g_list_last (request->async_results); lp != NULL; lp = lp->prev)
+    {
+      result = lp->data;
+      info = request->infos[result->n];
+      thumbnailers = request->thumbnailers[result->n];
+
+      if (result->error == NULL)
+        {
+          tumbler_group_scheduler_thumbnailer_ready (thumbnailers->data, info, request);
+        }
+      else if (!g_error_matches (result->error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          if (thumbnailers->next == NULL)
+            {
+              tumbler_group_scheduler_thumbnailer_error (thumbnailers->data, info,
+                                                         result->error->domain,
+                                                         result->error->code,
+                                                         result->error->message,
+                                                         request);
+            }
+          else
+            {
+              if (tumbler_util_is_debug_logging_enabled (G_LOG_DOMAIN))
+                tumbler_scheduler_thumberr_debuglog (thumbnailers->data, info,
+                                                     result->error->domain,
+                                                     result->error->code,
+                                                     result->error->message,
+                                                     request);
+
+              /* try the thumbnailers with a lower priority */
+              tumbler_group_scheduler_run_thumbnailers (request, result->n, thumbnailers->next);
+            }
+        }
+    }
+
+  g_list_free_full (request->async_results, tumbler_scheduler_async_result_free);
+  request->async_results = NULL;
+}
+
+
+
 static void
 tumbler_group_scheduler_thumbnailer_error (TumblerThumbnailer *thumbnailer,
                                            TumblerFileInfo *failed_info,
@@ -663,6 +928,9 @@ tumbler_group_scheduler_thumbnailer_error (TumblerThumbnailer *thumbnailer,
   g_return_if_fail (TUMBLER_IS_FILE_INFO (failed_info));
   g_return_if_fail (request != NULL);
 
+  tumbler_stats_add (TUMBLER_STATS_CREATE_ERRORS, G_OBJECT_TYPE_NAME (thumbnailer),
+                     tumbler_file_info_get_mime_type (failed_info), 1);
+
   for (guint n = 0; n < request->length; n++)
     {
       if (request->infos[n] == failed_info)
@@ -694,6 +962,7 @@ tumbler_group_scheduler_thumbnailer_ready (TumblerThumbnailer *thumbnailer,
         {
           /* add the uri to the list */
           request->ready_uris = g_list_prepend (request->ready_uris, g_strdup (tumbler_file_info_get_uri (info)));
+          tumbler_content_index_add (info);
 
           /* cancel lower priority thumbnailers for this uri */
           g_cancellable_cancel (request->cancellables[n]);
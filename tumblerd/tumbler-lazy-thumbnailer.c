@@ -0,0 +1,426 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "tumbler-lazy-thumbnailer.h"
+#include "tumbler-utils.h"
+
+
+
+/* Property identifiers */
+enum
+{
+  PROP_0,
+  PROP_MODULE,
+  PROP_INDEX,
+  PROP_TYPE_NAME,
+};
+
+
+
+static void
+tumbler_lazy_thumbnailer_finalize (GObject *object);
+static void
+tumbler_lazy_thumbnailer_get_property (GObject *object,
+                                       guint prop_id,
+                                       GValue *value,
+                                       GParamSpec *pspec);
+static void
+tumbler_lazy_thumbnailer_set_property (GObject *object,
+                                       guint prop_id,
+                                       const GValue *value,
+                                       GParamSpec *pspec);
+static void
+tumbler_lazy_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
+                                 GCancellable *cancellable,
+                                 TumblerFileInfo *info);
+static void
+tumbler_lazy_thumbnailer_reclaim (TumblerAbstractThumbnailer *thumbnailer);
+
+
+
+struct _TumblerLazyThumbnailer
+{
+  TumblerAbstractThumbnailer __parent__;
+
+  gchar *module;
+  guint index;
+  gchar *type_name;
+
+  /* the thumbnailer of the plugin, created on first use */
+  TUMBLER_MUTEX (mutex);
+  TumblerThumbnailer *thumbnailer;
+  gboolean failed;
+};
+
+
+
+G_DEFINE_FINAL_TYPE (TumblerLazyThumbnailer,
+                     tumbler_lazy_thumbnailer,
+                     TUMBLER_TYPE_ABSTRACT_THUMBNAILER);
+
+
+
+static void
+tumbler_lazy_thumbnailer_class_init (TumblerLazyThumbnailerClass *klass)
+{
+  TumblerAbstractThumbnailerClass *abstractthumbnailer_class;
+  GObjectClass *gobject_class;
+
+  /* admission control happens here, the plugin thumbnailer runs unrestricted */
+  abstractthumbnailer_class = TUMBLER_ABSTRACT_THUMBNAILER_CLASS (klass);
+  abstractthumbnailer_class->create = tumbler_lazy_thumbnailer_create;
+  abstractthumbnailer_class->reclaim = tumbler_lazy_thumbnailer_reclaim;
+
+  gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = tumbler_lazy_thumbnailer_finalize;
+  gobject_class->get_property = tumbler_lazy_thumbnailer_get_property;
+  gobject_class->set_property = tumbler_lazy_thumbnailer_set_property;
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_MODULE,
+                                   g_param_spec_string ("module",
+                                                        "module",
+                                                        "module",
+                                                        NULL,
+                                                        G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_INDEX,
+                                   g_param_spec_uint ("index",
+                                                      "index",
+                                                      "index",
+                                                      0, G_MAXUINT, 0,
+                                                      G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_TYPE_NAME,
+                                   g_param_spec_string ("type-name",
+                                                        "type-name",
+                                                        "type-name",
+                                                        NULL,
+                                                        G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+
+
+static void
+tumbler_lazy_thumbnailer_init (TumblerLazyThumbnailer *thumbnailer)
+{
+  tumbler_mutex_create (thumbnailer->mutex);
+}
+
+
+
+static void
+tumbler_lazy_thumbnailer_finalize (GObject *object)
+{
+  TumblerLazyThumbnailer *thumbnailer = TUMBLER_LAZY_THUMBNAILER (object);
+
+  if (thumbnailer->thumbnailer != NULL)
+    {
+      g_signal_handlers_disconnect_by_data (thumbnailer->thumbnailer, thumbnailer);
+      g_object_unref (thumbnailer->thumbnailer);
+    }
+
+  g_free (thumbnailer->module);
+  g_free (thumbnailer->type_name);
+
+  tumbler_mutex_free (thumbnailer->mutex);
+
+  (*G_OBJECT_CLASS (tumbler_lazy_thumbnailer_parent_class)->finalize) (object);
+}
+
+
+
+static void
+tumbler_lazy_thumbnailer_get_property (GObject *object,
+                                       guint prop_id,
+                                       GValue *value,
+                                       GParamSpec *pspec)
+{
+  TumblerLazyThumbnailer *thumbnailer = TUMBLER_LAZY_THUMBNAILER (object);
+
+  switch (prop_id)
+    {
+    case PROP_MODULE:
+      g_value_set_string (value, thumbnailer->module);
+      break;
+
+    case PROP_INDEX:
+      g_value_set_uint (value, thumbnailer->index);
+      break;
+
+    case PROP_TYPE_NAME:
+      g_value_set_string (value, thumbnailer->type_name);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+
+
+static void
+tumbler_lazy_thumbnailer_set_property (GObject *object,
+                                       guint prop_id,
+                                       const GValue *value,
+                                       GParamSpec *pspec)
+{
+  TumblerLazyThumbnailer *thumbnailer = TUMBLER_LAZY_THUMBNAILER (object);
+
+  switch (prop_id)
+    {
+    case PROP_MODULE:
+      thumbnailer->module = g_value_dup_string (value);
+      break;
+
+    case PROP_INDEX:
+      thumbnailer->index = g_value_get_uint (value);
+      break;
+
+    case PROP_TYPE_NAME:
+      thumbnailer->type_name = g_value_dup_string (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+
+
+static void
+tumbler_lazy_thumbnailer_ready (TumblerThumbnailer *plugin_thumbnailer,
+                                TumblerFileInfo *info,
+                                TumblerLazyThumbnailer *thumbnailer)
+{
+  g_signal_emit_by_name (thumbnailer, "ready", info);
+}
+
+
+
+static void
+tumbler_lazy_thumbnailer_error (TumblerThumbnailer *plugin_thumbnailer,
+                                TumblerFileInfo *info,
+                                GQuark error_domain,
+                                gint error_code,
+                                const gchar *message,
+                                TumblerLazyThumbnailer *thumbnailer)
+{
+  g_signal_emit_by_name (thumbnailer, "error", info, error_domain, error_code, message);
+}
+
+
+
+static TumblerThumbnailer *
+tumbler_lazy_thumbnailer_find (TumblerLazyThumbnailer *thumbnailer)
+{
+  TumblerProviderFactory *factory;
+  TumblerThumbnailer *found = NULL;
+  GList *providers;
+  GList *thumbnailers;
+  GList *lp;
+  GList *tp;
+  guint n = 0;
+
+  factory = tumbler_provider_factory_get_default ();
+  /* the positions in the plugin cache count disabled providers too */
+  providers = tumbler_provider_factory_get_module_providers (factory, thumbnailer->module,
+                                                             TUMBLER_TYPE_THUMBNAILER_PROVIDER,
+                                                             TRUE);
+
+  /* the plugin cache refers to thumbnailers by their position in the module,
+   * fall back to the first one of the same type if that does not match */
+  for (lp = providers; lp != NULL; lp = lp->next)
+    {
+      thumbnailers = tumbler_thumbnailer_provider_get_thumbnailers (lp->data);
+      for (tp = thumbnailers; tp != NULL; tp = tp->next, n++)
+        {
+          if (!g_str_equal (G_OBJECT_TYPE_NAME (tp->data), thumbnailer->type_name))
+            continue;
+
+          if (found == NULL || n == thumbnailer->index)
+            {
+              if (found != NULL)
+                g_object_unref (found);
+              found = g_object_ref (tp->data);
+            }
+        }
+
+      g_list_free_full (thumbnailers, g_object_unref);
+    }
+
+  g_list_free_full (providers, g_object_unref);
+  g_object_unref (factory);
+
+  return found;
+}
+
+
+
+static TumblerThumbnailer *
+tumbler_lazy_thumbnailer_resolve (TumblerLazyThumbnailer *thumbnailer)
+{
+  TumblerThumbnailer *plugin_thumbnailer;
+  GSList *locations;
+  GSList *excludes;
+  gint64 file_size;
+  gint priority;
+
+  tumbler_mutex_lock (thumbnailer->mutex);
+
+  if (thumbnailer->thumbnailer == NULL && !thumbnailer->failed)
+    {
+      g_debug ("Loading plugin module '%s' for %s", thumbnailer->module, thumbnailer->type_name);
+
+      thumbnailer->thumbnailer = tumbler_lazy_thumbnailer_find (thumbnailer);
+      if (thumbnailer->thumbnailer != NULL)
+        {
+          /* hand over the settings from the rc file */
+          g_object_get (thumbnailer, "priority", &priority, "max-file-size", &file_size,
+                        "locations", &locations, "excludes", &excludes, NULL);
+          g_object_set (thumbnailer->thumbnailer, "priority", priority, "max-file-size", file_size,
+                        "max-concurrency", 0, "locations", locations, "excludes", excludes, NULL);
+
+          g_slist_free_full (locations, g_object_unref);
+          g_slist_free_full (excludes, g_object_unref);
+
+          g_signal_connect (thumbnailer->thumbnailer, "ready",
+                            G_CALLBACK (tumbler_lazy_thumbnailer_ready), thumbnailer);
+          g_signal_connect (thumbnailer->thumbnailer, "error",
+                            G_CALLBACK (tumbler_lazy_thumbnailer_error), thumbnailer);
+        }
+      else
+        {
+          g_warning ("Plugin module '%s' does not provide %s, rerun tumbler-query-plugins",
+                     thumbnailer->module, thumbnailer->type_name);
+          thumbnailer->failed = TRUE;
+        }
+    }
+
+  plugin_thumbnailer = thumbnailer->thumbnailer != NULL ? g_object_ref (thumbnailer->thumbnailer) : NULL;
+
+  tumbler_mutex_unlock (thumbnailer->mutex);
+
+  return plugin_thumbnailer;
+}
+
+
+
+static void
+tumbler_lazy_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
+                                 GCancellable *cancellable,
+                                 TumblerFileInfo *info)
+{
+  TumblerThumbnailer *plugin_thumbnailer;
+  GError *error = NULL;
+
+  g_return_if_fail (TUMBLER_IS_LAZY_THUMBNAILER (thumbnailer));
+  g_return_if_fail (TUMBLER_IS_FILE_INFO (info));
+
+  plugin_thumbnailer = tumbler_lazy_thumbnailer_resolve (TUMBLER_LAZY_THUMBNAILER (thumbnailer));
+  if (plugin_thumbnailer == NULL)
+    {
+      g_set_error (&error, TUMBLER_ERROR, TUMBLER_ERROR_UNSUPPORTED,
+                   TUMBLER_ERROR_MESSAGE_NO_THUMBNAILER,
+                   tumbler_file_info_get_uri (info));
+      g_signal_emit_by_name (thumbnailer, "error", info,
+                             error->domain, error->code, error->message);
+      g_error_free (error);
+      return;
+    }
+
+  tumbler_thumbnailer_create (plugin_thumbnailer, cancellable, info);
+
+  g_object_unref (plugin_thumbnailer);
+}
+
+
+
+static void
+tumbler_lazy_thumbnailer_reclaim (TumblerAbstractThumbnailer *thumbnailer)
+{
+  TumblerLazyThumbnailer *lazy_thumbnailer = TUMBLER_LAZY_THUMBNAILER (thumbnailer);
+  TumblerThumbnailer *plugin_thumbnailer;
+
+  /* a plugin thumbnailer that was never loaded has nothing to release */
+  tumbler_mutex_lock (lazy_thumbnailer->mutex);
+  plugin_thumbnailer = lazy_thumbnailer->thumbnailer;
+  if (plugin_thumbnailer != NULL)
+    g_object_ref (plugin_thumbnailer);
+  tumbler_mutex_unlock (lazy_thumbnailer->mutex);
+
+  if (plugin_thumbnailer != NULL)
+    {
+      tumbler_thumbnailer_reclaim (plugin_thumbnailer);
+      g_object_unref (plugin_thumbnailer);
+    }
+}
+
+
+
+TumblerThumbnailer *
+tumbler_lazy_thumbnailer_new (const gchar *module,
+                              guint index,
+                              const gchar *type_name,
+                              const gchar *const *uri_schemes,
+                              const gchar *const *mime_types)
+{
+  g_return_val_if_fail (module != NULL, NULL);
+  g_return_val_if_fail (type_name != NULL, NULL);
+  g_return_val_if_fail (uri_schemes != NULL, NULL);
+  g_return_val_if_fail (mime_types != NULL, NULL);
+
+  return g_object_new (TUMBLER_TYPE_LAZY_THUMBNAILER,
+                       "module", module, "index", index, "type-name", type_name,
+                       "uri-schemes", uri_schemes, "mime-types", mime_types, NULL);
+}
+
+
+
+const gchar *
+tumbler_lazy_thumbnailer_get_type_name (TumblerLazyThumbnailer *thumbnailer)
+{
+  g_return_val_if_fail (TUMBLER_IS_LAZY_THUMBNAILER (thumbnailer), NULL);
+  return thumbnailer->type_name;
+}
+
+
+
+void
+tumbler_lazy_thumbnailer_release (TumblerLazyThumbnailer *thumbnailer)
+{
+  g_return_if_fail (TUMBLER_IS_LAZY_THUMBNAILER (thumbnailer));
+
+  tumbler_mutex_lock (thumbnailer->mutex);
+
+  /* the plugin thumbnailer is created again on next use */
+  if (thumbnailer->thumbnailer != NULL)
+    {
+      g_debug ("Releasing %s", thumbnailer->type_name);
+      g_signal_handlers_disconnect_by_data (thumbnailer->thumbnailer, thumbnailer);
+      g_clear_object (&thumbnailer->thumbnailer);
+    }
+
+  tumbler_mutex_unlock (thumbnailer->mutex);
+}
@@ -0,0 +1,44 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __TUMBLER_LAZY_THUMBNAILER_H__
+#define __TUMBLER_LAZY_THUMBNAILER_H__
+
+#include "tumbler/tumbler.h"
+
+G_BEGIN_DECLS
+
+#define TUMBLER_TYPE_LAZY_THUMBNAILER (tumbler_lazy_thumbnailer_get_type ())
+G_DECLARE_FINAL_TYPE (TumblerLazyThumbnailer, tumbler_lazy_thumbnailer, TUMBLER, LAZY_THUMBNAILER, TumblerAbstractThumbnailer)
+
+TumblerThumbnailer *
+tumbler_lazy_thumbnailer_new (const gchar *module,
+                              guint index,
+                              const gchar *type_name,
+                              const gchar *const *uri_schemes,
+                              const gchar *const *mime_types) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+const gchar *
+tumbler_lazy_thumbnailer_get_type_name (TumblerLazyThumbnailer *thumbnailer);
+void
+tumbler_lazy_thumbnailer_release (TumblerLazyThumbnailer *thumbnailer);
+
+G_END_DECLS
+
+#endif /* !__TUMBLER_LAZY_THUMBNAILER_H__ */
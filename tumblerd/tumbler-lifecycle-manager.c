@@ -23,17 +23,35 @@
 
 #include "tumbler/tumbler.h"
 
+#include <errno.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 
 
+/* defaults for the [Lifecycle] section of tumbler.rc */
 #define SHUTDOWN_TIMEOUT_SECONDS 300
+#define MAX_SHUTDOWN_TIMEOUT_SECONDS 1800
+#define RELEASE_TIMEOUT_SECONDS 60
+
+/* inactivity shorter than this is part of the same burst of requests */
+#define MIN_GAP_SECONDS 10
+
+/* number of gaps between bursts the adaptive timeout is computed from */
+#define N_GAPS 16
+#define MIN_GAPS 3
+
+/* gaps and last activity, kept across restarts in the user cache directory */
+#define STATE_FILE "lifecycle"
 
 
 
 /* signal identifiers */
 enum
 {
+  SIGNAL_RELEASE,
   SIGNAL_SHUTDOWN,
   LAST_SIGNAL,
 };
@@ -52,8 +70,21 @@ struct _TumblerLifecycleManager
   TUMBLER_MUTEX (lock);
 
   guint timeout_id;
+  guint release_id;
   guint component_use_count;
   guint shutdown_emitted : 1;
+
+  /* settings, in seconds */
+  guint shutdown_timeout;
+  guint max_shutdown_timeout;
+  guint release_timeout;
+
+  /* wall-clock time of the last request, and a ring buffer of the
+   * gaps between bursts of requests, in seconds */
+  gint64 last_activity;
+  guint gaps[N_GAPS];
+  guint n_gaps;
+  guint next_gap;
 };
 
 
@@ -77,6 +108,17 @@ tumbler_lifecycle_manager_class_init (TumblerLifecycleManagerClass *klass)
   gobject_class = G_OBJECT_CLASS (klass);
   gobject_class->finalize = tumbler_lifecycle_manager_finalize;
 
+  lifecycle_manager_signals[SIGNAL_RELEASE] =
+    g_signal_new ("release",
+                  TUMBLER_TYPE_LIFECYCLE_MANAGER,
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL,
+                  NULL,
+                  g_cclosure_marshal_VOID__VOID,
+                  G_TYPE_NONE,
+                  0);
+
   lifecycle_manager_signals[SIGNAL_SHUTDOWN] =
     g_signal_new ("shutdown",
                   TUMBLER_TYPE_LIFECYCLE_MANAGER,
@@ -91,13 +133,164 @@ tumbler_lifecycle_manager_class_init (TumblerLifecycleManagerClass *klass)
 
 
 
+static guint
+tumbler_lifecycle_manager_get_setting (GKeyFile *rc,
+                                       const gchar *key,
+                                       guint default_value)
+{
+  GError *error = NULL;
+  gint value;
+
+  value = g_key_file_get_integer (rc, "Lifecycle", key, &error);
+  if (error != NULL)
+    {
+      g_error_free (error);
+      return default_value;
+    }
+
+  return MAX (value, 0);
+}
+
+
+
+static gchar *
+tumbler_lifecycle_manager_get_state_filename (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "tumbler", STATE_FILE, NULL);
+}
+
+
+
+static void
+tumbler_lifecycle_manager_load_state (TumblerLifecycleManager *manager)
+{
+  GKeyFile *state;
+  gchar *filename;
+  gint *gaps;
+  gsize n_gaps = 0;
+  gsize n;
+
+  state = g_key_file_new ();
+  filename = tumbler_lifecycle_manager_get_state_filename ();
+
+  if (g_key_file_load_from_file (state, filename, G_KEY_FILE_NONE, NULL))
+    {
+      manager->last_activity = g_key_file_get_int64 (state, "Lifecycle", "LastActivity", NULL);
+
+      gaps = g_key_file_get_integer_list (state, "Lifecycle", "Gaps", &n_gaps, NULL);
+      for (n = 0; n < n_gaps && n < N_GAPS; n++)
+        manager->gaps[n] = MAX (gaps[n], 0);
+      manager->n_gaps = n;
+      manager->next_gap = n % N_GAPS;
+      g_free (gaps);
+    }
+
+  g_free (filename);
+  g_key_file_free (state);
+}
+
+
+
+static void
+tumbler_lifecycle_manager_save_state (TumblerLifecycleManager *manager)
+{
+  GKeyFile *state;
+  GError *error = NULL;
+  gchar *filename;
+  gchar *dirname;
+  gint gaps[N_GAPS];
+  guint n;
+
+  state = g_key_file_new ();
+  filename = tumbler_lifecycle_manager_get_state_filename ();
+  dirname = g_path_get_dirname (filename);
+
+  /* oldest gap first, so that they are restored in the same order */
+  for (n = 0; n < manager->n_gaps; n++)
+    gaps[n] = manager->gaps[(manager->next_gap + N_GAPS - manager->n_gaps + n) % N_GAPS];
+
+  g_key_file_set_int64 (state, "Lifecycle", "LastActivity", manager->last_activity);
+  g_key_file_set_integer_list (state, "Lifecycle", "Gaps", gaps, manager->n_gaps);
+
+  if (g_mkdir_with_parents (dirname, 0700) != 0
+      || !g_key_file_save_to_file (state, filename, &error))
+    {
+      g_debug ("Failed to save the lifecycle state to \"%s\": %s", filename,
+               error != NULL ? error->message : g_strerror (errno));
+      g_clear_error (&error);
+    }
+
+  g_free (dirname);
+  g_free (filename);
+  g_key_file_free (state);
+}
+
+
+
+static gint
+tumbler_lifecycle_manager_compare_gaps (gconstpointer a,
+                                        gconstpointer b)
+{
+  guint gap_a = *(const guint *) a;
+  guint gap_b = *(const guint *) b;
+
+  return gap_a < gap_b ? -1 : gap_a > gap_b;
+}
+
+
+
+/* the idle time after which the daemon exits: long enough to cover most of
+ * the recent gaps between bursts of requests, or as many as possible if those
+ * gaps are longer than the daemon may stay idle */
+static guint
+tumbler_lifecycle_manager_get_timeout (TumblerLifecycleManager *manager)
+{
+  guint gaps[N_GAPS];
+  guint gap;
+  guint n;
+
+  if (manager->n_gaps < MIN_GAPS || manager->max_shutdown_timeout <= manager->shutdown_timeout)
+    return manager->shutdown_timeout;
+
+  memcpy (gaps, manager->gaps, manager->n_gaps * sizeof (guint));
+  qsort (gaps, manager->n_gaps, sizeof (guint), tumbler_lifecycle_manager_compare_gaps);
+
+  /* 80th percentile, or the longest gap the daemon may still stay idle for */
+  n = (manager->n_gaps * 4 - 1) / 5;
+  while (n > 0 && gaps[n] > manager->max_shutdown_timeout)
+    n--;
+
+  gap = MIN (gaps[n], manager->max_shutdown_timeout);
+
+  return CLAMP (gap + gap / 4, manager->shutdown_timeout, manager->max_shutdown_timeout);
+}
+
+
+
 static void
 tumbler_lifecycle_manager_init (TumblerLifecycleManager *manager)
 {
+  GKeyFile *rc;
+
   tumbler_mutex_create (manager->lock);
   manager->timeout_id = 0;
+  manager->release_id = 0;
   manager->component_use_count = 0;
   manager->shutdown_emitted = FALSE;
+
+  rc = tumbler_util_get_settings ();
+  manager->shutdown_timeout =
+    tumbler_lifecycle_manager_get_setting (rc, "IdleTimeout", SHUTDOWN_TIMEOUT_SECONDS);
+  manager->max_shutdown_timeout =
+    tumbler_lifecycle_manager_get_setting (rc, "MaxIdleTimeout", MAX_SHUTDOWN_TIMEOUT_SECONDS);
+  manager->release_timeout =
+    tumbler_lifecycle_manager_get_setting (rc, "ReleaseTimeout", RELEASE_TIMEOUT_SECONDS);
+  g_key_file_free (rc);
+
+  /* g_timeout_add_seconds() with 0 would exit before serving anything */
+  manager->shutdown_timeout = MAX (manager->shutdown_timeout, 1);
+
+  tumbler_lifecycle_manager_load_state (manager);
 }
 
 
@@ -107,6 +300,10 @@ tumbler_lifecycle_manager_finalize (GObject *object)
 {
   TumblerLifecycleManager *manager = TUMBLER_LIFECYCLE_MANAGER (object);
 
+  /* remember when we were last used, to learn from the next restart, however
+   * the daemon exits */
+  tumbler_lifecycle_manager_save_state (manager);
+
   tumbler_mutex_free (manager->lock);
 
   (*G_OBJECT_CLASS (tumbler_lifecycle_manager_parent_class)->finalize) (object);
@@ -131,6 +328,12 @@ tumbler_lifecycle_manager_timeout (gpointer user_data)
   /* reset the timeout id */
   manager->timeout_id = 0;
 
+  if (manager->release_id > 0)
+    {
+      g_source_remove (manager->release_id);
+      manager->release_id = 0;
+    }
+
   /* emit the shutdown signal */
   g_signal_emit (manager, lifecycle_manager_signals[SIGNAL_SHUTDOWN], 0);
 
@@ -145,6 +348,66 @@ tumbler_lifecycle_manager_timeout (gpointer user_data)
 
 
 
+static gboolean
+tumbler_lifecycle_manager_release (gpointer user_data)
+{
+  TumblerLifecycleManager *manager = user_data;
+
+  tumbler_mutex_lock (manager->lock);
+
+  /* reschedule the release if one of the components is still in use */
+  if (manager->component_use_count > 0)
+    {
+      tumbler_mutex_unlock (manager->lock);
+      return TRUE;
+    }
+
+  manager->release_id = 0;
+
+  tumbler_mutex_unlock (manager->lock);
+
+  g_debug ("Idle for %u seconds, releasing memory", manager->release_timeout);
+
+  /* let the daemon drop what it can rebuild while waiting for the shutdown */
+  g_signal_emit (manager, lifecycle_manager_signals[SIGNAL_RELEASE], 0);
+
+  return FALSE;
+}
+
+
+
+/* must be called with the lock held */
+static void
+tumbler_lifecycle_manager_schedule (TumblerLifecycleManager *manager)
+{
+  guint timeout;
+
+  /* if there is an existing timeout, drop it (we are going to
+   * replace it with a new one) */
+  if (manager->timeout_id > 0)
+    g_source_remove (manager->timeout_id);
+  if (manager->release_id > 0)
+    g_source_remove (manager->release_id);
+  manager->release_id = 0;
+
+  timeout = tumbler_lifecycle_manager_get_timeout (manager);
+
+  /* reschedule the shutdown timeout */
+  manager->timeout_id =
+    g_timeout_add_seconds (timeout,
+                           tumbler_lifecycle_manager_timeout,
+                           manager);
+
+  /* only worth it if the daemon is going to stay idle for a while longer */
+  if (manager->release_timeout > 0 && manager->release_timeout < timeout)
+    manager->release_id =
+      g_timeout_add_seconds (manager->release_timeout,
+                             tumbler_lifecycle_manager_release,
+                             manager);
+}
+
+
+
 TumblerLifecycleManager *
 tumbler_lifecycle_manager_new (void)
 {
@@ -167,10 +430,7 @@ tumbler_lifecycle_manager_start (TumblerLifecycleManager *manager)
       return;
     }
 
-  manager->timeout_id =
-    g_timeout_add_seconds (SHUTDOWN_TIMEOUT_SECONDS,
-                           tumbler_lifecycle_manager_timeout,
-                           manager);
+  tumbler_lifecycle_manager_schedule (manager);
 
   tumbler_mutex_unlock (manager->lock);
 }
@@ -181,6 +441,8 @@ gboolean
 tumbler_lifecycle_manager_keep_alive (TumblerLifecycleManager *manager,
                                       GError **error)
 {
+  gint64 now;
+
   g_return_val_if_fail (TUMBLER_IS_LIFECYCLE_MANAGER (manager), FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
@@ -200,16 +462,19 @@ tumbler_lifecycle_manager_keep_alive (TumblerLifecycleManager *manager,
       return FALSE;
     }
 
-  /* if there is an existing timeout, drop it (we are going to
-   * replace it with a new one) */
-  if (manager->timeout_id > 0)
-    g_source_remove (manager->timeout_id);
+  /* a request after a long enough pause starts a new burst */
+  now = g_get_real_time ();
+  if (manager->last_activity > 0
+      && now - manager->last_activity >= MIN_GAP_SECONDS * G_USEC_PER_SEC)
+    {
+      manager->gaps[manager->next_gap] =
+        MIN ((now - manager->last_activity) / G_USEC_PER_SEC, G_MAXUINT);
+      manager->next_gap = (manager->next_gap + 1) % N_GAPS;
+      manager->n_gaps = MIN (manager->n_gaps + 1, N_GAPS);
+    }
+  manager->last_activity = now;
 
-  /* reschedule the shutdown timeout */
-  manager->timeout_id =
-    g_timeout_add_seconds (SHUTDOWN_TIMEOUT_SECONDS,
-                           tumbler_lifecycle_manager_timeout,
-                           manager);
+  tumbler_lifecycle_manager_schedule (manager);
 
   tumbler_mutex_unlock (manager->lock);
 
@@ -20,7 +20,9 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include "tumbler-content-index.h"
 #include "tumbler-lifo-scheduler.h"
+#include "tumbler-stats.h"
 #include "tumbler-utils.h"
 
 #include "tumbler/tumbler.h"
@@ -63,6 +65,11 @@ static void
 tumbler_lifo_scheduler_cancel_by_mount (TumblerScheduler *scheduler,
                                         GMount *mount);
 static void
+tumbler_lifo_scheduler_resume (TumblerScheduler *scheduler,
+                               TumblerSchedulerRequest *request);
+static void
+tumbler_lifo_scheduler_reclaim (TumblerScheduler *scheduler);
+static void
 tumbler_lifo_scheduler_finish_request (TumblerLifoScheduler *scheduler,
                                        TumblerSchedulerRequest *request);
 static void
@@ -72,6 +79,13 @@ static void
 tumbler_lifo_scheduler_thread (gpointer data,
                                gpointer user_data);
 static void
+tumbler_lifo_scheduler_run_thumbnailers (TumblerSchedulerRequest *request,
+                                         guint n,
+                                         GList *thumbnailers);
+static void
+tumbler_lifo_scheduler_process_async_results (TumblerLifoScheduler *scheduler,
+                                              TumblerSchedulerRequest *request);
+static void
 tumbler_lifo_scheduler_thumbnailer_error (TumblerThumbnailer *thumbnailer,
                                           TumblerFileInfo *failed_info,
                                           GQuark error_domain,
@@ -129,6 +143,8 @@ tumbler_lifo_scheduler_iface_init (TumblerSchedulerIface *iface)
   iface->push = tumbler_lifo_scheduler_push;
   iface->dequeue = tumbler_lifo_scheduler_dequeue;
   iface->cancel_by_mount = tumbler_lifo_scheduler_cancel_by_mount;
+  iface->resume = tumbler_lifo_scheduler_resume;
+  iface->reclaim = tumbler_lifo_scheduler_reclaim;
 }
 
 
@@ -138,13 +154,8 @@ tumbler_lifo_scheduler_init (TumblerLifoScheduler *scheduler)
   tumbler_mutex_create (scheduler->mutex);
   scheduler->requests = NULL;
 
-  /* allocate a pool with a number of threads depending on the system */
-  scheduler->pool = g_thread_pool_new (tumbler_lifo_scheduler_thread,
-                                       scheduler, g_get_num_processors (), TRUE, NULL);
-
-  /* make the thread a LIFO */
-  g_thread_pool_set_sort_function (scheduler->pool,
-                                   tumbler_scheduler_request_compare, NULL);
+  /* the thread pool is created on first use */
+  scheduler->pool = NULL;
 }
 
 
@@ -154,8 +165,9 @@ tumbler_lifo_scheduler_finalize (GObject *object)
 {
   TumblerLifoScheduler *scheduler = TUMBLER_LIFO_SCHEDULER (object);
 
-  /* destroy both thread pools */
-  g_thread_pool_free (scheduler->pool, TRUE, TRUE);
+  /* destroy the thread pool */
+  if (scheduler->pool != NULL)
+    g_thread_pool_free (scheduler->pool, TRUE, TRUE);
 
   /* release all pending requests and destroy the request list */
   g_list_free_full (scheduler->requests, tumbler_scheduler_request_free);
@@ -213,6 +225,29 @@ tumbler_lifo_scheduler_set_property (GObject *object,
 
 
 
+static void
+tumbler_lifo_scheduler_push_pool (TumblerLifoScheduler *scheduler,
+                                  TumblerSchedulerRequest *request)
+{
+  GThreadPool *pool = scheduler->pool;
+
+  /* allocate a pool with a number of threads depending on the system */
+  if (pool == NULL)
+    {
+      pool = g_thread_pool_new (tumbler_lifo_scheduler_thread,
+                                scheduler, g_get_num_processors (), TRUE, NULL);
+
+      /* make the thread a LIFO */
+      g_thread_pool_set_sort_function (pool, tumbler_scheduler_request_compare, NULL);
+
+      scheduler->pool = pool;
+    }
+
+  g_thread_pool_push (pool, request, NULL);
+}
+
+
+
 static void
 tumbler_lifo_scheduler_push (TumblerScheduler *scheduler,
                              TumblerSchedulerRequest *request)
@@ -231,7 +266,7 @@ tumbler_lifo_scheduler_push (TumblerScheduler *scheduler,
   lifo_scheduler->requests = g_list_prepend (lifo_scheduler->requests, request);
 
   /* enqueue the request in the pool */
-  g_thread_pool_push (lifo_scheduler->pool, request, NULL);
+  tumbler_lifo_scheduler_push_pool (lifo_scheduler, request);
 
   tumbler_mutex_unlock (lifo_scheduler->mutex);
 }
@@ -306,6 +341,53 @@ tumbler_lifo_scheduler_cancel_by_mount (TumblerScheduler *scheduler,
 
 
 
+static void
+tumbler_lifo_scheduler_resume (TumblerScheduler *scheduler,
+                               TumblerSchedulerRequest *request)
+{
+  TumblerLifoScheduler *lifo_scheduler = TUMBLER_LIFO_SCHEDULER (scheduler);
+
+  g_return_if_fail (TUMBLER_IS_LIFO_SCHEDULER (scheduler));
+  g_return_if_fail (request != NULL);
+
+  tumbler_mutex_lock (lifo_scheduler->mutex);
+
+  /* the request is still in the request list, only enqueue it again */
+  tumbler_lifo_scheduler_push_pool (lifo_scheduler, request);
+
+  tumbler_mutex_unlock (lifo_scheduler->mutex);
+}
+
+
+
+static void
+tumbler_lifo_scheduler_reclaim (TumblerScheduler *scheduler)
+{
+  TumblerLifoScheduler *lifo_scheduler = TUMBLER_LIFO_SCHEDULER (scheduler);
+  GThreadPool *pool = NULL;
+
+  g_return_if_fail (TUMBLER_IS_LIFO_SCHEDULER (scheduler));
+
+  tumbler_mutex_lock (lifo_scheduler->mutex);
+
+  /* an exclusive pool keeps all its threads until it is freed, so drop
+   * it while there is nothing to do, the next push creates a new one */
+  if (lifo_scheduler->requests == NULL && lifo_scheduler->pool != NULL)
+    {
+      pool = lifo_scheduler->pool;
+      lifo_scheduler->pool = NULL;
+    }
+
+  tumbler_mutex_unlock (lifo_scheduler->mutex);
+
+  /* the threads may still be on their way out of the last request, which
+   * takes the scheduler mutex, so wait for them without holding it */
+  if (pool != NULL)
+    g_thread_pool_free (pool, FALSE, TRUE);
+}
+
+
+
 static void
 tumbler_lifo_scheduler_finish_request (TumblerLifoScheduler *scheduler,
                                        TumblerSchedulerRequest *request)
@@ -360,12 +442,31 @@ tumbler_lifo_scheduler_thread (gpointer data,
   GError *error = NULL;
   GList *cached_uris = NULL;
   GList *missing_uris = NULL;
-  GList *lp, *lq;
+  GQueue pending_uris = G_QUEUE_INIT;
+  GList *lp;
+  gint64 trace;
   guint n;
 
   g_return_if_fail (TUMBLER_IS_LIFO_SCHEDULER (scheduler));
   g_return_if_fail (request != NULL);
 
+  tumbler_stats_add (TUMBLER_STATS_QUEUED_REQUESTS, scheduler->name, NULL, -1);
+  tumbler_util_trace_end (request->trace_queued, "queue", "handle=%u", request->handle);
+
+  /* specialized thumbnailers are done with a request we let go earlier */
+  if (request->resumed)
+    {
+      if (!request->dequeued)
+        tumbler_lifo_scheduler_process_async_results (scheduler, request);
+
+      tumbler_mutex_lock (scheduler->mutex);
+      tumbler_lifo_scheduler_finish_request (scheduler, request);
+      tumbler_mutex_unlock (scheduler->mutex);
+      return;
+    }
+
+  request->trace_started = tumbler_util_trace_begin ();
+
   /* notify others that we're starting to process this request */
   g_signal_emit_by_name (request->scheduler, "started", request->handle,
                          request->origin);
@@ -400,7 +501,12 @@ tumbler_lifo_scheduler_thread (gpointer data,
       /* create a file info for the current URI */
       uri_needs_update = FALSE;
 
+      trace = tumbler_util_trace_begin ();
       G_LOCK (plugin_access_lock);
+      tumbler_util_trace_end (trace, "lock", "handle=%u uri=%s", request->handle,
+                              tumbler_file_info_get_uri (request->infos[n]));
+
+      trace = tumbler_util_trace_begin ();
 
       /* try to load thumbnail information about the URI */
       if (tumbler_file_info_load (request->infos[n], NULL, &error))
@@ -422,9 +528,15 @@ tumbler_lifo_scheduler_thread (gpointer data,
 
       G_UNLOCK (plugin_access_lock);
 
+      tumbler_util_trace_end (trace, "file-info", "handle=%u uri=%s", request->handle,
+                              tumbler_file_info_get_uri (request->infos[n]));
+
       /* check if the URI is supported */
       if (error == NULL)
         {
+          tumbler_stats_add (uri_needs_update ? TUMBLER_STATS_CACHE_MISSES : TUMBLER_STATS_CACHE_HITS,
+                             scheduler->name, tumbler_file_info_get_mime_type (request->infos[n]), 1);
+
           /* put it in the right list depending on its thumbnail status */
           if (uri_needs_update)
             missing_uris = g_list_prepend (missing_uris, GINT_TO_POINTER (n));
@@ -458,49 +570,46 @@ tumbler_lifo_scheduler_thread (gpointer data,
       g_free (uris);
     }
 
-  /* iterate over invalid/missing URI list */
+  /* queue the invalid/missing URIs in request order */
   for (lp = g_list_last (missing_uris); lp != NULL; lp = lp->prev)
+    g_queue_push_tail (&pending_uris, lp->data);
+  g_list_free (missing_uris);
+
+  /* iterate over invalid/missing URIs */
+  while (!g_queue_is_empty (&pending_uris))
     {
-      n = GPOINTER_TO_INT (lp->data);
+      n = tumbler_scheduler_request_pop_pending (request, &pending_uris);
 
-      /* finish the request if it was dequeued */
+      /* finish the request if it was dequeued, or once specialized
+       * thumbnailers don't use it anymore */
       if (request->dequeued)
         {
           tumbler_mutex_lock (scheduler->mutex);
-          tumbler_lifo_scheduler_finish_request (scheduler, request);
+          if (!tumbler_scheduler_request_detach (request))
+            tumbler_lifo_scheduler_finish_request (scheduler, request);
           tumbler_mutex_unlock (scheduler->mutex);
-          g_list_free (missing_uris);
+          g_queue_clear (&pending_uris);
           return;
         }
 
-      for (lq = request->thumbnailers[n]; lq != NULL; lq = lq->next)
+      /* a copy of the same file may have been thumbnailed already */
+      if (tumbler_content_index_reuse (request->infos[n], request->cancellables[n]))
         {
-          /* We immediately forward error and ready so that clients rapidly know
-           * when individual thumbnails are ready. It's a LIFO for better inter-
-           * activity with the clients, so we assume this behaviour to be desired. */
-
-          /* forward only the error signal of the last thumbnailer */
-          if (lq->next == NULL)
-            g_signal_connect (lq->data, "error",
-                              G_CALLBACK (tumbler_lifo_scheduler_thumbnailer_error), request);
-          else if (tumbler_util_is_debug_logging_enabled (G_LOG_DOMAIN))
-            g_signal_connect (lq->data, "error",
-                              G_CALLBACK (tumbler_scheduler_thumberr_debuglog), request);
-
-          /* connect to the ready signal of the thumbnailer */
-          g_signal_connect (lq->data, "ready",
-                            G_CALLBACK (tumbler_lifo_scheduler_thumbnailer_ready), request);
-
-          /* tell the thumbnailer to generate the thumbnail */
-          tumbler_thumbnailer_create (lq->data, request->cancellables[n], request->infos[n]);
-
-          /* disconnect from all signals when we're finished */
-          g_signal_handlers_disconnect_by_data (lq->data, request);
+          tumbler_lifo_scheduler_thumbnailer_ready (request->thumbnailers[n]->data,
+                                                    request->infos[n], request);
+          continue;
         }
+
+      /* specialized thumbnailers don't need this thread to wait for them */
+      if (!tumbler_scheduler_request_queue_async (request, n))
+        tumbler_lifo_scheduler_run_thumbnailers (request, n, request->thumbnailers[n]);
     }
 
-  /* free list */
-  g_list_free (missing_uris);
+  /* let the request go while specialized thumbnailers are busy with it */
+  if (tumbler_scheduler_request_detach (request))
+    return;
+
+  tumbler_lifo_scheduler_process_async_results (scheduler, request);
 
   tumbler_mutex_lock (scheduler->mutex);
 
@@ -512,6 +621,102 @@ tumbler_lifo_scheduler_thread (gpointer data,
 
 
 
+static void
+tumbler_lifo_scheduler_run_thumbnailers (TumblerSchedulerRequest *request,
+                                         guint n,
+                                         GList *thumbnailers)
+{
+  GList *lq;
+  gint64 start;
+  gint64 trace;
+
+  for (lq = thumbnailers; lq != NULL; lq = lq->next)
+    {
+      /* We immediately forward error and ready so that clients rapidly know
+       * when individual thumbnails are ready. It's a LIFO for better inter-
+       * activity with the clients, so we assume this behaviour to be desired. */
+
+      /* forward only the error signal of the last thumbnailer */
+      if (lq->next == NULL)
+        g_signal_connect (lq->data, "error",
+                          G_CALLBACK (tumbler_lifo_scheduler_thumbnailer_error), request);
+      else if (tumbler_util_is_debug_logging_enabled (G_LOG_DOMAIN))
+        g_signal_connect (lq->data, "error",
+                          G_CALLBACK (tumbler_scheduler_thumberr_debuglog), request);
+
+      /* connect to the ready signal of the thumbnailer */
+      g_signal_connect (lq->data, "ready",
+                        G_CALLBACK (tumbler_lifo_scheduler_thumbnailer_ready), request);
+
+      /* tell the thumbnailer to generate the thumbnail */
+      trace = tumbler_util_trace_begin ();
+      start = g_get_monotonic_time ();
+      tumbler_thumbnailer_create (lq->data, request->cancellables[n], request->infos[n]);
+      tumbler_util_trace_end (trace, "create", "handle=%u uri=%s thumbnailer=%s",
+                              request->handle, tumbler_file_info_get_uri (request->infos[n]),
+                              G_OBJECT_TYPE_NAME (lq->data));
+      tumbler_stats_observe (TUMBLER_STATS_CREATE_SECONDS, G_OBJECT_TYPE_NAME (lq->data),
+                             tumbler_file_info_get_mime_type (request->infos[n]),
+                             g_get_monotonic_time () - start);
+
+      /* disconnect from all signals when we're finished */
+      g_signal_handlers_disconnect_by_data (lq->data, request);
+    }
+}
+
+
+
+static void
+tumbler_lifo_scheduler_process_async_results (TumblerLifoScheduler *scheduler,
+                                              TumblerSchedulerRequest *request)
+{
+  TumblerSchedulerAsyncResult *result;
+  TumblerFileInfo *info;
+  GList *thumbnailers;
+  GList *lp;
+
+  /* results are prepended as they come in */
+  for (lp = g_list_last (request->async_results); lp != NULL; lp = lp->prev)
+    {
+      result = lp->data;
+      info = request->infos[result->n];
+      thumbnailers = request->thumbnailers[result->n];
+
+      if (result->error == NULL)
+        {
+          tumbler_lifo_scheduler_thumbnailer_ready (thumbnailers->data, info, request);
+        }
+      else if (!g_error_matches (result->error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          if (thumbnailers->next == NULL)
+            {
+              tumbler_lifo_scheduler_thumbnailer_error (thumbnailers->data, info,
+                                                        result->error->domain,
+                                                        result->error->code,
+                                                        result->error->message,
+                                                        request);
+            }
+          else
+            {
+              if (tumbler_util_is_debug_logging_enabled (G_LOG_DOMAIN))
+                tumbler_scheduler_thumberr_debuglog (thumbnailers->data, info,
+                                                     result->error->domain,
+                                                     result->error->code,
+                                                     result->error->message,
+                                                     request);
+
+              /* try the thumbnailers with a lower priority */
+              tumbler_lifo_scheduler_run_thumbnailers (request, result->n, thumbnailers->next);
+            }
+        }
+    }
+
+  g_list_free_full (request->async_results, tumbler_scheduler_async_result_free);
+  request->async_results = NULL;
+}
+
+
+
 static void
 tumbler_lifo_scheduler_thumbnailer_error (TumblerThumbnailer *thumbnailer,
                                           TumblerFileInfo *failed_info,
@@ -525,6 +730,9 @@ tumbler_lifo_scheduler_thumbnailer_error (TumblerThumbnailer *thumbnailer,
   g_return_if_fail (request != NULL);
   g_return_if_fail (TUMBLER_IS_LIFO_SCHEDULER (request->scheduler));
 
+  tumbler_stats_add (TUMBLER_STATS_CREATE_ERRORS, G_OBJECT_TYPE_NAME (thumbnailer),
+                     tumbler_file_info_get_mime_type (failed_info), 1);
+
   /* forward the error signal */
   for (guint n = 0; n < request->length; n++)
     {
@@ -557,6 +765,7 @@ tumbler_lifo_scheduler_thumbnailer_ready (TumblerThumbnailer *thumbnailer,
         {
           const gchar *uris[] = { tumbler_file_info_get_uri (info), NULL };
           g_signal_emit_by_name (request->scheduler, "ready", request->handle, uris, request->origin);
+          tumbler_content_index_add (info);
 
           /* cancel lower priority thumbnailers for this uri */
           g_cancellable_cancel (request->cancellables[n]);
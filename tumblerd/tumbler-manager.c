@@ -24,6 +24,7 @@
 #include "tumbler-specialized-thumbnailer.h"
 #include "tumbler-utils.h"
 
+#include <errno.h>
 #include <gio/gio.h>
 #include <glib-object.h>
 #include <glib/gi18n.h>
@@ -38,6 +39,10 @@
 
 #define WARNING_MALFORMED_SECTION "Malformed section \"%s\" in file \"%s\": %s"
 
+/* parsed thumbnailer directories, in the user cache directory */
+#define SNAPSHOT_FILE "manager.cache"
+#define SNAPSHOT_VERSION 2
+
 /* Property identifiers */
 enum
 {
@@ -77,6 +82,18 @@ static void
 tumbler_manager_monitor_unref (GFileMonitor *monitor,
                                TumblerManager *manager);
 static void
+tumbler_manager_add_thumbnailer (TumblerManager *manager,
+                                 GFile *file,
+                                 const gchar *name,
+                                 const gchar *object_path,
+                                 const gchar *const *uri_schemes,
+                                 const gchar *const *mime_types,
+                                 guint64 modified);
+static void
+tumbler_manager_add_overrides (TumblerManager *manager,
+                               GList *overrides,
+                               gint dir_index);
+static void
 tumbler_manager_load_thumbnailers (TumblerManager *manager,
                                    GFile *directory);
 static void
@@ -632,24 +649,15 @@ tumbler_manager_parse_overrides (TumblerManager *manager,
  * @file    : an overrides GFile to load.
  *
  * This function tries to parse @file into a number of override infos, one
- * for each section in the @file. If this succeeds, it adds each info to
- * the correct override info list in the hash table that maps hash keys to
- * infos. The infos are inserted in sorted order (where the sort key is the
- * directory index). This ensures that infos from thumbnailer directories
- * with higher priority always come first.
+ * for each section in the @file. If this succeeds, they are added with
+ * tumbler_manager_add_overrides().
  */
 static void
 tumbler_manager_load_overrides_file (TumblerManager *manager,
                                      GFile *file)
 {
-  OverrideInfo *info;
-  OverrideInfo *info2;
   GList *overrides;
-  GList *lp;
-  GList *op;
-  GList **list;
   GFile *directory;
-  gchar *hash_key;
   gint dir_index;
 
   g_return_if_fail (TUMBLER_MANAGER (manager));
@@ -667,6 +675,34 @@ tumbler_manager_load_overrides_file (TumblerManager *manager,
   /* try parsing the file into override infos */
   overrides = tumbler_manager_parse_overrides (manager, file);
 
+  tumbler_manager_add_overrides (manager, overrides, dir_index);
+}
+
+
+
+/**
+ * tumbler_manager_add_overrides:
+ * @manager   : a #TumblerManager.
+ * @overrides : a list of #OverrideInfo<!---->s, which is freed.
+ * @dir_index : the index of the thumbnailer directory they come from.
+ *
+ * Adds each info to the correct override info list in the hash table that
+ * maps hash keys to infos. The infos are inserted in sorted order (where
+ * the sort key is the directory index). This ensures that infos from
+ * thumbnailer directories with higher priority always come first.
+ */
+static void
+tumbler_manager_add_overrides (TumblerManager *manager,
+                               GList *overrides,
+                               gint dir_index)
+{
+  OverrideInfo *info;
+  OverrideInfo *info2;
+  GList *lp;
+  GList *op;
+  GList **list;
+  gchar *hash_key;
+
   /* iterate over all override infos we parsed successfully */
   for (op = overrides; op != NULL; op = op->next)
     {
@@ -899,32 +935,21 @@ tumbler_manager_unload_overrides_file (TumblerManager *manager,
  * @file    : the #GFile to load thumbnailer information from.
  *
  * Attempts to load information about a permanently installed specialized
- * thumbnailer from the @file. On success, the resulting thumbnailer info
- * is added to the basename -> thumbnailer info list hash table. If it is
- * inserted as the first element of that list, the preferred thumbnailer
- * for all hash keys supported by the thumbnailer is updated.
+ * thumbnailer from the @file. On success, the thumbnailer is added with
+ * tumbler_manager_add_thumbnailer().
  */
 static void
 tumbler_manager_load_thumbnailer (TumblerManager *manager,
                                   GFile *file)
 {
-  ThumbnailerInfo *info;
-  ThumbnailerInfo *info2;
   struct stat file_stat;
   GKeyFile *key_file;
-  gboolean first = FALSE;
   GError *error = NULL;
-  GFile *directory;
-  GList **list;
-  GList *lp;
-  gchar **hash_keys;
-  gchar *base_name;
   const gchar *filename;
   gchar *name;
   gchar *object_path;
   gchar **uri_schemes;
   gchar **mime_types;
-  guint n;
 
   g_return_if_fail (TUMBLER_IS_MANAGER (manager));
   g_return_if_fail (G_IS_FILE (file));
@@ -1012,6 +1037,55 @@ tumbler_manager_load_thumbnailer (TumblerManager *manager,
       return;
     }
 
+  tumbler_manager_add_thumbnailer (manager, file, name, object_path,
+                                   (const gchar *const *) uri_schemes,
+                                   (const gchar *const *) mime_types,
+                                   file_stat.st_mtime);
+
+  /* free stuff */
+  g_strfreev (uri_schemes);
+  g_strfreev (mime_types);
+  g_free (object_path);
+  g_free (name);
+  g_key_file_free (key_file);
+}
+
+
+
+/**
+ * tumbler_manager_add_thumbnailer:
+ * @manager     : a #TumblerManager.
+ * @file        : the thumbnailer .service #GFile.
+ * @name        : the D-Bus name of the specialized thumbnailer.
+ * @object_path : the D-Bus object path of the specialized thumbnailer.
+ * @uri_schemes : the URI schemes supported by the thumbnailer.
+ * @mime_types  : the MIME types supported by the thumbnailer.
+ * @modified    : the time @file was last modified.
+ *
+ * Creates a thumbnailer info for a specialized thumbnailer loaded from
+ * @file and adds it to the basename -> thumbnailer info list hash table.
+ * If it is inserted as the first element of that list, the preferred
+ * thumbnailer for all hash keys supported by the thumbnailer is updated.
+ */
+static void
+tumbler_manager_add_thumbnailer (TumblerManager *manager,
+                                 GFile *file,
+                                 const gchar *name,
+                                 const gchar *object_path,
+                                 const gchar *const *uri_schemes,
+                                 const gchar *const *mime_types,
+                                 guint64 modified)
+{
+  ThumbnailerInfo *info;
+  ThumbnailerInfo *info2;
+  gboolean first = FALSE;
+  GFile *directory;
+  GList **list;
+  GList *lp;
+  gchar **hash_keys;
+  gchar *base_name;
+  guint n;
+
   /* allocate a new thumbnailer info */
   info = thumbnailer_info_new ();
   if (tumbler_util_is_debug_logging_enabled (G_LOG_DOMAIN))
@@ -1026,16 +1100,7 @@ tumbler_manager_load_thumbnailer (TumblerManager *manager,
    * information on to it */
   info->thumbnailer =
     tumbler_specialized_thumbnailer_new (manager->connection, name, object_path,
-                                         (const gchar *const *) uri_schemes,
-                                         (const gchar *const *) mime_types,
-                                         file_stat.st_mtime);
-
-  /* free stuff */
-  g_strfreev (uri_schemes);
-  g_strfreev (mime_types);
-  g_free (object_path);
-  g_free (name);
-  g_key_file_free (key_file);
+                                         uri_schemes, mime_types, modified);
 
   /* determine the basename of the file */
   base_name = g_file_get_basename (file);
@@ -1197,6 +1262,351 @@ tumbler_manager_load_thumbnailers (TumblerManager *manager,
 
 
 
+/**
+ * tumbler_manager_snapshot_mtime:
+ * @directory : a thumbnailer directory.
+ * @base_name : a file in @directory or %NULL for @directory itself.
+ *
+ * Return value: the modification time of the file, or -1 if it does not exist.
+ */
+static gint64
+tumbler_manager_snapshot_mtime (GFile *directory,
+                                const gchar *base_name)
+{
+  struct stat file_stat;
+  gchar *filename;
+  gint result;
+
+  filename = g_build_filename (g_file_peek_path (directory), base_name, NULL);
+  result = g_stat (filename, &file_stat);
+  g_free (filename);
+
+  return result == 0 ? (gint64) file_stat.st_mtime : -1;
+}
+
+
+
+/**
+ * tumbler_manager_snapshot_load:
+ * @manager : a #TumblerManager.
+ *
+ * Maps the snapshot written by tumbler_manager_snapshot_save() and checks
+ * that it is still up to date: the thumbnailer directories must be the same,
+ * and neither they nor the .service and overrides files in them, whether
+ * they could be loaded or not, may have been modified since.
+ *
+ * Return value: the snapshot, or %NULL if there is no valid snapshot.
+ */
+static GKeyFile *
+tumbler_manager_snapshot_load (TumblerManager *manager)
+{
+  GMappedFile *mapped_file;
+  GKeyFile *snapshot;
+  const gchar *key;
+  gboolean valid;
+  gchar **groups;
+  gchar *filename;
+  gchar *group;
+  gchar *path;
+  gchar *base_name;
+  GFile *directory;
+  GList *lp;
+  gint dir_index;
+  guint n;
+
+  filename = g_build_filename (g_get_user_cache_dir (), "tumbler", SNAPSHOT_FILE, NULL);
+  mapped_file = g_mapped_file_new (filename, FALSE, NULL);
+  g_free (filename);
+
+  if (mapped_file == NULL)
+    return NULL;
+
+  snapshot = g_key_file_new ();
+  valid = g_key_file_load_from_data (snapshot, g_mapped_file_get_contents (mapped_file),
+                                     g_mapped_file_get_length (mapped_file),
+                                     G_KEY_FILE_NONE, NULL)
+          && g_key_file_get_integer (snapshot, "Snapshot", "Version", NULL) == SNAPSHOT_VERSION;
+  g_mapped_file_unref (mapped_file);
+
+  /* the list of thumbnailer directories must be the same... */
+  for (lp = manager->directories, n = 0; valid && lp != NULL; lp = lp->next, ++n)
+    {
+      group = g_strdup_printf ("Directory %u", n);
+      path = g_key_file_get_string (snapshot, group, "Path", NULL);
+
+      /* ...and files must neither have been added nor removed */
+      valid = g_strcmp0 (path, g_file_peek_path (lp->data)) == 0
+              && g_key_file_get_int64 (snapshot, group, "MTime", NULL)
+                   == tumbler_manager_snapshot_mtime (lp->data, NULL)
+              && g_key_file_get_int64 (snapshot, group, "OverridesMTime", NULL)
+                   == tumbler_manager_snapshot_mtime (lp->data, "overrides");
+
+      g_free (path);
+      g_free (group);
+    }
+
+  if (valid)
+    {
+      group = g_strdup_printf ("Directory %u", n);
+      valid = !g_key_file_has_group (snapshot, group);
+      g_free (group);
+    }
+
+  /* editing a file in place does not change the mtime of its directory, this
+   * includes files that were skipped because they were malformed */
+  groups = g_key_file_get_groups (snapshot, NULL);
+  for (n = 0; valid && groups[n] != NULL; ++n)
+    {
+      if (g_str_has_prefix (groups[n], "Service "))
+        key = "Modified";
+      else if (g_str_has_prefix (groups[n], "File "))
+        key = "MTime";
+      else
+        continue;
+
+      dir_index = g_key_file_get_integer (snapshot, groups[n], "Directory", NULL);
+      base_name = g_key_file_get_string (snapshot, groups[n], "File", NULL);
+      directory = g_list_nth_data (manager->directories, dir_index);
+
+      valid = directory != NULL && base_name != NULL
+              && g_key_file_get_int64 (snapshot, groups[n], key, NULL)
+                   == tumbler_manager_snapshot_mtime (directory, base_name);
+
+      g_free (base_name);
+    }
+  g_strfreev (groups);
+
+  if (!valid)
+    {
+      g_debug ("Thumbnailer directories changed, not using the snapshot");
+      g_key_file_free (snapshot);
+      return NULL;
+    }
+
+  return snapshot;
+}
+
+
+
+/**
+ * tumbler_manager_snapshot_apply:
+ * @manager  : a #TumblerManager.
+ * @snapshot : a snapshot returned by tumbler_manager_snapshot_load().
+ *
+ * Loads the thumbnailer and override infos from @snapshot instead of
+ * parsing the files in the thumbnailer directories. Like
+ * tumbler_manager_load_thumbnailers() and tumbler_manager_load_overrides(),
+ * but without touching the files.
+ */
+static void
+tumbler_manager_snapshot_apply (TumblerManager *manager,
+                                GKeyFile *snapshot)
+{
+  OverrideInfo *info;
+  GList **overrides;
+  GFile *file;
+  gchar **groups;
+  gchar **uri_schemes;
+  gchar **mime_types;
+  gchar *base_name;
+  gchar *name;
+  gchar *object_path;
+  gint n_directories;
+  gint dir_index;
+  guint n;
+
+  n_directories = g_list_length (manager->directories);
+  overrides = g_new0 (GList *, n_directories);
+
+  groups = g_key_file_get_groups (snapshot, NULL);
+  for (n = 0; groups[n] != NULL; ++n)
+    {
+      dir_index = g_key_file_get_integer (snapshot, groups[n], "Directory", NULL);
+      if (dir_index < 0 || dir_index >= n_directories)
+        continue;
+
+      if (g_str_has_prefix (groups[n], "Service "))
+        {
+          base_name = g_key_file_get_string (snapshot, groups[n], "File", NULL);
+          name = g_key_file_get_string (snapshot, groups[n], "Name", NULL);
+          object_path = g_key_file_get_string (snapshot, groups[n], "ObjectPath", NULL);
+          uri_schemes = g_key_file_get_string_list (snapshot, groups[n], "UriSchemes", NULL, NULL);
+          mime_types = g_key_file_get_string_list (snapshot, groups[n], "MimeTypes", NULL, NULL);
+
+          if (base_name != NULL && name != NULL && object_path != NULL
+              && uri_schemes != NULL && mime_types != NULL)
+            {
+              file = g_file_get_child (g_list_nth_data (manager->directories, dir_index), base_name);
+              tumbler_manager_add_thumbnailer (manager, file, name, object_path,
+                                               (const gchar *const *) uri_schemes,
+                                               (const gchar *const *) mime_types,
+                                               g_key_file_get_uint64 (snapshot, groups[n],
+                                                                      "Modified", NULL));
+              g_object_unref (file);
+            }
+
+          g_strfreev (mime_types);
+          g_strfreev (uri_schemes);
+          g_free (object_path);
+          g_free (name);
+          g_free (base_name);
+        }
+      else if (g_str_has_prefix (groups[n], "Override "))
+        {
+          info = override_info_new ();
+          info->name = g_key_file_get_string (snapshot, groups[n], "Name", NULL);
+          info->uri_scheme = g_key_file_get_string (snapshot, groups[n], "UriScheme", NULL);
+          info->mime_type = g_key_file_get_string (snapshot, groups[n], "MimeType", NULL);
+          info->dir_index = dir_index;
+
+          if (info->name != NULL && info->uri_scheme != NULL && info->mime_type != NULL)
+            overrides[dir_index] = g_list_prepend (overrides[dir_index], info);
+          else
+            override_info_free (info);
+        }
+    }
+  g_strfreev (groups);
+
+  dump_thumbnailers (manager);
+
+  /* overrides are loaded after all thumbnailers, as in tumbler_manager_load() */
+  for (dir_index = 0; dir_index < n_directories; ++dir_index)
+    tumbler_manager_add_overrides (manager, overrides[dir_index], dir_index);
+  g_free (overrides);
+
+  dump_overrides (manager);
+}
+
+
+
+/**
+ * tumbler_manager_snapshot_save:
+ * @manager : a #TumblerManager.
+ *
+ * Saves the thumbnailer and override infos loaded from the thumbnailer
+ * directories, so that the next instance of tumblerd can skip parsing
+ * them with tumbler_manager_snapshot_load() if nothing changed.
+ */
+static void
+tumbler_manager_snapshot_save (TumblerManager *manager)
+{
+  TumblerSpecializedThumbnailer *thumbnailer;
+  ThumbnailerInfo *thumbnailer_info;
+  OverrideInfo *override_info;
+  GHashTableIter iter;
+  const gchar *base_name;
+  const gchar *key;
+  GKeyFile *snapshot;
+  GError *error = NULL;
+  GList **list;
+  GList *lp;
+  gchar **uri_schemes;
+  gchar **mime_types;
+  gchar *object_path;
+  gchar *filename;
+  gchar *dirname;
+  gchar *group;
+  GDir *dir;
+  guint n;
+
+  snapshot = g_key_file_new ();
+  g_key_file_set_integer (snapshot, "Snapshot", "Version", SNAPSHOT_VERSION);
+
+  for (lp = manager->directories, n = 0; lp != NULL; lp = lp->next, ++n)
+    {
+      group = g_strdup_printf ("Directory %u", n);
+      g_key_file_set_string (snapshot, group, "Path", g_file_peek_path (lp->data));
+      g_key_file_set_int64 (snapshot, group, "MTime",
+                            tumbler_manager_snapshot_mtime (lp->data, NULL));
+      g_key_file_set_int64 (snapshot, group, "OverridesMTime",
+                            tumbler_manager_snapshot_mtime (lp->data, "overrides"));
+      g_free (group);
+
+      /* every .service file, also those that were not loaded */
+      dir = g_dir_open (g_file_peek_path (lp->data), 0, NULL);
+      if (dir == NULL)
+        continue;
+
+      while ((base_name = g_dir_read_name (dir)) != NULL)
+        {
+          if (!g_str_has_suffix (base_name, ".service"))
+            continue;
+
+          group = g_strdup_printf ("File %u %s", n, base_name);
+          g_key_file_set_integer (snapshot, group, "Directory", n);
+          g_key_file_set_string (snapshot, group, "File", base_name);
+          g_key_file_set_int64 (snapshot, group, "MTime",
+                                tumbler_manager_snapshot_mtime (lp->data, base_name));
+          g_free (group);
+        }
+
+      g_dir_close (dir);
+    }
+
+  g_hash_table_iter_init (&iter, manager->thumbnailers);
+  while (g_hash_table_iter_next (&iter, (gpointer) &key, (gpointer) &list))
+    for (lp = *list; lp != NULL; lp = lp->next)
+      {
+        thumbnailer_info = lp->data;
+        thumbnailer = TUMBLER_SPECIALIZED_THUMBNAILER (thumbnailer_info->thumbnailer);
+
+        g_object_get (thumbnailer, "object-path", &object_path, NULL);
+        uri_schemes = tumbler_thumbnailer_get_uri_schemes (thumbnailer_info->thumbnailer);
+        mime_types = tumbler_thumbnailer_get_mime_types (thumbnailer_info->thumbnailer);
+
+        group = g_strdup_printf ("Service %d %s", thumbnailer_info->dir_index, key);
+        g_key_file_set_integer (snapshot, group, "Directory", thumbnailer_info->dir_index);
+        g_key_file_set_string (snapshot, group, "File", key);
+        g_key_file_set_string (snapshot, group, "Name",
+                               tumbler_specialized_thumbnailer_get_name (thumbnailer));
+        g_key_file_set_string (snapshot, group, "ObjectPath", object_path);
+        g_key_file_set_string_list (snapshot, group, "UriSchemes",
+                                    (const gchar *const *) uri_schemes,
+                                    g_strv_length (uri_schemes));
+        g_key_file_set_string_list (snapshot, group, "MimeTypes",
+                                    (const gchar *const *) mime_types,
+                                    g_strv_length (mime_types));
+        g_key_file_set_uint64 (snapshot, group, "Modified",
+                               tumbler_specialized_thumbnailer_get_modified (thumbnailer));
+
+        g_free (group);
+        g_strfreev (mime_types);
+        g_strfreev (uri_schemes);
+        g_free (object_path);
+      }
+
+  g_hash_table_iter_init (&iter, manager->overrides);
+  while (g_hash_table_iter_next (&iter, (gpointer) &key, (gpointer) &list))
+    for (lp = *list; lp != NULL; lp = lp->next)
+      {
+        override_info = lp->data;
+
+        group = g_strdup_printf ("Override %d %s", override_info->dir_index, key);
+        g_key_file_set_integer (snapshot, group, "Directory", override_info->dir_index);
+        g_key_file_set_string (snapshot, group, "Name", override_info->name);
+        g_key_file_set_string (snapshot, group, "UriScheme", override_info->uri_scheme);
+        g_key_file_set_string (snapshot, group, "MimeType", override_info->mime_type);
+        g_free (group);
+      }
+
+  filename = g_build_filename (g_get_user_cache_dir (), "tumbler", SNAPSHOT_FILE, NULL);
+  dirname = g_path_get_dirname (filename);
+
+  if (g_mkdir_with_parents (dirname, 0700) != 0
+      || !g_key_file_save_to_file (snapshot, filename, &error))
+    {
+      g_debug ("Failed to save the thumbnailer snapshot to \"%s\": %s", filename,
+               error != NULL ? error->message : g_strerror (errno));
+      g_clear_error (&error);
+    }
+
+  g_free (dirname);
+  g_free (filename);
+  g_key_file_free (snapshot);
+}
+
+
+
 /**
  * tumbler_manager_load:
  * @manager : a #TumblerManager.
@@ -1209,6 +1619,7 @@ void
 tumbler_manager_load (TumblerManager *manager)
 {
   GFileMonitor *monitor;
+  GKeyFile *snapshot;
   GList *directories, *iter;
 
   g_return_if_fail (TUMBLER_MANAGER (manager));
@@ -1229,14 +1640,26 @@ tumbler_manager_load (TumblerManager *manager)
   manager->directories = directories;
   manager->monitors = NULL;
 
-  /* update the thumbnailer cache */
-  for (iter = manager->directories; iter != NULL; iter = iter->next)
-    tumbler_manager_load_thumbnailers (manager, iter->data);
+  snapshot = tumbler_manager_snapshot_load (manager);
+  if (snapshot != NULL)
+    {
+      /* nothing changed since the last start, skip parsing the files */
+      tumbler_manager_snapshot_apply (manager, snapshot);
+      g_key_file_free (snapshot);
+    }
+  else
+    {
+      /* update the thumbnailer cache */
+      for (iter = manager->directories; iter != NULL; iter = iter->next)
+        tumbler_manager_load_thumbnailers (manager, iter->data);
+
+      dump_thumbnailers (manager);
 
-  dump_thumbnailers (manager);
+      /* update the overrides cache */
+      tumbler_manager_load_overrides (manager);
 
-  /* update the overrides cache */
-  tumbler_manager_load_overrides (manager);
+      tumbler_manager_snapshot_save (manager);
+    }
 
   /* update the supported information */
   tumbler_registry_update_supported (manager->registry);
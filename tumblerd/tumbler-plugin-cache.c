@@ -0,0 +1,343 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "tumbler-lazy-thumbnailer.h"
+#include "tumbler-plugin-cache.h"
+
+#include <glib/gstdio.h>
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+
+
+/* The plugin cache lists the thumbnailers of each plugin module, so that
+ * tumblerd can register them without loading the module. It is a key file:
+ *
+ *   [Module tumbler-gst-thumbnailer.so]
+ *   MTime=1700000000
+ *   Size=40960
+ *   LoadersMTime=1700000000
+ *   Thumbnailers=1
+ *
+ *   [Thumbnailer tumbler-gst-thumbnailer.so 0]
+ *   Type=GstThumbnailer
+ *   Provider=GstThumbnailerProvider
+ *   MimeTypes=audio/mpeg;video/mp4;...
+ *
+ * UriSchemes is only written if a thumbnailer does not support all the URI
+ * schemes supported by GIO, which are otherwise determined at startup.
+ * Modules that are missing from the cache or whose file changed since it was
+ * written are loaded as usual. So are all modules once the gdk-pixbuf loader
+ * cache changed, recorded as LoadersMTime, because the MIME types a thumbnailer
+ * built on gdk-pixbuf supports come from the installed loaders. */
+
+
+
+static gboolean
+tumbler_plugin_cache_stat (const gchar *module,
+                           gint64 *mtime,
+                           gint64 *size)
+{
+  GStatBuf statbuf;
+  gchar *path;
+  gint result;
+
+  path = g_build_filename (TUMBLER_PLUGIN_DIRECTORY, module, NULL);
+  result = g_stat (path, &statbuf);
+  g_free (path);
+
+  if (result != 0)
+    return FALSE;
+
+  *mtime = statbuf.st_mtime;
+  *size = statbuf.st_size;
+
+  return TRUE;
+}
+
+
+
+static gint64
+tumbler_plugin_cache_get_loaders_mtime (void)
+{
+  GStatBuf statbuf;
+  const gchar *path;
+
+  /* same lookup as gdk-pixbuf itself */
+  path = g_getenv ("GDK_PIXBUF_MODULE_FILE");
+  if (path == NULL || *path == '\0')
+    path = TUMBLER_GDK_PIXBUF_CACHE_FILE;
+
+  if (*path == '\0' || g_stat (path, &statbuf) != 0)
+    return 0;
+
+  return statbuf.st_mtime;
+}
+
+
+
+static void
+tumbler_plugin_cache_add_module (GKeyFile *cache,
+                                 TumblerProviderFactory *factory,
+                                 const gchar *module,
+                                 const gchar *const *supported_schemes)
+{
+  TumblerThumbnailer *thumbnailer;
+  GPtrArray *thumbnailers;
+  GPtrArray *provider_names;
+  GList *providers;
+  GList *list;
+  GList *lp;
+  GList *tp;
+  gchar **uri_schemes;
+  gchar **mime_types;
+  gchar *group;
+  gint64 mtime;
+  gint64 size;
+  guint n;
+
+  if (!tumbler_plugin_cache_stat (module, &mtime, &size))
+    return;
+
+  thumbnailers = g_ptr_array_new_with_free_func (g_object_unref);
+  provider_names = g_ptr_array_new ();
+
+  /* disabled providers are filtered when the cache is read, so that changing
+   * tumbler.rc takes effect without rebuilding the cache */
+  providers = tumbler_provider_factory_get_module_providers (factory, module,
+                                                             TUMBLER_TYPE_THUMBNAILER_PROVIDER,
+                                                             TRUE);
+  for (lp = providers; lp != NULL; lp = lp->next)
+    {
+      list = tumbler_thumbnailer_provider_get_thumbnailers (lp->data);
+      for (tp = list; tp != NULL; tp = tp->next)
+        {
+          g_ptr_array_add (thumbnailers, tp->data);
+          g_ptr_array_add (provider_names, (gpointer) G_OBJECT_TYPE_NAME (lp->data));
+        }
+
+      g_list_free (list);
+    }
+
+  /* a module without thumbnailers may just not have found any yet, like the
+   * desktop thumbnailer provider before the first .thumbnailer file exists */
+  if (thumbnailers->len == 0)
+    {
+      g_debug ("Not caching plugin module '%s', it has no thumbnailers", module);
+      goto out;
+    }
+
+  /* desktop thumbnailers are set up per desktop file, so they can change at any time */
+  for (n = 0; n < thumbnailers->len; n++)
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (thumbnailers->pdata[n]), "exec") != NULL)
+      {
+        g_debug ("Not caching plugin module '%s', it has dynamic thumbnailers", module);
+        goto out;
+      }
+
+  group = g_strdup_printf ("Module %s", module);
+  g_key_file_set_int64 (cache, group, "MTime", mtime);
+  g_key_file_set_int64 (cache, group, "Size", size);
+  g_key_file_set_int64 (cache, group, "LoadersMTime", tumbler_plugin_cache_get_loaders_mtime ());
+  g_key_file_set_integer (cache, group, "Thumbnailers", thumbnailers->len);
+  g_free (group);
+
+  for (n = 0; n < thumbnailers->len; n++)
+    {
+      thumbnailer = thumbnailers->pdata[n];
+      group = g_strdup_printf ("Thumbnailer %s %u", module, n);
+
+      g_key_file_set_string (cache, group, "Type", G_OBJECT_TYPE_NAME (thumbnailer));
+      g_key_file_set_string (cache, group, "Provider", provider_names->pdata[n]);
+
+      mime_types = tumbler_thumbnailer_get_mime_types (thumbnailer);
+      g_key_file_set_string_list (cache, group, "MimeTypes", (const gchar *const *) mime_types,
+                                  g_strv_length (mime_types));
+
+      uri_schemes = tumbler_thumbnailer_get_uri_schemes (thumbnailer);
+      if (!g_strv_equal ((const gchar *const *) uri_schemes, supported_schemes))
+        g_key_file_set_string_list (cache, group, "UriSchemes", (const gchar *const *) uri_schemes,
+                                    g_strv_length (uri_schemes));
+
+      g_strfreev (mime_types);
+      g_strfreev (uri_schemes);
+      g_free (group);
+    }
+
+out:
+  g_list_free_full (providers, g_object_unref);
+  g_ptr_array_free (provider_names, TRUE);
+  g_ptr_array_free (thumbnailers, TRUE);
+}
+
+
+
+gchar *
+tumbler_plugin_cache_query (gsize *length)
+{
+  TumblerProviderFactory *factory;
+  GKeyFile *cache;
+  gchar **supported_schemes;
+  gchar **modules;
+  gchar *data;
+  guint n;
+
+  cache = g_key_file_new ();
+  factory = tumbler_provider_factory_get_default ();
+  supported_schemes = tumbler_util_get_supported_uri_schemes ();
+
+  modules = tumbler_provider_factory_list_modules (factory);
+  for (n = 0; modules[n] != NULL; n++)
+    tumbler_plugin_cache_add_module (cache, factory, modules[n],
+                                     (const gchar *const *) supported_schemes);
+
+  data = g_key_file_to_data (cache, length, NULL);
+
+  g_strfreev (modules);
+  g_strfreev (supported_schemes);
+  g_object_unref (factory);
+  g_key_file_free (cache);
+
+  return data;
+}
+
+
+
+GKeyFile *
+tumbler_plugin_cache_load (void)
+{
+  GKeyFile *cache;
+  GError *error = NULL;
+
+  cache = g_key_file_new ();
+  if (!g_key_file_load_from_file (cache, TUMBLER_PLUGIN_CACHE_FILE, G_KEY_FILE_NONE, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning (TUMBLER_WARNING_LOAD_FILE_FAILED, TUMBLER_PLUGIN_CACHE_FILE, error->message);
+
+      g_error_free (error);
+      g_key_file_free (cache);
+
+      return NULL;
+    }
+
+  return cache;
+}
+
+
+
+GList *
+tumbler_plugin_cache_get_thumbnailers (GKeyFile *cache,
+                                       const gchar *module,
+                                       GKeyFile *rc,
+                                       gboolean *cached)
+{
+  TumblerThumbnailer *thumbnailer;
+  GList *thumbnailers = NULL;
+  gchar **supported_schemes = NULL;
+  gchar **uri_schemes;
+  gchar **mime_types;
+  gchar *type_name;
+  gchar *provider;
+  gchar *name;
+  gchar *group;
+  gboolean disabled;
+  gboolean valid = TRUE;
+  gint64 mtime;
+  gint64 size;
+  gint n_thumbnailers;
+  gint n;
+
+  g_return_val_if_fail (cache != NULL, NULL);
+  g_return_val_if_fail (module != NULL, NULL);
+  g_return_val_if_fail (cached != NULL, NULL);
+
+  *cached = FALSE;
+
+  /* only trust the entry if the module did not change since it was written */
+  group = g_strdup_printf ("Module %s", module);
+  if (!g_key_file_has_group (cache, group)
+      || !tumbler_plugin_cache_stat (module, &mtime, &size)
+      || g_key_file_get_int64 (cache, group, "MTime", NULL) != mtime
+      || g_key_file_get_int64 (cache, group, "Size", NULL) != size
+      || g_key_file_get_int64 (cache, group, "LoadersMTime", NULL)
+           != tumbler_plugin_cache_get_loaders_mtime ())
+    {
+      g_debug ("No up-to-date plugin cache entry for '%s'", module);
+      g_free (group);
+      return NULL;
+    }
+
+  n_thumbnailers = g_key_file_get_integer (cache, group, "Thumbnailers", NULL);
+  g_free (group);
+
+  for (n = 0; n < n_thumbnailers && valid; n++)
+    {
+      group = g_strdup_printf ("Thumbnailer %s %d", module, n);
+      type_name = g_key_file_get_string (cache, group, "Type", NULL);
+      provider = g_key_file_get_string (cache, group, "Provider", NULL);
+      mime_types = g_key_file_get_string_list (cache, group, "MimeTypes", NULL, NULL);
+      uri_schemes = g_key_file_get_string_list (cache, group, "UriSchemes", NULL, NULL);
+      g_free (group);
+
+      valid = type_name != NULL && mime_types != NULL
+              && provider != NULL && g_str_has_suffix (provider, "Provider");
+      if (valid)
+        {
+          /* same check as in tumbler_provider_factory_get_providers() */
+          name = g_strndup (provider, strlen (provider) - 8);
+          disabled = g_key_file_get_boolean (rc, name, "Disabled", NULL);
+          if (disabled)
+            g_debug ("Thumbnailer \"%s\" disabled in config file", name);
+          g_free (name);
+
+          if (!disabled)
+            {
+              if (uri_schemes == NULL && supported_schemes == NULL)
+                supported_schemes = tumbler_util_get_supported_uri_schemes ();
+
+              thumbnailer = tumbler_lazy_thumbnailer_new (module, n, type_name,
+                                                          (const gchar *const *) (uri_schemes != NULL ? uri_schemes : supported_schemes),
+                                                          (const gchar *const *) mime_types);
+              thumbnailers = g_list_prepend (thumbnailers, thumbnailer);
+            }
+        }
+
+      g_free (type_name);
+      g_free (provider);
+      g_strfreev (mime_types);
+      g_strfreev (uri_schemes);
+    }
+
+  g_strfreev (supported_schemes);
+
+  if (!valid)
+    {
+      g_warning ("Ignoring malformed entry for '%s' in %s", module, TUMBLER_PLUGIN_CACHE_FILE);
+      g_list_free_full (thumbnailers, g_object_unref);
+      return NULL;
+    }
+
+  *cached = TRUE;
+
+  return g_list_reverse (thumbnailers);
+}
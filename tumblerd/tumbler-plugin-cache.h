@@ -0,0 +1,42 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __TUMBLER_PLUGIN_CACHE_H__
+#define __TUMBLER_PLUGIN_CACHE_H__
+
+#include "tumbler/tumbler.h"
+
+G_BEGIN_DECLS
+
+#define TUMBLER_PLUGIN_CACHE_FILE TUMBLER_PLUGIN_DIRECTORY G_DIR_SEPARATOR_S "plugins.cache"
+
+gchar *
+tumbler_plugin_cache_query (gsize *length) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+GKeyFile *
+tumbler_plugin_cache_load (void) G_GNUC_MALLOC;
+GList *
+tumbler_plugin_cache_get_thumbnailers (GKeyFile *cache,
+                                       const gchar *module,
+                                       GKeyFile *rc,
+                                       gboolean *cached) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+
+G_END_DECLS
+
+#endif /* !__TUMBLER_PLUGIN_CACHE_H__ */
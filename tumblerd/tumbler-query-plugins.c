@@ -0,0 +1,78 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "tumbler-plugin-cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+
+int
+main (int argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  gboolean update_cache = FALSE;
+  gchar *data;
+  gsize length;
+  GOptionEntry entries[] = {
+    { "update-cache", 0, 0, G_OPTION_ARG_NONE, &update_cache,
+      "Write the cache to " TUMBLER_PLUGIN_CACHE_FILE " instead of stdout", NULL },
+    { NULL },
+  };
+
+  context = g_option_context_new (NULL);
+  g_option_context_set_summary (context, "Lists the thumbnailers of the installed tumbler "
+                                         "plugins, so that tumblerd does not need to load "
+                                         "them at startup.");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      g_option_context_free (context);
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free (context);
+
+  data = tumbler_plugin_cache_query (&length);
+
+  if (update_cache)
+    {
+      if (!g_file_set_contents (TUMBLER_PLUGIN_CACHE_FILE, data, length, &error))
+        {
+          g_printerr ("Failed to write %s: %s\n", TUMBLER_PLUGIN_CACHE_FILE, error->message);
+          g_error_free (error);
+          g_free (data);
+          return EXIT_FAILURE;
+        }
+    }
+  else
+    {
+      fwrite (data, 1, length, stdout);
+    }
+
+  g_free (data);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,201 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "tumbler-recorder.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* Incoming Queue/Dequeue calls and mount removals are appended to the file
+ * named by $TUMBLER_RECORD_FILE, one event per line with tab-separated and
+ * g_strescape()d fields, the second one being the time in microseconds since
+ * the tumblerd instance started recording. tumblerd exits when idle, so every
+ * instance starts a session of its own, which begins with the wall clock time
+ * in microseconds and the process ID:
+ *
+ *   S 0 <wall-clock-time> <pid>
+ *   Q <time> <handle> <handle-to-dequeue> <flavor> <scheduler> [<uri> <mime-hint>]...
+ *   D <time> <handle>
+ *   U <time> <mount-root-uri>
+ *
+ * tumbler-bench --replay feeds such a trace back to tumblerd. */
+
+#define TUMBLER_RECORDER_HEADER "# tumbler queue trace 2\n"
+
+
+
+G_LOCK_DEFINE_STATIC (recorder);
+static FILE *recorder_file = NULL;
+static gint64 recorder_start = 0;
+
+
+
+static gboolean
+tumbler_recorder_is_enabled (void)
+{
+  static gsize initialized = 0;
+  const gchar *path;
+
+  if (g_once_init_enter (&initialized))
+    {
+      path = g_getenv ("TUMBLER_RECORD_FILE");
+      if (path != NULL && *path != '\0')
+        {
+          /* add to the trace of earlier instances rather than replacing it */
+          recorder_file = g_fopen (path, "a");
+          if (recorder_file != NULL)
+            {
+              recorder_start = g_get_monotonic_time ();
+              if (fseek (recorder_file, 0, SEEK_END) == 0 && ftell (recorder_file) == 0)
+                fputs (TUMBLER_RECORDER_HEADER, recorder_file);
+              fprintf (recorder_file, "S\t0\t%" G_GINT64_FORMAT "\t%d\n",
+                       g_get_real_time (), (gint) getpid ());
+              fflush (recorder_file);
+              g_debug ("Recording Queue traffic to %s", path);
+            }
+          else
+            g_warning ("Failed to open %s for recording: %s", path, g_strerror (errno));
+        }
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return recorder_file != NULL;
+}
+
+
+
+static GString *
+tumbler_recorder_begin (gchar type)
+{
+  return g_string_append_c (g_string_new (NULL), type);
+}
+
+
+
+static void
+tumbler_recorder_append (GString *line,
+                         const gchar *field)
+{
+  gchar *escaped;
+
+  escaped = g_strescape (field != NULL ? field : "", NULL);
+  g_string_append_c (line, '\t');
+  g_string_append (line, escaped);
+  g_free (escaped);
+}
+
+
+
+static void
+tumbler_recorder_write (GString *line)
+{
+  G_LOCK (recorder);
+
+  /* take the time under the lock so that events stay ordered */
+  fprintf (recorder_file, "%c\t%" G_GINT64_FORMAT "%s\n", line->str[0],
+           g_get_monotonic_time () - recorder_start, line->str + 1);
+
+  /* keep the trace usable if tumblerd gets killed */
+  fflush (recorder_file);
+
+  G_UNLOCK (recorder);
+
+  g_string_free (line, TRUE);
+}
+
+
+
+void
+tumbler_recorder_queue (guint32 handle,
+                        const gchar *const *uris,
+                        const gchar *const *mime_hints,
+                        const gchar *flavor_name,
+                        const gchar *scheduler_name,
+                        guint32 handle_to_dequeue)
+{
+  GString *line;
+  gchar number[16];
+  gboolean has_hint = TRUE;
+  guint n;
+
+  if (!tumbler_recorder_is_enabled ())
+    return;
+
+  line = tumbler_recorder_begin ('Q');
+
+  g_snprintf (number, sizeof (number), "%u", handle);
+  tumbler_recorder_append (line, number);
+  g_snprintf (number, sizeof (number), "%u", handle_to_dequeue);
+  tumbler_recorder_append (line, number);
+  tumbler_recorder_append (line, flavor_name);
+  tumbler_recorder_append (line, scheduler_name);
+
+  for (n = 0; uris[n] != NULL; n++)
+    {
+      has_hint = has_hint && mime_hints[n] != NULL;
+      tumbler_recorder_append (line, uris[n]);
+      tumbler_recorder_append (line, has_hint ? mime_hints[n] : NULL);
+    }
+
+  tumbler_recorder_write (line);
+}
+
+
+
+void
+tumbler_recorder_dequeue (guint32 handle)
+{
+  GString *line;
+  gchar number[16];
+
+  if (!tumbler_recorder_is_enabled ())
+    return;
+
+  line = tumbler_recorder_begin ('D');
+  g_snprintf (number, sizeof (number), "%u", handle);
+  tumbler_recorder_append (line, number);
+  tumbler_recorder_write (line);
+}
+
+
+
+void
+tumbler_recorder_unmount (GMount *mount)
+{
+  GString *line;
+  GFile *root;
+  gchar *uri;
+
+  if (!tumbler_recorder_is_enabled ())
+    return;
+
+  root = g_mount_get_root (mount);
+  uri = g_file_get_uri (root);
+  g_object_unref (root);
+
+  line = tumbler_recorder_begin ('U');
+  tumbler_recorder_append (line, uri);
+  tumbler_recorder_write (line);
+
+  g_free (uri);
+}
@@ -0,0 +1,42 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __TUMBLER_RECORDER_H__
+#define __TUMBLER_RECORDER_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+void
+tumbler_recorder_queue (guint32 handle,
+                        const gchar *const *uris,
+                        const gchar *const *mime_hints,
+                        const gchar *flavor_name,
+                        const gchar *scheduler_name,
+                        guint32 handle_to_dequeue);
+void
+tumbler_recorder_dequeue (guint32 handle);
+void
+tumbler_recorder_unmount (GMount *mount);
+
+G_END_DECLS
+
+#endif /* !__TUMBLER_RECORDER_H__ */
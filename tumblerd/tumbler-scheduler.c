@@ -20,7 +20,29 @@
 
 #include "tumbler-marshal.h"
 #include "tumbler-scheduler.h"
+#include "tumbler-specialized-thumbnailer.h"
+#include "tumbler-stats.h"
 
+#include <glib/gstdio.h>
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_SYS_IOCTL_H
+#include <sys/ioctl.h>
+#endif
+#ifdef HAVE_SYS_SYSMACROS_H
+#include <sys/sysmacros.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_LINUX_FIEMAP_H
+#include <linux/fiemap.h>
+#endif
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -70,6 +92,30 @@ enum
 
 static guint tumbler_scheduler_signals[LAST_SIGNAL];
 
+G_LOCK_DEFINE_STATIC (async_lock);
+
+
+
+typedef enum
+{
+  LOCATION_ORDER_NEVER,
+  LOCATION_ORDER_AUTO,
+  LOCATION_ORDER_ALWAYS,
+} LocationOrder;
+
+typedef struct
+{
+  guint n;
+  guint64 device;
+  guint64 location;
+} PendingLocation;
+
+typedef struct
+{
+  TumblerSchedulerRequest *request;
+  guint n;
+} AsyncCall;
+
 
 
 G_DEFINE_INTERFACE (TumblerScheduler, tumbler_scheduler, G_TYPE_OBJECT)
@@ -150,10 +196,21 @@ void
 tumbler_scheduler_push (TumblerScheduler *scheduler,
                         TumblerSchedulerRequest *request)
 {
+  gchar *name;
+
   g_return_if_fail (TUMBLER_IS_SCHEDULER (scheduler));
   g_return_if_fail (request != NULL);
   g_return_if_fail (TUMBLER_SCHEDULER_GET_IFACE (scheduler)->push != NULL);
 
+  name = tumbler_scheduler_get_name (scheduler);
+  tumbler_stats_add (TUMBLER_STATS_REQUESTS, name, NULL, 1);
+  tumbler_stats_add (TUMBLER_STATS_URIS, name, NULL, request->length);
+  tumbler_stats_add (TUMBLER_STATS_QUEUED_REQUESTS, name, NULL, 1);
+  tumbler_stats_add (TUMBLER_STATS_ACTIVE_REQUESTS, name, NULL, 1);
+  g_free (name);
+
+  request->trace_queued = tumbler_util_trace_begin ();
+
   TUMBLER_SCHEDULER_GET_IFACE (scheduler)->push (scheduler, request);
 }
 
@@ -185,6 +242,38 @@ tumbler_scheduler_cancel_by_mount (TumblerScheduler *scheduler,
 
 
 
+void
+tumbler_scheduler_resume (TumblerScheduler *scheduler,
+                          TumblerSchedulerRequest *request)
+{
+  gchar *name;
+
+  g_return_if_fail (TUMBLER_IS_SCHEDULER (scheduler));
+  g_return_if_fail (request != NULL);
+  g_return_if_fail (TUMBLER_SCHEDULER_GET_IFACE (scheduler)->resume != NULL);
+
+  name = tumbler_scheduler_get_name (scheduler);
+  tumbler_stats_add (TUMBLER_STATS_QUEUED_REQUESTS, name, NULL, 1);
+  g_free (name);
+
+  request->trace_queued = tumbler_util_trace_begin ();
+
+  TUMBLER_SCHEDULER_GET_IFACE (scheduler)->resume (scheduler, request);
+}
+
+
+
+void
+tumbler_scheduler_reclaim (TumblerScheduler *scheduler)
+{
+  g_return_if_fail (TUMBLER_IS_SCHEDULER (scheduler));
+
+  if (TUMBLER_SCHEDULER_GET_IFACE (scheduler)->reclaim != NULL)
+    TUMBLER_SCHEDULER_GET_IFACE (scheduler)->reclaim (scheduler);
+}
+
+
+
 void
 tumbler_scheduler_take_request (TumblerScheduler *scheduler,
                                 TumblerSchedulerRequest *request)
@@ -267,14 +356,24 @@ void
 tumbler_scheduler_request_free (gpointer data)
 {
   TumblerSchedulerRequest *request = data;
+  gchar *name;
   gint n;
 
   g_return_if_fail (request != NULL);
 
+  tumbler_util_trace_end (request->trace_started, "request", "handle=%u origin=%s",
+                          request->handle, request->origin);
+
   tumbler_thumbnailer_array_free (request->thumbnailers, request->length);
 
   if (G_LIKELY (request->scheduler != NULL))
-    g_object_unref (request->scheduler);
+    {
+      name = tumbler_scheduler_get_name (request->scheduler);
+      tumbler_stats_add (TUMBLER_STATS_ACTIVE_REQUESTS, name, NULL, -1);
+      g_free (name);
+
+      g_object_unref (request->scheduler);
+    }
 
   tumbler_file_info_array_free (request->infos);
 
@@ -282,6 +381,8 @@ tumbler_scheduler_request_free (gpointer data)
     g_object_unref (request->cancellables[n]);
   g_free (request->cancellables);
 
+  g_list_free_full (request->async_results, tumbler_scheduler_async_result_free);
+
   g_free (request->origin);
   g_free (request);
 }
@@ -299,6 +400,348 @@ tumbler_scheduler_request_compare (gconstpointer a,
   return request_b->handle - request_a->handle;
 }
 
+
+
+static LocationOrder
+tumbler_scheduler_get_location_order (void)
+{
+  static gsize order = 0;
+
+  if (g_once_init_enter (&order))
+    {
+      GKeyFile *rc = tumbler_util_get_settings ();
+      gchar *value = g_key_file_get_string (rc, "Scheduler", "LocationOrder", NULL);
+      LocationOrder location_order = LOCATION_ORDER_AUTO;
+
+      if (g_strcmp0 (value, "never") == 0)
+        location_order = LOCATION_ORDER_NEVER;
+      else if (g_strcmp0 (value, "always") == 0)
+        location_order = LOCATION_ORDER_ALWAYS;
+
+      g_free (value);
+      g_key_file_free (rc);
+
+      /* offset by one, zero means not initialized yet */
+      g_once_init_leave (&order, location_order + 1);
+    }
+
+  return order - 1;
+}
+
+
+
+static gboolean
+tumbler_scheduler_device_is_rotational (guint64 device)
+{
+#ifdef HAVE_SYS_SYSMACROS_H
+  G_LOCK_DEFINE_STATIC (devices_lock);
+  static GHashTable *devices = NULL;
+  gpointer value;
+  gboolean found;
+  gboolean rotational = FALSE;
+  gchar *contents = NULL;
+  gchar *path;
+
+  G_LOCK (devices_lock);
+  if (devices == NULL)
+    devices = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+  found = g_hash_table_lookup_extended (devices, &device, NULL, &value);
+  G_UNLOCK (devices_lock);
+
+  if (found)
+    return GPOINTER_TO_INT (value);
+
+  /* network and virtual file systems have no block device and are left alone */
+  path = g_strdup_printf ("/sys/dev/block/%u:%u/queue/rotational",
+                          major (device), minor (device));
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    {
+      /* partitions share the queue of their disk */
+      g_free (path);
+      path = g_strdup_printf ("/sys/dev/block/%u:%u/../queue/rotational",
+                              major (device), minor (device));
+      g_file_get_contents (path, &contents, NULL, NULL);
+    }
+
+  rotational = contents != NULL && contents[0] == '1';
+
+  g_free (contents);
+  g_free (path);
+
+  G_LOCK (devices_lock);
+  g_hash_table_insert (devices, g_memdup2 (&device, sizeof (device)),
+                       GINT_TO_POINTER (rotational));
+  G_UNLOCK (devices_lock);
+
+  return rotational;
+#else
+  return FALSE;
+#endif
+}
+
+
+
+static guint64
+tumbler_scheduler_get_location (const gchar *filename,
+                                guint64 inode)
+{
+#if defined(HAVE_LINUX_FIEMAP_H) && defined(HAVE_SYS_IOCTL_H) && defined(FS_IOC_FIEMAP)
+  guint64 buffer[(sizeof (struct fiemap) + sizeof (struct fiemap_extent)) / sizeof (guint64) + 1];
+  struct fiemap *fiemap = (struct fiemap *) buffer;
+  gint fd;
+
+  /* the physical offset of the first extent is where reading starts */
+  fd = g_open (filename, O_RDONLY | O_CLOEXEC, 0);
+  if (fd >= 0)
+    {
+      memset (buffer, 0, sizeof (buffer));
+      fiemap->fm_length = FIEMAP_MAX_OFFSET;
+      fiemap->fm_extent_count = 1;
+
+      if (ioctl (fd, FS_IOC_FIEMAP, fiemap) == 0 && fiemap->fm_mapped_extents > 0)
+        {
+          close (fd);
+          return fiemap->fm_extents[0].fe_physical;
+        }
+
+      close (fd);
+    }
+#endif
+
+  /* file systems tend to allocate inodes and data in the same order */
+  return inode;
+}
+
+
+
+static gint
+tumbler_scheduler_compare_locations (gconstpointer a,
+                                     gconstpointer b)
+{
+  const PendingLocation *location_a = a;
+  const PendingLocation *location_b = b;
+
+  if (location_a->device != location_b->device)
+    return location_a->device < location_b->device ? -1 : 1;
+  if (location_a->location != location_b->location)
+    return location_a->location < location_b->location ? -1 : 1;
+
+  return (gint) location_a->n - (gint) location_b->n;
+}
+
+
+
+/*
+ * Sorts the URI indices in @pending by the location of the files on disk, so that
+ * rotational disks read them in one sweep instead of seeking back and forth. By
+ * default this is only done if one of the files is on a rotational disk, see the
+ * [Scheduler] section of tumbler.rc. Returns whether @pending was reordered.
+ */
+gboolean
+tumbler_scheduler_request_sort_pending (TumblerSchedulerRequest *request,
+                                        GQueue *pending)
+{
+  PendingLocation *location;
+  LocationOrder order;
+  GStatBuf statbuf;
+  gboolean rotational = FALSE;
+  GArray *locations;
+  GList *lp;
+  gchar *filename;
+  guint i;
+
+  g_return_val_if_fail (request != NULL, FALSE);
+
+  order = tumbler_scheduler_get_location_order ();
+  if (order == LOCATION_ORDER_NEVER || g_queue_get_length (pending) < 2)
+    return FALSE;
+
+  locations = g_array_sized_new (FALSE, FALSE, sizeof (PendingLocation),
+                                 g_queue_get_length (pending));
+
+  for (lp = pending->head; lp != NULL; lp = lp->next)
+    {
+      PendingLocation new_location = { GPOINTER_TO_UINT (lp->data), G_MAXUINT64, G_MAXUINT64 };
+
+      filename = g_filename_from_uri (tumbler_file_info_get_uri (request->infos[new_location.n]),
+                                      NULL, NULL);
+      if (filename != NULL && g_stat (filename, &statbuf) == 0)
+        {
+          new_location.device = statbuf.st_dev;
+
+          if (order == LOCATION_ORDER_ALWAYS
+              || tumbler_scheduler_device_is_rotational (statbuf.st_dev))
+            {
+              new_location.location = tumbler_scheduler_get_location (filename, statbuf.st_ino);
+              rotational = TRUE;
+            }
+        }
+
+      g_array_append_val (locations, new_location);
+      g_free (filename);
+    }
+
+  if (rotational)
+    {
+      g_array_sort (locations, tumbler_scheduler_compare_locations);
+
+      for (lp = pending->head, i = 0; lp != NULL; lp = lp->next, ++i)
+        {
+          location = &g_array_index (locations, PendingLocation, i);
+          lp->data = GUINT_TO_POINTER (location->n);
+        }
+    }
+
+  g_array_free (locations, TRUE);
+
+  return rotational;
+}
+
+
+
+/*
+ * Pops the index of the next URI of @request to generate a thumbnail for from @pending.
+ * URIs whose first thumbnailer is already running at its concurrency limit are moved to
+ * the tail of the queue, so the calling thread works on other types in the meantime.
+ * If all pending URIs are in this case, the first one is returned anyway and will wait
+ * for admission in tumbler_thumbnailer_create().
+ */
+guint
+tumbler_scheduler_request_pop_pending (TumblerSchedulerRequest *request,
+                                       GQueue *pending)
+{
+  guint remaining;
+  guint n;
+
+  g_return_val_if_fail (request != NULL, 0);
+  g_return_val_if_fail (!g_queue_is_empty (pending), 0);
+
+  for (remaining = g_queue_get_length (pending); remaining > 1; remaining--)
+    {
+      n = GPOINTER_TO_UINT (g_queue_peek_head (pending));
+      if (request->thumbnailers[n] == NULL
+          || !tumbler_thumbnailer_is_saturated (request->thumbnailers[n]->data))
+        break;
+
+      g_queue_push_tail (pending, g_queue_pop_head (pending));
+    }
+
+  return GPOINTER_TO_UINT (g_queue_pop_head (pending));
+}
+
+
+
+static void
+tumbler_scheduler_request_async_finished (TumblerSpecializedThumbnailer *thumbnailer,
+                                          TumblerFileInfo *info,
+                                          const GError *error,
+                                          gpointer user_data)
+{
+  AsyncCall *call = user_data;
+  TumblerSchedulerRequest *request = call->request;
+  TumblerSchedulerAsyncResult *result;
+  gboolean resume = FALSE;
+
+  result = g_slice_new0 (TumblerSchedulerAsyncResult);
+  result->n = call->n;
+  result->error = error != NULL ? g_error_copy (error) : NULL;
+  g_slice_free (AsyncCall, call);
+
+  G_LOCK (async_lock);
+
+  request->async_results = g_list_prepend (request->async_results, result);
+  request->n_async--;
+
+  /* the scheduler thread let the request go, hand it back to the pool */
+  if (request->n_async == 0 && request->detached)
+    {
+      request->detached = FALSE;
+      request->resumed = TRUE;
+      resume = TRUE;
+    }
+
+  G_UNLOCK (async_lock);
+
+  if (resume)
+    tumbler_scheduler_resume (request->scheduler, request);
+}
+
+
+
+/*
+ * Hands URI @n of @request over to its specialized thumbnailer without waiting
+ * for the result, if the thumbnailer with the highest priority is one. Returns
+ * FALSE if the URI has to be processed synchronously. The results are collected
+ * in request->async_results.
+ */
+gboolean
+tumbler_scheduler_request_queue_async (TumblerSchedulerRequest *request,
+                                       guint n)
+{
+  TumblerThumbnailer *thumbnailer;
+  AsyncCall *call;
+
+  g_return_val_if_fail (request != NULL, FALSE);
+  g_return_val_if_fail (n < request->length, FALSE);
+
+  if (request->thumbnailers[n] == NULL)
+    return FALSE;
+
+  thumbnailer = request->thumbnailers[n]->data;
+  if (!TUMBLER_IS_SPECIALIZED_THUMBNAILER (thumbnailer))
+    return FALSE;
+
+  G_LOCK (async_lock);
+  request->n_async++;
+  G_UNLOCK (async_lock);
+
+  /* the callback gets the position of the URI rather than looking it up */
+  call = g_slice_new (AsyncCall);
+  call->request = request;
+  call->n = n;
+
+  tumbler_specialized_thumbnailer_queue (TUMBLER_SPECIALIZED_THUMBNAILER (thumbnailer),
+                                         request->cancellables[n], request->infos[n],
+                                         tumbler_scheduler_request_async_finished, call);
+
+  return TRUE;
+}
+
+
+
+/*
+ * Called by a scheduler thread when it is done with @request. Returns TRUE if
+ * specialized thumbnailers are still busy with it: the thread must then let the
+ * request go, it is pushed back to the scheduler with request->resumed set once
+ * they are done. Otherwise all results are available in request->async_results.
+ */
+gboolean
+tumbler_scheduler_request_detach (TumblerSchedulerRequest *request)
+{
+  gboolean detached;
+
+  g_return_val_if_fail (request != NULL, FALSE);
+
+  G_LOCK (async_lock);
+  detached = request->detached = request->n_async > 0;
+  G_UNLOCK (async_lock);
+
+  return detached;
+}
+
+
+
+void
+tumbler_scheduler_async_result_free (gpointer data)
+{
+  TumblerSchedulerAsyncResult *result = data;
+
+  if (result->error != NULL)
+    g_error_free (result->error);
+
+  g_slice_free (TumblerSchedulerAsyncResult, result);
+}
+
 static int
 ioprio_set (int which, int who, int ioprio_val)
 {
@@ -328,6 +771,9 @@ tumbler_scheduler_thread_use_lower_priority (void)
   if (sched_getparam (0, &sp) == 0)
     sched_setscheduler (0, SCHED_IDLE, &sp);
 #endif
+
+  /* keep the source files read by this thread out of the page cache */
+  tumbler_util_set_background_io (TRUE);
 }
 
 
@@ -28,6 +28,7 @@
 G_BEGIN_DECLS
 
 typedef struct _TumblerSchedulerRequest TumblerSchedulerRequest;
+typedef struct _TumblerSchedulerAsyncResult TumblerSchedulerAsyncResult;
 
 #define TUMBLER_TYPE_SCHEDULER (tumbler_scheduler_get_type ())
 G_DECLARE_INTERFACE (TumblerScheduler, tumbler_scheduler, TUMBLER, SCHEDULER, GObject)
@@ -57,6 +58,9 @@ typedef struct _TumblerSchedulerInterface
                    guint32 handle);
   void (*cancel_by_mount) (TumblerScheduler *scheduler,
                            GMount *mount);
+  void (*resume) (TumblerScheduler *scheduler,
+                  TumblerSchedulerRequest *request);
+  void (*reclaim) (TumblerScheduler *scheduler);
 } TumblerSchedulerIface;
 
 void
@@ -68,6 +72,11 @@ tumbler_scheduler_dequeue (TumblerScheduler *scheduler,
 void
 tumbler_scheduler_cancel_by_mount (TumblerScheduler *scheduler,
                                    GMount *mount);
+void
+tumbler_scheduler_resume (TumblerScheduler *scheduler,
+                          TumblerSchedulerRequest *request);
+void
+tumbler_scheduler_reclaim (TumblerScheduler *scheduler);
 gchar *
 tumbler_scheduler_get_name (TumblerScheduler *scheduler);
 void
@@ -89,6 +98,19 @@ gint
 tumbler_scheduler_request_compare (gconstpointer a,
                                    gconstpointer b,
                                    gpointer user_data);
+gboolean
+tumbler_scheduler_request_sort_pending (TumblerSchedulerRequest *request,
+                                        GQueue *pending);
+guint
+tumbler_scheduler_request_pop_pending (TumblerSchedulerRequest *request,
+                                       GQueue *pending);
+gboolean
+tumbler_scheduler_request_queue_async (TumblerSchedulerRequest *request,
+                                       guint n);
+gboolean
+tumbler_scheduler_request_detach (TumblerSchedulerRequest *request);
+void
+tumbler_scheduler_async_result_free (gpointer data);
 
 void
 tumbler_scheduler_thread_use_lower_priority (void);
@@ -114,6 +136,27 @@ struct _TumblerSchedulerRequest
   guint length;
   GList *uri_errors;
   GList *ready_uris;
+
+  /* URIs are processed in the order of the files on disk rather than the
+   * request, see tumbler_scheduler_request_sort_pending() */
+  gboolean reordered;
+
+  /* URIs handed over to specialized thumbnailers, see
+   * tumbler_scheduler_request_queue_async() */
+  guint n_async;
+  gboolean detached;
+  gboolean resumed;
+  GList *async_results;
+
+  /* tracing marks, see tumbler_util_trace_begin() */
+  gint64 trace_queued;
+  gint64 trace_started;
+};
+
+struct _TumblerSchedulerAsyncResult
+{
+  guint n;
+  GError *error;
 };
 
 G_END_DECLS
@@ -21,6 +21,7 @@
 
 #include "tumbler-group-scheduler.h"
 #include "tumbler-lifo-scheduler.h"
+#include "tumbler-recorder.h"
 #include "tumbler-scheduler.h"
 #include "tumbler-service-gdbus.h"
 #include "tumbler-service.h"
@@ -29,14 +30,41 @@
 #include "tumbler/tumbler.h"
 
 #include <gio/gio.h>
+#include <gio/gunixfdlist.h>
 #include <glib-object.h>
 #include <glib/gi18n.h>
 
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_MALLOC_H
+#include <malloc.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
 
 #define THUMBNAILER_PATH TUMBLER_SERVICE_PATH_PREFIX "/Thumbnailer1"
 #define THUMBNAILER_SERVICE TUMBLER_SERVICE_NAME_PREFIX ".Thumbnailer1"
 #define THUMBNAILER_IFACE TUMBLER_SERVICE_NAME_PREFIX ".Thumbnailer1"
 
+/* seconds without requests before memory used by the last burst is released */
+#define RECLAIM_TIMEOUT_SECONDS 5
+
+/* defaults for the [Signals] section of tumbler.rc */
+#define COALESCE_WINDOW_MS 50
+#define COALESCE_MAX_URIS 256
+
 
 
 /* property identifiers */
@@ -49,7 +77,19 @@ enum
 
 
 
+/* how QueueWithData() hands out the thumbnails of a request */
+typedef enum
+{
+  DELIVERY_FORMAT_NONE,
+  DELIVERY_FORMAT_PNG,
+  DELIVERY_FORMAT_RGBA,
+} DeliveryFormat;
+
+
+
 typedef struct _SchedulerIdleInfo SchedulerIdleInfo;
+typedef struct _Delivery Delivery;
+typedef struct _PendingSignals PendingSignals;
 
 
 
@@ -77,6 +117,16 @@ tumbler_service_queue_cb (TumblerExportedService *skeleton,
                           guint handle_to_dequeue,
                           TumblerService *service);
 static gboolean
+tumbler_service_queue_with_data_cb (TumblerExportedService *skeleton,
+                                    GDBusMethodInvocation *invocation,
+                                    const gchar *const *uris,
+                                    const gchar *const *mime_hints,
+                                    const gchar *flavor_name,
+                                    const gchar *scheduler_name,
+                                    guint handle_to_dequeue,
+                                    const gchar *format,
+                                    TumblerService *service);
+static gboolean
 tumbler_service_dequeue_cb (TumblerExportedService *skeleton,
                             GDBusMethodInvocation *invocation,
                             guint handle,
@@ -122,8 +172,28 @@ static void
 tumbler_service_pre_unmount (TumblerService *service,
                              GMount *mount,
                              GVolumeMonitor *monitor);
+static gboolean
+tumbler_service_reclaim (gpointer user_data);
+static void
+tumbler_service_pack_thumbnails (Delivery *delivery,
+                                 const gchar *const *uris,
+                                 SchedulerIdleInfo *info);
+static void
+tumbler_service_emit_error (SchedulerIdleInfo *info);
+static void
+tumbler_service_emit_ready (SchedulerIdleInfo *info);
+static void
+tumbler_service_coalesce_signal (TumblerService *service,
+                                 SchedulerIdleInfo *info);
+static void
+tumbler_service_flush_signals (TumblerService *service,
+                               const gchar *origin);
 static void
 scheduler_idle_info_free (SchedulerIdleInfo *info);
+static void
+delivery_free (gpointer data);
+static void
+pending_signals_free (gpointer data);
 
 
 
@@ -139,6 +209,20 @@ struct _TumblerService
   TUMBLER_MUTEX (mutex);
   GList *schedulers;
 
+  /* requests queued but not finished yet, memory is reclaimed once
+   * this drops to zero and stays there for a while */
+  guint n_requests;
+  guint reclaim_id;
+
+  /* requests queued with QueueWithData(), by handle */
+  TUMBLER_MUTEX (deliveries_mutex);
+  GHashTable *deliveries;
+
+  /* ready and error signals waiting to be merged, by origin */
+  GHashTable *pending;
+  guint coalesce_window;
+  guint coalesce_max_uris;
+
   GVolumeMonitor *volume_monitor;
 };
 
@@ -151,6 +235,29 @@ struct _SchedulerIdleInfo
   gchar *origin;
   guint handle;
   gint error_code;
+  gboolean is_error;
+  gint64 trace;
+
+  /* thumbnails packed into a memfd, see tumbler_service_pack_thumbnails() */
+  gchar **data_uris;
+  GUnixFDList *fd_list;
+  GVariant *layout;
+};
+
+struct _Delivery
+{
+  DeliveryFormat format;
+  TumblerCache *cache;
+  TumblerThumbnailFlavor *flavor;
+};
+
+struct _PendingSignals
+{
+  TumblerService *service;
+  gchar *origin;
+  GQueue signals;
+  guint n_uris;
+  guint flush_id;
 };
 
 
@@ -187,11 +294,49 @@ tumbler_service_class_init (TumblerServiceClass *klass)
 
 
 
+static guint
+tumbler_service_get_setting (GKeyFile *rc,
+                             const gchar *key,
+                             guint default_value)
+{
+  GError *error = NULL;
+  gint value;
+
+  value = g_key_file_get_integer (rc, "Signals", key, &error);
+  if (error != NULL)
+    {
+      g_error_free (error);
+      return default_value;
+    }
+
+  return MAX (value, 0);
+}
+
+
+
 static void
 tumbler_service_init (TumblerService *service)
 {
+  GKeyFile *rc;
+
   tumbler_mutex_create (service->mutex);
   service->schedulers = NULL;
+  service->n_requests = 0;
+  service->reclaim_id = 0;
+
+  tumbler_mutex_create (service->deliveries_mutex);
+  service->deliveries = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                               NULL, delivery_free);
+
+  service->pending = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                            NULL, pending_signals_free);
+
+  rc = tumbler_util_get_settings ();
+  service->coalesce_window =
+    tumbler_service_get_setting (rc, "CoalesceWindow", COALESCE_WINDOW_MS);
+  service->coalesce_max_uris =
+    tumbler_service_get_setting (rc, "CoalesceMaxURIs", COALESCE_MAX_URIS);
+  g_key_file_free (rc);
 
   service->volume_monitor = g_volume_monitor_get ();
   g_signal_connect_swapped (service->volume_monitor, "mount-pre-unmount",
@@ -275,6 +420,9 @@ tumbler_service_constructed (GObject *object)
       g_signal_connect (service->skeleton, "handle-queue",
                         G_CALLBACK (tumbler_service_queue_cb), service);
 
+      g_signal_connect (service->skeleton, "handle-queue-with-data",
+                        G_CALLBACK (tumbler_service_queue_with_data_cb), service);
+
       g_signal_connect (service->skeleton, "handle-dequeue",
                         G_CALLBACK (tumbler_service_dequeue_cb), service);
 
@@ -303,6 +451,9 @@ tumbler_service_finalize (GObject *object)
   /* release the volume monitor */
   g_object_unref (service->volume_monitor);
 
+  if (service->reclaim_id != 0)
+    g_source_remove (service->reclaim_id);
+
   /* release all schedulers and the scheduler list */
   g_list_foreach (service->schedulers, (GFunc) tumbler_service_remove_scheduler, service);
   g_list_free (service->schedulers);
@@ -324,6 +475,11 @@ tumbler_service_finalize (GObject *object)
 
   tumbler_mutex_free (service->mutex);
 
+  g_hash_table_destroy (service->deliveries);
+  tumbler_mutex_free (service->deliveries_mutex);
+
+  g_hash_table_destroy (service->pending);
+
   (*G_OBJECT_CLASS (tumbler_service_parent_class)->finalize) (object);
 }
 
@@ -378,18 +534,142 @@ tumbler_service_set_property (GObject *object,
 
 
 static gboolean
-tumbler_service_error_idle (gpointer user_data)
+tumbler_service_can_merge_signals (SchedulerIdleInfo *info,
+                                   SchedulerIdleInfo *next)
+{
+  /* thumbnail data has its own file descriptor, never merge it */
+  if (info->data_uris != NULL || next->data_uris != NULL
+      || info->uris == NULL || next->uris == NULL)
+    return FALSE;
+
+  return info->handle == next->handle
+         && info->is_error == next->is_error
+         && info->error_code == next->error_code
+         && g_strcmp0 (info->message, next->message) == 0;
+}
+
+
+
+static void
+tumbler_service_flush_signals (TumblerService *service,
+                               const gchar *origin)
+{
+  PendingSignals *pending;
+  SchedulerIdleInfo *info;
+
+  pending = g_hash_table_lookup (service->pending, origin);
+  if (pending == NULL)
+    return;
+
+  while ((info = g_queue_pop_head (&pending->signals)) != NULL)
+    {
+      if (info->is_error)
+        tumbler_service_emit_error (info);
+      else
+        tumbler_service_emit_ready (info);
+
+      scheduler_idle_info_free (info);
+    }
+
+  g_hash_table_remove (service->pending, origin);
+}
+
+
+
+static gboolean
+tumbler_service_flush_signals_timeout (gpointer user_data)
+{
+  PendingSignals *pending = user_data;
+
+  pending->flush_id = 0;
+  tumbler_service_flush_signals (pending->service, pending->origin);
+
+  return FALSE;
+}
+
+
+
+/* ready and error signals of a client are held back for a short while, so
+ * that URIs of consecutive signals for the same request go out in one signal */
+static void
+tumbler_service_coalesce_signal (TumblerService *service,
+                                 SchedulerIdleInfo *info)
+{
+  PendingSignals *pending;
+  SchedulerIdleInfo *last;
+  gchar **uris;
+  guint n_uris, n_last, n;
+
+  n_uris = (info->uris != NULL ? g_strv_length (info->uris) : 0)
+           + (info->data_uris != NULL ? g_strv_length (info->data_uris) : 0);
+
+  pending = g_hash_table_lookup (service->pending, info->origin);
+
+  /* nothing to merge with, and no time to wait for something */
+  if (pending == NULL && (service->coalesce_window == 0 || n_uris >= service->coalesce_max_uris))
+    {
+      if (info->is_error)
+        tumbler_service_emit_error (info);
+      else
+        tumbler_service_emit_ready (info);
+
+      scheduler_idle_info_free (info);
+      return;
+    }
+
+  if (pending == NULL)
+    {
+      pending = g_slice_new0 (PendingSignals);
+      pending->service = service;
+      pending->origin = g_strdup (info->origin);
+      g_queue_init (&pending->signals);
+      g_hash_table_insert (service->pending, pending->origin, pending);
+    }
+
+  last = g_queue_peek_tail (&pending->signals);
+  if (last != NULL && tumbler_service_can_merge_signals (last, info))
+    {
+      /* append the URIs to the last signal, the strings change owner */
+      n_last = g_strv_length (last->uris);
+      uris = g_new (gchar *, n_last + n_uris + 1);
+      memcpy (uris, last->uris, n_last * sizeof (gchar *));
+      for (n = 0; n < n_uris; n++)
+        uris[n_last + n] = info->uris[n];
+      uris[n_last + n_uris] = NULL;
+
+      g_free (last->uris);
+      g_free (info->uris);
+      last->uris = uris;
+      info->uris = NULL;
+
+      scheduler_idle_info_free (info);
+    }
+  else
+    g_queue_push_tail (&pending->signals, info);
+
+  pending->n_uris += n_uris;
+
+  if (pending->n_uris >= service->coalesce_max_uris)
+    tumbler_service_flush_signals (service, pending->origin);
+  else if (pending->flush_id == 0)
+    pending->flush_id = g_timeout_add (service->coalesce_window,
+                                       tumbler_service_flush_signals_timeout, pending);
+}
+
+
+
+static void
+tumbler_service_emit_error (SchedulerIdleInfo *info)
 {
   TumblerCache *cache;
-  SchedulerIdleInfo *info = user_data;
   GVariant *signal_variant;
 
-  g_return_val_if_fail (info != NULL, FALSE);
-  g_return_val_if_fail (TUMBLER_IS_SCHEDULER (info->scheduler), FALSE);
-  g_return_val_if_fail (info->uris != NULL && info->uris[0] != NULL && *info->uris[0] != '\0', FALSE);
-  g_return_val_if_fail (info->message != NULL && *info->message != '\0', FALSE);
-  g_return_val_if_fail (info->origin != NULL && *info->origin != '\0', FALSE);
-  g_return_val_if_fail (TUMBLER_IS_SERVICE (info->service), FALSE);
+  g_return_if_fail (info != NULL);
+  g_return_if_fail (TUMBLER_IS_SCHEDULER (info->scheduler));
+  g_return_if_fail (info->uris != NULL && info->uris[0] != NULL && *info->uris[0] != '\0');
+  g_return_if_fail (info->message != NULL && *info->message != '\0');
+  g_return_if_fail (info->origin != NULL && *info->origin != '\0');
+  g_return_if_fail (TUMBLER_IS_SERVICE (info->service));
 
   /* cache cleanup: any previous thumbnail is now invalid */
   cache = tumbler_cache_get_default ();
@@ -412,7 +692,21 @@ tumbler_service_error_idle (gpointer user_data)
                                  signal_variant,
                                  NULL);
 
-  scheduler_idle_info_free (info);
+  tumbler_util_trace_end (info->trace, "error-signal", "handle=%u uri=%s",
+                          info->handle, info->uris[0]);
+}
+
+
+
+static gboolean
+tumbler_service_error_idle (gpointer user_data)
+{
+  SchedulerIdleInfo *info = user_data;
+
+  g_return_val_if_fail (info != NULL, FALSE);
+  g_return_val_if_fail (TUMBLER_IS_SERVICE (info->service), FALSE);
+
+  tumbler_service_coalesce_signal (info->service, info);
 
   return FALSE;
 }
@@ -449,6 +743,7 @@ tumbler_service_scheduler_error (TumblerScheduler *scheduler,
   info->uris = g_strdupv ((gchar **) failed_uris);
   info->origin = g_strdup (origin);
   info->service = g_object_ref (service);
+  info->is_error = TRUE;
   if (error_domain == TUMBLER_ERROR)
     {
       info->error_code = error_code;
@@ -465,6 +760,7 @@ tumbler_service_scheduler_error (TumblerScheduler *scheduler,
            handle, info->error_code, info->message);
   tumbler_util_dump_strv (G_LOG_DOMAIN, "URIs", failed_uris);
 
+  info->trace = tumbler_util_trace_begin ();
   g_idle_add (tumbler_service_error_idle, info);
 }
 
@@ -480,6 +776,9 @@ tumbler_service_finished_idle (gpointer user_data)
   g_return_val_if_fail (info->origin != NULL && *info->origin != '\0', FALSE);
   g_return_val_if_fail (TUMBLER_IS_SERVICE (info->service), FALSE);
 
+  /* clients expect all ready and error signals of a request before it finishes */
+  tumbler_service_flush_signals (info->service, info->origin);
+
   signal_variant = g_variant_new ("(u)",
                                   info->handle);
 
@@ -492,10 +791,24 @@ tumbler_service_finished_idle (gpointer user_data)
                                  signal_variant,
                                  NULL);
 
+  tumbler_util_trace_end (info->trace, "finished-signal", "handle=%u", info->handle);
+
   /* allow the lifecycle manager to shut down the service again (unless there
    * are other requests still being processed) */
   tumbler_component_decrement_use_count (TUMBLER_COMPONENT (info->service));
 
+  tumbler_mutex_lock (info->service->deliveries_mutex);
+  g_hash_table_remove (info->service->deliveries, GUINT_TO_POINTER (info->handle));
+  tumbler_mutex_unlock (info->service->deliveries_mutex);
+
+  /* release the memory of the burst once both schedulers have drained */
+  tumbler_mutex_lock (info->service->mutex);
+  if (info->service->n_requests > 0 && --info->service->n_requests == 0)
+    info->service->reclaim_id = g_timeout_add_seconds (RECLAIM_TIMEOUT_SECONDS,
+                                                       tumbler_service_reclaim,
+                                                       info->service);
+  tumbler_mutex_unlock (info->service->mutex);
+
   scheduler_idle_info_free (info);
 
   return FALSE;
@@ -524,37 +837,273 @@ tumbler_service_scheduler_finished (TumblerScheduler *scheduler,
   info->origin = g_strdup (origin);
   info->service = g_object_ref (service);
 
+  info->trace = tumbler_util_trace_begin ();
   g_idle_add (tumbler_service_finished_idle, info);
 }
 
 
 
+#ifdef HAVE_MEMFD_CREATE
+static gboolean
+tumbler_service_write_all (gint fd,
+                           const guchar *data,
+                           gsize size)
+{
+  gssize n_written;
+
+  while (size > 0)
+    {
+      n_written = write (fd, data, size);
+      if (n_written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          return FALSE;
+        }
+
+      data += n_written;
+      size -= n_written;
+    }
+
+  return TRUE;
+}
+
+
+
+static gboolean
+tumbler_service_pack_thumbnail (Delivery *delivery,
+                                const gchar *uri,
+                                gint fd,
+                                guint64 offset,
+                                GVariantBuilder *layout)
+{
+  TumblerThumbnail *thumbnail;
+  GdkPixbufLoader *loader;
+  GdkPixbuf *pixbuf = NULL;
+  GBytes *bytes;
+  const guchar *pixels;
+  gboolean success = FALSE;
+  gsize size;
+  gint width, height, rowstride, y;
+
+  thumbnail = tumbler_cache_get_thumbnail (delivery->cache, uri, delivery->flavor);
+  if (thumbnail == NULL)
+    return FALSE;
+
+  bytes = tumbler_thumbnail_load_bytes (thumbnail, NULL, NULL);
+  g_object_unref (thumbnail);
+  if (bytes == NULL)
+    return FALSE;
+
+  if (delivery->format == DELIVERY_FORMAT_PNG)
+    {
+      size = g_bytes_get_size (bytes);
+      success = tumbler_service_write_all (fd, g_bytes_get_data (bytes, NULL), size);
+      if (success)
+        g_variant_builder_add (layout, "(ttiii)", offset, (guint64) size, 0, 0, 0);
+
+      g_bytes_unref (bytes);
+      return success;
+    }
+
+  /* decode the thumbnail to tightly packed RGBA rows */
+  loader = gdk_pixbuf_loader_new ();
+  if (gdk_pixbuf_loader_write_bytes (loader, bytes, NULL)
+      && gdk_pixbuf_loader_close (loader, NULL))
+    pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+  else
+    gdk_pixbuf_loader_close (loader, NULL);
+
+  if (pixbuf != NULL)
+    {
+      if (gdk_pixbuf_get_has_alpha (pixbuf))
+        g_object_ref (pixbuf);
+      else
+        pixbuf = gdk_pixbuf_add_alpha (pixbuf, FALSE, 0, 0, 0);
+
+      width = gdk_pixbuf_get_width (pixbuf);
+      height = gdk_pixbuf_get_height (pixbuf);
+      rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+      pixels = gdk_pixbuf_read_pixels (pixbuf);
+
+      if (rowstride == width * 4)
+        success = tumbler_service_write_all (fd, pixels, (gsize) rowstride * height);
+      else
+        for (y = 0, success = TRUE; success && y < height; y++)
+          success = tumbler_service_write_all (fd, pixels + (gsize) y * rowstride, width * 4);
+
+      if (success)
+        g_variant_builder_add (layout, "(ttiii)", offset, (guint64) width * 4 * height,
+                               width, height, width * 4);
+
+      g_object_unref (pixbuf);
+    }
+
+  g_object_unref (loader);
+  g_bytes_unref (bytes);
+
+  return success;
+}
+#endif
+
+
+
+/* thumbnails of a QueueWithData() request are written one after another into
+ * a sealed memfd, URIs that could not be packed are reported as usual */
+static void
+tumbler_service_pack_thumbnails (Delivery *delivery,
+                                 const gchar *const *uris,
+                                 SchedulerIdleInfo *info)
+{
+#ifdef HAVE_MEMFD_CREATE
+  GVariantBuilder layout;
+  GPtrArray *packed;
+  GPtrArray *unpacked;
+  guint64 offset = 0;
+  off_t end;
+  gint fd;
+  guint n;
+
+  fd = memfd_create ("tumbler-thumbnails", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+    {
+      info->uris = g_strdupv ((gchar **) uris);
+      return;
+    }
+
+  packed = g_ptr_array_new_with_free_func (g_free);
+  unpacked = g_ptr_array_new_with_free_func (g_free);
+  g_variant_builder_init (&layout, G_VARIANT_TYPE ("a(ttiii)"));
+
+  for (n = 0; uris[n] != NULL; n++)
+    {
+      if (tumbler_service_pack_thumbnail (delivery, uris[n], fd, offset, &layout))
+        {
+          g_ptr_array_add (packed, g_strdup (uris[n]));
+          offset = lseek (fd, 0, SEEK_CUR);
+        }
+      else
+        {
+          g_ptr_array_add (unpacked, g_strdup (uris[n]));
+
+          /* drop what a failed write left behind, or give up on the memfd */
+          end = offset;
+          if (lseek (fd, end, SEEK_SET) < 0 || ftruncate (fd, end) < 0)
+            {
+              g_ptr_array_set_size (packed, 0);
+              break;
+            }
+        }
+    }
+
+  /* the client maps the data read-only, make sure it stays as it is */
+  fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+
+  if (packed->len > 0)
+    {
+      g_ptr_array_add (packed, NULL);
+      info->data_uris = (gchar **) g_ptr_array_free (packed, FALSE);
+      info->layout = g_variant_ref_sink (g_variant_builder_end (&layout));
+      info->fd_list = g_unix_fd_list_new_from_array (&fd, 1);
+    }
+  else
+    {
+      g_ptr_array_free (packed, TRUE);
+      g_variant_builder_clear (&layout);
+      close (fd);
+
+      /* report everything through the ready signal */
+      g_ptr_array_set_size (unpacked, 0);
+      for (n = 0; uris[n] != NULL; n++)
+        g_ptr_array_add (unpacked, g_strdup (uris[n]));
+    }
+
+  if (unpacked->len > 0)
+    {
+      g_ptr_array_add (unpacked, NULL);
+      info->uris = (gchar **) g_ptr_array_free (unpacked, FALSE);
+    }
+  else
+    g_ptr_array_free (unpacked, TRUE);
+#else
+  info->uris = g_strdupv ((gchar **) uris);
+#endif
+}
+
+
+
+static void
+tumbler_service_emit_ready (SchedulerIdleInfo *info)
+{
+  GVariant *signal_variant;
+  GDBusMessage *message;
+  GError *error = NULL;
+
+  g_return_if_fail (info != NULL);
+  g_return_if_fail (TUMBLER_IS_SCHEDULER (info->scheduler));
+  g_return_if_fail (info->uris != NULL || info->data_uris != NULL);
+  g_return_if_fail (info->origin != NULL && *info->origin != '\0');
+  g_return_if_fail (TUMBLER_IS_SERVICE (info->service));
+
+  if (info->data_uris != NULL)
+    {
+      /* signals carrying a file descriptor have to be sent as a message */
+      message = g_dbus_message_new_signal (THUMBNAILER_PATH, THUMBNAILER_IFACE, "ReadyData");
+      g_dbus_message_set_destination (message, info->origin);
+      g_dbus_message_set_body (message, g_variant_new ("(u^ash@a(ttiii))",
+                                                       info->handle, info->data_uris,
+                                                       0, info->layout));
+      g_dbus_message_set_unix_fd_list (message, info->fd_list);
+
+      if (!g_dbus_connection_send_message (info->service->connection, message,
+                                           G_DBUS_SEND_MESSAGE_FLAGS_NONE, NULL, &error))
+        {
+          g_warning ("Failed to send thumbnail data for request %u: %s",
+                     info->handle, error->message);
+          g_clear_error (&error);
+
+          /* fall back to a ready signal for these URIs */
+          signal_variant = g_variant_new ("(u^as)", info->handle, info->data_uris);
+          g_dbus_connection_emit_signal (info->service->connection, info->origin,
+                                         THUMBNAILER_PATH, THUMBNAILER_IFACE,
+                                         "Ready", signal_variant, NULL);
+        }
+
+      g_object_unref (message);
+    }
+
+  if (info->uris != NULL)
+    {
+      signal_variant = g_variant_new ("(u^as)",
+                                      info->handle,
+                                      info->uris);
+
+      /* send the signal message over D-Bus */
+      g_dbus_connection_emit_signal (info->service->connection,
+                                     info->origin,
+                                     THUMBNAILER_PATH,
+                                     THUMBNAILER_IFACE,
+                                     "Ready",
+                                     signal_variant,
+                                     NULL);
+    }
+
+  tumbler_util_trace_end (info->trace, "ready-signal", "handle=%u uri=%s", info->handle,
+                          info->uris != NULL ? info->uris[0] : info->data_uris[0]);
+}
+
+
+
 static gboolean
 tumbler_service_ready_idle (gpointer user_data)
 {
   SchedulerIdleInfo *info = user_data;
-  GVariant *signal_variant;
 
   g_return_val_if_fail (info != NULL, FALSE);
-  g_return_val_if_fail (TUMBLER_IS_SCHEDULER (info->scheduler), FALSE);
-  g_return_val_if_fail (info->uris != NULL && info->uris[0] != NULL && *info->uris[0] != '\0', FALSE);
-  g_return_val_if_fail (info->origin != NULL && *info->origin != '\0', FALSE);
   g_return_val_if_fail (TUMBLER_IS_SERVICE (info->service), FALSE);
 
-  signal_variant = g_variant_new ("(u^as)",
-                                  info->handle,
-                                  info->uris);
-
-  /* send the signal message over D-Bus */
-  g_dbus_connection_emit_signal (info->service->connection,
-                                 info->origin,
-                                 THUMBNAILER_PATH,
-                                 THUMBNAILER_IFACE,
-                                 "Ready",
-                                 signal_variant,
-                                 NULL);
-
-  scheduler_idle_info_free (info);
+  tumbler_service_coalesce_signal (info->service, info);
 
   return FALSE;
 }
@@ -569,6 +1118,8 @@ tumbler_service_scheduler_ready (TumblerScheduler *scheduler,
                                  TumblerService *service)
 {
   SchedulerIdleInfo *info;
+  Delivery *delivery;
+  Delivery packing;
 
   g_return_if_fail (TUMBLER_IS_SCHEDULER (scheduler));
   g_return_if_fail (origin != NULL && *origin != '\0');
@@ -582,10 +1133,33 @@ tumbler_service_scheduler_ready (TumblerScheduler *scheduler,
 
   info->scheduler = g_object_ref (scheduler);
   info->handle = handle;
-  info->uris = g_strdupv ((gchar **) uris);
   info->origin = g_strdup (origin);
   info->service = g_object_ref (service);
 
+  info->trace = tumbler_util_trace_begin ();
+
+  /* pack the thumbnails here in the scheduler thread, the files were
+   * just written or checked and are still in the page cache */
+  tumbler_mutex_lock (service->deliveries_mutex);
+  delivery = g_hash_table_lookup (service->deliveries, GUINT_TO_POINTER (handle));
+  if (delivery != NULL)
+    {
+      /* the request may finish while we are still packing */
+      packing.format = delivery->format;
+      packing.cache = g_object_ref (delivery->cache);
+      packing.flavor = g_object_ref (delivery->flavor);
+    }
+  tumbler_mutex_unlock (service->deliveries_mutex);
+
+  if (delivery != NULL)
+    {
+      tumbler_service_pack_thumbnails (&packing, uris, info);
+      g_object_unref (packing.cache);
+      g_object_unref (packing.flavor);
+    }
+  else
+    info->uris = g_strdupv ((gchar **) uris);
+
   g_idle_add (tumbler_service_ready_idle, info);
 }
 
@@ -613,6 +1187,8 @@ tumbler_service_started_idle (gpointer user_data)
                                  signal_variant,
                                  NULL);
 
+  tumbler_util_trace_end (info->trace, "started-signal", "handle=%u", info->handle);
+
   scheduler_idle_info_free (info);
 
   return FALSE;
@@ -641,6 +1217,7 @@ tumbler_service_scheduler_started (TumblerScheduler *scheduler,
   info->origin = g_strdup (origin);
   info->service = g_object_ref (service);
 
+  info->trace = tumbler_util_trace_begin ();
   g_idle_add (tumbler_service_started_idle, info);
 }
 
@@ -657,6 +1234,8 @@ tumbler_service_pre_unmount (TumblerService *service,
   g_return_if_fail (G_IS_MOUNT (mount));
   g_return_if_fail (volume_monitor == service->volume_monitor);
 
+  tumbler_recorder_unmount (mount);
+
   tumbler_mutex_lock (service->mutex);
 
   /* iterate over all schedulers, cancelling URIs belonging to the mount */
@@ -668,6 +1247,69 @@ tumbler_service_pre_unmount (TumblerService *service,
 
 
 
+static gsize
+tumbler_service_get_rss (void)
+{
+  gchar *contents;
+  gchar *line;
+  gsize rss = 0;
+
+  /* resident set size in kB, as reported by the kernel */
+  if (g_file_get_contents ("/proc/self/status", &contents, NULL, NULL))
+    {
+      line = strstr (contents, "\nVmRSS:");
+      if (line != NULL)
+        rss = g_ascii_strtoull (line + strlen ("\nVmRSS:"), NULL, 10);
+
+      g_free (contents);
+    }
+
+  return rss;
+}
+
+
+
+static gboolean
+tumbler_service_reclaim (gpointer user_data)
+{
+  TumblerService *service = user_data;
+  GList *thumbnailers;
+  GList *iter;
+  gsize rss = 0;
+
+  g_return_val_if_fail (TUMBLER_IS_SERVICE (service), FALSE);
+
+  service->reclaim_id = 0;
+
+  if (tumbler_util_is_debug_logging_enabled (G_LOG_DOMAIN))
+    rss = tumbler_service_get_rss ();
+
+  /* stop the idle scheduler threads, along with their thread-local caches */
+  for (iter = service->schedulers; iter != NULL; iter = iter->next)
+    tumbler_scheduler_reclaim (iter->data);
+
+  /* let the thumbnailers drop decoder state they keep between jobs */
+  thumbnailers = tumbler_registry_get_thumbnailers (service->registry);
+  for (iter = thumbnailers; iter != NULL; iter = iter->next)
+    tumbler_thumbnailer_reclaim (iter->data);
+  g_list_free_full (thumbnailers, g_object_unref);
+
+  g_thread_pool_stop_unused_threads ();
+
+#ifdef HAVE_MALLOC_TRIM
+  /* hand the freed heap pages of all arenas back to the system */
+  malloc_trim (0);
+#endif
+
+  if (tumbler_util_is_debug_logging_enabled (G_LOG_DOMAIN))
+    g_debug ("Reclaimed idle memory: RSS %" G_GSIZE_FORMAT " kB -> %" G_GSIZE_FORMAT " kB",
+             rss, tumbler_service_get_rss ());
+
+  return FALSE;
+}
+
+
+
 static void
 scheduler_idle_info_free (SchedulerIdleInfo *info)
 {
@@ -677,6 +1319,12 @@ scheduler_idle_info_free (SchedulerIdleInfo *info)
   g_free (info->message);
   g_free (info->origin);
   g_strfreev (info->uris);
+  g_strfreev (info->data_uris);
+
+  if (info->fd_list != NULL)
+    g_object_unref (info->fd_list);
+  if (info->layout != NULL)
+    g_variant_unref (info->layout);
 
   g_object_unref (info->scheduler);
   g_object_unref (info->service);
@@ -686,6 +1334,33 @@ scheduler_idle_info_free (SchedulerIdleInfo *info)
 
 
 
+static void
+delivery_free (gpointer data)
+{
+  Delivery *delivery = data;
+
+  g_object_unref (delivery->cache);
+  g_object_unref (delivery->flavor);
+  g_slice_free (Delivery, delivery);
+}
+
+
+
+static void
+pending_signals_free (gpointer data)
+{
+  PendingSignals *pending = data;
+
+  if (pending->flush_id != 0)
+    g_source_remove (pending->flush_id);
+
+  g_queue_clear_full (&pending->signals, (GDestroyNotify) scheduler_idle_info_free);
+  g_free (pending->origin);
+  g_slice_free (PendingSignals, pending);
+}
+
+
+
 TumblerService *
 tumbler_service_new (GDBusConnection *connection,
                      TumblerLifecycleManager *lifecycle_manager,
@@ -700,15 +1375,15 @@ tumbler_service_new (GDBusConnection *connection,
 
 
 
-static gboolean
-tumbler_service_queue_cb (TumblerExportedService *skeleton,
-                          GDBusMethodInvocation *invocation,
-                          const gchar *const *uris,
-                          const gchar *const *mime_hints,
-                          const gchar *flavor_name,
-                          const gchar *scheduler_name,
-                          guint handle_to_dequeue,
-                          TumblerService *service)
+static guint32
+tumbler_service_queue (TumblerService *service,
+                       GDBusMethodInvocation *invocation,
+                       const gchar *const *uris,
+                       const gchar *const *mime_hints,
+                       const gchar *flavor_name,
+                       const gchar *scheduler_name,
+                       guint handle_to_dequeue,
+                       DeliveryFormat format)
 {
   TumblerSchedulerRequest *scheduler_request;
   TumblerThumbnailFlavor *flavor;
@@ -719,26 +1394,30 @@ tumbler_service_queue_cb (TumblerExportedService *skeleton,
   GList *iter;
   gchar *name;
   const gchar *origin;
+  Delivery *delivery;
   guint32 handle;
   guint length;
 
-  g_dbus_async_return_val_if_fail (TUMBLER_IS_SERVICE (service), invocation, FALSE);
-  g_dbus_async_return_val_if_fail (uris != NULL, invocation, FALSE);
-  g_dbus_async_return_val_if_fail (mime_hints != NULL, invocation, FALSE);
-
   tumbler_mutex_lock (service->mutex);
 
   /* prevent the lifecycle manager to shut down the service as long
    * as the request is still being processed */
   tumbler_component_increment_use_count (TUMBLER_COMPONENT (service));
 
+  /* the next burst may need the resources we were about to release */
+  service->n_requests++;
+  if (service->reclaim_id != 0)
+    {
+      g_source_remove (service->reclaim_id);
+      service->reclaim_id = 0;
+    }
+
   /* if the scheduler is not defined, fall back to "default" */
   if (scheduler_name == NULL || *scheduler_name == '\0')
     scheduler_name = "default";
 
   cache = tumbler_cache_get_default ();
   flavor = tumbler_cache_get_flavor (cache, flavor_name);
-  g_object_unref (cache);
 
   infos = tumbler_file_info_array_new_with_flavor (uris, mime_hints, flavor,
                                                    &length);
@@ -762,6 +1441,9 @@ tumbler_service_queue_cb (TumblerExportedService *skeleton,
   g_debug ("Handling request %u", handle);
   tumbler_util_dump_strvs_side_by_side (G_LOG_DOMAIN, "URIs", "Mime types", uris, mime_hints);
 
+  tumbler_recorder_queue (handle, uris, mime_hints, flavor_name, scheduler_name,
+                          handle_to_dequeue);
+
   /* iterate over all schedulers */
   for (iter = service->schedulers; iter != NULL; iter = iter->next)
     {
@@ -809,6 +1491,19 @@ tumbler_service_queue_cb (TumblerExportedService *skeleton,
     }
   else
     {
+      /* remember where to find the thumbnails before any of them is ready */
+      if (format != DELIVERY_FORMAT_NONE)
+        {
+          delivery = g_slice_new0 (Delivery);
+          delivery->format = format;
+          delivery->cache = g_object_ref (cache);
+          delivery->flavor = g_object_ref (flavor);
+
+          tumbler_mutex_lock (service->deliveries_mutex);
+          g_hash_table_insert (service->deliveries, GUINT_TO_POINTER (handle), delivery);
+          tumbler_mutex_unlock (service->deliveries_mutex);
+        }
+
       /* let the scheduler take it from here */
       tumbler_scheduler_push (scheduler, scheduler_request);
       g_object_unref (flavor);
@@ -817,8 +1512,34 @@ tumbler_service_queue_cb (TumblerExportedService *skeleton,
   /* free the thumbnailer array */
   tumbler_thumbnailer_array_free (thumbnailers, length);
 
+  g_object_unref (cache);
+
   tumbler_mutex_unlock (service->mutex);
 
+  return handle;
+}
+
+
+
+static gboolean
+tumbler_service_queue_cb (TumblerExportedService *skeleton,
+                          GDBusMethodInvocation *invocation,
+                          const gchar *const *uris,
+                          const gchar *const *mime_hints,
+                          const gchar *flavor_name,
+                          const gchar *scheduler_name,
+                          guint handle_to_dequeue,
+                          TumblerService *service)
+{
+  guint32 handle;
+
+  g_dbus_async_return_val_if_fail (TUMBLER_IS_SERVICE (service), invocation, FALSE);
+  g_dbus_async_return_val_if_fail (uris != NULL, invocation, FALSE);
+  g_dbus_async_return_val_if_fail (mime_hints != NULL, invocation, FALSE);
+
+  handle = tumbler_service_queue (service, invocation, uris, mime_hints, flavor_name,
+                                  scheduler_name, handle_to_dequeue, DELIVERY_FORMAT_NONE);
+
   tumbler_exported_service_complete_queue (skeleton, invocation, handle);
 
   /* try to keep tumbler alive */
@@ -829,6 +1550,51 @@ tumbler_service_queue_cb (TumblerExportedService *skeleton,
 
 
 
+static gboolean
+tumbler_service_queue_with_data_cb (TumblerExportedService *skeleton,
+                                    GDBusMethodInvocation *invocation,
+                                    const gchar *const *uris,
+                                    const gchar *const *mime_hints,
+                                    const gchar *flavor_name,
+                                    const gchar *scheduler_name,
+                                    guint handle_to_dequeue,
+                                    const gchar *format,
+                                    TumblerService *service)
+{
+  DeliveryFormat delivery_format;
+  guint32 handle;
+
+  g_dbus_async_return_val_if_fail (TUMBLER_IS_SERVICE (service), invocation, FALSE);
+  g_dbus_async_return_val_if_fail (uris != NULL, invocation, FALSE);
+  g_dbus_async_return_val_if_fail (mime_hints != NULL, invocation, FALSE);
+
+  if (g_strcmp0 (format, "png") == 0)
+    delivery_format = DELIVERY_FORMAT_PNG;
+  else if (g_strcmp0 (format, "rgba") == 0)
+    delivery_format = DELIVERY_FORMAT_RGBA;
+  else
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                             "Unsupported thumbnail data format \"%s\"", format);
+      return TRUE;
+    }
+
+  /* the thumbnails are sent as a file descriptor, which the bus drops for
+   * clients that can't receive them, so this is up to the client: it must
+   * only call this method on a connection with file descriptor passing */
+  handle = tumbler_service_queue (service, invocation, uris, mime_hints, flavor_name,
+                                  scheduler_name, handle_to_dequeue, delivery_format);
+
+  tumbler_exported_service_complete_queue_with_data (skeleton, invocation, handle);
+
+  /* try to keep tumbler alive */
+  tumbler_component_keep_alive (TUMBLER_COMPONENT (service), NULL);
+
+  return TRUE;
+}
+
+
+
 static gboolean
 tumbler_service_dequeue_cb (TumblerExportedService *skeleton,
                             GDBusMethodInvocation *invocation,
@@ -843,6 +1609,8 @@ tumbler_service_dequeue_cb (TumblerExportedService *skeleton,
     {
       g_debug ("Dequeuing files for job %u", handle);
 
+      tumbler_recorder_dequeue (handle);
+
       /* iterate over all available schedulers */
       for (iter = service->schedulers; iter != NULL; iter = iter->next)
         {
@@ -27,6 +27,14 @@
 
 
 
+/* number of Queue calls kept outstanding per service, unless MaxConcurrency is set */
+#define DEFAULT_CALL_WINDOW 8
+
+/* seconds to wait for the service to answer or to finish a call */
+#define CALL_TIMEOUT 100
+
+
+
 /* Property identifiers */
 enum
 {
@@ -41,12 +49,11 @@ enum
 
 
 
+typedef struct _SpecializedCall SpecializedCall;
 typedef struct _SpecializedInfo SpecializedInfo;
 
 
 
-static void
-tumbler_specialized_thumbnailer_iface_init (TumblerThumbnailerIface *iface);
 static void
 tumbler_specialized_thumbnailer_constructed (GObject *object);
 static void
@@ -62,9 +69,17 @@ tumbler_specialized_thumbnailer_set_property (GObject *object,
                                               const GValue *value,
                                               GParamSpec *pspec);
 static void
-tumbler_specialized_thumbnailer_create (TumblerThumbnailer *thumbnailer,
+tumbler_specialized_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
                                         GCancellable *cancellable,
                                         TumblerFileInfo *info);
+static void
+tumbler_specialized_thumbnailer_dispatch (TumblerSpecializedThumbnailer *thumbnailer);
+static void
+tumbler_specialized_thumbnailer_proxy_signal (GDBusProxy *proxy,
+                                              gchar *sender_name,
+                                              gchar *signal_name,
+                                              GVariant *parameters,
+                                              TumblerSpecializedThumbnailer *thumbnailer);
 
 static void
 tumbler_specialized_thumbnailer_proxy_name_owner_changed (GDBusProxy *proxy,
@@ -84,33 +99,57 @@ struct _TumblerSpecializedThumbnailer
 
   gchar *name;
   gchar *object_path;
+
+  /* calls waiting for a slot in the window, and the number of calls sent to the
+   * service that are not finished yet, both protected by calls_mutex */
+  TUMBLER_MUTEX (calls_mutex);
+  GQueue waiting_calls;
+  guint n_outstanding;
+
+  /* handle => SpecializedCall, only used on the main context */
+  GHashTable *running_calls;
+};
+
+struct _SpecializedCall
+{
+  TumblerSpecializedThumbnailer *thumbnailer;
+  TumblerFileInfo *info;
+  GCancellable *cancellable;
+  TumblerSpecializedThumbnailerFunc func;
+  gpointer user_data;
+
+  guint32 handle;
+  guint timeout_id;
+  gboolean had_result;
+  GError *error;
 };
 
 struct _SpecializedInfo
 {
-  TumblerThumbnailer *thumbnailer;
   GCond condition;
   TUMBLER_MUTEX (mutex);
-  TumblerFileInfo *info;
-  gboolean had_callback;
-  guint32 handle;
+  gboolean finished;
+  GError *error;
 };
 
 
 
-G_DEFINE_FINAL_TYPE_WITH_CODE (TumblerSpecializedThumbnailer,
-                               tumbler_specialized_thumbnailer,
-                               TUMBLER_TYPE_ABSTRACT_THUMBNAILER,
-                               G_IMPLEMENT_INTERFACE (TUMBLER_TYPE_THUMBNAILER,
-                                                      tumbler_specialized_thumbnailer_iface_init));
+G_DEFINE_FINAL_TYPE (TumblerSpecializedThumbnailer,
+                     tumbler_specialized_thumbnailer,
+                     TUMBLER_TYPE_ABSTRACT_THUMBNAILER);
 
 
 
 static void
 tumbler_specialized_thumbnailer_class_init (TumblerSpecializedThumbnailerClass *klass)
 {
+  TumblerAbstractThumbnailerClass *abstractthumbnailer_class;
   GObjectClass *gobject_class;
 
+  /* go through the abstract thumbnailer so that admission control applies */
+  abstractthumbnailer_class = TUMBLER_ABSTRACT_THUMBNAILER_CLASS (klass);
+  abstractthumbnailer_class->create = tumbler_specialized_thumbnailer_create;
+
   gobject_class = G_OBJECT_CLASS (klass);
   gobject_class->constructed = tumbler_specialized_thumbnailer_constructed;
   gobject_class->finalize = tumbler_specialized_thumbnailer_finalize;
@@ -168,17 +207,12 @@ tumbler_specialized_thumbnailer_class_init (TumblerSpecializedThumbnailerClass *
 
 
 
-static void
-tumbler_specialized_thumbnailer_iface_init (TumblerThumbnailerIface *iface)
-{
-  iface->create = tumbler_specialized_thumbnailer_create;
-}
-
-
-
 static void
 tumbler_specialized_thumbnailer_init (TumblerSpecializedThumbnailer *thumbnailer)
 {
+  tumbler_mutex_create (thumbnailer->calls_mutex);
+  g_queue_init (&thumbnailer->waiting_calls);
+  thumbnailer->running_calls = g_hash_table_new (g_direct_hash, g_direct_equal);
 }
 
 
@@ -187,6 +221,8 @@ static void
 tumbler_specialized_thumbnailer_constructed (GObject *object)
 {
   TumblerSpecializedThumbnailer *thumbnailer = TUMBLER_SPECIALIZED_THUMBNAILER (object);
+  GKeyFile *rc;
+  gint max_concurrency;
 
   g_return_if_fail (TUMBLER_SPECIALIZED_THUMBNAILER (thumbnailer));
 
@@ -194,6 +230,14 @@ tumbler_specialized_thumbnailer_constructed (GObject *object)
   if (G_OBJECT_CLASS (tumbler_specialized_thumbnailer_parent_class)->constructed != NULL)
     (G_OBJECT_CLASS (tumbler_specialized_thumbnailer_parent_class)->constructed) (object);
 
+  /* specialized thumbnailers are not set up by a provider, so apply the
+   * concurrency limit from the rc file here */
+  rc = tumbler_util_get_settings ();
+  max_concurrency = g_key_file_get_integer (rc, G_OBJECT_TYPE_NAME (object),
+                                            "MaxConcurrency", NULL);
+  g_object_set (object, "max-concurrency", MAX (max_concurrency, 0), NULL);
+  g_key_file_free (rc);
+
   thumbnailer->proxy =
     g_dbus_proxy_new_sync (thumbnailer->connection,
                            G_DBUS_PROXY_FLAGS_NONE,
@@ -204,6 +248,9 @@ tumbler_specialized_thumbnailer_constructed (GObject *object)
                            NULL,
                            NULL);
 
+  g_signal_connect (thumbnailer->proxy, "g-signal",
+                    G_CALLBACK (tumbler_specialized_thumbnailer_proxy_signal), thumbnailer);
+
   if (thumbnailer->foreign)
     {
       g_signal_connect (thumbnailer->proxy, "notify::g-name-owner",
@@ -229,6 +276,10 @@ tumbler_specialized_thumbnailer_finalize (GObject *object)
 
   g_object_unref (thumbnailer->connection);
 
+  /* every call holds a reference on the thumbnailer, so there are none left here */
+  g_hash_table_destroy (thumbnailer->running_calls);
+  tumbler_mutex_free (thumbnailer->calls_mutex);
+
   (*G_OBJECT_CLASS (tumbler_specialized_thumbnailer_parent_class)->finalize) (object);
 }
 
@@ -304,26 +355,128 @@ tumbler_specialized_thumbnailer_set_property (GObject *object,
 
 
 static void
-thumbnailer_proxy_g_signal_cb (GDBusProxy *proxy,
-                               gchar *sender_name,
-                               gchar *signal_name,
-                               GVariant *parameters,
-                               gpointer user_data)
+specialized_call_free (SpecializedCall *call)
+{
+  if (call->error != NULL)
+    g_error_free (call->error);
+
+  if (call->cancellable != NULL)
+    g_object_unref (call->cancellable);
+
+  g_object_unref (call->info);
+  g_object_unref (call->thumbnailer);
+
+  g_slice_free (SpecializedCall, call);
+}
+
+
+
+static void
+tumbler_specialized_thumbnailer_finish_call (SpecializedCall *call,
+                                             gboolean sent)
+{
+  TumblerSpecializedThumbnailer *thumbnailer = call->thumbnailer;
+
+  if (call->timeout_id != 0)
+    g_source_remove (call->timeout_id);
+
+  call->func (thumbnailer, call->info, call->error, call->user_data);
+
+  if (sent)
+    {
+      /* make room for the next waiting call */
+      tumbler_mutex_lock (thumbnailer->calls_mutex);
+      thumbnailer->n_outstanding--;
+      tumbler_mutex_unlock (thumbnailer->calls_mutex);
+
+      tumbler_specialized_thumbnailer_dispatch (thumbnailer);
+    }
+
+  specialized_call_free (call);
+}
+
+
+
+static gboolean
+tumbler_specialized_thumbnailer_call_timeout (gpointer user_data)
+{
+  SpecializedCall *call = user_data;
+
+  g_hash_table_remove (call->thumbnailer->running_calls, GUINT_TO_POINTER (call->handle));
+  call->timeout_id = 0;
+
+  g_clear_error (&call->error);
+  g_set_error_literal (&call->error, TUMBLER_ERROR, TUMBLER_ERROR_CONNECTION_ERROR,
+                       _("Failed to call the specialized thumbnailer: timeout"));
+
+  tumbler_specialized_thumbnailer_finish_call (call, TRUE);
+
+  return G_SOURCE_REMOVE;
+}
+
+
+
+static void
+tumbler_specialized_thumbnailer_queue_ready (GObject *source_object,
+                                             GAsyncResult *result,
+                                             gpointer user_data)
+{
+  SpecializedCall *call = user_data;
+  GVariant *reply;
+  GError *error = NULL;
+
+  reply = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), result, &error);
+  if (reply == NULL)
+    {
+      g_set_error (&call->error, TUMBLER_ERROR, TUMBLER_ERROR_CONNECTION_ERROR,
+                   _("Failed to call the specialized thumbnailer: %s"), error->message);
+      g_error_free (error);
+
+      tumbler_specialized_thumbnailer_finish_call (call, TRUE);
+      return;
+    }
+
+  g_variant_get (reply, "(u)", &call->handle);
+  g_variant_unref (reply);
+
+  /* the reply is dispatched before the signals of the service for this
+   * handle, so the call can be looked up when they arrive */
+  g_hash_table_insert (call->thumbnailer->running_calls, GUINT_TO_POINTER (call->handle), call);
+  call->timeout_id = g_timeout_add_seconds (CALL_TIMEOUT,
+                                            tumbler_specialized_thumbnailer_call_timeout,
+                                            call);
+}
+
+
+
+static void
+tumbler_specialized_thumbnailer_proxy_signal (GDBusProxy *proxy,
+                                              gchar *sender_name,
+                                              gchar *signal_name,
+                                              GVariant *parameters,
+                                              TumblerSpecializedThumbnailer *thumbnailer)
 {
-  SpecializedInfo *info = user_data;
+  SpecializedCall *call;
+  const gchar *uri, *error_msg;
   guint32 handle;
+  gint error_code;
 
   if (strcmp (signal_name, "Finished") == 0)
     {
       if (g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(u)")))
         {
           g_variant_get (parameters, "(u)", &handle);
-          if (info->handle == handle)
+          call = g_hash_table_lookup (thumbnailer->running_calls, GUINT_TO_POINTER (handle));
+          if (call != NULL)
             {
-              tumbler_mutex_lock (info->mutex);
-              g_cond_broadcast (&info->condition);
-              info->had_callback = TRUE;
-              tumbler_mutex_unlock (info->mutex);
+              g_hash_table_remove (thumbnailer->running_calls, GUINT_TO_POINTER (handle));
+
+              /* the service did not report anything, so there is no thumbnail */
+              if (!call->had_result)
+                g_set_error_literal (&call->error, TUMBLER_ERROR, TUMBLER_ERROR_NO_CONTENT,
+                                     TUMBLER_ERROR_MESSAGE_CREATION_FAILED);
+
+              tumbler_specialized_thumbnailer_finish_call (call, TRUE);
             }
         }
     }
@@ -331,26 +484,22 @@ thumbnailer_proxy_g_signal_cb (GDBusProxy *proxy,
     {
       if (g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(us)")))
         {
-          const gchar *uri;
           g_variant_get (parameters, "(u&s)", &handle, &uri);
-          if (info->handle == handle)
-            {
-              g_signal_emit_by_name (info->thumbnailer, "ready", info->info);
-            }
+          call = g_hash_table_lookup (thumbnailer->running_calls, GUINT_TO_POINTER (handle));
+          if (call != NULL)
+            call->had_result = TRUE;
         }
     }
   else if (strcmp (signal_name, "Error") == 0)
     {
       if (g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(usis)")))
         {
-          const gchar *uri, *error_msg;
-          gint error_code;
-
           g_variant_get (parameters, "(u&si&s)", &handle, &uri, &error_code, &error_msg);
-          if (info->handle == handle)
+          call = g_hash_table_lookup (thumbnailer->running_calls, GUINT_TO_POINTER (handle));
+          if (call != NULL && !call->had_result)
             {
-              g_signal_emit_by_name (info->thumbnailer, "error", info->info,
-                                     TUMBLER_ERROR, error_code, error_msg);
+              call->had_result = TRUE;
+              g_set_error_literal (&call->error, TUMBLER_ERROR, error_code, error_msg);
             }
         }
     }
@@ -359,90 +508,124 @@ thumbnailer_proxy_g_signal_cb (GDBusProxy *proxy,
 
 
 static void
-tumbler_specialized_thumbnailer_create (TumblerThumbnailer *thumbnailer,
-                                        GCancellable *cancellable,
-                                        TumblerFileInfo *info)
+tumbler_specialized_thumbnailer_dispatch (TumblerSpecializedThumbnailer *thumbnailer)
 {
-  TumblerSpecializedThumbnailer *s;
-  SpecializedInfo sinfo;
-  gint64 end_time;
-  TumblerThumbnail *thumbnail;
   TumblerThumbnailFlavor *flavor;
-  GVariant *result;
-  const gchar *flavor_name;
-  const gchar *uri;
-  GError *error = NULL;
-  gchar *message;
-  int handler_id;
-
-  g_return_if_fail (TUMBLER_IS_SPECIALIZED_THUMBNAILER (thumbnailer));
+  TumblerThumbnail *thumbnail;
+  SpecializedCall *call;
+  GList *cancelled = NULL, *lp;
+  guint window;
 
-  uri = tumbler_file_info_get_uri (info);
-  thumbnail = tumbler_file_info_get_thumbnail (info);
-  flavor = tumbler_thumbnail_get_flavor (thumbnail);
-  flavor_name = tumbler_thumbnail_flavor_get_name (flavor);
+  window = tumbler_thumbnailer_get_max_concurrency (TUMBLER_THUMBNAILER (thumbnailer));
+  if (window == 0)
+    window = DEFAULT_CALL_WINDOW;
 
-  s = TUMBLER_SPECIALIZED_THUMBNAILER (thumbnailer);
+  tumbler_mutex_lock (thumbnailer->calls_mutex);
 
-  g_cond_init (&sinfo.condition);
-  sinfo.had_callback = FALSE;
-  tumbler_mutex_create (sinfo.mutex);
-  sinfo.info = info;
-  sinfo.thumbnailer = thumbnailer;
-
-  handler_id = g_signal_connect (s->proxy, "g-signal",
-                                 G_CALLBACK (thumbnailer_proxy_g_signal_cb), &sinfo);
-
-  result = g_dbus_proxy_call_sync (s->proxy,
-                                   "Queue",
-                                   g_variant_new ("(sssb)",
-                                                  uri,
-                                                  tumbler_file_info_get_mime_type (info),
-                                                  flavor_name,
-                                                  /* TODO: Get this bool from scheduler type */
-                                                  FALSE),
-                                   G_DBUS_CALL_FLAGS_NONE,
-                                   100000000, /* 100 seconds worth of timeout */
-                                   NULL,
-                                   &error);
-
-  if (error == NULL)
+  while (thumbnailer->n_outstanding < window
+         && (call = g_queue_pop_head (&thumbnailer->waiting_calls)) != NULL)
     {
-      /*Get the return handle */
-      g_variant_get (result, "(u)", &sinfo.handle);
-      g_variant_unref (result);
-
-      /* 100 seconds worth of timeout */
-      end_time = g_get_monotonic_time () + 100 * G_TIME_SPAN_SECOND;
-
-      tumbler_mutex_lock (sinfo.mutex);
-
-      /* we are a thread, so the mainloop will still be
-       * be running to receive the error and ready signals */
-      if (!sinfo.had_callback)
+      /* don't bother the service with calls cancelled while waiting */
+      if (g_cancellable_is_cancelled (call->cancellable))
         {
-          if (!g_cond_wait_until (&sinfo.condition, &sinfo.mutex, end_time))
-            {
-              message = g_strdup (_("Failed to call the specialized thumbnailer: timeout"));
-              g_signal_emit_by_name (thumbnailer, "error", info,
-                                     TUMBLER_ERROR, TUMBLER_ERROR_CONNECTION_ERROR, message);
-              g_free (message);
-            }
+          cancelled = g_list_prepend (cancelled, call);
+          continue;
         }
-      tumbler_mutex_unlock (sinfo.mutex);
+
+      thumbnail = tumbler_file_info_get_thumbnail (call->info);
+      flavor = tumbler_thumbnail_get_flavor (thumbnail);
+
+      /* the reply is handled on the main context, where the signals arrive too */
+      g_dbus_proxy_call (thumbnailer->proxy,
+                         "Queue",
+                         g_variant_new ("(sssb)",
+                                        tumbler_file_info_get_uri (call->info),
+                                        tumbler_file_info_get_mime_type (call->info),
+                                        tumbler_thumbnail_flavor_get_name (flavor),
+                                        /* TODO: Get this bool from scheduler type */
+                                        FALSE),
+                         G_DBUS_CALL_FLAGS_NONE,
+                         CALL_TIMEOUT * 1000,
+                         NULL,
+                         tumbler_specialized_thumbnailer_queue_ready,
+                         call);
+
+      thumbnailer->n_outstanding++;
+
+      g_object_unref (flavor);
+      g_object_unref (thumbnail);
     }
-  else
+
+  tumbler_mutex_unlock (thumbnailer->calls_mutex);
+
+  for (lp = cancelled; lp != NULL; lp = lp->next)
     {
-      message = g_strdup_printf (_("Failed to call the specialized thumbnailer: %s"),
-                                 error->message);
-      g_signal_emit_by_name (thumbnailer, "error", info,
-                             TUMBLER_ERROR, TUMBLER_ERROR_CONNECTION_ERROR, message);
-      g_free (message);
-      g_clear_error (&error);
+      call = lp->data;
+      g_cancellable_set_error_if_cancelled (call->cancellable, &call->error);
+      tumbler_specialized_thumbnailer_finish_call (call, FALSE);
     }
 
-  g_signal_handler_disconnect (s->proxy, handler_id);
+  g_list_free (cancelled);
+}
+
+
+
+static void
+tumbler_specialized_thumbnailer_create_finished (TumblerSpecializedThumbnailer *thumbnailer,
+                                                 TumblerFileInfo *info,
+                                                 const GError *error,
+                                                 gpointer user_data)
+{
+  SpecializedInfo *sinfo = user_data;
+
+  tumbler_mutex_lock (sinfo->mutex);
+
+  if (error != NULL)
+    sinfo->error = g_error_copy (error);
 
+  sinfo->finished = TRUE;
+  g_cond_signal (&sinfo->condition);
+
+  tumbler_mutex_unlock (sinfo->mutex);
+}
+
+
+
+static void
+tumbler_specialized_thumbnailer_create (TumblerAbstractThumbnailer *thumbnailer,
+                                        GCancellable *cancellable,
+                                        TumblerFileInfo *info)
+{
+  SpecializedInfo sinfo;
+
+  g_return_if_fail (TUMBLER_IS_SPECIALIZED_THUMBNAILER (thumbnailer));
+
+  g_cond_init (&sinfo.condition);
+  tumbler_mutex_create (sinfo.mutex);
+  sinfo.finished = FALSE;
+  sinfo.error = NULL;
+
+  tumbler_specialized_thumbnailer_queue (TUMBLER_SPECIALIZED_THUMBNAILER (thumbnailer),
+                                         cancellable, info,
+                                         tumbler_specialized_thumbnailer_create_finished,
+                                         &sinfo);
+
+  /* we are a thread, so the main loop will still be running to
+   * receive the reply and the signals of the service; every call
+   * ends at the latest when its timeout expires */
+  tumbler_mutex_lock (sinfo.mutex);
+  while (!sinfo.finished)
+    g_cond_wait (&sinfo.condition, &sinfo.mutex);
+  tumbler_mutex_unlock (sinfo.mutex);
+
+  if (sinfo.error == NULL)
+    g_signal_emit_by_name (thumbnailer, "ready", info);
+  else if (!g_error_matches (sinfo.error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    g_signal_emit_by_name (thumbnailer, "error", info, sinfo.error->domain,
+                           sinfo.error->code, sinfo.error->message);
+
+  g_clear_error (&sinfo.error);
+  tumbler_mutex_free (sinfo.mutex);
   g_cond_clear (&sinfo.condition);
 }
 
@@ -543,3 +726,40 @@ tumbler_specialized_thumbnailer_get_modified (TumblerSpecializedThumbnailer *thu
   g_return_val_if_fail (TUMBLER_IS_SPECIALIZED_THUMBNAILER (thumbnailer), 0);
   return thumbnailer->modified;
 }
+
+
+
+/*
+ * Queues @info at the service without waiting for it. At most MaxConcurrency
+ * (or DEFAULT_CALL_WINDOW) calls are outstanding per service, further calls wait
+ * for a free slot. @func is called once the service is done with @info, with
+ * @error set if it failed, usually on the main context. Calls cancelled before
+ * they are sent end with a G_IO_ERROR_CANCELLED error.
+ */
+void
+tumbler_specialized_thumbnailer_queue (TumblerSpecializedThumbnailer *thumbnailer,
+                                       GCancellable *cancellable,
+                                       TumblerFileInfo *info,
+                                       TumblerSpecializedThumbnailerFunc func,
+                                       gpointer user_data)
+{
+  SpecializedCall *call;
+
+  g_return_if_fail (TUMBLER_IS_SPECIALIZED_THUMBNAILER (thumbnailer));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+  g_return_if_fail (TUMBLER_IS_FILE_INFO (info));
+  g_return_if_fail (func != NULL);
+
+  call = g_slice_new0 (SpecializedCall);
+  call->thumbnailer = g_object_ref (thumbnailer);
+  call->info = g_object_ref (info);
+  call->cancellable = cancellable != NULL ? g_object_ref (cancellable) : NULL;
+  call->func = func;
+  call->user_data = user_data;
+
+  tumbler_mutex_lock (thumbnailer->calls_mutex);
+  g_queue_push_tail (&thumbnailer->waiting_calls, call);
+  tumbler_mutex_unlock (thumbnailer->calls_mutex);
+
+  tumbler_specialized_thumbnailer_dispatch (thumbnailer);
+}
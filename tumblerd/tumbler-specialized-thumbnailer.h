@@ -28,6 +28,11 @@ G_BEGIN_DECLS
 #define TUMBLER_TYPE_SPECIALIZED_THUMBNAILER (tumbler_specialized_thumbnailer_get_type ())
 G_DECLARE_FINAL_TYPE (TumblerSpecializedThumbnailer, tumbler_specialized_thumbnailer, TUMBLER, SPECIALIZED_THUMBNAILER, TumblerAbstractThumbnailer)
 
+typedef void (*TumblerSpecializedThumbnailerFunc) (TumblerSpecializedThumbnailer *thumbnailer,
+                                                   TumblerFileInfo *info,
+                                                   const GError *error,
+                                                   gpointer user_data);
+
 TumblerThumbnailer *
 tumbler_specialized_thumbnailer_new (GDBusConnection *connection,
                                      const gchar *name,
@@ -46,6 +51,12 @@ gboolean
 tumbler_specialized_thumbnailer_get_foreign (TumblerSpecializedThumbnailer *thumbnailer);
 guint64
 tumbler_specialized_thumbnailer_get_modified (TumblerSpecializedThumbnailer *thumbnailer);
+void
+tumbler_specialized_thumbnailer_queue (TumblerSpecializedThumbnailer *thumbnailer,
+                                       GCancellable *cancellable,
+                                       TumblerFileInfo *info,
+                                       TumblerSpecializedThumbnailerFunc func,
+                                       gpointer user_data);
 
 G_END_DECLS
 
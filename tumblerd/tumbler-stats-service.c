@@ -0,0 +1,236 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "tumbler-stats-service-gdbus.h"
+#include "tumbler-stats-service.h"
+#include "tumbler-stats.h"
+#include "tumbler-utils.h"
+
+#define THUMBNAILER_STATS_PATH TUMBLER_SERVICE_PATH_PREFIX "/Stats1"
+
+
+
+/* Property identifiers */
+enum
+{
+  PROP_0,
+  PROP_CONNECTION,
+};
+
+
+
+static void
+tumbler_stats_service_constructed (GObject *object);
+static void
+tumbler_stats_service_finalize (GObject *object);
+static void
+tumbler_stats_service_get_property (GObject *object,
+                                    guint prop_id,
+                                    GValue *value,
+                                    GParamSpec *pspec);
+static void
+tumbler_stats_service_set_property (GObject *object,
+                                    guint prop_id,
+                                    const GValue *value,
+                                    GParamSpec *pspec);
+static gboolean
+tumbler_stats_service_get_metrics (TumblerExportedStatsService *skeleton,
+                                   GDBusMethodInvocation *invocation,
+                                   TumblerStatsService *service);
+
+
+
+struct _TumblerStatsService
+{
+  TumblerComponent __parent__;
+
+  GDBusConnection *connection;
+  TumblerExportedStatsService *skeleton;
+  gboolean dbus_interface_exported;
+};
+
+
+
+G_DEFINE_FINAL_TYPE (TumblerStatsService, tumbler_stats_service, TUMBLER_TYPE_COMPONENT);
+
+
+
+static void
+tumbler_stats_service_class_init (TumblerStatsServiceClass *klass)
+{
+  GObjectClass *gobject_class;
+
+  gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->constructed = tumbler_stats_service_constructed;
+  gobject_class->finalize = tumbler_stats_service_finalize;
+  gobject_class->get_property = tumbler_stats_service_get_property;
+  gobject_class->set_property = tumbler_stats_service_set_property;
+
+  g_object_class_install_property (gobject_class, PROP_CONNECTION,
+                                   g_param_spec_object ("connection",
+                                                        "connection",
+                                                        "connection",
+                                                        G_TYPE_DBUS_CONNECTION,
+                                                        G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+}
+
+
+
+static void
+tumbler_stats_service_init (TumblerStatsService *service)
+{
+}
+
+
+
+static void
+tumbler_stats_service_constructed (GObject *object)
+{
+  TumblerStatsService *service = TUMBLER_STATS_SERVICE (object);
+  GError *error = NULL;
+
+  /* chain up to parent classes */
+  if (G_OBJECT_CLASS (tumbler_stats_service_parent_class)->constructed != NULL)
+    (G_OBJECT_CLASS (tumbler_stats_service_parent_class)->constructed) (object);
+
+  service->skeleton = tumbler_exported_stats_service_skeleton_new ();
+
+  g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (service->skeleton),
+                                    service->connection,
+                                    THUMBNAILER_STATS_PATH,
+                                    &error);
+  if (error != NULL)
+    {
+      g_critical ("error exporting thumbnail stats service on session bus: %s", error->message);
+      g_error_free (error);
+      service->dbus_interface_exported = FALSE;
+    }
+  else
+    {
+      service->dbus_interface_exported = TRUE;
+
+      g_signal_connect (service->skeleton, "handle-get-metrics",
+                        G_CALLBACK (tumbler_stats_service_get_metrics), service);
+    }
+}
+
+
+
+static void
+tumbler_stats_service_finalize (GObject *object)
+{
+  TumblerStatsService *service = TUMBLER_STATS_SERVICE (object);
+
+  /* Unexport from dbus */
+  if (service->dbus_interface_exported)
+    g_dbus_interface_skeleton_unexport_from_connection (
+      G_DBUS_INTERFACE_SKELETON (service->skeleton),
+      service->connection);
+
+  /* release the Skeleton object */
+  g_object_unref (service->skeleton);
+
+  g_object_unref (service->connection);
+
+  (*G_OBJECT_CLASS (tumbler_stats_service_parent_class)->finalize) (object);
+}
+
+
+
+static void
+tumbler_stats_service_get_property (GObject *object,
+                                    guint prop_id,
+                                    GValue *value,
+                                    GParamSpec *pspec)
+{
+  TumblerStatsService *service = TUMBLER_STATS_SERVICE (object);
+
+  switch (prop_id)
+    {
+    case PROP_CONNECTION:
+      g_value_set_object (value, service->connection);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+
+
+static void
+tumbler_stats_service_set_property (GObject *object,
+                                    guint prop_id,
+                                    const GValue *value,
+                                    GParamSpec *pspec)
+{
+  TumblerStatsService *service = TUMBLER_STATS_SERVICE (object);
+
+  switch (prop_id)
+    {
+    case PROP_CONNECTION:
+      service->connection = g_object_ref (g_value_get_object (value));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+
+
+static gboolean
+tumbler_stats_service_get_metrics (TumblerExportedStatsService *skeleton,
+                                   GDBusMethodInvocation *invocation,
+                                   TumblerStatsService *service)
+{
+  gchar *metrics;
+
+  g_dbus_async_return_val_if_fail (TUMBLER_IS_STATS_SERVICE (service), invocation, FALSE);
+
+  /* scraping the metrics deliberately does not keep tumbler alive, otherwise
+   * a periodic collector would prevent it from ever shutting down */
+  metrics = tumbler_stats_dump ();
+  tumbler_exported_stats_service_complete_get_metrics (skeleton, invocation, metrics);
+  g_free (metrics);
+
+  return TRUE;
+}
+
+
+
+TumblerStatsService *
+tumbler_stats_service_new (GDBusConnection *connection,
+                           TumblerLifecycleManager *lifecycle_manager)
+{
+  return g_object_new (TUMBLER_TYPE_STATS_SERVICE,
+                       "connection", connection,
+                       "lifecycle-manager", lifecycle_manager,
+                       NULL);
+}
+
+
+
+gboolean
+tumbler_stats_service_is_exported (TumblerStatsService *service)
+{
+  g_return_val_if_fail (TUMBLER_IS_STATS_SERVICE (service), FALSE);
+  return service->dbus_interface_exported;
+}
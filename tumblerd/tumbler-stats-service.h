@@ -0,0 +1,43 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __TUMBLER_STATS_SERVICE_H__
+#define __TUMBLER_STATS_SERVICE_H__
+
+#include "tumbler-component.h"
+#include "tumbler-lifecycle-manager.h"
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS;
+
+#define TUMBLER_TYPE_STATS_SERVICE (tumbler_stats_service_get_type ())
+G_DECLARE_FINAL_TYPE (TumblerStatsService, tumbler_stats_service, TUMBLER, STATS_SERVICE, TumblerComponent)
+
+TumblerStatsService *
+tumbler_stats_service_new (GDBusConnection *connection,
+                           TumblerLifecycleManager *lifecycle_manager) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+
+gboolean
+tumbler_stats_service_is_exported (TumblerStatsService *service);
+
+G_END_DECLS;
+
+#endif /* !__TUMBLER_STATS_SERVICE_H__ */
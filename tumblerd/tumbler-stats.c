@@ -0,0 +1,432 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "tumbler-stats.h"
+#include "tumbler-utils.h"
+
+#include "tumbler/tumbler.h"
+
+/* Every thread records into a shard of its own. The shard lock is only
+ * contended while tumbler_stats_dump() merges the shards, so recording
+ * costs a hash lookup and an uncontended lock. */
+
+#define KEY_SEPARATOR "\x1f"
+
+typedef struct _TumblerStatsShard TumblerStatsShard;
+typedef struct _TumblerStatsValue TumblerStatsValue;
+
+typedef enum
+{
+  TUMBLER_STATS_COUNTER,
+  TUMBLER_STATS_GAUGE,
+  TUMBLER_STATS_HISTOGRAM,
+} TumblerStatsType;
+
+
+
+struct _TumblerStatsShard
+{
+  TUMBLER_MUTEX (mutex);
+  GHashTable *values[TUMBLER_STATS_N_METRICS];
+};
+
+/* upper bounds of the histogram buckets in microseconds */
+static const gint64 buckets[] = {
+  1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+};
+
+struct _TumblerStatsValue
+{
+  /* the counter or gauge value, the number of observations for histograms */
+  gint64 value;
+  gint64 sum;
+  gint64 buckets[G_N_ELEMENTS (buckets)];
+};
+
+static const struct
+{
+  const gchar *name;
+  const gchar *help;
+  TumblerStatsType type;
+  const gchar *label1;
+  const gchar *label2;
+} metrics[TUMBLER_STATS_N_METRICS] = {
+  { "tumbler_requests_total", "Requests pushed to a scheduler.",
+    TUMBLER_STATS_COUNTER, "scheduler", NULL },
+  { "tumbler_uris_total", "URIs pushed to a scheduler.",
+    TUMBLER_STATS_COUNTER, "scheduler", NULL },
+  { "tumbler_queued_requests", "Requests waiting for a scheduler thread.",
+    TUMBLER_STATS_GAUGE, "scheduler", NULL },
+  { "tumbler_active_requests", "Requests pushed to a scheduler and not finished yet.",
+    TUMBLER_STATS_GAUGE, "scheduler", NULL },
+  { "tumbler_cache_hits_total", "URIs with an up-to-date thumbnail.",
+    TUMBLER_STATS_COUNTER, "scheduler", "mime_type" },
+  { "tumbler_cache_misses_total", "URIs with a missing or outdated thumbnail.",
+    TUMBLER_STATS_COUNTER, "scheduler", "mime_type" },
+  { "tumbler_create_seconds", "Time spent in a thumbnailer's create().",
+    TUMBLER_STATS_HISTOGRAM, "thumbnailer", "mime_type" },
+  { "tumbler_create_errors_total", "Thumbnails that could not be created.",
+    TUMBLER_STATS_COUNTER, "thumbnailer", "mime_type" },
+};
+
+
+
+static void
+tumbler_stats_shard_merge (TumblerStatsShard *dest,
+                           TumblerStatsShard *src);
+static void
+tumbler_stats_shard_retire (gpointer data);
+
+
+
+G_LOCK_DEFINE_STATIC (shards);
+static GSList *shards = NULL;
+static TumblerStatsShard *retired = NULL;
+static GPrivate current_shard = G_PRIVATE_INIT (tumbler_stats_shard_retire);
+
+
+
+static TumblerStatsShard *
+tumbler_stats_shard_new (void)
+{
+  TumblerStatsShard *shard;
+  guint n;
+
+  shard = g_slice_new0 (TumblerStatsShard);
+  tumbler_mutex_create (shard->mutex);
+  for (n = 0; n < TUMBLER_STATS_N_METRICS; n++)
+    shard->values[n] = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  return shard;
+}
+
+
+
+static void
+tumbler_stats_shard_free (TumblerStatsShard *shard)
+{
+  guint n;
+
+  for (n = 0; n < TUMBLER_STATS_N_METRICS; n++)
+    g_hash_table_destroy (shard->values[n]);
+  tumbler_mutex_free (shard->mutex);
+  g_slice_free (TumblerStatsShard, shard);
+}
+
+
+
+static void
+tumbler_stats_shard_retire (gpointer data)
+{
+  TumblerStatsShard *shard = data;
+
+  /* keep what the exiting thread recorded */
+  G_LOCK (shards);
+  shards = g_slist_remove (shards, shard);
+  if (retired == NULL)
+    retired = tumbler_stats_shard_new ();
+  tumbler_stats_shard_merge (retired, shard);
+  G_UNLOCK (shards);
+
+  tumbler_stats_shard_free (shard);
+}
+
+
+
+static TumblerStatsShard *
+tumbler_stats_get_shard (void)
+{
+  TumblerStatsShard *shard;
+
+  shard = g_private_get (&current_shard);
+  if (G_UNLIKELY (shard == NULL))
+    {
+      shard = tumbler_stats_shard_new ();
+      g_private_set (&current_shard, shard);
+
+      G_LOCK (shards);
+      shards = g_slist_prepend (shards, shard);
+      G_UNLOCK (shards);
+    }
+
+  return shard;
+}
+
+
+
+static TumblerStatsValue *
+tumbler_stats_shard_lookup (TumblerStatsShard *shard,
+                            TumblerStatsMetric metric,
+                            const gchar *key)
+{
+  TumblerStatsValue *value;
+
+  value = g_hash_table_lookup (shard->values[metric], key);
+  if (G_UNLIKELY (value == NULL))
+    {
+      value = g_new0 (TumblerStatsValue, 1);
+      g_hash_table_insert (shard->values[metric], g_strdup (key), value);
+    }
+
+  return value;
+}
+
+
+
+static void
+tumbler_stats_shard_merge (TumblerStatsShard *dest,
+                           TumblerStatsShard *src)
+{
+  TumblerStatsValue *dest_value;
+  TumblerStatsValue *src_value;
+  GHashTableIter iter;
+  const gchar *key;
+  guint n, b;
+
+  tumbler_mutex_lock (src->mutex);
+
+  for (n = 0; n < TUMBLER_STATS_N_METRICS; n++)
+    {
+      g_hash_table_iter_init (&iter, src->values[n]);
+      while (g_hash_table_iter_next (&iter, (gpointer *) &key, (gpointer *) &src_value))
+        {
+          dest_value = tumbler_stats_shard_lookup (dest, n, key);
+          dest_value->value += src_value->value;
+          dest_value->sum += src_value->sum;
+          for (b = 0; b < G_N_ELEMENTS (buckets); b++)
+            dest_value->buckets[b] += src_value->buckets[b];
+        }
+    }
+
+  tumbler_mutex_unlock (src->mutex);
+}
+
+
+
+static void
+tumbler_stats_make_key (gchar *key,
+                        gsize size,
+                        const gchar *label1,
+                        const gchar *label2)
+{
+  g_snprintf (key, size, "%s" KEY_SEPARATOR "%s", label1 != NULL ? label1 : "",
+              label2 != NULL ? label2 : "");
+}
+
+
+
+void
+tumbler_stats_add (TumblerStatsMetric metric,
+                   const gchar *label1,
+                   const gchar *label2,
+                   gint64 delta)
+{
+  TumblerStatsShard *shard;
+  TumblerStatsValue *value;
+  gchar key[256];
+
+  g_return_if_fail (metric < TUMBLER_STATS_N_METRICS);
+  g_return_if_fail (metrics[metric].type != TUMBLER_STATS_HISTOGRAM);
+
+  tumbler_stats_make_key (key, sizeof (key), label1, label2);
+
+  shard = tumbler_stats_get_shard ();
+  tumbler_mutex_lock (shard->mutex);
+  value = tumbler_stats_shard_lookup (shard, metric, key);
+  value->value += delta;
+  tumbler_mutex_unlock (shard->mutex);
+}
+
+
+
+void
+tumbler_stats_observe (TumblerStatsMetric metric,
+                       const gchar *label1,
+                       const gchar *label2,
+                       gint64 usec)
+{
+  TumblerStatsShard *shard;
+  TumblerStatsValue *value;
+  gchar key[256];
+  guint b;
+
+  g_return_if_fail (metric < TUMBLER_STATS_N_METRICS);
+  g_return_if_fail (metrics[metric].type == TUMBLER_STATS_HISTOGRAM);
+
+  tumbler_stats_make_key (key, sizeof (key), label1, label2);
+
+  shard = tumbler_stats_get_shard ();
+  tumbler_mutex_lock (shard->mutex);
+  value = tumbler_stats_shard_lookup (shard, metric, key);
+  value->value++;
+  value->sum += usec;
+  for (b = 0; b < G_N_ELEMENTS (buckets); b++)
+    if (usec <= buckets[b])
+      {
+        value->buckets[b]++;
+        break;
+      }
+  tumbler_mutex_unlock (shard->mutex);
+}
+
+
+
+static void
+tumbler_stats_append_label (GString *string,
+                            const gchar *name,
+                            const gchar *value,
+                            gboolean first)
+{
+  const gchar *p;
+
+  g_string_append_printf (string, "%s%s=\"", first ? "" : ",", name);
+
+  /* the exposition format only knows these escapes */
+  for (p = value; *p != '\0'; p++)
+    {
+      if (*p == '\\')
+        g_string_append (string, "\\\\");
+      else if (*p == '"')
+        g_string_append (string, "\\\"");
+      else if (*p == '\n')
+        g_string_append (string, "\\n");
+      else
+        g_string_append_c (string, *p);
+    }
+
+  g_string_append_c (string, '"');
+}
+
+
+
+static void
+tumbler_stats_append_sample (GString *string,
+                             TumblerStatsMetric metric,
+                             const gchar *suffix,
+                             const gchar *key,
+                             const gchar *le,
+                             const gchar *sample)
+{
+  gchar **labels;
+
+  labels = g_strsplit (key, KEY_SEPARATOR, 2);
+
+  g_string_append_printf (string, "%s%s{", metrics[metric].name, suffix);
+  tumbler_stats_append_label (string, metrics[metric].label1, labels[0], TRUE);
+  if (metrics[metric].label2 != NULL && labels[1] != NULL)
+    tumbler_stats_append_label (string, metrics[metric].label2, labels[1], FALSE);
+  if (le != NULL)
+    tumbler_stats_append_label (string, "le", le, FALSE);
+  g_string_append_printf (string, "} %s\n", sample);
+
+  g_strfreev (labels);
+}
+
+
+
+gchar *
+tumbler_stats_dump (void)
+{
+  TumblerStatsShard *merged;
+  TumblerStatsValue *value;
+  GString *string;
+  GList *keys, *kp;
+  GSList *lp;
+  gchar number[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar le[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar *sample;
+  gint64 cumulative;
+  guint64 hits, misses;
+  guint n, b;
+
+  /* merge all shards into a snapshot */
+  merged = tumbler_stats_shard_new ();
+  G_LOCK (shards);
+  if (retired != NULL)
+    tumbler_stats_shard_merge (merged, retired);
+  for (lp = shards; lp != NULL; lp = lp->next)
+    tumbler_stats_shard_merge (merged, lp->data);
+  G_UNLOCK (shards);
+
+  string = g_string_new (NULL);
+
+  for (n = 0; n < TUMBLER_STATS_N_METRICS; n++)
+    {
+      g_string_append_printf (string, "# HELP %s %s\n# TYPE %s %s\n",
+                              metrics[n].name, metrics[n].help, metrics[n].name,
+                              metrics[n].type == TUMBLER_STATS_COUNTER
+                                ? "counter"
+                                : (metrics[n].type == TUMBLER_STATS_GAUGE ? "gauge" : "histogram"));
+
+      /* sorted for a stable output */
+      keys = g_list_sort (g_hash_table_get_keys (merged->values[n]), (GCompareFunc) g_strcmp0);
+
+      for (kp = keys; kp != NULL; kp = kp->next)
+        {
+          value = g_hash_table_lookup (merged->values[n], kp->data);
+
+          if (metrics[n].type != TUMBLER_STATS_HISTOGRAM)
+            {
+              sample = g_strdup_printf ("%" G_GINT64_FORMAT, value->value);
+              tumbler_stats_append_sample (string, n, "", kp->data, NULL, sample);
+              g_free (sample);
+              continue;
+            }
+
+          for (b = 0, cumulative = 0; b < G_N_ELEMENTS (buckets); b++)
+            {
+              cumulative += value->buckets[b];
+              g_ascii_dtostr (le, sizeof (le), buckets[b] / (gdouble) G_USEC_PER_SEC);
+              sample = g_strdup_printf ("%" G_GINT64_FORMAT, cumulative);
+              tumbler_stats_append_sample (string, n, "_bucket", kp->data,
+                                           le, sample);
+              g_free (sample);
+            }
+
+          sample = g_strdup_printf ("%" G_GINT64_FORMAT, value->value);
+          tumbler_stats_append_sample (string, n, "_bucket", kp->data,
+                                       "+Inf", sample);
+          tumbler_stats_append_sample (string, n, "_count", kp->data,
+                                       NULL, sample);
+          g_free (sample);
+
+          g_ascii_dtostr (number, sizeof (number), value->sum / (gdouble) G_USEC_PER_SEC);
+          tumbler_stats_append_sample (string, n, "_sum", kp->data,
+                                       NULL, number);
+        }
+
+      g_list_free (keys);
+    }
+
+  tumbler_stats_shard_free (merged);
+
+  /* pixel buffers are counted in libtumbler, see tumbler_util_pixels_alloc() */
+  tumbler_util_pixels_get_stats (&hits, &misses);
+  g_string_append_printf (string,
+                          "# HELP tumbler_pixel_buffer_hits_total Pixel buffers reused from a thread arena.\n"
+                          "# TYPE tumbler_pixel_buffer_hits_total counter\n"
+                          "tumbler_pixel_buffer_hits_total %" G_GUINT64_FORMAT "\n"
+                          "# HELP tumbler_pixel_buffer_misses_total Pixel buffers newly allocated.\n"
+                          "# TYPE tumbler_pixel_buffer_misses_total counter\n"
+                          "tumbler_pixel_buffer_misses_total %" G_GUINT64_FORMAT "\n",
+                          hits, misses);
+
+  return g_string_free (string, FALSE);
+}
@@ -0,0 +1,56 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/*-
+ * Copyright (c) 2026 The Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __TUMBLER_STATS_H__
+#define __TUMBLER_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  TUMBLER_STATS_REQUESTS,
+  TUMBLER_STATS_URIS,
+  TUMBLER_STATS_QUEUED_REQUESTS,
+  TUMBLER_STATS_ACTIVE_REQUESTS,
+  TUMBLER_STATS_CACHE_HITS,
+  TUMBLER_STATS_CACHE_MISSES,
+  TUMBLER_STATS_CREATE_SECONDS,
+  TUMBLER_STATS_CREATE_ERRORS,
+  TUMBLER_STATS_N_METRICS,
+} TumblerStatsMetric;
+
+void
+tumbler_stats_add (TumblerStatsMetric metric,
+                   const gchar *label1,
+                   const gchar *label2,
+                   gint64 delta);
+void
+tumbler_stats_observe (TumblerStatsMetric metric,
+                       const gchar *label1,
+                       const gchar *label2,
+                       gint64 usec);
+gchar *
+tumbler_stats_dump (void) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+
+G_END_DECLS
+
+#endif /* !__TUMBLER_STATS_H__ */